@@ -153,6 +153,11 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
     fprintf(stderr, "JxlEncoderSetParallelRunner failed\n");
     return false;
   }
+  if (dparams.runner_opaque != nullptr && dparams.runner_allows_nesting &&
+      JXL_DEC_SUCCESS != JxlDecoderSetParallelRunnerNesting(dec, JXL_TRUE)) {
+    fprintf(stderr, "JxlDecoderSetParallelRunnerNesting failed\n");
+    return false;
+  }
 
   JxlPixelFormat format = {};  // Initialize to calm down clang-tidy.
   std::vector<JxlPixelFormat> accepted_formats = dparams.accepted_formats;
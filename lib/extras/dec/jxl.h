@@ -45,6 +45,8 @@ struct JXLDecompressParams {
   // If runner_opaque is set, the decoder uses this parallel runner.
   JxlParallelRunner runner;
   void* runner_opaque = nullptr;
+  // Whether the runner supports nested calls from within its tasks.
+  bool runner_allows_nesting = false;
 
   // If memory_manager is set, decoder uses it.
   JxlMemoryManager* memory_manager = nullptr;
@@ -144,6 +144,11 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
     fprintf(stderr, "JxlEncoderSetParallelRunner failed\n");
     return false;
   }
+  if (params.runner_opaque != nullptr && params.runner_allows_nesting &&
+      JXL_ENC_SUCCESS != JxlEncoderSetParallelRunnerNesting(enc, JXL_TRUE)) {
+    fprintf(stderr, "JxlEncoderSetParallelRunnerNesting failed\n");
+    return false;
+  }
 
   if (params.HasOutputProcessor() &&
       JXL_ENC_SUCCESS !=
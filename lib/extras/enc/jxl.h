@@ -69,6 +69,8 @@ struct JXLCompressParams {
   // If runner_opaque is set, the encoder uses this parallel runner.
   JxlParallelRunner runner = JxlThreadParallelRunner;
   void* runner_opaque = nullptr;
+  // Whether the runner supports nested calls from within its tasks.
+  bool runner_allows_nesting = false;
 
   // If memory_manager is set, encoder uses it.
   JxlMemoryManager* memory_manager = nullptr;
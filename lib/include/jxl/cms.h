@@ -10,6 +10,8 @@
 
 #include <jxl/cms_interface.h>
 #include <jxl/jxl_cms_export.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +19,38 @@ extern "C" {
 
 JXL_CMS_EXPORT const JxlCmsInterface* JxlGetDefaultCms();
 
+/** Counters of the transform cache of the default CMS, since the start of the
+ * process.
+ */
+typedef struct {
+  /** Number of color transforms constructed and used. A transform that
+   * another thread constructed at the same time and added to the cache first
+   * is dropped, and counted as reused instead.
+   */
+  uint64_t transforms_created;
+  /** Number of color transforms taken from the cache instead. */
+  uint64_t transforms_reused;
+} JxlCmsTransformCacheStats;
+
+/** Sets the maximum number of color transforms that the default CMS keeps in
+ * its process-wide cache, 16 by default. Transforms are keyed by their input
+ * and output ICC profiles, and all encoder and decoder instances using the
+ * default CMS share them, which avoids constructing the same transform for
+ * every image or frame. The least recently used transform is evicted first;
+ * 0 disables the cache. Thread-safe.
+ *
+ * @param max_transforms maximum number of cached transforms.
+ */
+JXL_CMS_EXPORT void JxlCmsSetTransformCacheSize(size_t max_transforms);
+
+/** Returns the counters of the transform cache of the default CMS.
+ * Thread-safe.
+ *
+ * @param stats receives the counters.
+ */
+JXL_CMS_EXPORT void JxlCmsGetTransformCacheStats(
+    JxlCmsTransformCacheStats* stats);
+
 #ifdef __cplusplus
 }
 #endif
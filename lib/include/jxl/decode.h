@@ -426,6 +426,92 @@ JXL_EXPORT void JxlDecoderSkipFrames(JxlDecoder* dec, size_t amount);
  */
 JXL_EXPORT JxlDecoderStatus JxlDecoderSkipCurrentFrame(JxlDecoder* dec);
 
+/** Value of @ref JxlFrameIndexEntry::file_offset when the position of the frame
+ * in the input is not known.
+ */
+#define JXL_FRAME_OFFSET_UNKNOWN (~(uint64_t)0)
+
+/**
+ * Entry of the frame index that the decoder builds from the frame headers it
+ * has seen, see @ref JxlDecoderGetFrameIndexEntry. Frames are counted as in
+ * @ref JxlDecoderSkipFrames.
+ */
+typedef struct {
+  /** Offset in bytes of the frame from the start of the input, or
+   * ::JXL_FRAME_OFFSET_UNKNOWN if the frame header was split across container
+   * boxes.
+   */
+  uint64_t file_offset;
+
+  /** Duration of the frame in ticks, as in @ref JxlFrameHeader::duration.
+   */
+  uint32_t duration;
+
+  /** Index of the earliest frame from which decoding must start to reconstruct
+   * this frame and continue with the frames after it. Equal to the index of
+   * the frame itself if it does not depend on earlier frames.
+   */
+  uint32_t keyframe;
+
+  /** Bit mask of the reference frames 0-3 that the frame may be blended onto
+   * or take patches from. Until the frame has been decoded, this is the worst
+   * case allowed by its header.
+   */
+  uint32_t references;
+
+  /** Bit mask of the reference frames 0-3 that the frame is saved as.
+   */
+  uint32_t saved_as;
+} JxlFrameIndexEntry;
+
+/**
+ * Returns the number of frames in the frame index of the decoder: the frames
+ * whose headers were seen since the decoder was created or reset. The index is
+ * kept by @ref JxlDecoderRewind, so a first pass over the input (which may skip
+ * frames or only subscribe to ::JXL_DEC_FRAME) allows seeking to any frame.
+ *
+ * @param dec decoder object
+ * @return number of indexed frames
+ */
+JXL_EXPORT size_t JxlDecoderGetNumIndexedFrames(const JxlDecoder* dec);
+
+/**
+ * Outputs the frame index entry of a frame.
+ *
+ * @param dec decoder object
+ * @param index index of the frame, smaller than the result of @ref
+ *     JxlDecoderGetNumIndexedFrames
+ * @param entry output for the frame index entry
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if the frame is not
+ *     indexed.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetFrameIndexEntry(
+    const JxlDecoder* dec, size_t index, JxlFrameIndexEntry* entry);
+
+/**
+ * Makes the decoder continue with an indexed frame, without parsing the input
+ * before it. The decoder resumes at the keyframe of the requested frame (see
+ * @ref JxlFrameIndexEntry::keyframe) and decodes only the frames between the
+ * keyframe and the requested frame that the requested frame depends on. The
+ * next ::JXL_DEC_FRAME event is that of the requested frame. The basic info and
+ * color encoding events are not emitted again.
+ *
+ * Can be called once the headers of the image have been decoded. Any input that
+ * was set is released: the next call to @ref JxlDecoderSetInput must provide
+ * the input starting at the returned file offset.
+ *
+ * @param dec decoder object
+ * @param index index of the frame, smaller than the result of @ref
+ *     JxlDecoderGetNumIndexedFrames
+ * @param file_offset output for the offset in the input from which to provide
+ *     the input
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if the frame is not
+ *     indexed, the offset of its keyframe is unknown, or the headers of the
+ *     image were not decoded yet.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSeekToFrame(JxlDecoder* dec, size_t index,
+                                                  uint64_t* file_offset);
+
 /**
  * Set the parallel runner for multithreading. May only be set before starting
  * decoding.
@@ -442,6 +528,43 @@ JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Allows the decoder to call the parallel runner from within tasks that the
+ * runner is already running, e.g. to split a large lossless group across
+ * threads when the frame has fewer groups than threads. Only enable this with
+ * runners that support such nested calls, such as @ref
+ * JxlThreadParallelRunner. If disabled (the default), nested loops run on the
+ * calling thread.
+ *
+ * @param dec decoder object.
+ * @param allow_nesting whether nested calls to the runner are allowed.
+ * @return ::JXL_DEC_SUCCESS if the option was set, ::JXL_DEC_ERROR if no
+ * parallel runner was set with @ref JxlDecoderSetParallelRunner.
+ */
+JXL_EXPORT JxlDecoderStatus
+JxlDecoderSetParallelRunnerNesting(JxlDecoder* dec, JXL_BOOL allow_nesting);
+
+/**
+ * Sets how many bytes of released image buffers the decoder keeps for reuse.
+ * Large internal buffers (planes of frames, groups and per-thread scratch) are
+ * not returned to the memory manager right away, but kept in size classes and
+ * handed out again to later frames and, after @ref JxlDecoderReset or
+ * @ref JxlDecoderRewind, to later images. This saves most allocations when
+ * decoding many frames or images of similar size with the same decoder.
+ * Retained buffers are returned to the memory manager when the limit is
+ * lowered, when an allocation fails, and when the decoder is destroyed.
+ *
+ * The limit is part of the memory management of the decoder and is therefore
+ * kept by @ref JxlDecoderReset. The default is 0: buffers are not kept unless
+ * this is called. May be called at any time.
+ *
+ * @param dec decoder object
+ * @param max_bytes maximum number of bytes kept; 0 disables the reuse.
+ * @return ::JXL_DEC_SUCCESS
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetBufferPoolLimit(JxlDecoder* dec,
+                                                         size_t max_bytes);
+
 /**
  * Returns a hint indicating how many more bytes the decoder is expected to
  * need to make @ref JxlDecoderGetBasicInfo available after the next @ref
@@ -657,6 +780,29 @@ JXL_EXPORT size_t JxlDecoderReleaseInput(JxlDecoder* dec);
  */
 JXL_EXPORT void JxlDecoderCloseInput(JxlDecoder* dec);
 
+/**
+ * Sets the whole remaining input at once, for input that stays resident and
+ * unchanged in memory, such as a memory-mapped file. This is @ref
+ * JxlDecoderSetInput followed by @ref JxlDecoderCloseInput, with the additional
+ * guarantee from the caller that the data stays valid and unchanged until the
+ * decoder is destroyed, reset or rewound, or @ref JxlDecoderSeekToFrame is
+ * called. The decoder then reads the codestream in place, also when it is split
+ * across several "jxlp" container boxes, instead of copying the parts of it
+ * that cross a box boundary into an internal buffer. Only sections that cross a
+ * box boundary are joined, one at a time.
+ *
+ * @param dec decoder object
+ * @param data pointer to the input data, from the current position of the
+ *     decoder (the beginning of the file, or the offset returned by @ref
+ *     JxlDecoderSeekToFrame) to the end of the file
+ * @param size amount of bytes of input
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if input was already
+ *     set or closed.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetResidentInput(JxlDecoder* dec,
+                                                       const uint8_t* data,
+                                                       size_t size);
+
 /**
  * Outputs the basic image information, such as image dimensions, bit depth and
  * all other JxlBasicInfo fields, if available.
@@ -981,6 +1127,134 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderGetFrameName(const JxlDecoder* dec,
 JXL_EXPORT JxlDecoderStatus JxlDecoderGetExtraChannelBlendInfo(
     const JxlDecoder* dec, size_t index, JxlBlendInfo* blend_info);
 
+/**
+ * Restricts the decoded image to a rectangular region. The image output buffer
+ * or callback then receives only the pixels of the region: @ref
+ * JxlDecoderImageOutBufferSize returns the size for the region, and the pixel
+ * callbacks get coordinates relative to its top left corner. Parts of frames
+ * that do not affect the region are not decoded, and their data is skipped,
+ * which makes extracting a small region of a large image much cheaper than
+ * decoding the full image. Frames that are referenced by later frames are
+ * still decoded fully.
+ *
+ * The region is given in the image dimensions of @ref JxlBasicInfo, so after
+ * applying the orientation unless @ref JxlDecoderSetKeepOrientation is set. It
+ * applies to all frames of the main image, but not to the preview image, the
+ * extra channel buffers of @ref JxlDecoderSetExtraChannelBuffer are sized for
+ * the region as well. It has no effect on JPEG reconstruction.
+ *
+ * Can only be called after the ::JXL_DEC_BASIC_INFO event, with coalescing
+ * enabled, and before the image output buffer or callback is set. It cannot be
+ * combined with @ref JxlDecoderSetRowStreaming. Calling it with the full image
+ * dimensions removes the restriction. The region is reset
+ * by @ref JxlDecoderReset, but kept by @ref JxlDecoderRewind.
+ *
+ * @param dec decoder object
+ * @param x0 left column of the region
+ * @param y0 top row of the region
+ * @param xsize width of the region, must be non-zero
+ * @param ysize height of the region, must be non-zero
+ * @return ::JXL_DEC_SUCCESS if the region was set, ::JXL_DEC_ERROR if it does
+ *     not lie within the image or if called at the wrong time.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetCropRegion(JxlDecoder* dec,
+                                                    size_t x0, size_t y0,
+                                                    size_t xsize, size_t ysize);
+
+/**
+ * Decodes the main image at a reduced resolution: 1/2, 1/4 or 1/8 of its
+ * width and height, rounded up. Each output pixel approximates the average of
+ * the corresponding square of pixels of the full image. @ref
+ * JxlDecoderImageOutBufferSize and @ref JxlDecoderExtraChannelBufferSize return
+ * the sizes for the reduced image, and the pixel callbacks get reduced
+ * coordinates.
+ *
+ * Simple lossy (VarDCT) frames are rendered directly at the reduced scale, with
+ * smaller inverse transforms, which is much cheaper than decoding the full
+ * image: at 1/8 scale only the DC is decoded and the AC data is skipped. The
+ * restoration filters and the noise are skipped for these frames. Other frames,
+ * such as lossless frames or frames with extra channels, are decoded at full
+ * resolution and downsampled.
+ *
+ * Can only be called before the image output buffer or callback is set, and
+ * cannot be combined with @ref JxlDecoderSetCropRegion or @ref
+ * JxlDecoderSetRowStreaming. It does not apply to the preview image or to JPEG
+ * reconstruction. The scale is reset by @ref JxlDecoderReset, but kept by @ref
+ * JxlDecoderRewind.
+ *
+ * @param dec decoder object
+ * @param scale 1 for the full image, or 2, 4 or 8
+ * @return ::JXL_DEC_SUCCESS if the scale was set, ::JXL_DEC_ERROR for other
+ *     scales, if a crop region or row streaming is set, or if called at the
+ *     wrong time.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetOutputScale(JxlDecoder* dec,
+                                                     uint32_t scale);
+
+/** Memory layout of the image output buffer, see @ref
+ * JxlDecoderSetImageOutLayout. In all layouts, the rows of each plane are
+ * padded to a multiple of the align field of @ref JxlPixelFormat, and the
+ * planes follow each other without gaps.
+ */
+typedef enum {
+  /** The channels of each pixel are stored next to each other, as described
+   * by @ref JxlPixelFormat. This is the default.
+   */
+  JXL_IMAGE_OUT_INTERLEAVED = 0,
+
+  /** Each channel is stored in a plane of its own, in the channel order of
+   * @ref JxlPixelFormat (e.g. R, G, B, A), with the data type and endianness
+   * of the format.
+   */
+  JXL_IMAGE_OUT_PLANAR = 1,
+
+  /** 8-bit YCbCr with 4:2:0 chroma subsampling in three planes (I420): Y at
+   * full size, then Cb and Cr at half width and half height, rounded up.
+   * Requires 3 channels and ::JXL_TYPE_UINT8.
+   */
+  JXL_IMAGE_OUT_I420 = 2,
+
+  /** 10-bit YCbCr with 4:2:0 chroma subsampling in two planes of 16-bit
+   * samples (P010): Y at full size, then Cb and Cr interleaved at half width
+   * and half height, rounded up. The 10-bit values are stored in the high bits
+   * of the samples. Requires 3 channels and ::JXL_TYPE_UINT16.
+   */
+  JXL_IMAGE_OUT_P010 = 3,
+} JxlImageOutLayout;
+
+/**
+ * Sets the memory layout of the image output buffer. The pixels are converted
+ * to the layout while they are written, so that no second pass over the image
+ * is needed. @ref JxlDecoderImageOutBufferSize returns the size for the
+ * layout.
+ *
+ * The YCbCr layouts use the full range BT.601 matrix of JPEG (JFIF), applied to
+ * the output color space, and ignore the alpha channel and @ref
+ * JxlDecoderSetImageOutBitDepth. Each chroma sample is the average of 2x2
+ * pixels, also for odd image sizes, crop regions and orientations, and does not
+ * depend on the number of threads. @ref JxlDecoderFlushImage is not supported
+ * with the YCbCr layouts and returns ::JXL_DEC_ERROR. For frames stored as
+ * YCbCr, such as recompressed JPEG images, the stored YCbCr values are output
+ * without a round trip to RGB when the color space of the output is that of
+ * the image.
+ *
+ * The layout only applies to the image output buffer: it cannot be combined
+ * with the image output callbacks or with @ref JxlDecoderSetOutputScale, and
+ * does not apply to the preview image or to the extra channel buffers. The
+ * YCbCr layouts require an orientation that does not transpose the image, or
+ * @ref JxlDecoderSetKeepOrientation. Can only be called before the image output
+ * buffer is set. The layout is reset by @ref JxlDecoderReset, but kept by @ref
+ * JxlDecoderRewind.
+ *
+ * @param dec decoder object
+ * @param layout the layout of the image output buffer
+ * @return ::JXL_DEC_SUCCESS if the layout was set, ::JXL_DEC_ERROR for an
+ *     invalid layout, if an output scale is set, or if called at the wrong
+ *     time.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetImageOutLayout(
+    JxlDecoder* dec, JxlImageOutLayout layout);
+
 /**
  * Returns the minimum size in bytes of the image output pixel buffer for the
  * given format. This is the buffer for @ref JxlDecoderSetImageOutBuffer.
@@ -1151,6 +1425,40 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
     JxlImageOutInitCallback init_callback, JxlImageOutRunCallback run_callback,
     JxlImageOutDestroyCallback destroy_callback, void* init_opaque);
 
+/**
+ * Enables or disables decoding frames in rows, to bound the memory used for
+ * large images. The decoder then processes the frame one row of DC groups
+ * (2048 pixels high) at a time, and releases the data of a row once its pixels
+ * are output, so that its working memory grows with the width of the frame
+ * but not with its height. Combined with @ref JxlDecoderSetImageOutCallback or
+ * @ref JxlDecoderSetMultithreadedImageOutCallback, this allows decoding images
+ * that do not fit in memory; the pixels are passed to the callback in rows of
+ * groups from top to bottom.
+ *
+ * This applies to the frames of the main image that are decoded in a single
+ * pass and not referenced by later frames, such as the frames written by the
+ * streaming encoder (see ::JXL_ENC_FRAME_SETTING_BUFFERING), in lossy (VarDCT)
+ * or lossless (modular) mode without chroma subsampling. Other frames, and
+ * lossless frames with global transforms such as the squeeze transform, are
+ * decoded as usual. The data of a frame is decoded once it is all available
+ * in the input, and the decoder keeps the compressed frame meanwhile:
+ * progressive events and @ref JxlDecoderFlushImage are not supported for
+ * these frames.
+ *
+ * Can only be called before starting decoding, and cannot be combined with
+ * @ref JxlDecoderSetCropRegion or @ref JxlDecoderSetOutputScale. Disabled by
+ * default. The setting is reset by @ref JxlDecoderReset.
+ *
+ * @param dec decoder object
+ * @param row_streaming JXL_TRUE to decode frames in rows, JXL_FALSE to decode
+ *     them whole.
+ * @return ::JXL_DEC_SUCCESS if the setting was applied, ::JXL_DEC_ERROR if an
+ *     output scale or a crop region (also one kept by @ref JxlDecoderRewind)
+ *     is set, or if called at the wrong time.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetRowStreaming(JxlDecoder* dec,
+                                                      JXL_BOOL row_streaming);
+
 /**
  * Returns the minimum size in bytes of an extra channel pixel buffer for the
  * given format. This is the buffer for @ref JxlDecoderSetExtraChannelBuffer.
@@ -1442,9 +1750,11 @@ JXL_EXPORT size_t JxlDecoderGetIntendedDownsamplingRatio(JxlDecoder* dec);
  * @param dec decoder object
  * @return ::JXL_DEC_SUCCESS if image data was flushed to the output buffer,
  *     or ::JXL_DEC_ERROR when no flush was done, e.g. if not enough image
- *     data was available yet even for flush, or no output buffer was set yet.
- *     This error is not fatal, it only indicates no flushed image is available
- *     right now. Regular decoding can still be performed.
+ *     data was available yet even for flush, no output buffer was set yet, or
+ *     the image output buffer has a YCbCr layout (see @ref
+ *     JxlDecoderSetImageOutLayout). This error is not fatal, it only
+ *     indicates no flushed image is available right now. Regular decoding can
+ *     still be performed.
  */
 JXL_EXPORT JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec);
 
@@ -1463,6 +1773,79 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec);
 JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetImageOutBitDepth(JxlDecoder* dec, const JxlBitDepth* bit_depth);
 
+/** Type of a decoder trace event, see @ref JxlDecoderSetTraceCallback.
+ */
+typedef enum {
+  /** A decoding step starts. */
+  JXL_DEC_TRACE_BEGIN = 0,
+  /** The decoding step of the last unmatched ::JXL_DEC_TRACE_BEGIN event of
+   * the same thread ends.
+   */
+  JXL_DEC_TRACE_END = 1,
+} JxlDecoderTraceEventType;
+
+/** Decoder trace event, see @ref JxlDecoderSetTraceCallback.
+ */
+typedef struct {
+  /** Whether a step begins or ends. */
+  JxlDecoderTraceEventType type;
+  /** Name of the step, e.g. "TOC", "DecodeHistograms", "ACGroup", or the name
+   * of a render pipeline stage. The string is static and outlives the
+   * decoder.
+   */
+  const char* name;
+  /** Index of the DC or AC group the step works on, or -1 for steps that do
+   * not belong to a group.
+   */
+  int32_t group_id;
+  /** Identifies the thread that runs the step: 0 for the thread that called
+   * @ref JxlDecoderProcessInput or @ref JxlDecoderFlushImage, also when it
+   * runs tasks of the parallel runner, and 1, 2, ... for the other threads, in
+   * the order of their first event of this decoder.
+   */
+  uint32_t thread_id;
+  /** Time of the event in nanoseconds, from a monotonic clock with an
+   * unspecified origin.
+   */
+  uint64_t timestamp_ns;
+} JxlDecoderTraceEvent;
+
+/**
+ * Function type for @ref JxlDecoderSetTraceCallback.
+ *
+ * The callback may be called concurrently from different threads of the
+ * parallel runner, with distinct thread_id values, and must be thread-safe.
+ * It should return quickly, since it runs in the middle of decoding.
+ *
+ * @param opaque optional user data, as given to @ref
+ *     JxlDecoderSetTraceCallback.
+ * @param event the event, only valid during the call.
+ */
+typedef void (*JxlDecoderTraceCallback)(void* opaque,
+                                        const JxlDecoderTraceEvent* event);
+
+/**
+ * Sets a callback that receives begin and end events for the steps of frame
+ * decoding: TOC parsing, global DC and AC sections, histogram decoding, DC
+ * and AC groups, modular decoding and the render pipeline stages. Events of
+ * each thread are properly nested. Render pipeline stages process the rows of
+ * a group interleaved with each other; their time is summed per group and
+ * reported as consecutive steps, in pipeline order, at the start of the
+ * enclosing "RenderPipeline" step.
+ *
+ * Tracing is disabled by default, and costs close to nothing then. Must be
+ * called before starting to decode. The callback is reset by @ref
+ * JxlDecoderReset, but kept by @ref JxlDecoderRewind.
+ *
+ * @param dec decoder object
+ * @param callback the callback, or NULL to disable tracing
+ * @param opaque optional user data passed to the callback
+ * @return ::JXL_DEC_SUCCESS if the callback was set, ::JXL_DEC_ERROR if
+ *     decoding already started.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetTraceCallback(
+    JxlDecoder* dec, JxlDecoderTraceCallback callback, void* opaque);
+
 #ifdef __cplusplus
 }
 #endif
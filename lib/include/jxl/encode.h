@@ -353,6 +353,13 @@ typedef enum {
    * When using streaming input and output the encoder minimizes memory usage at
    * the cost of compression density. Also note that images produced with
    * streaming mode might not be progressively decodable.
+   *
+   * In streaming mode, a frame is encoded one DC group (2048 x 2048 pixels) at
+   * a time: its pixels are requested from the @ref JxlChunkedFrameInputSource,
+   * encoded, and its sections are passed to the output processor before the
+   * next DC group is started. The memory used by the encoder is then bounded by
+   * the working set of one DC group, independently of the image size, apart
+   * from a few hundred bytes of bookkeeping per 256 x 256 group.
    */
   JXL_ENC_FRAME_SETTING_BUFFERING = 34,
 
@@ -457,6 +464,45 @@ JXL_EXPORT JxlEncoderStatus
 JxlEncoderSetParallelRunner(JxlEncoder* enc, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Allows the encoder to call the parallel runner from within tasks that the
+ * runner is already running, e.g. to use all threads when an outer loop has
+ * fewer tasks than threads. Only enable this with runners that support such
+ * nested calls, such as @ref JxlThreadParallelRunner. If disabled (the
+ * default), nested loops run on the calling thread.
+ *
+ * @param enc encoder object.
+ * @param allow_nesting whether nested calls to the runner are allowed.
+ * @return ::JXL_ENC_SUCCESS if the option was set, ::JXL_ENC_ERROR if no
+ * parallel runner was set with @ref JxlEncoderSetParallelRunner.
+ */
+JXL_EXPORT JxlEncoderStatus
+JxlEncoderSetParallelRunnerNesting(JxlEncoder* enc, JXL_BOOL allow_nesting);
+
+/**
+ * Sets how many bytes of released image buffers the encoder keeps for reuse.
+ * Large internal buffers (planes of the frame being encoded, per-group and
+ * per-thread scratch) are not returned to the memory manager right away, but
+ * kept in size classes and handed out again when the next frame is encoded.
+ * This saves most allocations when encoding animations or many images of
+ * similar size with the same encoder. Buffers are matched by size class, not
+ * by frame dimensions; frames of equal dimensions request mostly the same
+ * sizes, so with a large enough limit the following frames make few or no new
+ * large allocations. Retained buffers are returned to the memory manager when
+ * the limit is lowered, when an allocation fails, and when the encoder is
+ * destroyed.
+ *
+ * The limit is part of the memory management of the encoder and is therefore
+ * kept by @ref JxlEncoderReset. The default is 0: buffers are not kept unless
+ * this is called. May be called at any time.
+ *
+ * @param enc encoder object.
+ * @param max_bytes maximum number of bytes kept; 0 disables the reuse.
+ * @return ::JXL_ENC_SUCCESS
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetBufferPoolLimit(JxlEncoder* enc,
+                                                         size_t max_bytes);
+
 /**
  * Get the (last) error code in case ::JXL_ENC_ERROR was returned.
  *
@@ -853,7 +899,9 @@ struct JxlChunkedFrameInputSource {
    * Callback to retrieve a rectangle of color channel data at a specific
    * location. It is guaranteed that xpos and ypos are multiples of 8. xsize,
    * ysize will be multiples of 8, unless the resulting rectangle would be out
-   * of image bounds. Moreover, xsize and ysize will be at most 2048. The
+   * of image bounds. Moreover, when the frame is encoded in streaming mode,
+   * xsize and ysize will be at most 2064, i.e. a 2048 x 2048 DC group extended
+   * by 8 pixels on each side; otherwise the whole frame may be requested. The
    * returned data will be assumed to be in the format returned by the
    * (preceding) call to get_color_channels_pixel_format, except the `align`
    * parameter of the pixel format will be ignored. Instead, the `i`-th row will
@@ -896,13 +944,14 @@ struct JxlChunkedFrameInputSource {
    * Callback to retrieve a rectangle of extra channel `ec_index` data at a
    * specific location. It is guaranteed that xpos and ypos are multiples of
    * 8. xsize, ysize will be multiples of 8, unless the resulting rectangle
-   * would be out of image bounds. Moreover, xsize and ysize will be at most
-   * 2048. The returned data will be assumed to be in the format returned by the
-   * (preceding) call to get_extra_channels_pixel_format_at with the
-   * corresponding extra channel index `ec_index`, except the `align` parameter
-   * of the pixel format will be ignored. Instead, the `i`-th row will be
-   * assumed to start at position `return_value + i * *row_offset`, with the
-   * value of `*row_offset` decided by the callee.
+   * would be out of image bounds. Moreover, when the frame is encoded in
+   * streaming mode, xsize and ysize will be at most 2064. The returned data
+   * will be assumed to be in the format returned by the (preceding) call to
+   * get_extra_channels_pixel_format_at with the corresponding extra channel
+   * index `ec_index`, except the `align` parameter of the pixel format will be
+   * ignored. Instead, the `i`-th row will be assumed to start at position
+   * `return_value + i * *row_offset`, with the value of `*row_offset` decided
+   * by the callee.
    *
    * Note that multiple calls to `get_extra_channel_data_at` may happen before a
    * call to `release_buffer`.
@@ -945,6 +994,13 @@ struct JxlChunkedFrameInputSource {
  * completely retrieved, this function will flush the input and close it if it
  * is the last frame.
  *
+ * Pixels are only read on demand if an output processor is set with @ref
+ * JxlEncoderSetOutputProcessor; otherwise the whole frame is copied before
+ * this function returns. When the frame is encoded in streaming mode (see
+ * @ref JXL_ENC_FRAME_SETTING_BUFFERING), the rectangles are requested one DC
+ * group at a time. The order of the DC groups is unspecified and may change
+ * between versions, so the source must be able to provide any of them.
+ *
  * @param frame_settings set of options and metadata for this frame. Also
  * includes reference to the encoder object.
  * @param is_last_frame indicates if this is the last frame.
@@ -0,0 +1,90 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_threads
+ * @{
+ * @file shared_parallel_runner.h
+ * @brief implementation of a ::JxlParallelRunner that shares one set of
+ * threads among many encoder and decoder instances.
+ */
+
+/** Implementation of JxlParallelRunner for processes that run many encoders
+ * and/or decoders concurrently. Instead of one thread pool per instance, which
+ * leads to oversubscription when there are more instances than cores, a single
+ * pool with a fixed number of threads is created with
+ * @ref JxlSharedParallelRunnerPoolCreate, and each instance gets its own
+ * lightweight runner attached to it with @ref JxlSharedParallelRunnerCreate.
+ *
+ * The pool interleaves the tasks of all concurrent runs. Each runner has a
+ * weight; when several runs compete for the threads, each receives a share of
+ * task executions proportional to the weight of its runner (stride
+ * scheduling), so a heavy instance cannot starve the others.
+ *
+ * Only one concurrent @ref JxlSharedParallelRunner call per runner is allowed
+ * at a time, but any number of runners of the same pool may run concurrently.
+ * The calling thread blocks until the run is complete.
+ */
+
+#ifndef JXL_SHARED_PARALLEL_RUNNER_H_
+#define JXL_SHARED_PARALLEL_RUNNER_H_
+
+#include <jxl/jxl_threads_export.h>
+#include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Parallel runner that runs tasks on the threads of a shared pool. Use as
+ * @ref JxlParallelRunner with a runner created by
+ * @ref JxlSharedParallelRunnerCreate as opaque runner.
+ */
+JXL_THREADS_EXPORT JxlParallelRetCode JxlSharedParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
+
+/** Creates a pool of @p num_worker_threads threads that can be shared by
+ * many runners. If @p num_worker_threads is zero, all tasks run on the
+ * calling threads.
+ *
+ * @param memory_manager custom allocator function. It may be NULL.
+ * @param num_worker_threads the number of worker threads to create.
+ * @return @c NULL if the pool could not be created.
+ */
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerPoolCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads);
+
+/** Destroys the pool created by @ref JxlSharedParallelRunnerPoolCreate. All
+ * runners attached to it must be destroyed first.
+ */
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerPoolDestroy(void* pool);
+
+/** Creates a runner for @ref JxlSharedParallelRunner attached to @p pool.
+ *
+ * @param pool the pool created by @ref JxlSharedParallelRunnerPoolCreate.
+ * @param weight relative share of the threads this runner receives when
+ * competing with other runners of the same pool; must be positive.
+ * @return @c NULL if the runner could not be created or @p weight is zero.
+ */
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerCreate(void* pool,
+                                                       uint32_t weight);
+
+/** Destroys the runner created by @ref JxlSharedParallelRunnerCreate. It must
+ * not be running.
+ */
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerDestroy(void* runner_opaque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JXL_SHARED_PARALLEL_RUNNER_H_ */
+
+/** @}*/
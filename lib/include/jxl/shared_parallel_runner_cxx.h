@@ -0,0 +1,74 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+/// @addtogroup libjxl_cpp
+/// @{
+///
+/// @file shared_parallel_runner_cxx.h
+/// @ingroup libjxl_threads
+/// @brief C++ header-only helper for @ref shared_parallel_runner.h.
+///
+/// There's no binary library associated with the header since this is a header
+/// only library.
+
+#ifndef JXL_SHARED_PARALLEL_RUNNER_CXX_H_
+#define JXL_SHARED_PARALLEL_RUNNER_CXX_H_
+
+#include <jxl/memory_manager.h>
+#include <jxl/shared_parallel_runner.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#ifndef __cplusplus
+#error \
+    "This a C++ only header. Use jxl/shared_parallel_runner.h from C" \
+    "sources."
+#endif
+
+/// Struct to call JxlSharedParallelRunnerPoolDestroy from the
+/// JxlSharedParallelRunnerPoolPtr unique_ptr.
+struct JxlSharedParallelRunnerPoolDestroyStruct {
+  /// Calls @ref JxlSharedParallelRunnerPoolDestroy() on the passed pool.
+  void operator()(void* pool) { JxlSharedParallelRunnerPoolDestroy(pool); }
+};
+
+/// std::unique_ptr<> type that calls JxlSharedParallelRunnerPoolDestroy() when
+/// releasing the pool.
+typedef std::unique_ptr<void, JxlSharedParallelRunnerPoolDestroyStruct>
+    JxlSharedParallelRunnerPoolPtr;
+
+/// Creates a pool for JxlSharedParallelRunner into a
+/// JxlSharedParallelRunnerPoolPtr. See @ref JxlSharedParallelRunnerPoolCreate
+/// for details.
+static inline JxlSharedParallelRunnerPoolPtr JxlSharedParallelRunnerPoolMake(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads) {
+  return JxlSharedParallelRunnerPoolPtr(
+      JxlSharedParallelRunnerPoolCreate(memory_manager, num_worker_threads));
+}
+
+/// Struct to call JxlSharedParallelRunnerDestroy from the
+/// JxlSharedParallelRunnerPtr unique_ptr.
+struct JxlSharedParallelRunnerDestroyStruct {
+  /// Calls @ref JxlSharedParallelRunnerDestroy() on the passed runner.
+  void operator()(void* runner) { JxlSharedParallelRunnerDestroy(runner); }
+};
+
+/// std::unique_ptr<> type that calls JxlSharedParallelRunnerDestroy() when
+/// releasing the runner.
+typedef std::unique_ptr<void, JxlSharedParallelRunnerDestroyStruct>
+    JxlSharedParallelRunnerPtr;
+
+/// Creates a runner attached to @p pool into a JxlSharedParallelRunnerPtr. See
+/// @ref JxlSharedParallelRunnerCreate for details.
+static inline JxlSharedParallelRunnerPtr JxlSharedParallelRunnerMake(
+    void* pool, uint32_t weight) {
+  return JxlSharedParallelRunnerPtr(JxlSharedParallelRunnerCreate(pool, weight));
+}
+
+#endif  // JXL_SHARED_PARALLEL_RUNNER_CXX_H_
+
+/// @}
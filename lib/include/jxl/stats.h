@@ -72,6 +72,36 @@ typedef enum {
   JXL_ENC_STAT_NUM_DCT32X64_BLOCKS,
   JXL_ENC_STAT_NUM_DCT64_BLOCKS,
   JXL_ENC_STAT_NUM_BUTTERAUGLI_ITERS,
+  /* Time spent in each encoder phase, in microseconds summed over all threads,
+   * followed by the amount of work done in the phase. Phases may be nested in
+   * each other, e.g. token writing happens within patch detection. */
+  /** Conversion of the input to XYB; number of pixels. */
+  JXL_ENC_STAT_XYB_TIME_US,
+  JXL_ENC_STAT_XYB_PIXELS,
+  /** Adaptive quantization; number of 8x8 blocks. */
+  JXL_ENC_STAT_ADAPTIVE_QUANTIZATION_TIME_US,
+  JXL_ENC_STAT_ADAPTIVE_QUANTIZATION_BLOCKS,
+  /** AC strategy (block size) search; number of 8x8 blocks. */
+  JXL_ENC_STAT_AC_STRATEGY_TIME_US,
+  JXL_ENC_STAT_AC_STRATEGY_BLOCKS,
+  /** Chroma from luma search; number of 8x8 blocks. */
+  JXL_ENC_STAT_CFL_TIME_US,
+  JXL_ENC_STAT_CFL_BLOCKS,
+  /** Patches and dots detection; number of pixels searched. */
+  JXL_ENC_STAT_PATCHES_TIME_US,
+  JXL_ENC_STAT_PATCHES_PIXELS,
+  /** MA tree learning; number of tree nodes learned. */
+  JXL_ENC_STAT_TREE_LEARNING_TIME_US,
+  JXL_ENC_STAT_TREE_LEARNING_NODES,
+  /** Histogram clustering; number of histograms clustered. */
+  JXL_ENC_STAT_HISTOGRAM_CLUSTERING_TIME_US,
+  JXL_ENC_STAT_HISTOGRAM_CLUSTERING_HISTOGRAMS,
+  /** LZ77 search; number of input tokens. */
+  JXL_ENC_STAT_LZ77_TIME_US,
+  JXL_ENC_STAT_LZ77_TOKENS,
+  /** Writing of entropy coded tokens; number of tokens. */
+  JXL_ENC_STAT_TOKEN_WRITING_TIME_US,
+  JXL_ENC_STAT_TOKEN_WRITING_TOKENS,
   JXL_ENC_NUM_STATS,
 } JxlEncoderStatsKey;
 
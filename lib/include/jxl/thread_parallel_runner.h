@@ -15,7 +15,8 @@
  * internally and related synchronization functions. The number of threads
  * created is fixed at construction time and the threads are re-used for every
  * ThreadParallelRunner::Runner call. Only one concurrent
- * JxlThreadParallelRunner call per instance is allowed at a time.
+ * JxlThreadParallelRunner call per instance is allowed at a time, except for
+ * nested calls from within the tasks it runs.
  *
  * This is a scalable, lower-overhead thread pool runner, especially suitable
  * for data-parallel computations in the fork-join model, where clients need to
@@ -41,6 +42,68 @@
 extern "C" {
 #endif
 
+/** Scheduling strategy of the worker threads of a
+ * @ref JxlThreadParallelRunner.
+ */
+typedef enum {
+  /** Workers reserve chunks of decreasing size from a counter shared by all
+   * workers. This is the default.
+   */
+  JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_GUIDED = 0,
+
+  /** Each worker owns a contiguous part of the range and runs it chunk by
+   * chunk; idle workers steal half of the largest remaining part. Idle
+   * workers spin briefly before blocking. This scales better on machines with
+   * many cores when the library issues many runs with few, small tasks, at the
+   * cost of some CPU time spent spinning.
+   */
+  JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_WORK_STEALING = 1,
+} JxlThreadParallelRunnerSchedule;
+
+/** Placement of the worker threads of a @ref JxlThreadParallelRunner on the
+ * CPUs the process is allowed to run on. Only supported on Linux; elsewhere
+ * workers are not pinned, as with JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NONE.
+ */
+typedef enum {
+  /** Workers may run on any CPU and migrate freely. This is the default.
+   */
+  JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NONE = 0,
+
+  /** Each worker is pinned to a single CPU, in order of CPU number. If there
+   * are more workers than CPUs, CPUs are assigned again from the first one.
+   */
+  JXL_THREAD_PARALLEL_RUNNER_AFFINITY_CORES = 1,
+
+  /** Workers are split into consecutive blocks of similar size, one per NUMA
+   * node, and each worker may run on any CPU of its node. Workers with
+   * adjacent indices, which tend to process adjacent groups, thus share a
+   * node. Falls back to JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NONE if the NUMA
+   * topology is unknown.
+   */
+  JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NUMA_NODES = 2,
+} JxlThreadParallelRunnerAffinity;
+
+/** Creation options for @ref JxlThreadParallelRunnerCreateWithOptions.
+ * Initialize with @ref JxlThreadParallelRunnerDefaultOptions before changing
+ * individual fields.
+ */
+typedef struct {
+  /** The number of worker threads to create. If zero, all tasks run on the
+   * calling thread.
+   */
+  size_t num_worker_threads;
+
+  /** How tasks are distributed among the worker threads.
+   */
+  JxlThreadParallelRunnerSchedule schedule;
+
+  /** Which CPUs the worker threads are pinned to. Workers pin themselves when
+   * they start, so memory they allocate and first write (e.g. per-thread
+   * scratch buffers of the decoder) is local to their NUMA node.
+   */
+  JxlThreadParallelRunnerAffinity affinity;
+} JxlThreadParallelRunnerOptions;
+
 /** Parallel runner internally using std::thread. Use as @ref JxlParallelRunner.
  */
 JXL_THREADS_EXPORT JxlParallelRetCode JxlThreadParallelRunner(
@@ -53,6 +116,24 @@ JXL_THREADS_EXPORT JxlParallelRetCode JxlThreadParallelRunner(
 JXL_THREADS_EXPORT void* JxlThreadParallelRunnerCreate(
     const JxlMemoryManager* memory_manager, size_t num_worker_threads);
 
+/** Sets @p options to the defaults used by @ref JxlThreadParallelRunnerCreate
+ * with @ref JxlThreadParallelRunnerDefaultNumWorkerThreads worker threads.
+ */
+JXL_THREADS_EXPORT void JxlThreadParallelRunnerDefaultOptions(
+    JxlThreadParallelRunnerOptions* options);
+
+/** Creates the runner for @ref JxlThreadParallelRunner with the given
+ * @p options. Use as the opaque runner.
+ *
+ * @param memory_manager custom allocator function. It may be NULL.
+ * @param options creation options, must not be NULL.
+ * @return @c NULL if the runner could not be allocated or the options are
+ * invalid.
+ */
+JXL_THREADS_EXPORT void* JxlThreadParallelRunnerCreateWithOptions(
+    const JxlMemoryManager* memory_manager,
+    const JxlThreadParallelRunnerOptions* options);
+
 /** Destroys the runner created by @ref JxlThreadParallelRunnerCreate.
  */
 JXL_THREADS_EXPORT void JxlThreadParallelRunnerDestroy(void* runner_opaque);
@@ -61,6 +61,25 @@ static inline JxlThreadParallelRunnerPtr JxlThreadParallelRunnerMake(
       JxlThreadParallelRunnerCreate(memory_manager, num_worker_threads));
 }
 
+/// Creates an instance of JxlThreadParallelRunner with the given options into
+/// a JxlThreadParallelRunnerPtr and initializes it.
+///
+/// See @ref JxlThreadParallelRunnerCreateWithOptions for details on the
+/// instance creation.
+///
+/// @param memory_manager custom allocator function. It may be NULL. The memory
+///        manager will be copied internally.
+/// @param options the creation options.
+/// @return a @c NULL JxlThreadParallelRunnerPtr if the instance can not be
+/// allocated or initialized
+/// @return initialized JxlThreadParallelRunnerPtr instance otherwise.
+static inline JxlThreadParallelRunnerPtr JxlThreadParallelRunnerMake(
+    const JxlMemoryManager* memory_manager,
+    const JxlThreadParallelRunnerOptions& options) {
+  return JxlThreadParallelRunnerPtr(
+      JxlThreadParallelRunnerCreateWithOptions(memory_manager, &options));
+}
+
 #endif  // JXL_THREAD_PARALLEL_RUNNER_CXX_H_
 
 /// @}
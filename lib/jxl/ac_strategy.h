@@ -213,6 +213,10 @@ class AcStrategyImage {
   void FillDCT8() { FillDCT8(Rect(layers_)); }
 
   void FillInvalid() { FillImage(INVALID, &layers_); }
+  void FillInvalid(const Rect& rect) { FillPlane(INVALID, &layers_, rect); }
+
+  // See MoveRowsUp in image_ops.h.
+  void MoveRowsUp(size_t dy) { jxl::MoveRowsUp(dy, &layers_); }
 
   Status Set(size_t x, size_t y, AcStrategyType type) {
 #if (JXL_IS_DEBUG_BUILD)
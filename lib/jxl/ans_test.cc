@@ -373,5 +373,83 @@ TEST_P(AnsSimdTest, EstimateTokenCost) {
     ASSERT_EQ(actual_out[i], expected_out[i]) << i;
   }
 }
+
+std::vector<uint8_t> EncodeTokens(const HistogramParams& params,
+                                  size_t num_contexts,
+                                  const std::vector<Token>& tokens,
+                                  ThreadPool* pool) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  EntropyEncodingData codes;
+  BitWriter writer{memory_manager};
+  std::vector<std::vector<Token>> tokens_copy = {tokens};
+  JXL_TEST_ASSIGN_OR_DIE(
+      size_t cost,
+      BuildAndEncodeHistograms(memory_manager, params, num_contexts,
+                               tokens_copy, &codes, &writer, LayerType::Header,
+                               nullptr, pool));
+  (void)cost;
+  EXPECT_TRUE(WriteTokens(tokens_copy[0], codes, 0, &writer, LayerType::Header,
+                          nullptr));
+  writer.ZeroPadToByte();
+  return writer.GetSpan().Copy();
+}
+
+TEST(ANSTest, HistogramsDoNotDependOnThreads) {
+  constexpr size_t kNumContexts = 120;
+  Rng rng(0);
+  // Contexts with a few different distributions, so that clustering has
+  // something to merge.
+  std::vector<Token> tokens;
+  for (size_t i = 0; i < 50000; i++) {
+    uint32_t ctx = rng.UniformU(0, kNumContexts);
+    uint32_t range = 4u << (2 * (ctx % 5));
+    tokens.emplace_back(ctx, rng.UniformU(0, range) + ctx % 3);
+  }
+  std::vector<uint8_t> expected =
+      EncodeTokens(HistogramParams(), kNumContexts, tokens, nullptr);
+  test::ThreadPoolForTests pool(4);
+  EXPECT_EQ(expected,
+            EncodeTokens(HistogramParams(), kNumContexts, tokens, pool.get()));
+}
+
+TEST(ANSTest, LZ77DoesNotDependOnThreads) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  // Long enough to be matched in several chunks.
+  constexpr size_t kNumTokens = 600000;
+  constexpr size_t kWidth = 300;
+  Rng rng(0);
+  std::vector<Token> tokens;
+  for (size_t i = 0; i < kNumTokens; i++) {
+    uint32_t value = rng.UniformU(0, 64);
+    if (i >= kWidth && rng.UniformU(0, 4) != 0) {
+      value = tokens[i - kWidth].value;
+    }
+    tokens.emplace_back(0, value);
+  }
+  HistogramParams params;
+  params.lz77_method = HistogramParams::LZ77Method::kOptimal;
+  params.image_widths = {kWidth};
+  std::vector<uint8_t> expected = EncodeTokens(params, 1, tokens, nullptr);
+  test::ThreadPoolForTests pool(4);
+  EXPECT_EQ(expected, EncodeTokens(params, 1, tokens, pool.get()));
+
+  BitReader br(expected);
+  Status status = true;
+  {
+    BitReaderScopedCloser bc(br, status);
+    std::vector<uint8_t> dec_context_map;
+    ANSCode decoded_codes;
+    ASSERT_TRUE(DecodeHistograms(memory_manager, &br, 1, &decoded_codes,
+                                 &dec_context_map));
+    ASSERT_TRUE(decoded_codes.lz77.enabled);
+    JXL_TEST_ASSIGN_OR_DIE(ANSSymbolReader reader,
+                           ANSSymbolReader::Create(&decoded_codes, &br));
+    for (const Token& token : tokens) {
+      ASSERT_EQ(reader.ReadHybridUint(0, &br, dec_context_map), token.value);
+    }
+    EXPECT_TRUE(reader.CheckANSFinalState());
+  }
+  EXPECT_TRUE(status);
+}
 }  // namespace
 }  // namespace jxl
@@ -38,11 +38,18 @@ class ThreadPool {
   JxlParallelRunner runner() const { return runner_; }
   void* runner_opaque() const { return runner_opaque_; }
 
+  // Whether the runner may be called from within a data_func it is running.
+  // If not (the default), nested Run calls run sequentially on the calling
+  // thread, so code running inside a task may still pass this pool along.
+  void SetAllowNesting(bool allow_nesting) { allow_nesting_ = allow_nesting; }
+  bool AllowNesting() const { return allow_nesting_; }
+
   // Runs init_func(num_threads) followed by data_func(task, thread) on worker
   // thread(s) for every task in [begin, end). init_func() must return a Status
   // indicating whether the initialization succeeded.
   // "thread" is an integer smaller than num_threads.
-  // Not thread-safe - no two calls to Run may overlap.
+  // Not thread-safe - no two calls to Run may overlap, except for calls from
+  // within data_func (see SetAllowNesting).
   // Subsequent calls will reuse the same threads.
   //
   // Precondition: begin <= end.
@@ -51,10 +58,10 @@ class ThreadPool {
              const DataFunc& data_func, const char* caller) {
     JXL_ENSURE(begin <= end);
     if (begin == end) return true;
-    RunCallState<InitFunc, DataFunc> call_state(init_func, data_func);
+    RunCallState<InitFunc, DataFunc> call_state(this, init_func, data_func);
     // The runner_ uses the C convention and returns 0 in case of error, so we
     // convert it to a Status.
-    if (!runner_) {
+    if (!runner_ || (RunningPool() == this && !allow_nesting_)) {
       void* jpegxl_opaque = static_cast<void*>(&call_state);
       if (call_state.CallInitFunc(jpegxl_opaque, 1) !=
           JXL_PARALLEL_RET_SUCCESS) {
@@ -87,8 +94,9 @@ class ThreadPool {
   template <class InitFunc, class DataFunc>
   class RunCallState final {
    public:
-    RunCallState(const InitFunc& init_func, const DataFunc& data_func)
-        : init_func_(init_func), data_func_(data_func) {}
+    RunCallState(const ThreadPool* pool, const InitFunc& init_func,
+                 const DataFunc& data_func)
+        : pool_(pool), init_func_(init_func), data_func_(data_func) {}
 
     // JxlParallelRunInit interface.
     static int CallInitFunc(void* jpegxl_opaque, size_t num_threads) {
@@ -109,14 +117,19 @@ class ThreadPool {
       auto* self =
           static_cast<RunCallState<InitFunc, DataFunc>*>(jpegxl_opaque);
       if (self->has_error_) return;
+      const ThreadPool*& running_pool = RunningPool();
+      const ThreadPool* outer_pool = running_pool;
+      running_pool = self->pool_;
       if (!self->data_func_(value, thread_id)) {
         self->has_error_ = 1;
       }
+      running_pool = outer_pool;
     }
 
     bool HasError() const { return has_error_ != 0; }
 
    private:
+    const ThreadPool* pool_;
     const InitFunc& init_func_;
     const DataFunc& data_func_;
     std::atomic<uint32_t> has_error_{0};
@@ -125,6 +138,14 @@ class ThreadPool {
   // The caller supplied runner function and its opaque void*.
   const JxlParallelRunner runner_;
   void* const runner_opaque_;
+  bool allow_nesting_ = false;
+
+  // The pool whose data_func is running on the current thread, if any. A
+  // function-local thread_local, since inline variables need C++17.
+  static const ThreadPool*& RunningPool() {
+    static thread_local const ThreadPool* running_pool = nullptr;
+    return running_pool;
+  }
 };
 
 template <class InitFunc, class DataFunc>
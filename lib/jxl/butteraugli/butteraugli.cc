@@ -35,6 +35,7 @@
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/convolve.h"
 #include "lib/jxl/image.h"
@@ -74,6 +75,26 @@ static const double wmul[9] = {
     29.2353797994, 0.844626970982, 0.703646627719,
 };
 
+// Number of rows handled by each task of the row-parallel stages.
+constexpr size_t kStripeRows = 64;
+
+// Calls `func(y_begin, y_end)` on stripes of kStripeRows rows that cover
+// [0, ysize). The stripes run on `pool` if it is not null. `func` must only
+// write outputs that belong to its own stripe.
+template <typename Func>
+Status RunOnRowStripes(ThreadPool* pool, const size_t ysize, const Func& func,
+                       const char* caller) {
+  const size_t num_stripes = DivCeil(ysize, kStripeRows);
+  const auto process_stripe = [&](const uint32_t stripe,
+                                  size_t /*thread*/) -> Status {
+    const size_t y_begin = stripe * kStripeRows;
+    const size_t y_end = std::min(ysize, y_begin + kStripeRows);
+    return func(y_begin, y_end);
+  };
+  return RunOnPool(pool, 0, num_stripes, ThreadPool::NoInit, process_stripe,
+                   caller);
+}
+
 std::vector<float> ComputeKernel(float sigma) {
   const float m = 2.25;  // Accuracy increases when m is increased.
   const double scaler = -1.0 / (2.0 * sigma * sigma);
@@ -86,7 +107,9 @@ std::vector<float> ComputeKernel(float sigma) {
 }
 
 void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
-                          const size_t x, float* BUTTERAUGLI_RESTRICT row_out) {
+                          const size_t x, const size_t y_begin,
+                          const size_t y_end,
+                          float* BUTTERAUGLI_RESTRICT row_out) {
   const size_t offset = kernel.size() / 2;
   int minx = x < offset ? 0 : x - offset;
   int maxx = std::min<int>(in.xsize() - 1, x + offset);
@@ -95,7 +118,7 @@ void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
     weight += kernel[j - x + offset];
   }
   float scale = 1.0f / weight;
-  for (size_t y = 0; y < in.ysize(); ++y) {
+  for (size_t y = y_begin; y < y_end; ++y) {
     const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y);
     float sum = 0.0f;
     for (int j = minx; j <= maxx; ++j) {
@@ -108,6 +131,7 @@ void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
 // Computes a horizontal convolution and transposes the result.
 Status ConvolutionWithTranspose(const ImageF& in,
                                 const std::vector<float>& kernel,
+                                ThreadPool* pool,
                                 ImageF* BUTTERAUGLI_RESTRICT out) {
   JXL_ENSURE(out->xsize() == in.ysize());
   JXL_ENSURE(out->ysize() == in.xsize());
@@ -125,101 +149,112 @@ Status ConvolutionWithTranspose(const ImageF& in,
     scaled_kernel[i] = kernel[i] * scale_no_border;
   }
 
-  // middle
-  switch (len) {
-    case 7: {
-      const float sk0 = scaled_kernel[0];
-      const float sk1 = scaled_kernel[1];
-      const float sk2 = scaled_kernel[2];
-      const float sk3 = scaled_kernel[3];
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          const float sum0 = (row_in[0] + row_in[6]) * sk0;
-          const float sum1 = (row_in[1] + row_in[5]) * sk1;
-          const float sum2 = (row_in[2] + row_in[4]) * sk2;
-          const float sum = (row_in[3]) * sk3 + sum0 + sum1 + sum2;
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum;
+  // Each row of `in` is written to a column of `out`, so stripes of rows
+  // can be processed independently.
+  const auto process_rows = [&](const size_t y_begin,
+                                const size_t y_end) -> Status {
+    // middle
+    switch (len) {
+      case 7: {
+        const float sk0 = scaled_kernel[0];
+        const float sk1 = scaled_kernel[1];
+        const float sk2 = scaled_kernel[2];
+        const float sk3 = scaled_kernel[3];
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            const float sum0 = (row_in[0] + row_in[6]) * sk0;
+            const float sum1 = (row_in[1] + row_in[5]) * sk1;
+            const float sum2 = (row_in[2] + row_in[4]) * sk2;
+            const float sum = (row_in[3]) * sk3 + sum0 + sum1 + sum2;
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum;
+          }
         }
-      }
-    } break;
-    case 13: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          float sum0 = (row_in[0] + row_in[12]) * scaled_kernel[0];
-          float sum1 = (row_in[1] + row_in[11]) * scaled_kernel[1];
-          float sum2 = (row_in[2] + row_in[10]) * scaled_kernel[2];
-          float sum3 = (row_in[3] + row_in[9]) * scaled_kernel[3];
-          sum0 += (row_in[4] + row_in[8]) * scaled_kernel[4];
-          sum1 += (row_in[5] + row_in[7]) * scaled_kernel[5];
-          const float sum = (row_in[6]) * scaled_kernel[6];
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+      } break;
+      case 13: {
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            float sum0 = (row_in[0] + row_in[12]) * scaled_kernel[0];
+            float sum1 = (row_in[1] + row_in[11]) * scaled_kernel[1];
+            float sum2 = (row_in[2] + row_in[10]) * scaled_kernel[2];
+            float sum3 = (row_in[3] + row_in[9]) * scaled_kernel[3];
+            sum0 += (row_in[4] + row_in[8]) * scaled_kernel[4];
+            sum1 += (row_in[5] + row_in[7]) * scaled_kernel[5];
+            const float sum = (row_in[6]) * scaled_kernel[6];
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+          }
         }
+        break;
       }
-      break;
-    }
-    case 15: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          float sum0 = (row_in[0] + row_in[14]) * scaled_kernel[0];
-          float sum1 = (row_in[1] + row_in[13]) * scaled_kernel[1];
-          float sum2 = (row_in[2] + row_in[12]) * scaled_kernel[2];
-          float sum3 = (row_in[3] + row_in[11]) * scaled_kernel[3];
-          sum0 += (row_in[4] + row_in[10]) * scaled_kernel[4];
-          sum1 += (row_in[5] + row_in[9]) * scaled_kernel[5];
-          sum2 += (row_in[6] + row_in[8]) * scaled_kernel[6];
-          const float sum = (row_in[7]) * scaled_kernel[7];
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+      case 15: {
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            float sum0 = (row_in[0] + row_in[14]) * scaled_kernel[0];
+            float sum1 = (row_in[1] + row_in[13]) * scaled_kernel[1];
+            float sum2 = (row_in[2] + row_in[12]) * scaled_kernel[2];
+            float sum3 = (row_in[3] + row_in[11]) * scaled_kernel[3];
+            sum0 += (row_in[4] + row_in[10]) * scaled_kernel[4];
+            sum1 += (row_in[5] + row_in[9]) * scaled_kernel[5];
+            sum2 += (row_in[6] + row_in[8]) * scaled_kernel[6];
+            const float sum = (row_in[7]) * scaled_kernel[7];
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+          }
         }
+        break;
       }
-      break;
-    }
-    case 33: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          float sum0 = (row_in[0] + row_in[32]) * scaled_kernel[0];
-          float sum1 = (row_in[1] + row_in[31]) * scaled_kernel[1];
-          float sum2 = (row_in[2] + row_in[30]) * scaled_kernel[2];
-          float sum3 = (row_in[3] + row_in[29]) * scaled_kernel[3];
-          sum0 += (row_in[4] + row_in[28]) * scaled_kernel[4];
-          sum1 += (row_in[5] + row_in[27]) * scaled_kernel[5];
-          sum2 += (row_in[6] + row_in[26]) * scaled_kernel[6];
-          sum3 += (row_in[7] + row_in[25]) * scaled_kernel[7];
-          sum0 += (row_in[8] + row_in[24]) * scaled_kernel[8];
-          sum1 += (row_in[9] + row_in[23]) * scaled_kernel[9];
-          sum2 += (row_in[10] + row_in[22]) * scaled_kernel[10];
-          sum3 += (row_in[11] + row_in[21]) * scaled_kernel[11];
-          sum0 += (row_in[12] + row_in[20]) * scaled_kernel[12];
-          sum1 += (row_in[13] + row_in[19]) * scaled_kernel[13];
-          sum2 += (row_in[14] + row_in[18]) * scaled_kernel[14];
-          sum3 += (row_in[15] + row_in[17]) * scaled_kernel[15];
-          const float sum = (row_in[16]) * scaled_kernel[16];
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+      case 33: {
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            float sum0 = (row_in[0] + row_in[32]) * scaled_kernel[0];
+            float sum1 = (row_in[1] + row_in[31]) * scaled_kernel[1];
+            float sum2 = (row_in[2] + row_in[30]) * scaled_kernel[2];
+            float sum3 = (row_in[3] + row_in[29]) * scaled_kernel[3];
+            sum0 += (row_in[4] + row_in[28]) * scaled_kernel[4];
+            sum1 += (row_in[5] + row_in[27]) * scaled_kernel[5];
+            sum2 += (row_in[6] + row_in[26]) * scaled_kernel[6];
+            sum3 += (row_in[7] + row_in[25]) * scaled_kernel[7];
+            sum0 += (row_in[8] + row_in[24]) * scaled_kernel[8];
+            sum1 += (row_in[9] + row_in[23]) * scaled_kernel[9];
+            sum2 += (row_in[10] + row_in[22]) * scaled_kernel[10];
+            sum3 += (row_in[11] + row_in[21]) * scaled_kernel[11];
+            sum0 += (row_in[12] + row_in[20]) * scaled_kernel[12];
+            sum1 += (row_in[13] + row_in[19]) * scaled_kernel[13];
+            sum2 += (row_in[14] + row_in[18]) * scaled_kernel[14];
+            sum3 += (row_in[15] + row_in[17]) * scaled_kernel[15];
+            const float sum = (row_in[16]) * scaled_kernel[16];
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+          }
         }
+        break;
       }
-      break;
+      default:
+        return JXL_UNREACHABLE("kernel size %d not implemented",
+                               static_cast<int>(len));
+    }
+    // left border
+    for (size_t x = 0; x < border1; ++x) {
+      ConvolveBorderColumn(in, kernel, x, y_begin, y_end, out->Row(x));
     }
-    default:
-      return JXL_UNREACHABLE("kernel size %d not implemented",
-                             static_cast<int>(len));
-  }
-  // left border
-  for (size_t x = 0; x < border1; ++x) {
-    ConvolveBorderColumn(in, kernel, x, out->Row(x));
-  }
 
-  // right border
-  for (size_t x = border2; x < in.xsize(); ++x) {
-    ConvolveBorderColumn(in, kernel, x, out->Row(x));
-  }
-  return true;
+    // right border
+    for (size_t x = border2; x < in.xsize(); ++x) {
+      ConvolveBorderColumn(in, kernel, x, y_begin, y_end, out->Row(x));
+    }
+    return true;
+  };
+  return RunOnRowStripes(pool, in.ysize(), process_rows,
+                         "ConvolutionWithTranspose");
 }
 
 // A blur somewhat similar to a 2D Gaussian blur.
@@ -233,7 +268,7 @@ Status ConvolutionWithTranspose(const ImageF& in,
 // optionally use gauss_blur followed by fixup of the borders for large images,
 // or fall back to the previous truncated FIR followed by a transpose.
 Status Blur(const ImageF& in, float sigma, const ButteraugliParams& params,
-            BlurTemp* temp, ImageF* out) {
+            BlurTemp* temp, ThreadPool* pool, ImageF* out) {
   std::vector<float> kernel = ComputeKernel(sigma);
   // Separable5 does an in-place convolution, so this fast path is not safe if
   // in aliases out.
@@ -251,14 +286,14 @@ Status Blur(const ImageF& in, float sigma, const ButteraugliParams& params,
         {HWY_REP4(w0), HWY_REP4(w1), HWY_REP4(w2)},
     };
     JXL_RETURN_IF_ERROR(
-        Separable5(in, Rect(in), weights, /*pool=*/nullptr, out));
+        Separable5(in, Rect(in), weights, pool, out));
     return true;
   }
 
   ImageF* temp_t;
   JXL_RETURN_IF_ERROR(temp->GetTransposed(in, &temp_t));
-  JXL_RETURN_IF_ERROR(ConvolutionWithTranspose(in, kernel, temp_t));
-  JXL_RETURN_IF_ERROR(ConvolutionWithTranspose(*temp_t, kernel, out));
+  JXL_RETURN_IF_ERROR(ConvolutionWithTranspose(in, kernel, pool, temp_t));
+  JXL_RETURN_IF_ERROR(ConvolutionWithTranspose(*temp_t, kernel, pool, out));
   return true;
 }
 
@@ -401,12 +436,13 @@ void Subtract(const ImageF& a, const ImageF& b, ImageF* c) {
 }
 
 Status SeparateLFAndMF(const ButteraugliParams& params, const Image3F& xyb,
-                       Image3F* lf, Image3F* mf, BlurTemp* blur_temp) {
+                       Image3F* lf, Image3F* mf, BlurTemp* blur_temp,
+                       ThreadPool* pool) {
   static const double kSigmaLf = 7.15593339443;
   for (int i = 0; i < 3; ++i) {
     // Extract lf ...
     JXL_RETURN_IF_ERROR(
-        Blur(xyb.Plane(i), kSigmaLf, params, blur_temp, &lf->Plane(i)));
+        Blur(xyb.Plane(i), kSigmaLf, params, blur_temp, pool, &lf->Plane(i)));
     // ... and keep everything else in mf.
     Subtract(xyb.Plane(i), lf->Plane(i), &mf->Plane(i));
   }
@@ -415,7 +451,7 @@ Status SeparateLFAndMF(const ButteraugliParams& params, const Image3F& xyb,
 }
 
 Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
-                       BlurTemp* blur_temp) {
+                       BlurTemp* blur_temp, ThreadPool* pool) {
   const HWY_FULL(float) d;
   static const double kSigmaHf = 3.22489901262;
   const size_t xsize = mf->xsize();
@@ -426,7 +462,7 @@ Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
   for (int i = 0; i < 3; ++i) {
     if (i == 2) {
       JXL_RETURN_IF_ERROR(
-          Blur(mf->Plane(i), kSigmaHf, params, blur_temp, &mf->Plane(i)));
+          Blur(mf->Plane(i), kSigmaHf, params, blur_temp, pool, &mf->Plane(i)));
       break;
     }
     for (size_t y = 0; y < ysize; ++y) {
@@ -437,7 +473,7 @@ Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
       }
     }
     JXL_RETURN_IF_ERROR(
-        Blur(mf->Plane(i), kSigmaHf, params, blur_temp, &mf->Plane(i)));
+        Blur(mf->Plane(i), kSigmaHf, params, blur_temp, pool, &mf->Plane(i)));
     static const double kRemoveMfRange = 0.29;
     static const double kAddMfRange = 0.1;
     if (i == 0) {
@@ -473,7 +509,7 @@ Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
 }
 
 Status SeparateHFAndUHF(const ButteraugliParams& params, ImageF* hf,
-                        ImageF* uhf, BlurTemp* blur_temp) {
+                        ImageF* uhf, BlurTemp* blur_temp, ThreadPool* pool) {
   const HWY_FULL(float) d;
   const size_t xsize = hf[0].xsize();
   const size_t ysize = hf[0].ysize();
@@ -490,7 +526,8 @@ Status SeparateHFAndUHF(const ButteraugliParams& params, ImageF* hf,
         row_uhf[x] = row_hf[x];
       }
     }
-    JXL_RETURN_IF_ERROR(Blur(hf[i], kSigmaUhf, params, blur_temp, &hf[i]));
+    JXL_RETURN_IF_ERROR(
+        Blur(hf[i], kSigmaUhf, params, blur_temp, pool, &hf[i]));
     static const double kRemoveHfRange = 1.5;
     static const double kAddHfRange = 0.132;
     static const double kRemoveUhfRange = 0.04;
@@ -543,16 +580,19 @@ void DeallocateHFAndUHF(ImageF* hf, ImageF* uhf) {
 
 Status SeparateFrequencies(size_t xsize, size_t ysize,
                            const ButteraugliParams& params, BlurTemp* blur_temp,
-                           const Image3F& xyb, PsychoImage& ps) {
+                           const Image3F& xyb, PsychoImage& ps,
+                           ThreadPool* pool) {
   JxlMemoryManager* memory_manager = xyb.memory_manager();
   JXL_ASSIGN_OR_RETURN(
       ps.lf, Image3F::Create(memory_manager, xyb.xsize(), xyb.ysize()));
   JXL_ASSIGN_OR_RETURN(
       ps.mf, Image3F::Create(memory_manager, xyb.xsize(), xyb.ysize()));
-  JXL_RETURN_IF_ERROR(SeparateLFAndMF(params, xyb, &ps.lf, &ps.mf, blur_temp));
-  JXL_RETURN_IF_ERROR(SeparateMFAndHF(params, &ps.mf, &ps.hf[0], blur_temp));
   JXL_RETURN_IF_ERROR(
-      SeparateHFAndUHF(params, &ps.hf[0], &ps.uhf[0], blur_temp));
+      SeparateLFAndMF(params, xyb, &ps.lf, &ps.mf, blur_temp, pool));
+  JXL_RETURN_IF_ERROR(
+      SeparateMFAndHF(params, &ps.mf, &ps.hf[0], blur_temp, pool));
+  JXL_RETURN_IF_ERROR(
+      SeparateHFAndUHF(params, &ps.hf[0], &ps.uhf[0], blur_temp, pool));
   return true;
 }
 
@@ -989,7 +1029,8 @@ static Status MaltaDiffMapT(const Tag tag, const ImageF& lum0,
                             const double w_0lt1, const double norm1,
                             const double len, const double mulli,
                             ImageF* HWY_RESTRICT diffs,
-                            ImageF* HWY_RESTRICT block_diff_ac) {
+                            ImageF* HWY_RESTRICT block_diff_ac,
+                            ThreadPool* pool) {
   JXL_ENSURE(SameSize(lum0, lum1) && SameSize(lum0, *diffs));
   const size_t xsize_ = lum0.xsize();
   const size_t ysize_ = lum0.ysize();
@@ -1002,107 +1043,109 @@ static Status MaltaDiffMapT(const Tag tag, const ImageF& lum0,
   const float norm2_0gt1 = w_pre0gt1 * norm1;
   const float norm2_0lt1 = w_pre0lt1 * norm1;
 
-  for (size_t y = 0; y < ysize_; ++y) {
-    const float* HWY_RESTRICT row0 = lum0.ConstRow(y);
-    const float* HWY_RESTRICT row1 = lum1.ConstRow(y);
-    float* HWY_RESTRICT row_diffs = diffs->Row(y);
-    for (size_t x = 0; x < xsize_; ++x) {
-      const float absval = 0.5f * (std::abs(row0[x]) + std::abs(row1[x]));
-      const float diff = row0[x] - row1[x];
-      const float scaler = norm2_0gt1 / (static_cast<float>(norm1) + absval);
-
-      // Primary symmetric quadratic objective.
-      row_diffs[x] = scaler * diff;
-
-      const float scaler2 = norm2_0lt1 / (static_cast<float>(norm1) + absval);
-      const double fabs0 = std::fabs(row0[x]);
-
-      // Secondary half-open quadratic objectives.
-      const double too_small = 0.55 * fabs0;
-      const double too_big = 1.05 * fabs0;
-
-      if (row0[x] < 0) {
-        if (row1[x] > -too_small) {
-          double impact = scaler2 * (row1[x] + too_small);
-          row_diffs[x] -= impact;
-        } else if (row1[x] < -too_big) {
-          double impact = scaler2 * (-row1[x] - too_big);
-          row_diffs[x] += impact;
-        }
-      } else {
-        if (row1[x] < too_small) {
-          double impact = scaler2 * (too_small - row1[x]);
-          row_diffs[x] += impact;
-        } else if (row1[x] > too_big) {
-          double impact = scaler2 * (row1[x] - too_big);
-          row_diffs[x] -= impact;
+  const auto compute_diffs = [&](const size_t y_begin,
+                                 const size_t y_end) -> Status {
+    for (size_t y = y_begin; y < y_end; ++y) {
+      const float* HWY_RESTRICT row0 = lum0.ConstRow(y);
+      const float* HWY_RESTRICT row1 = lum1.ConstRow(y);
+      float* HWY_RESTRICT row_diffs = diffs->Row(y);
+      for (size_t x = 0; x < xsize_; ++x) {
+        const float absval = 0.5f * (std::abs(row0[x]) + std::abs(row1[x]));
+        const float diff = row0[x] - row1[x];
+        const float scaler = norm2_0gt1 / (static_cast<float>(norm1) + absval);
+
+        // Primary symmetric quadratic objective.
+        row_diffs[x] = scaler * diff;
+
+        const float scaler2 = norm2_0lt1 / (static_cast<float>(norm1) + absval);
+        const double fabs0 = std::fabs(row0[x]);
+
+        // Secondary half-open quadratic objectives.
+        const double too_small = 0.55 * fabs0;
+        const double too_big = 1.05 * fabs0;
+
+        if (row0[x] < 0) {
+          if (row1[x] > -too_small) {
+            double impact = scaler2 * (row1[x] + too_small);
+            row_diffs[x] -= impact;
+          } else if (row1[x] < -too_big) {
+            double impact = scaler2 * (-row1[x] - too_big);
+            row_diffs[x] += impact;
+          }
+        } else {
+          if (row1[x] < too_small) {
+            double impact = scaler2 * (too_small - row1[x]);
+            row_diffs[x] += impact;
+          } else if (row1[x] > too_big) {
+            double impact = scaler2 * (row1[x] - too_big);
+            row_diffs[x] -= impact;
+          }
         }
       }
     }
-  }
-
-  size_t y0 = 0;
-  // Top
-  for (; y0 < 4; ++y0) {
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
-    for (size_t x0 = 0; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-  }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(
+      RunOnRowStripes(pool, ysize_, compute_diffs, "MaltaDiffMap diffs"));
 
   const HWY_FULL(float) df;
   const size_t aligned_x = std::max(static_cast<size_t>(4), Lanes(df));
   const ptrdiff_t stride = diffs->PixelsPerRow();
 
-  // Middle
-  for (; y0 < ysize_ - 4; ++y0) {
-    const float* BUTTERAUGLI_RESTRICT row_in = diffs->ConstRow(y0);
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
-    size_t x0 = 0;
-    for (; x0 < aligned_x; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-    for (; x0 + Lanes(df) + 4 <= xsize_; x0 += Lanes(df)) {
-      auto diff = Load(df, row_diff + x0);
-      diff = Add(diff, MaltaUnit(Tag(), df, row_in + x0, stride));
-      Store(diff, df, row_diff + x0);
-    }
-
-    for (; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-  }
+  const auto accumulate_malta = [&](const size_t y_begin,
+                                    const size_t y_end) -> Status {
+    for (size_t y0 = y_begin; y0 < y_end; ++y0) {
+      float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
+      if (y0 < 4 || y0 >= ysize_ - 4) {
+        // Top and bottom.
+        for (size_t x0 = 0; x0 < xsize_; ++x0) {
+          row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+        }
+        continue;
+      }
+      // Middle.
+      const float* BUTTERAUGLI_RESTRICT row_in = diffs->ConstRow(y0);
+      size_t x0 = 0;
+      for (; x0 < aligned_x; ++x0) {
+        row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+      }
+      for (; x0 + Lanes(df) + 4 <= xsize_; x0 += Lanes(df)) {
+        auto diff = Load(df, row_diff + x0);
+        diff = Add(diff, MaltaUnit(Tag(), df, row_in + x0, stride));
+        Store(diff, df, row_diff + x0);
+      }
 
-  // Bottom
-  for (; y0 < ysize_; ++y0) {
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
-    for (size_t x0 = 0; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+      for (; x0 < xsize_; ++x0) {
+        row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+      }
     }
-  }
-  return true;
+    return true;
+  };
+  return RunOnRowStripes(pool, ysize_, accumulate_malta, "MaltaDiffMap");
 }
 
 // Need non-template wrapper functions for HWY_EXPORT.
 Status MaltaDiffMap(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
                     const double w_0lt1, const double norm1,
                     ImageF* HWY_RESTRICT diffs,
-                    ImageF* HWY_RESTRICT block_diff_ac) {
+                    ImageF* HWY_RESTRICT block_diff_ac, ThreadPool* pool) {
   const double len = 3.75;
   static const double mulli = 0.39905817637;
   JXL_RETURN_IF_ERROR(MaltaDiffMapT(MaltaTag(), lum0, lum1, w_0gt1, w_0lt1,
-                                    norm1, len, mulli, diffs, block_diff_ac));
+                                    norm1, len, mulli, diffs, block_diff_ac,
+                                    pool));
   return true;
 }
 
 Status MaltaDiffMapLF(const ImageF& lum0, const ImageF& lum1,
                       const double w_0gt1, const double w_0lt1,
                       const double norm1, ImageF* HWY_RESTRICT diffs,
-                      ImageF* HWY_RESTRICT block_diff_ac) {
+                      ImageF* HWY_RESTRICT block_diff_ac, ThreadPool* pool) {
   const double len = 3.75;
   static const double mulli = 0.611612573796;
   JXL_RETURN_IF_ERROR(MaltaDiffMapT(MaltaTagLF(), lum0, lum1, w_0gt1, w_0lt1,
-                                    norm1, len, mulli, diffs, block_diff_ac));
+                                    norm1, len, mulli, diffs, block_diff_ac,
+                                    pool));
   return true;
 }
 
@@ -1170,42 +1213,47 @@ void StoreMin3(const float v, float& min0, float& min1, float& min2) {
 
 // Look for smooth areas near the area of degradation.
 // If the areas area generally smooth, don't do masking.
-void FuzzyErosion(const ImageF& from, ImageF* to) {
+Status FuzzyErosion(const ImageF& from, ImageF* to, ThreadPool* pool) {
   const size_t xsize = from.xsize();
   const size_t ysize = from.ysize();
   static const int kStep = 3;
-  for (size_t y = 0; y < ysize; ++y) {
-    for (size_t x = 0; x < xsize; ++x) {
-      float min0 = from.Row(y)[x];
-      float min1 = 2 * min0;
-      float min2 = min1;
-      if (x >= kStep) {
-        StoreMin3(from.Row(y)[x - kStep], min0, min1, min2);
-        if (y >= kStep) {
-          StoreMin3(from.Row(y - kStep)[x - kStep], min0, min1, min2);
+  const auto erode_rows = [&](const size_t y_begin,
+                              const size_t y_end) -> Status {
+    for (size_t y = y_begin; y < y_end; ++y) {
+      for (size_t x = 0; x < xsize; ++x) {
+        float min0 = from.Row(y)[x];
+        float min1 = 2 * min0;
+        float min2 = min1;
+        if (x >= kStep) {
+          StoreMin3(from.Row(y)[x - kStep], min0, min1, min2);
+          if (y >= kStep) {
+            StoreMin3(from.Row(y - kStep)[x - kStep], min0, min1, min2);
+          }
+          if (y < ysize - kStep) {
+            StoreMin3(from.Row(y + kStep)[x - kStep], min0, min1, min2);
+          }
         }
-        if (y < ysize - kStep) {
-          StoreMin3(from.Row(y + kStep)[x - kStep], min0, min1, min2);
+        if (x < xsize - kStep) {
+          StoreMin3(from.Row(y)[x + kStep], min0, min1, min2);
+          if (y >= kStep) {
+            StoreMin3(from.Row(y - kStep)[x + kStep], min0, min1, min2);
+          }
+          if (y < ysize - kStep) {
+            StoreMin3(from.Row(y + kStep)[x + kStep], min0, min1, min2);
+          }
         }
-      }
-      if (x < xsize - kStep) {
-        StoreMin3(from.Row(y)[x + kStep], min0, min1, min2);
         if (y >= kStep) {
-          StoreMin3(from.Row(y - kStep)[x + kStep], min0, min1, min2);
+          StoreMin3(from.Row(y - kStep)[x], min0, min1, min2);
         }
         if (y < ysize - kStep) {
-          StoreMin3(from.Row(y + kStep)[x + kStep], min0, min1, min2);
+          StoreMin3(from.Row(y + kStep)[x], min0, min1, min2);
         }
+        to->Row(y)[x] = (0.45f * min0 + 0.3f * min1 + 0.25f * min2);
       }
-      if (y >= kStep) {
-        StoreMin3(from.Row(y - kStep)[x], min0, min1, min2);
-      }
-      if (y < ysize - kStep) {
-        StoreMin3(from.Row(y + kStep)[x], min0, min1, min2);
-      }
-      to->Row(y)[x] = (0.45f * min0 + 0.3f * min1 + 0.25f * min2);
     }
-  }
+    return true;
+  };
+  return RunOnRowStripes(pool, ysize, erode_rows, "FuzzyErosion");
 }
 
 // Compute values of local frequency and dc masking based on the activity
@@ -1213,7 +1261,7 @@ void FuzzyErosion(const ImageF& from, ImageF* to) {
 Status Mask(const ImageF& mask0, const ImageF& mask1,
             const ButteraugliParams& params, BlurTemp* blur_temp,
             ImageF* BUTTERAUGLI_RESTRICT mask,
-            ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
+            ImageF* BUTTERAUGLI_RESTRICT diff_ac, ThreadPool* pool) {
   const size_t xsize = mask0.xsize();
   const size_t ysize = mask0.ysize();
   JxlMemoryManager* memory_manager = mask0.memory_manager();
@@ -1231,9 +1279,9 @@ Status Mask(const ImageF& mask0, const ImageF& mask1,
                        ImageF::Create(memory_manager, xsize, ysize));
   DiffPrecompute(mask0, kMul, kBias, &diff0);
   DiffPrecompute(mask1, kMul, kBias, &diff1);
-  JXL_RETURN_IF_ERROR(Blur(diff0, kRadius, params, blur_temp, &blurred0));
-  FuzzyErosion(blurred0, &diff0);
-  JXL_RETURN_IF_ERROR(Blur(diff1, kRadius, params, blur_temp, &blurred1));
+  JXL_RETURN_IF_ERROR(Blur(diff0, kRadius, params, blur_temp, pool, &blurred0));
+  JXL_RETURN_IF_ERROR(FuzzyErosion(blurred0, &diff0, pool));
+  JXL_RETURN_IF_ERROR(Blur(diff1, kRadius, params, blur_temp, pool, &blurred1));
   for (size_t y = 0; y < ysize; ++y) {
     for (size_t x = 0; x < xsize; ++x) {
       mask->Row(y)[x] = diff0.Row(y)[x];
@@ -1252,7 +1300,7 @@ Status MaskPsychoImage(const PsychoImage& pi0, const PsychoImage& pi1,
                        const size_t xsize, const size_t ysize,
                        const ButteraugliParams& params, BlurTemp* blur_temp,
                        ImageF* BUTTERAUGLI_RESTRICT mask,
-                       ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
+                       ImageF* BUTTERAUGLI_RESTRICT diff_ac, ThreadPool* pool) {
   JxlMemoryManager* memory_manager = pi0.hf[0].memory_manager();
   JXL_ASSIGN_OR_RETURN(ImageF mask0,
                        ImageF::Create(memory_manager, xsize, ysize));
@@ -1260,7 +1308,8 @@ Status MaskPsychoImage(const PsychoImage& pi0, const PsychoImage& pi1,
                        ImageF::Create(memory_manager, xsize, ysize));
   CombineChannelsForMasking(&pi0.hf[0], &pi0.uhf[0], &mask0);
   CombineChannelsForMasking(&pi1.hf[0], &pi1.uhf[0], &mask1);
-  JXL_RETURN_IF_ERROR(Mask(mask0, mask1, params, blur_temp, mask, diff_ac));
+  JXL_RETURN_IF_ERROR(
+      Mask(mask0, mask1, params, blur_temp, mask, diff_ac, pool));
   return true;
 }
 
@@ -1290,29 +1339,34 @@ inline float MaskColor(const float color[3], const float mask) {
 Status CombineChannelsToDiffmap(const ImageF& mask,
                                 const Image3F& block_diff_dc,
                                 const Image3F& block_diff_ac, float xmul,
-                                ImageF* result) {
+                                ImageF* result, ThreadPool* pool) {
   JXL_ENSURE(SameSize(mask, *result));
   size_t xsize = mask.xsize();
   size_t ysize = mask.ysize();
-  for (size_t y = 0; y < ysize; ++y) {
-    float* BUTTERAUGLI_RESTRICT row_out = result->Row(y);
-    for (size_t x = 0; x < xsize; ++x) {
-      float val = mask.Row(y)[x];
-      float maskval = MaskY(val);
-      float dc_maskval = MaskDcY(val);
-      float diff_dc[3];
-      float diff_ac[3];
-      for (int i = 0; i < 3; ++i) {
-        diff_dc[i] = block_diff_dc.PlaneRow(i, y)[x];
-        diff_ac[i] = block_diff_ac.PlaneRow(i, y)[x];
+  const auto combine_rows = [&](const size_t y_begin,
+                                const size_t y_end) -> Status {
+    for (size_t y = y_begin; y < y_end; ++y) {
+      float* BUTTERAUGLI_RESTRICT row_out = result->Row(y);
+      for (size_t x = 0; x < xsize; ++x) {
+        float val = mask.Row(y)[x];
+        float maskval = MaskY(val);
+        float dc_maskval = MaskDcY(val);
+        float diff_dc[3];
+        float diff_ac[3];
+        for (int i = 0; i < 3; ++i) {
+          diff_dc[i] = block_diff_dc.PlaneRow(i, y)[x];
+          diff_ac[i] = block_diff_ac.PlaneRow(i, y)[x];
+        }
+        diff_ac[0] *= xmul;
+        diff_dc[0] *= xmul;
+        row_out[x] = std::sqrt(MaskColor(diff_dc, dc_maskval) +
+                               MaskColor(diff_ac, maskval));
       }
-      diff_ac[0] *= xmul;
-      diff_dc[0] *= xmul;
-      row_out[x] = std::sqrt(MaskColor(diff_dc, dc_maskval) +
-                             MaskColor(diff_ac, maskval));
     }
-  }
-  return true;
+    return true;
+  };
+  return RunOnRowStripes(pool, ysize, combine_rows,
+                         "CombineChannelsToDiffmap");
 }
 
 // Adds weighted L2 difference between i0 and i1 to diffmap.
@@ -1465,77 +1519,83 @@ BUTTERAUGLI_INLINE void OpsinAbsorbance(const DF df, const V& in0, const V& in1,
 
 // `blurred` is a temporary image used inside this function and not returned.
 Status OpsinDynamicsImage(const Image3F& rgb, const ButteraugliParams& params,
-                          Image3F* blurred, BlurTemp* blur_temp, Image3F* xyb) {
+                          Image3F* blurred, BlurTemp* blur_temp, Image3F* xyb,
+                          ThreadPool* pool) {
   JXL_ENSURE(blurred != nullptr);
   const double kSigma = 1.2;
   JXL_RETURN_IF_ERROR(
-      Blur(rgb.Plane(0), kSigma, params, blur_temp, &blurred->Plane(0)));
+      Blur(rgb.Plane(0), kSigma, params, blur_temp, pool, &blurred->Plane(0)));
   JXL_RETURN_IF_ERROR(
-      Blur(rgb.Plane(1), kSigma, params, blur_temp, &blurred->Plane(1)));
+      Blur(rgb.Plane(1), kSigma, params, blur_temp, pool, &blurred->Plane(1)));
   JXL_RETURN_IF_ERROR(
-      Blur(rgb.Plane(2), kSigma, params, blur_temp, &blurred->Plane(2)));
+      Blur(rgb.Plane(2), kSigma, params, blur_temp, pool, &blurred->Plane(2)));
   const HWY_FULL(float) df;
-  const auto intensity_target_multiplier = Set(df, params.intensity_target);
-  for (size_t y = 0; y < rgb.ysize(); ++y) {
-    const float* row_r = rgb.ConstPlaneRow(0, y);
-    const float* row_g = rgb.ConstPlaneRow(1, y);
-    const float* row_b = rgb.ConstPlaneRow(2, y);
-    const float* row_blurred_r = blurred->ConstPlaneRow(0, y);
-    const float* row_blurred_g = blurred->ConstPlaneRow(1, y);
-    const float* row_blurred_b = blurred->ConstPlaneRow(2, y);
-    float* row_out_x = xyb->PlaneRow(0, y);
-    float* row_out_y = xyb->PlaneRow(1, y);
-    float* row_out_b = xyb->PlaneRow(2, y);
-    const auto min = Set(df, 1e-4f);
-    for (size_t x = 0; x < rgb.xsize(); x += Lanes(df)) {
-      auto sensitivity0 = Undefined(df);
-      auto sensitivity1 = Undefined(df);
-      auto sensitivity2 = Undefined(df);
-      {
-        // Calculate sensitivity based on the smoothed image gamma derivative.
-        auto pre_mixed0 = Undefined(df);
-        auto pre_mixed1 = Undefined(df);
-        auto pre_mixed2 = Undefined(df);
-        OpsinAbsorbance<true>(
-            df, Mul(Load(df, row_blurred_r + x), intensity_target_multiplier),
-            Mul(Load(df, row_blurred_g + x), intensity_target_multiplier),
-            Mul(Load(df, row_blurred_b + x), intensity_target_multiplier),
-            &pre_mixed0, &pre_mixed1, &pre_mixed2);
-        pre_mixed0 = Max(pre_mixed0, min);
-        pre_mixed1 = Max(pre_mixed1, min);
-        pre_mixed2 = Max(pre_mixed2, min);
-        sensitivity0 = Div(Gamma(df, pre_mixed0), pre_mixed0);
-        sensitivity1 = Div(Gamma(df, pre_mixed1), pre_mixed1);
-        sensitivity2 = Div(Gamma(df, pre_mixed2), pre_mixed2);
-        sensitivity0 = Max(sensitivity0, min);
-        sensitivity1 = Max(sensitivity1, min);
-        sensitivity2 = Max(sensitivity2, min);
+  const auto opsin_rows = [&](const size_t y_begin,
+                              const size_t y_end) -> Status {
+    const auto intensity_target_multiplier = Set(df, params.intensity_target);
+    for (size_t y = y_begin; y < y_end; ++y) {
+      const float* row_r = rgb.ConstPlaneRow(0, y);
+      const float* row_g = rgb.ConstPlaneRow(1, y);
+      const float* row_b = rgb.ConstPlaneRow(2, y);
+      const float* row_blurred_r = blurred->ConstPlaneRow(0, y);
+      const float* row_blurred_g = blurred->ConstPlaneRow(1, y);
+      const float* row_blurred_b = blurred->ConstPlaneRow(2, y);
+      float* row_out_x = xyb->PlaneRow(0, y);
+      float* row_out_y = xyb->PlaneRow(1, y);
+      float* row_out_b = xyb->PlaneRow(2, y);
+      const auto min = Set(df, 1e-4f);
+      for (size_t x = 0; x < rgb.xsize(); x += Lanes(df)) {
+        auto sensitivity0 = Undefined(df);
+        auto sensitivity1 = Undefined(df);
+        auto sensitivity2 = Undefined(df);
+        {
+          // Calculate sensitivity based on the smoothed image gamma derivative.
+          auto pre_mixed0 = Undefined(df);
+          auto pre_mixed1 = Undefined(df);
+          auto pre_mixed2 = Undefined(df);
+          OpsinAbsorbance<true>(
+              df, Mul(Load(df, row_blurred_r + x), intensity_target_multiplier),
+              Mul(Load(df, row_blurred_g + x), intensity_target_multiplier),
+              Mul(Load(df, row_blurred_b + x), intensity_target_multiplier),
+              &pre_mixed0, &pre_mixed1, &pre_mixed2);
+          pre_mixed0 = Max(pre_mixed0, min);
+          pre_mixed1 = Max(pre_mixed1, min);
+          pre_mixed2 = Max(pre_mixed2, min);
+          sensitivity0 = Div(Gamma(df, pre_mixed0), pre_mixed0);
+          sensitivity1 = Div(Gamma(df, pre_mixed1), pre_mixed1);
+          sensitivity2 = Div(Gamma(df, pre_mixed2), pre_mixed2);
+          sensitivity0 = Max(sensitivity0, min);
+          sensitivity1 = Max(sensitivity1, min);
+          sensitivity2 = Max(sensitivity2, min);
+        }
+        auto cur_mixed0 = Undefined(df);
+        auto cur_mixed1 = Undefined(df);
+        auto cur_mixed2 = Undefined(df);
+        OpsinAbsorbance<false>(
+            df, Mul(Load(df, row_r + x), intensity_target_multiplier),
+            Mul(Load(df, row_g + x), intensity_target_multiplier),
+            Mul(Load(df, row_b + x), intensity_target_multiplier), &cur_mixed0,
+            &cur_mixed1, &cur_mixed2);
+        cur_mixed0 = Mul(cur_mixed0, sensitivity0);
+        cur_mixed1 = Mul(cur_mixed1, sensitivity1);
+        cur_mixed2 = Mul(cur_mixed2, sensitivity2);
+        // This is a kludge. The negative values should be zeroed away before
+        // blurring. Ideally there would be no negative values in the first
+        // place.
+        const auto min01 = Set(df, 1.7557483643287353f);
+        const auto min2 = Set(df, 12.226454707163354f);
+        cur_mixed0 = Max(cur_mixed0, min01);
+        cur_mixed1 = Max(cur_mixed1, min01);
+        cur_mixed2 = Max(cur_mixed2, min2);
+
+        Store(Sub(cur_mixed0, cur_mixed1), df, row_out_x + x);
+        Store(Add(cur_mixed0, cur_mixed1), df, row_out_y + x);
+        Store(cur_mixed2, df, row_out_b + x);
       }
-      auto cur_mixed0 = Undefined(df);
-      auto cur_mixed1 = Undefined(df);
-      auto cur_mixed2 = Undefined(df);
-      OpsinAbsorbance<false>(
-          df, Mul(Load(df, row_r + x), intensity_target_multiplier),
-          Mul(Load(df, row_g + x), intensity_target_multiplier),
-          Mul(Load(df, row_b + x), intensity_target_multiplier), &cur_mixed0,
-          &cur_mixed1, &cur_mixed2);
-      cur_mixed0 = Mul(cur_mixed0, sensitivity0);
-      cur_mixed1 = Mul(cur_mixed1, sensitivity1);
-      cur_mixed2 = Mul(cur_mixed2, sensitivity2);
-      // This is a kludge. The negative values should be zeroed away before
-      // blurring. Ideally there would be no negative values in the first place.
-      const auto min01 = Set(df, 1.7557483643287353f);
-      const auto min2 = Set(df, 12.226454707163354f);
-      cur_mixed0 = Max(cur_mixed0, min01);
-      cur_mixed1 = Max(cur_mixed1, min01);
-      cur_mixed2 = Max(cur_mixed2, min2);
-
-      Store(Sub(cur_mixed0, cur_mixed1), df, row_out_x + x);
-      Store(Add(cur_mixed0, cur_mixed1), df, row_out_y + x);
-      Store(cur_mixed2, df, row_out_b + x);
     }
-  }
-  return true;
+    return true;
+  };
+  return RunOnRowStripes(pool, rgb.ysize(), opsin_rows, "OpsinDynamicsImage");
 }
 
 Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
@@ -1550,10 +1610,10 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     // Convert image0 and image1 to XYB in-place
     JXL_ASSIGN_OR_RETURN(Image3F temp,
                          Image3F::Create(memory_manager, xsize, ysize));
-    JXL_RETURN_IF_ERROR(
-        OpsinDynamicsImage(image0, params, &temp, &blur_temp, &image0));
-    JXL_RETURN_IF_ERROR(
-        OpsinDynamicsImage(image1, params, &temp, &blur_temp, &image1));
+    JXL_RETURN_IF_ERROR(OpsinDynamicsImage(image0, params, &temp, &blur_temp,
+                                           &image0, /*pool=*/nullptr));
+    JXL_RETURN_IF_ERROR(OpsinDynamicsImage(image1, params, &temp, &blur_temp,
+                                           &image1, /*pool=*/nullptr));
   }
   // image0 and image1 are in XYB color space
   JXL_ASSIGN_OR_RETURN(ImageF block_diff_dc,
@@ -1566,10 +1626,10 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
                          Image3F::Create(memory_manager, xsize, ysize));
     JXL_ASSIGN_OR_RETURN(Image3F lf1,
                          Image3F::Create(memory_manager, xsize, ysize));
-    JXL_RETURN_IF_ERROR(
-        SeparateLFAndMF(params, image0, &lf0, &image0, &blur_temp));
-    JXL_RETURN_IF_ERROR(
-        SeparateLFAndMF(params, image1, &lf1, &image1, &blur_temp));
+    JXL_RETURN_IF_ERROR(SeparateLFAndMF(params, image0, &lf0, &image0,
+                                        &blur_temp, /*pool=*/nullptr));
+    JXL_RETURN_IF_ERROR(SeparateLFAndMF(params, image1, &lf1, &image1,
+                                        &blur_temp, /*pool=*/nullptr));
     for (size_t c = 0; c < 3; ++c) {
       L2Diff(lf0.Plane(c), lf1.Plane(c), wmul[6 + c], &block_diff_dc);
     }
@@ -1577,8 +1637,10 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
   // image0 and image1 are MF residuals (before blurring) in XYB color space
   ImageF hf0[2];
   ImageF hf1[2];
-  JXL_RETURN_IF_ERROR(SeparateMFAndHF(params, &image0, &hf0[0], &blur_temp));
-  JXL_RETURN_IF_ERROR(SeparateMFAndHF(params, &image1, &hf1[0], &blur_temp));
+  JXL_RETURN_IF_ERROR(SeparateMFAndHF(params, &image0, &hf0[0], &blur_temp,
+                                      /*pool=*/nullptr));
+  JXL_RETURN_IF_ERROR(SeparateMFAndHF(params, &image1, &hf1[0], &blur_temp,
+                                      /*pool=*/nullptr));
   // image0 and image1 are MF-images in XYB color space
 
   JXL_ASSIGN_OR_RETURN(ImageF block_diff_ac,
@@ -1590,10 +1652,10 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
                          ImageF::Create(memory_manager, xsize, ysize));
     JXL_RETURN_IF_ERROR(MaltaDiffMapLF(image0.Plane(1), image1.Plane(1),
                                        wMfMalta, wMfMalta, norm1Mf, &diffs,
-                                       &block_diff_ac));
+                                       &block_diff_ac, /*pool=*/nullptr));
     JXL_RETURN_IF_ERROR(MaltaDiffMapLF(image0.Plane(0), image1.Plane(0),
                                        wMfMaltaX, wMfMaltaX, norm1MfX, &diffs,
-                                       &block_diff_ac));
+                                       &block_diff_ac, /*pool=*/nullptr));
   }
   for (size_t c = 0; c < 3; ++c) {
     L2Diff(image0.Plane(c), image1.Plane(c), wmul[3 + c], &block_diff_ac);
@@ -1605,8 +1667,10 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
 
   ImageF uhf0[2];
   ImageF uhf1[2];
-  JXL_RETURN_IF_ERROR(SeparateHFAndUHF(params, &hf0[0], &uhf0[0], &blur_temp));
-  JXL_RETURN_IF_ERROR(SeparateHFAndUHF(params, &hf1[0], &uhf1[0], &blur_temp));
+  JXL_RETURN_IF_ERROR(SeparateHFAndUHF(params, &hf0[0], &uhf0[0], &blur_temp,
+                                       /*pool=*/nullptr));
+  JXL_RETURN_IF_ERROR(SeparateHFAndUHF(params, &hf1[0], &uhf1[0], &blur_temp,
+                                       /*pool=*/nullptr));
 
   // continue accumulating ac diff image from HF and UHF images
   const float hf_asymmetry = params.hf_asymmetry;
@@ -1615,16 +1679,18 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
                          ImageF::Create(memory_manager, xsize, ysize));
     JXL_RETURN_IF_ERROR(MaltaDiffMap(uhf0[1], uhf1[1], wUhfMalta * hf_asymmetry,
                                      wUhfMalta / hf_asymmetry, norm1Uhf, &diffs,
-                                     &block_diff_ac));
+                                     &block_diff_ac, /*pool=*/nullptr));
     JXL_RETURN_IF_ERROR(MaltaDiffMap(
         uhf0[0], uhf1[0], wUhfMaltaX * hf_asymmetry, wUhfMaltaX / hf_asymmetry,
-        norm1UhfX, &diffs, &block_diff_ac));
+        norm1UhfX, &diffs, &block_diff_ac, /*pool=*/nullptr));
     JXL_RETURN_IF_ERROR(MaltaDiffMapLF(
         hf0[1], hf1[1], wHfMalta * std::sqrt(hf_asymmetry),
-        wHfMalta / std::sqrt(hf_asymmetry), norm1Hf, &diffs, &block_diff_ac));
+        wHfMalta / std::sqrt(hf_asymmetry), norm1Hf, &diffs, &block_diff_ac,
+        /*pool=*/nullptr));
     JXL_RETURN_IF_ERROR(MaltaDiffMapLF(
         hf0[0], hf1[0], wHfMaltaX * std::sqrt(hf_asymmetry),
-        wHfMaltaX / std::sqrt(hf_asymmetry), norm1HfX, &diffs, &block_diff_ac));
+        wHfMaltaX / std::sqrt(hf_asymmetry), norm1HfX, &diffs, &block_diff_ac,
+        /*pool=*/nullptr));
   }
   for (size_t c = 0; c < 2; ++c) {
     L2DiffAsymmetric(hf0[c], hf1[c], wmul[c] * hf_asymmetry,
@@ -1643,8 +1709,8 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     CombineChannelsForMasking(&hf1[0], &uhf1[0], &mask1);
     DeallocateHFAndUHF(&hf1[0], &uhf1[0]);
     DeallocateHFAndUHF(&hf0[0], &uhf0[0]);
-    JXL_RETURN_IF_ERROR(
-        Mask(mask0, mask1, params, &blur_temp, &mask, &block_diff_ac));
+    JXL_RETURN_IF_ERROR(Mask(mask0, mask1, params, &blur_temp, &mask,
+                             &block_diff_ac, /*pool=*/nullptr));
   }
 
   // compute final diffmap from mask image and ac and dc diff images
@@ -1785,17 +1851,18 @@ Image3F* ButteraugliComparator::Temp() const {
 void ButteraugliComparator::ReleaseTemp() const { temp_in_use_.clear(); }
 
 ButteraugliComparator::ButteraugliComparator(size_t xsize, size_t ysize,
-                                             const ButteraugliParams& params)
-    : xsize_(xsize), ysize_(ysize), params_(params) {}
+                                             const ButteraugliParams& params,
+                                             ThreadPool* pool)
+    : xsize_(xsize), ysize_(ysize), params_(params), pool_(pool) {}
 
 StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
-    const Image3F& rgb0, const ButteraugliParams& params) {
+    const Image3F& rgb0, const ButteraugliParams& params, ThreadPool* pool) {
   size_t xsize = rgb0.xsize();
   size_t ysize = rgb0.ysize();
   JxlMemoryManager* memory_manager = rgb0.memory_manager();
   std::unique_ptr<ButteraugliComparator> result =
       std::unique_ptr<ButteraugliComparator>(
-          new ButteraugliComparator(xsize, ysize, params));
+          new ButteraugliComparator(xsize, ysize, params, pool));
   JXL_ASSIGN_OR_RETURN(result->temp_,
                        Image3F::Create(memory_manager, xsize, ysize));
 
@@ -1806,23 +1873,56 @@ StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
   JXL_ASSIGN_OR_RETURN(Image3F xyb0,
                        Image3F::Create(memory_manager, xsize, ysize));
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-      rgb0, params, result->Temp(), &result->blur_temp_, &xyb0));
+      rgb0, params, result->Temp(), &result->blur_temp_, &xyb0, pool));
   result->ReleaseTemp();
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(SeparateFrequencies)(
-      xsize, ysize, params, &result->blur_temp_, xyb0, result->pi0_));
+      xsize, ysize, params, &result->blur_temp_, xyb0, result->pi0_, pool));
 
   // Awful recursive construction of samples of different resolution.
   // This is an after-thought and possibly somewhat parallel in
   // functionality with the PsychoImage multi-resolution approach.
   JXL_ASSIGN_OR_RETURN(Image3F subsampledRgb0, SubSample2x(rgb0));
-  JXL_ASSIGN_OR_RETURN(result->sub_,
-                       ButteraugliComparator::Make(subsampledRgb0, params));
+  JXL_ASSIGN_OR_RETURN(result->sub_, ButteraugliComparator::Make(
+                                         subsampledRgb0, params, pool));
+  return result;
+}
+
+StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Crop(
+    const Rect& rect) const {
+  JxlMemoryManager* memory_manager = temp_.memory_manager();
+  std::unique_ptr<ButteraugliComparator> result =
+      std::unique_ptr<ButteraugliComparator>(new ButteraugliComparator(
+          rect.xsize(), rect.ysize(), params_, pool_));
+  JXL_ASSIGN_OR_RETURN(
+      result->temp_,
+      Image3F::Create(memory_manager, rect.xsize(), rect.ysize()));
+  if (rect.xsize() < 8 || rect.ysize() < 8) {
+    return result;
+  }
+  PsychoImage& pi0 = result->pi0_;
+  for (size_t i = 0; i < 2; ++i) {
+    JXL_ASSIGN_OR_RETURN(
+        pi0.uhf[i], ImageF::Create(memory_manager, rect.xsize(), rect.ysize()));
+    JXL_RETURN_IF_ERROR(
+        CopyImageTo(rect, pi0_.uhf[i], Rect(pi0.uhf[i]), &pi0.uhf[i]));
+    JXL_ASSIGN_OR_RETURN(
+        pi0.hf[i], ImageF::Create(memory_manager, rect.xsize(), rect.ysize()));
+    JXL_RETURN_IF_ERROR(
+        CopyImageTo(rect, pi0_.hf[i], Rect(pi0.hf[i]), &pi0.hf[i]));
+  }
+  JXL_ASSIGN_OR_RETURN(
+      pi0.mf, Image3F::Create(memory_manager, rect.xsize(), rect.ysize()));
+  JXL_RETURN_IF_ERROR(CopyImageTo(rect, pi0_.mf, Rect(pi0.mf), &pi0.mf));
+  JXL_ASSIGN_OR_RETURN(
+      pi0.lf, Image3F::Create(memory_manager, rect.xsize(), rect.ysize()));
+  JXL_RETURN_IF_ERROR(CopyImageTo(rect, pi0_.lf, Rect(pi0.lf), &pi0.lf));
   return result;
 }
 
 Status ButteraugliComparator::Mask(ImageF* BUTTERAUGLI_RESTRICT mask) const {
-  return HWY_DYNAMIC_DISPATCH(MaskPsychoImage)(
-      pi0_, pi0_, xsize_, ysize_, params_, &blur_temp_, mask, nullptr);
+  return HWY_DYNAMIC_DISPATCH(MaskPsychoImage)(pi0_, pi0_, xsize_, ysize_,
+                                               params_, &blur_temp_, mask,
+                                               nullptr, pool_);
 }
 
 Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
@@ -1835,7 +1935,7 @@ Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
   JXL_ASSIGN_OR_RETURN(Image3F xyb1,
                        Image3F::Create(memory_manager, xsize_, ysize_));
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-      rgb1, params_, Temp(), &blur_temp_, &xyb1));
+      rgb1, params_, Temp(), &blur_temp_, &xyb1, pool_));
   ReleaseTemp();
   JXL_RETURN_IF_ERROR(DiffmapOpsinDynamicsImage(xyb1, result));
   if (sub_) {
@@ -1847,7 +1947,8 @@ Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
         Image3F::Create(memory_manager, sub_->xsize_, sub_->ysize_));
     JXL_ASSIGN_OR_RETURN(Image3F subsampledRgb1, SubSample2x(rgb1));
     JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-        subsampledRgb1, params_, sub_->Temp(), &sub_->blur_temp_, &sub_xyb));
+        subsampledRgb1, params_, sub_->Temp(), &sub_->blur_temp_, &sub_xyb,
+        sub_->pool_));
     sub_->ReleaseTemp();
     ImageF subresult;
     JXL_RETURN_IF_ERROR(sub_->DiffmapOpsinDynamicsImage(sub_xyb, subresult));
@@ -1856,6 +1957,46 @@ Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
   return true;
 }
 
+Status ButteraugliComparator::DiffmapRect(const Image3F& rgb1, const Rect& rect,
+                                          ImageF& diffmap) const {
+  JxlMemoryManager* memory_manager = rgb1.memory_manager();
+  const Rect image_rect(0, 0, xsize_, ysize_);
+  JXL_ENSURE(SameSize(rgb1, diffmap));
+  JXL_ENSURE(rgb1.xsize() == xsize_ && rgb1.ysize() == ysize_);
+  JXL_ENSURE(rect.IsInside(image_rect));
+  // Start the crop at even coordinates and give it an even size unless it
+  // reaches the image border, so that its 2x subsampled version is exactly a
+  // crop of the subsampled image.
+  const Rect extended = rect.Extend(kDiffmapRadius, image_rect);
+  const size_t x0 = extended.x0() & ~size_t{1};
+  const size_t y0 = extended.y0() & ~size_t{1};
+  const size_t x1 = std::min(xsize_, RoundUpTo(extended.x1(), 2));
+  const size_t y1 = std::min(ysize_, RoundUpTo(extended.y1(), 2));
+  const Rect crop_rect(x0, y0, x1 - x0, y1 - y0);
+  if (crop_rect.xsize() == xsize_ && crop_rect.ysize() == ysize_) {
+    JXL_ASSIGN_OR_RETURN(ImageF full,
+                         ImageF::Create(memory_manager, xsize_, ysize_));
+    JXL_RETURN_IF_ERROR(Diffmap(rgb1, full));
+    return CopyImageTo(rect, full, rect, &diffmap);
+  }
+
+  JXL_ASSIGN_OR_RETURN(std::unique_ptr<ButteraugliComparator> crop,
+                       Crop(crop_rect));
+  if (sub_) {
+    JXL_ASSIGN_OR_RETURN(crop->sub_, sub_->Crop(crop_rect.ShiftRight(1)));
+  }
+  JXL_ASSIGN_OR_RETURN(
+      Image3F crop_rgb1,
+      Image3F::Create(memory_manager, crop_rect.xsize(), crop_rect.ysize()));
+  JXL_RETURN_IF_ERROR(
+      CopyImageTo(crop_rect, rgb1, Rect(crop_rgb1), &crop_rgb1));
+  ImageF crop_diffmap;
+  JXL_RETURN_IF_ERROR(crop->Diffmap(crop_rgb1, crop_diffmap));
+  const Rect rect_in_crop(rect.x0() - x0, rect.y0() - y0, rect.xsize(),
+                          rect.ysize());
+  return CopyImageTo(rect_in_crop, crop_diffmap, rect, &diffmap);
+}
+
 Status ButteraugliComparator::DiffmapOpsinDynamicsImage(const Image3F& xyb1,
                                                         ImageF& result) const {
   JxlMemoryManager* memory_manager = xyb1.memory_manager();
@@ -1865,7 +2006,7 @@ Status ButteraugliComparator::DiffmapOpsinDynamicsImage(const Image3F& xyb1,
   }
   PsychoImage pi1;
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(SeparateFrequencies)(
-      xsize_, ysize_, params_, &blur_temp_, xyb1, pi1));
+      xsize_, ysize_, params_, &blur_temp_, xyb1, pi1, pool_));
   JXL_ASSIGN_OR_RETURN(result, ImageF::Create(memory_manager, xsize_, ysize_));
   return DiffmapPsychoImage(pi1, result);
 }
@@ -1875,17 +2016,21 @@ namespace {
 Status MaltaDiffMap(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
                     const double w_0lt1, const double norm1,
                     ImageF* HWY_RESTRICT diffs,
-                    Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
+                    Image3F* HWY_RESTRICT block_diff_ac, size_t c,
+                    ThreadPool* pool) {
   return HWY_DYNAMIC_DISPATCH(MaltaDiffMap)(lum0, lum1, w_0gt1, w_0lt1, norm1,
-                                            diffs, &block_diff_ac->Plane(c));
+                                            diffs, &block_diff_ac->Plane(c),
+                                            pool);
 }
 
 Status MaltaDiffMapLF(const ImageF& lum0, const ImageF& lum1,
                       const double w_0gt1, const double w_0lt1,
                       const double norm1, ImageF* HWY_RESTRICT diffs,
-                      Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
+                      Image3F* HWY_RESTRICT block_diff_ac, size_t c,
+                      ThreadPool* pool) {
   return HWY_DYNAMIC_DISPATCH(MaltaDiffMapLF)(lum0, lum1, w_0gt1, w_0lt1, norm1,
-                                              diffs, &block_diff_ac->Plane(c));
+                                              diffs, &block_diff_ac->Plane(c),
+                                              pool);
 }
 
 }  // namespace
@@ -1908,23 +2053,25 @@ Status ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
   ZeroFillImage(&block_diff_ac);
   JXL_RETURN_IF_ERROR(MaltaDiffMap(
       pi0_.uhf[1], pi1.uhf[1], wUhfMalta * hf_asymmetry_,
-      wUhfMalta / hf_asymmetry_, norm1Uhf, &diffs, &block_diff_ac, 1));
+      wUhfMalta / hf_asymmetry_, norm1Uhf, &diffs, &block_diff_ac, 1, pool_));
   JXL_RETURN_IF_ERROR(MaltaDiffMap(
       pi0_.uhf[0], pi1.uhf[0], wUhfMaltaX * hf_asymmetry_,
-      wUhfMaltaX / hf_asymmetry_, norm1UhfX, &diffs, &block_diff_ac, 0));
+      wUhfMaltaX / hf_asymmetry_, norm1UhfX, &diffs, &block_diff_ac, 0, pool_));
   JXL_RETURN_IF_ERROR(MaltaDiffMapLF(
       pi0_.hf[1], pi1.hf[1], wHfMalta * std::sqrt(hf_asymmetry_),
-      wHfMalta / std::sqrt(hf_asymmetry_), norm1Hf, &diffs, &block_diff_ac, 1));
+      wHfMalta / std::sqrt(hf_asymmetry_), norm1Hf, &diffs, &block_diff_ac, 1,
+      pool_));
   JXL_RETURN_IF_ERROR(MaltaDiffMapLF(pi0_.hf[0], pi1.hf[0],
                                      wHfMaltaX * std::sqrt(hf_asymmetry_),
                                      wHfMaltaX / std::sqrt(hf_asymmetry_),
-                                     norm1HfX, &diffs, &block_diff_ac, 0));
+                                     norm1HfX, &diffs, &block_diff_ac, 0,
+                                     pool_));
   JXL_RETURN_IF_ERROR(MaltaDiffMapLF(pi0_.mf.Plane(1), pi1.mf.Plane(1),
                                      wMfMalta, wMfMalta, norm1Mf, &diffs,
-                                     &block_diff_ac, 1));
+                                     &block_diff_ac, 1, pool_));
   JXL_RETURN_IF_ERROR(MaltaDiffMapLF(pi0_.mf.Plane(0), pi1.mf.Plane(0),
                                      wMfMaltaX, wMfMaltaX, norm1MfX, &diffs,
-                                     &block_diff_ac, 0));
+                                     &block_diff_ac, 0, pool_));
 
   JXL_ASSIGN_OR_RETURN(Image3F block_diff_dc,
                        Image3F::Create(memory_manager, xsize_, ysize_));
@@ -1943,10 +2090,10 @@ Status ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
   ImageF mask;
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(MaskPsychoImage)(
       pi0_, pi1, xsize_, ysize_, params_, &blur_temp_, &mask,
-      &block_diff_ac.Plane(1)));
+      &block_diff_ac.Plane(1), pool_));
 
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(CombineChannelsToDiffmap)(
-      mask, block_diff_dc, block_diff_ac, xmul_, &diffmap));
+      mask, block_diff_dc, block_diff_ac, xmul_, &diffmap, pool_));
   return true;
 }
 
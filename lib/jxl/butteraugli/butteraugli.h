@@ -17,6 +17,8 @@
 #include <memory>
 
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/image.h"
 
@@ -170,13 +172,28 @@ class ButteraugliComparator {
   // improve results at higher Butteraugli values.
   virtual ~ButteraugliComparator() = default;
 
+  // A pixel of the distorted image only affects the diffmap pixels that are
+  // at most this far from it, up to rounding. This is estimated from the sizes
+  // of the blur and Malta kernels at full and half resolution, not measured.
+  static constexpr size_t kDiffmapRadius = 80;
+
+  // If `pool` is not null, the comparisons process stripes of rows in
+  // parallel on it. The result does not depend on the number of threads.
   static StatusOr<std::unique_ptr<ButteraugliComparator>> Make(
-      const Image3F &rgb0, const ButteraugliParams &params);
+      const Image3F &rgb0, const ButteraugliParams &params,
+      ThreadPool *pool = nullptr);
 
   // Computes the butteraugli map between the original image given in the
   // constructor and the distorted image give here.
   Status Diffmap(const Image3F &rgb1, ImageF &result) const;
 
+  // Same as Diffmap(), but only computes the pixels in `rect` and stores them
+  // in the same rect of `diffmap`, which must have the size of the image.
+  // Only reads rgb1 within kDiffmapRadius of `rect`, so this is much cheaper
+  // than Diffmap() for a small rect. Matches Diffmap() up to rounding.
+  Status DiffmapRect(const Image3F &rgb1, const Rect &rect,
+                     ImageF &diffmap) const;
+
   // Same as above, but OpsinDynamicsImage() was already applied.
   Status DiffmapOpsinDynamicsImage(const Image3F &xyb1, ImageF &result) const;
 
@@ -187,13 +204,18 @@ class ButteraugliComparator {
 
  private:
   ButteraugliComparator(size_t xsize, size_t ysize,
-                        const ButteraugliParams &params);
+                        const ButteraugliParams &params, ThreadPool *pool);
+  // Returns a comparator for the crop `rect` of the original image, without
+  // a subsampled comparator.
+  StatusOr<std::unique_ptr<ButteraugliComparator>> Crop(
+      const Rect &rect) const;
   Image3F *Temp() const;
   void ReleaseTemp() const;
 
   const size_t xsize_;
   const size_t ysize_;
   ButteraugliParams params_;
+  ThreadPool *pool_;
   PsychoImage pi0_;
 
   // Shared temporary image storage to reduce the number of allocations;
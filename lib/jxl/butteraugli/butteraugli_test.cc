@@ -9,11 +9,14 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cmath>
 #include <cstdint>
+#include <memory>
 #include <utility>
 
 #include "lib/extras/metrics.h"
 #include "lib/jxl/base/random.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/test_image.h"
@@ -108,5 +111,58 @@ TEST(ButteraugliInPlaceTest, LargeImage) {
   EXPECT_NEAR(distp, distp2, 1e-7);
 }
 
+float MaxAbsDiff(const ImageF& a, const ImageF& b, const Rect& rect) {
+  float max_diff = 0.0f;
+  for (size_t y = rect.y0(); y < rect.y1(); ++y) {
+    for (size_t x = rect.x0(); x < rect.x1(); ++x) {
+      max_diff = std::max(max_diff, std::abs(a.Row(y)[x] - b.Row(y)[x]));
+    }
+  }
+  return max_diff;
+}
+
+TEST(ButteraugliComparatorTest, ThreadsAndRectsMatchDiffmap) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 523;
+  const size_t ysize = 411;
+  TestImage img;
+  ASSERT_TRUE(img.SetDimensions(xsize, ysize));
+  JXL_TEST_ASSIGN_OR_DIE(auto frame, img.AddFrame());
+  frame.RandomFill(777);
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb0, GetColorImage(img.ppf()));
+  JXL_TEST_ASSIGN_OR_DIE(Image3F rgb1,
+                         Image3F::Create(memory_manager, xsize, ysize));
+  ASSERT_TRUE(CopyImageTo(rgb0, &rgb1));
+  AddUniformNoise(&rgb1, 0.02f, 7777);
+  AddEdge(&rgb1, 0.1f, xsize / 2, ysize / 2);
+  ButteraugliParams butteraugli_params;
+
+  JXL_TEST_ASSIGN_OR_DIE(std::unique_ptr<ButteraugliComparator> comparator,
+                         ButteraugliComparator::Make(rgb0, butteraugli_params));
+  JXL_TEST_ASSIGN_OR_DIE(ImageF diffmap,
+                         ImageF::Create(memory_manager, xsize, ysize));
+  ASSERT_TRUE(comparator->Diffmap(rgb1, diffmap));
+
+  test::ThreadPoolForTests pool(4);
+  JXL_TEST_ASSIGN_OR_DIE(
+      std::unique_ptr<ButteraugliComparator> threaded_comparator,
+      ButteraugliComparator::Make(rgb0, butteraugli_params, pool.get()));
+  JXL_TEST_ASSIGN_OR_DIE(ImageF threaded_diffmap,
+                         ImageF::Create(memory_manager, xsize, ysize));
+  ASSERT_TRUE(threaded_comparator->Diffmap(rgb1, threaded_diffmap));
+  EXPECT_EQ(0.0f, MaxAbsDiff(diffmap, threaded_diffmap, Rect(diffmap)));
+
+  // Rects in a corner, at the border and in the interior, with odd
+  // coordinates to exercise the alignment of the subsampled crop.
+  const Rect rects[] = {Rect(0, 0, 37, 29), Rect(xsize - 64, 101, 64, 77),
+                        Rect(203, 171, 65, 63)};
+  JXL_TEST_ASSIGN_OR_DIE(ImageF rect_diffmap,
+                         ImageF::Create(memory_manager, xsize, ysize));
+  for (const Rect& rect : rects) {
+    ASSERT_TRUE(threaded_comparator->DiffmapRect(rgb1, rect, rect_diffmap));
+    EXPECT_LE(MaxAbsDiff(diffmap, rect_diffmap, rect), 1e-4f);
+  }
+}
+
 }  // namespace
 }  // namespace jxl
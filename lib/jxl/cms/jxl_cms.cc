@@ -17,7 +17,11 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jxl/cms/jxl_cms.cc"
@@ -51,12 +55,20 @@ namespace {
 
 using ::jxl::cms::ColorEncoding;
 
-struct JxlCms {
+// The part of a transform that only depends on the input and output
+// profiles. It is immutable once created and shared by all JxlCms instances
+// for the same profiles through the TransformCache.
+struct JxlCmsTransform {
+  JxlCmsTransform() = default;
+  JxlCmsTransform(const JxlCmsTransform&) = delete;
+  JxlCmsTransform& operator=(const JxlCmsTransform&) = delete;
+  ~JxlCmsTransform();
+
 #if JPEGXL_ENABLE_SKCMS
   IccBytes icc_src, icc_dst;
   skcms_ICCProfile profile_src, profile_dst;
 #else
-  void* lcms_transform;
+  void* lcms_transform = nullptr;
 #endif
 
   // These fields are used when the HLG OOTF or inverse OOTF must be applied.
@@ -68,15 +80,20 @@ struct JxlCms {
   size_t channels_src;
   size_t channels_dst;
 
+  bool skip_lcms = false;
+  ExtraTF preprocess = ExtraTF::kNone;
+  ExtraTF postprocess = ExtraTF::kNone;
+};
+
+struct JxlCms {
+  std::shared_ptr<const JxlCmsTransform> xform;
+
   std::vector<float> src_storage;
   std::vector<float*> buf_src;
   std::vector<float> dst_storage;
   std::vector<float*> buf_dst;
 
   float intensity_target;
-  bool skip_lcms = false;
-  ExtraTF preprocess = ExtraTF::kNone;
-  ExtraTF postprocess = ExtraTF::kNone;
 };
 
 Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
@@ -97,7 +114,7 @@ const size_t kX = 0;  // pixel index, multiplied by 3 for RGB
 // xform_src = UndoGammaCompression(buf_src).
 Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
                        size_t buf_size) {
-  switch (t->preprocess) {
+  switch (t->xform->preprocess) {
     case ExtraTF::kNone:
       JXL_ENSURE(false);  // unreachable
       break;
@@ -123,7 +140,7 @@ Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
         xform_src[i] = static_cast<float>(
             TF_HLG_Base::DisplayFromEncoded(static_cast<double>(buf_src[i])));
       }
-      if (t->apply_hlg_ootf) {
+      if (t->xform->apply_hlg_ootf) {
         JXL_RETURN_IF_ERROR(
             ApplyHlgOotf(t, xform_src, buf_size, /*forward=*/true));
       }
@@ -153,7 +170,7 @@ Status BeforeTransform(JxlCms* t, const float* buf_src, float* xform_src,
 
 // Applies gamma compression in-place.
 Status AfterTransform(JxlCms* t, float* JXL_RESTRICT buf_dst, size_t buf_size) {
-  switch (t->postprocess) {
+  switch (t->xform->postprocess) {
     case ExtraTF::kNone:
       JXL_DEBUG_ABORT("Unreachable");
       break;
@@ -172,7 +189,7 @@ Status AfterTransform(JxlCms* t, float* JXL_RESTRICT buf_dst, size_t buf_size) {
       break;
     }
     case ExtraTF::kHLG:
-      if (t->apply_hlg_ootf) {
+      if (t->xform->apply_hlg_ootf) {
         JXL_RETURN_IF_ERROR(
             ApplyHlgOotf(t, buf_dst, buf_size, /*forward=*/false));
       }
@@ -206,17 +223,18 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
                              size_t xsize) {
   // No lock needed.
   JxlCms* t = reinterpret_cast<JxlCms*>(cms_data);
+  const JxlCmsTransform* xform = t->xform.get();
 
   const float* xform_src = buf_src;  // Read-only.
-  if (t->preprocess != ExtraTF::kNone) {
+  if (xform->preprocess != ExtraTF::kNone) {
     float* mutable_xform_src = t->buf_src[thread];  // Writable buffer.
     JXL_RETURN_IF_ERROR(BeforeTransform(t, buf_src, mutable_xform_src,
-                                        xsize * t->channels_src));
+                                        xsize * xform->channels_src));
     xform_src = mutable_xform_src;
   }
 
 #if JPEGXL_ENABLE_SKCMS
-  if (t->channels_src == 1 && !t->skip_lcms) {
+  if (xform->channels_src == 1 && !xform->skip_lcms) {
     // Expand from 1 to 3 channels, starting from the end in case
     // xform_src == t->buf_src[thread].
     float* mutable_xform_src = t->buf_src[thread];
@@ -228,7 +246,7 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
     xform_src = mutable_xform_src;
   }
 #else
-  if (t->channels_src == 4 && !t->skip_lcms) {
+  if (xform->channels_src == 4 && !xform->skip_lcms) {
     // LCMS does CMYK in a weird way: 0 = white, 100 = max ink
     float* mutable_xform_src = t->buf_src[thread];
     for (size_t x = 0; x < xsize * 4; ++x) {
@@ -245,32 +263,33 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
   const float in2 = xform_src[3 * kX + 2];
 #endif
 
-  if (t->skip_lcms) {
+  if (xform->skip_lcms) {
     if (buf_dst != xform_src) {
-      memcpy(buf_dst, xform_src, xsize * t->channels_src * sizeof(*buf_dst));
+      memcpy(buf_dst, xform_src,
+             xsize * xform->channels_src * sizeof(*buf_dst));
     }  // else: in-place, no need to copy
   } else {
 #if JPEGXL_ENABLE_SKCMS
     JXL_ENSURE(
         skcms_Transform(xform_src,
-                        (t->channels_src == 4 ? skcms_PixelFormat_RGBA_ffff
-                                              : skcms_PixelFormat_RGB_fff),
-                        skcms_AlphaFormat_Opaque, &t->profile_src, buf_dst,
+                        (xform->channels_src == 4 ? skcms_PixelFormat_RGBA_ffff
+                                                  : skcms_PixelFormat_RGB_fff),
+                        skcms_AlphaFormat_Opaque, &xform->profile_src, buf_dst,
                         skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Opaque,
-                        &t->profile_dst, xsize));
+                        &xform->profile_dst, xsize));
 #else   // JPEGXL_ENABLE_SKCMS
-    cmsDoTransform(t->lcms_transform, xform_src, buf_dst,
+    cmsDoTransform(xform->lcms_transform, xform_src, buf_dst,
                    static_cast<cmsUInt32Number>(xsize));
 #endif  // JPEGXL_ENABLE_SKCMS
   }
 #if JXL_CMS_VERBOSE >= 2
   printf("xform skip%d: %.4f %.4f %.4f (%p) -> (%p) %.4f %.4f %.4f\n",
-         t->skip_lcms, in0, in1, in2, xform_src, buf_dst, buf_dst[3 * kX],
+         xform->skip_lcms, in0, in1, in2, xform_src, buf_dst, buf_dst[3 * kX],
          buf_dst[3 * kX + 1], buf_dst[3 * kX + 2]);
 #endif
 
 #if JPEGXL_ENABLE_SKCMS
-  if (t->channels_dst == 1 && !t->skip_lcms) {
+  if (xform->channels_dst == 1 && !xform->skip_lcms) {
     // Contract back from 3 to 1 channel, this time forward.
     float* grayscale_buf_dst = t->buf_dst[thread];
     for (size_t x = 0; x < xsize; ++x) {
@@ -280,8 +299,9 @@ Status DoColorSpaceTransform(void* cms_data, const size_t thread,
   }
 #endif
 
-  if (t->postprocess != ExtraTF::kNone) {
-    JXL_RETURN_IF_ERROR(AfterTransform(t, buf_dst, xsize * t->channels_dst));
+  if (xform->postprocess != ExtraTF::kNone) {
+    JXL_RETURN_IF_ERROR(
+        AfterTransform(t, buf_dst, xsize * xform->channels_dst));
   }
   return true;
 }
@@ -863,7 +883,7 @@ Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
   float gamma = 1.2f * std::pow(1.111f, std::log2(t->intensity_target * 1e-3f));
   if (!forward) gamma = 1.f / gamma;
 
-  switch (t->hlg_ootf_num_channels) {
+  switch (t->xform->hlg_ootf_num_channels) {
     case 1:
       for (size_t x = 0; x < xsize; ++x) {
         buf[x] = std::pow(buf[x], gamma);
@@ -872,9 +892,9 @@ Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
 
     case 3:
       for (size_t x = 0; x < xsize; x += 3) {
-        const float luminance = buf[x] * t->hlg_ootf_luminances[0] +
-                                buf[x + 1] * t->hlg_ootf_luminances[1] +
-                                buf[x + 2] * t->hlg_ootf_luminances[2];
+        const float luminance = buf[x] * t->xform->hlg_ootf_luminances[0] +
+                                buf[x + 1] * t->xform->hlg_ootf_luminances[1] +
+                                buf[x + 2] * t->xform->hlg_ootf_luminances[2];
         const float ratio = std::pow(luminance, gamma - 1);
         if (std::isfinite(ratio)) {
           buf[x] *= ratio;
@@ -903,7 +923,7 @@ Status ApplyHlgOotf(JxlCms* t, float* JXL_RESTRICT buf, size_t xsize,
 
     default:
       return JXL_FAILURE("HLG OOTF not implemented for %" PRIuS " channels",
-                         t->hlg_ootf_num_channels);
+                         t->xform->hlg_ootf_num_channels);
   }
   return true;
 }
@@ -1081,9 +1101,6 @@ namespace {
 void JxlCmsDestroy(void* cms_data) {
   if (cms_data == nullptr) return;
   JxlCms* t = reinterpret_cast<JxlCms*>(cms_data);
-#if !JPEGXL_ENABLE_SKCMS
-  TransformDeleter()(t->lcms_transform);
-#endif
   delete t;
 }
 
@@ -1102,25 +1119,125 @@ void AllocateBuffer(size_t length, size_t num_threads,
   }
 }
 
-void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
-                 const JxlColorProfile* input, const JxlColorProfile* output,
-                 float intensity_target) {
-  if (init_data == nullptr) {
-    JXL_NOTIFY_ERROR("JxlCmsInit: init_data is nullptr");
-    return nullptr;
+JxlCmsTransform::~JxlCmsTransform() {
+#if !JPEGXL_ENABLE_SKCMS
+  if (lcms_transform != nullptr) TransformDeleter()(lcms_transform);
+#endif
+}
+
+// Process-wide cache of the most recently used transforms, keyed by the input
+// and output ICC profiles; the rendering intent is part of the latter.
+class TransformCache {
+ public:
+  static TransformCache& Get() {
+    // Never destroyed, as transforms may still be in use at exit.
+    static TransformCache* cache = new TransformCache();
+    return *cache;
   }
-  const auto* cms = static_cast<const JxlCmsInterface*>(init_data);
-  auto t = jxl::make_unique<JxlCms>();
-  IccBytes icc_src;
-  IccBytes icc_dst;
-  if (input->icc.size == 0) {
-    JXL_NOTIFY_ERROR("JxlCmsInit: empty input ICC");
-    return nullptr;
+
+  // Returns the cached transform between the two profiles, or the result of
+  // `create`, which is called without holding the lock and may fail.
+  template <typename Create>
+  std::shared_ptr<const JxlCmsTransform> GetOrCreate(
+      const JxlColorProfile& input, const JxlColorProfile& output,
+      const Create& create) {
+    const uint64_t hash = HashBytes(
+        output.icc.data, output.icc.size,
+        HashBytes(input.icc.data, input.icc.size, 0xCBF29CE484222325ull));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::shared_ptr<const JxlCmsTransform> cached =
+          FindLocked(hash, input, output);
+      if (cached != nullptr) {
+        stats_.transforms_reused++;
+        return cached;
+      }
+    }
+    std::shared_ptr<const JxlCmsTransform> transform = create();
+    if (transform == nullptr) return nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Another thread may have created the same transform in the meantime; ours
+    // is then dropped and not counted.
+    std::shared_ptr<const JxlCmsTransform> cached =
+        FindLocked(hash, input, output);
+    if (cached != nullptr) {
+      stats_.transforms_reused++;
+      return cached;
+    }
+    stats_.transforms_created++;
+    if (max_entries_ == 0) return transform;
+    Entry entry;
+    entry.hash = hash;
+    entry.icc_src.assign(input.icc.data, input.icc.data + input.icc.size);
+    entry.icc_dst.assign(output.icc.data, output.icc.data + output.icc.size);
+    entry.transform = transform;
+    entries_.push_front(std::move(entry));
+    if (entries_.size() > max_entries_) entries_.pop_back();
+    return transform;
   }
-  if (output->icc.size == 0) {
-    JXL_NOTIFY_ERROR("JxlCmsInit: empty OUTPUT ICC");
+
+  void SetMaxEntries(size_t max_entries) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_entries_ = max_entries;
+    while (entries_.size() > max_entries_) entries_.pop_back();
+  }
+
+  JxlCmsTransformCacheStats Stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    IccBytes icc_src;
+    IccBytes icc_dst;
+    std::shared_ptr<const JxlCmsTransform> transform;
+  };
+
+  // FNV-1a, ICC profiles are a few KB at most.
+  static uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t hash) {
+    for (size_t i = 0; i < size; ++i) {
+      hash = (hash ^ data[i]) * 0x100000001B3ull;
+    }
+    return hash;
+  }
+
+  static bool SameBytes(const IccBytes& bytes, const uint8_t* data,
+                        size_t size) {
+    return bytes.size() == size && memcmp(bytes.data(), data, size) == 0;
+  }
+
+  // Moves the entry found, if any, to the front of the list.
+  std::shared_ptr<const JxlCmsTransform> FindLocked(
+      uint64_t hash, const JxlColorProfile& input,
+      const JxlColorProfile& output) {
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->hash == hash &&
+          SameBytes(it->icc_src, input.icc.data, input.icc.size) &&
+          SameBytes(it->icc_dst, output.icc.data, output.icc.size)) {
+        entries_.splice(entries_.begin(), entries_, it);
+        return it->transform;
+      }
+    }
     return nullptr;
   }
+
+  static constexpr size_t kDefaultMaxEntries = 16;
+
+  std::mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_;
+  size_t max_entries_ = kDefaultMaxEntries;
+  JxlCmsTransformCacheStats stats_ = {};
+};
+
+std::shared_ptr<const JxlCmsTransform> CreateTransform(
+    const JxlCmsInterface* cms, const JxlColorProfile* input,
+    const JxlColorProfile* output) {
+  auto t = std::make_shared<JxlCmsTransform>();
+  IccBytes icc_src;
+  IccBytes icc_dst;
   icc_src.assign(input->icc.data, input->icc.data + input->icc.size);
   ColorEncoding c_src;
   if (!c_src.SetFieldsFromICC(std::move(icc_src), *cms)) {
@@ -1138,11 +1255,15 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
 #endif
 
 #if JPEGXL_ENABLE_SKCMS
-  if (!DecodeProfile(input->icc.data, input->icc.size, &t->profile_src)) {
+  // The profiles point into the ICC data, which must outlive the caller's
+  // as the transform may be cached.
+  t->icc_src.assign(input->icc.data, input->icc.data + input->icc.size);
+  t->icc_dst.assign(output->icc.data, output->icc.data + output->icc.size);
+  if (!DecodeProfile(t->icc_src.data(), t->icc_src.size(), &t->profile_src)) {
     JXL_NOTIFY_ERROR("JxlCmsInit: skcms failed to parse input ICC");
     return nullptr;
   }
-  if (!DecodeProfile(output->icc.data, output->icc.size, &t->profile_dst)) {
+  if (!DecodeProfile(t->icc_dst.data(), t->icc_dst.size(), &t->profile_dst)) {
     JXL_NOTIFY_ERROR("JxlCmsInit: skcms failed to parse output ICC");
     return nullptr;
   }
@@ -1286,8 +1407,7 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   const size_t channels_src = (c_src.cmyk ? 4 : c_src.Channels());
   const size_t channels_dst = c_dst.Channels();
 #if JXL_CMS_VERBOSE
-  printf("Channels: %" PRIuS "; Threads: %" PRIuS "\n", channels_src,
-         num_threads);
+  printf("Channels: %" PRIuS " -> %" PRIuS "\n", channels_src, channels_dst);
 #endif
 
 #if !JPEGXL_ENABLE_SKCMS
@@ -1308,6 +1428,33 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   }
 #endif  // !JPEGXL_ENABLE_SKCMS
 
+  t->channels_src = channels_src;
+  t->channels_dst = channels_dst;
+  return t;
+}
+
+void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
+                 const JxlColorProfile* input, const JxlColorProfile* output,
+                 float intensity_target) {
+  if (init_data == nullptr) {
+    JXL_NOTIFY_ERROR("JxlCmsInit: init_data is nullptr");
+    return nullptr;
+  }
+  const auto* cms = static_cast<const JxlCmsInterface*>(init_data);
+  if (input->icc.size == 0) {
+    JXL_NOTIFY_ERROR("JxlCmsInit: empty input ICC");
+    return nullptr;
+  }
+  if (output->icc.size == 0) {
+    JXL_NOTIFY_ERROR("JxlCmsInit: empty OUTPUT ICC");
+    return nullptr;
+  }
+  auto t = jxl::make_unique<JxlCms>();
+  t->xform = TransformCache::Get().GetOrCreate(
+      *input, *output, [&]() { return CreateTransform(cms, input, output); });
+  if (t->xform == nullptr) return nullptr;
+  const size_t channels_src = t->xform->channels_src;
+
   // Ideally LCMS would convert directly from External to Image3. However,
   // cmsDoTransformLineStride only accepts 32-bit BytesPerPlaneIn, whereas our
   // planes can be more than 4 GiB apart. Hence, transform inputs/outputs must
@@ -1316,11 +1463,9 @@ void* JxlCmsInit(void* init_data, size_t num_threads, size_t xsize,
   // buffers. To avoid separate allocations, we use the rows of an image.
   // Because LCMS apparently also cannot handle <= 16 bit inputs and 32-bit
   // outputs (or vice versa), we use floating point input/output.
-  t->channels_src = channels_src;
-  t->channels_dst = channels_dst;
 #if !JPEGXL_ENABLE_SKCMS
   size_t actual_channels_src = channels_src;
-  size_t actual_channels_dst = channels_dst;
+  size_t actual_channels_dst = t->xform->channels_dst;
 #else
   // SkiaCMS doesn't support grayscale float buffers, so we create space for RGB
   // float buffers anyway.
@@ -1362,6 +1507,15 @@ JXL_CMS_EXPORT const JxlCmsInterface* JxlGetDefaultCms() {
   return &kInterface;
 }
 
+JXL_CMS_EXPORT void JxlCmsSetTransformCacheSize(size_t max_transforms) {
+  TransformCache::Get().SetMaxEntries(max_transforms);
+}
+
+JXL_CMS_EXPORT void JxlCmsGetTransformCacheStats(
+    JxlCmsTransformCacheStats* stats) {
+  *stats = TransformCache::Get().Stats();
+}
+
 }  // extern "C"
 
 }  // namespace jxl
@@ -6,6 +6,8 @@
 // Transfer functions for color encodings.
 
 #include <cstdint>
+#include <cstring>
+#include <vector>
 
 #include "lib/jxl/base/common.h"
 #if defined(LIB_JXL_CMS_TRANSFER_FUNCTIONS_INL_H_) == defined(HWY_TARGET_TOGGLE)
@@ -30,10 +32,14 @@ namespace HWY_NAMESPACE {
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::And;
 using hwy::HWY_NAMESPACE::AndNot;
+using hwy::HWY_NAMESPACE::GatherIndex;
 using hwy::HWY_NAMESPACE::Gt;
 using hwy::HWY_NAMESPACE::IfThenElse;
 using hwy::HWY_NAMESPACE::Lt;
+using hwy::HWY_NAMESPACE::Max;
+using hwy::HWY_NAMESPACE::Min;
 using hwy::HWY_NAMESPACE::Or;
+using hwy::HWY_NAMESPACE::ShiftRightSame;
 using hwy::HWY_NAMESPACE::Sqrt;
 using hwy::HWY_NAMESPACE::TableLookupBytes;
 
@@ -214,6 +220,11 @@ class TF_PQ : TF_PQ_Base {
 // sRGB
 class TF_SRGB {
  public:
+  static JXL_INLINE double EncodedFromDisplay(const double d) {
+    if (d <= kThreshLinearToSRGB) return kLowDiv * d;
+    return 1.055 * std::pow(d, 1 / 2.4) - 0.055;
+  }
+
   template <typename V>
   JXL_INLINE V DisplayFromEncoded(V x) const {
     const HWY_FULL(float) d;
@@ -340,6 +351,97 @@ V FastLinearToSRGB(D d, V v) {
                     MulAdd(pow, mul, Set(d, -0.055)));
 }
 
+// Transfer function tabulated for output that is quantized to at most 16 bits
+// per sample afterwards. Nodes are spaced uniformly within each octave of the
+// input, so that their float representations are consecutive after a shift,
+// and the function is interpolated linearly between them with an error of
+// at most 0.15 quantization steps. Inputs are clamped to [0, x_max], where
+// x_max is the first power of two that maps to 1 or above.
+class TfLut {
+ public:
+  // `tf` is the exact function for non-negative inputs, e.g. a static
+  // EncodedFromDisplay above. If `linear_below` is positive, `tf` is linear
+  // up to it and the nodes are continued from the function above it, which
+  // may be discontinuous there (BT.709).
+  template <class Func>
+  TfLut(const Func& tf, size_t bits_per_sample, float linear_below = 0.0f) {
+    JXL_DASSERT(bits_per_sample >= 1 && bits_per_sample <= 16);
+    const double quantum = 1.0 / ((1u << bits_per_sample) - 1);
+    // The interpolation error decreases quadratically with the node spacing.
+    const int mantissa_bits = static_cast<int>(bits_per_sample + 1) / 2 - 1;
+    shift_ = 23 - mantissa_bits;
+    int max_exp = 0;
+    while (max_exp < 16 && tf(std::ldexp(1.0, max_exp)) < 1.0) ++max_exp;
+    x_max_ = std::ldexp(1.0f, max_exp);
+    value0_ = tf(0.0);
+    double x_slope = linear_below * 0.5;
+    if (linear_below > 0) {
+      x_min_ = linear_below;
+    } else {
+      // Below x_min, the function is within a quarter of a quantization step
+      // of f(0), and it is interpolated linearly from there.
+      int min_exp = 0;
+      while (min_exp > -126 &&
+             tf(std::ldexp(1.0, min_exp)) - value0_ >= quantum / 4) {
+        --min_exp;
+      }
+      x_min_ = std::ldexp(1.0f, min_exp);
+      x_slope = x_min_;
+    }
+    slope_ = (tf(x_slope) - value0_) / x_slope;
+    base_ = FloatBits(x_min_) >> shift_;
+    const int32_t num_nodes = (FloatBits(x_max_) >> shift_) - base_ + 1;
+    JXL_DASSERT(num_nodes >= 3);
+    table_.resize(num_nodes + 1);
+    for (int32_t i = 0; i < num_nodes; ++i) {
+      const int32_t bits = (base_ + i) << shift_;
+      float x;
+      memcpy(&x, &bits, sizeof(x));
+      table_[i] = tf(x);
+    }
+    if (linear_below > 0) table_[0] = 2 * table_[1] - table_[2];
+    // Interpolation at x_max reads one node past it.
+    table_[num_nodes] = table_[num_nodes - 1];
+  }
+
+  template <class D, class V>
+  JXL_INLINE V EncodedFromDisplay(D d, V x) const {
+    const hwy::HWY_NAMESPACE::Rebind<int32_t, D> di;
+    x = Min(Max(x, Zero(d)), Set(d, x_max_));
+    const auto bits = BitCast(di, Max(x, Set(d, x_min_)));
+    const auto index = Sub(ShiftRightSame(bits, shift_), Set(di, base_));
+    const V frac =
+        Mul(ConvertTo(d, And(bits, Set(di, (1 << shift_) - 1))),
+            Set(d, 1.0f / (1 << shift_)));
+    const V lo = GatherIndex(d, table_.data(), index);
+    const V hi = GatherIndex(d, table_.data() + 1, index);
+    const V low = MulAdd(x, Set(d, slope_), Set(d, value0_));
+    return IfThenElse(Le(x, Set(d, x_min_)), low,
+                      MulAdd(Sub(hi, lo), frac, lo));
+  }
+
+ private:
+  static int32_t FloatBits(float x) {
+    int32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits;
+  }
+
+  std::vector<float> table_;
+  int shift_;
+  int32_t base_;
+  float x_min_;
+  float x_max_;
+  float value0_;
+  float slope_;
+};
+
+// The sRGB transfer function as a TfLut.
+inline TfLut MakeSRGBTfLut(size_t bits_per_sample) {
+  return TfLut([](double x) { return TF_SRGB::EncodedFromDisplay(x); },
+               bits_per_sample, 0.0031308f);
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
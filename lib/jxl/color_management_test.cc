@@ -20,6 +20,7 @@
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/scope_guard.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/cms/color_encoding_cms.h"
 #include "lib/jxl/cms/opsin_params.h"
@@ -292,6 +293,51 @@ TEST_F(ColorManagementTest, P3HlgTo2020Hlg) {
   EXPECT_ARRAY_NEAR(rec2020_hlg_values, rec2020_hlg_expected, 1e-4);
 }
 
+TEST_F(ColorManagementTest, TransformCache) {
+  ColorEncoding display_p3;
+  display_p3.SetColorSpace(ColorSpace::kRGB);
+  ASSERT_TRUE(display_p3.SetWhitePointType(WhitePoint::kD65));
+  ASSERT_TRUE(display_p3.SetPrimariesType(Primaries::kP3));
+  display_p3.Tf().SetTransferFunction(TransferFunction::kSRGB);
+  ASSERT_TRUE(display_p3.CreateICC());
+
+  const auto convert = [&](Color* srgb_values) {
+    ColorSpaceTransform transform(*JxlGetDefaultCms());
+    ASSERT_TRUE(transform.Init(display_p3, ColorEncoding::SRGB(),
+                               kDefaultIntensityTarget, 1, 1));
+    Color p3_values{0.2, 0.5, 0.8};
+    ASSERT_TRUE(transform.Run(0, p3_values.data(), srgb_values->data(), 1));
+  };
+  JxlCmsTransformCacheStats before;
+  JxlCmsGetTransformCacheStats(&before);
+  Color first;
+  convert(&first);
+  for (size_t i = 0; i < 3; ++i) {
+    Color again;
+    convert(&again);
+    EXPECT_ARRAY_NEAR(again, first, 0);
+  }
+  JxlCmsTransformCacheStats after;
+  JxlCmsGetTransformCacheStats(&after);
+  EXPECT_LE(after.transforms_created - before.transforms_created, 1u);
+  EXPECT_GE(after.transforms_reused - before.transforms_reused, 3u);
+
+  // Without the cache, every transform is constructed. The cache is shared by
+  // the whole process, so its default size is restored even if this fails.
+  const auto restore_cache_size =
+      MakeScopeGuard([]() { JxlCmsSetTransformCacheSize(16); });
+  JxlCmsSetTransformCacheSize(0);
+  before = after;
+  for (size_t i = 0; i < 2; ++i) {
+    Color again;
+    convert(&again);
+    EXPECT_ARRAY_NEAR(again, first, 0);
+  }
+  JxlCmsGetTransformCacheStats(&after);
+  EXPECT_EQ(after.transforms_created - before.transforms_created, 2u);
+  EXPECT_EQ(after.transforms_reused, before.transforms_reused);
+}
+
 TEST_F(ColorManagementTest, HlgOotf) {
   ColorEncoding p3_hlg;
   p3_hlg.SetColorSpace(ColorSpace::kRGB);
@@ -8,6 +8,7 @@
 #include <jxl/memory_manager.h>
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
@@ -125,6 +126,34 @@ JXL_INLINE void ComputePixel(
   Store(out, d, out_rows[2] + x);
 }
 
+// Smooths one row of the DC image; the first and last pixels are copied.
+void SmoothRow(const float* JXL_RESTRICT dc_factors,
+               const float* JXL_RESTRICT* JXL_RESTRICT rows_top,
+               const float* JXL_RESTRICT* JXL_RESTRICT rows,
+               const float* JXL_RESTRICT* JXL_RESTRICT rows_bottom,
+               float* JXL_RESTRICT* JXL_RESTRICT rows_out, size_t xsize) {
+  for (size_t x : {static_cast<size_t>(0), xsize - 1}) {
+    for (size_t c = 0; c < 3; c++) {
+      rows_out[c][x] = rows[c][x];
+    }
+  }
+
+  size_t x = 1;
+  // First pixels
+  const size_t N = Lanes(D());
+  for (; x < std::min(N, xsize - 1); x++) {
+    ComputePixel<DScalar>(dc_factors, rows_top, rows, rows_bottom, rows_out, x);
+  }
+  // Full vectors.
+  for (; x + N <= xsize - 1; x += N) {
+    ComputePixel<D>(dc_factors, rows_top, rows, rows_bottom, rows_out, x);
+  }
+  // Last pixels.
+  for (; x < xsize - 1; x++) {
+    ComputePixel<DScalar>(dc_factors, rows_top, rows, rows_bottom, rows_out, x);
+  }
+}
+
 Status AdaptiveDCSmoothing(JxlMemoryManager* memory_manager,
                            const float* dc_factors, Image3F* dc,
                            ThreadPool* pool) {
@@ -167,33 +196,79 @@ Status AdaptiveDCSmoothing(JxlMemoryManager* memory_manager,
         smoothed.PlaneRow(1, y),
         smoothed.PlaneRow(2, y),
     };
-    for (size_t x : {static_cast<size_t>(0), xsize - 1}) {
+    SmoothRow(dc_factors, rows_top, rows, rows_bottom, rows_out, xsize);
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 1, ysize - 1, ThreadPool::NoInit,
+                                process_row, "DCSmoothingRow"));
+  dc->Swap(smoothed);
+  return true;
+}
+
+Status AdaptiveDCSmoothingRows(JxlMemoryManager* memory_manager,
+                               const float* dc_factors, Image3F* dc,
+                               size_t dc_y0, size_t y0, size_t y1, size_t ysize,
+                               Image3F* top, ThreadPool* pool) {
+  const size_t xsize = dc->xsize();
+  JXL_ENSURE(dc_y0 <= y0 && y0 < y1 && y1 <= ysize);
+  JXL_ENSURE(y1 - dc_y0 <= dc->ysize());
+  JXL_ENSURE(y1 == ysize || y1 + 1 - dc_y0 <= dc->ysize());
+  if (ysize <= 2 || xsize <= 2) return true;
+  JXL_ENSURE(w1 + w2 < 0.25f);
+
+  JXL_ASSIGN_OR_RETURN(Image3F smoothed,
+                       Image3F::Create(memory_manager, xsize, y1 - y0));
+  // Rows are smoothed from the original values of their neighbours: the row
+  // above y0 was already smoothed in `dc`, its original is in `top`.
+  const auto original_row = [&](size_t c, size_t y) -> const float* {
+    return (y + 1 == y0) ? top->ConstPlaneRow(c, 0)
+                         : dc->ConstPlaneRow(c, y - dc_y0);
+  };
+  auto process_row = [&](const uint32_t task, size_t /*thread*/) -> Status {
+    const size_t y = y0 + task;
+    if (y == 0 || y + 1 == ysize) {
       for (size_t c = 0; c < 3; c++) {
-        rows_out[c][x] = rows[c][x];
+        memcpy(smoothed.PlaneRow(c, task), dc->ConstPlaneRow(c, y - dc_y0),
+               xsize * sizeof(float));
       }
+      return true;
     }
-
-    size_t x = 1;
-    // First pixels
-    const size_t N = Lanes(D());
-    for (; x < std::min(N, xsize - 1); x++) {
-      ComputePixel<DScalar>(dc_factors, rows_top, rows, rows_bottom, rows_out,
-                            x);
-    }
-    // Full vectors.
-    for (; x + N <= xsize - 1; x += N) {
-      ComputePixel<D>(dc_factors, rows_top, rows, rows_bottom, rows_out, x);
-    }
-    // Last pixels.
-    for (; x < xsize - 1; x++) {
-      ComputePixel<DScalar>(dc_factors, rows_top, rows, rows_bottom, rows_out,
-                            x);
-    }
+    const float* JXL_RESTRICT rows_top[3]{
+        original_row(0, y - 1),
+        original_row(1, y - 1),
+        original_row(2, y - 1),
+    };
+    const float* JXL_RESTRICT rows[3] = {
+        dc->ConstPlaneRow(0, y - dc_y0),
+        dc->ConstPlaneRow(1, y - dc_y0),
+        dc->ConstPlaneRow(2, y - dc_y0),
+    };
+    const float* JXL_RESTRICT rows_bottom[3] = {
+        dc->ConstPlaneRow(0, y + 1 - dc_y0),
+        dc->ConstPlaneRow(1, y + 1 - dc_y0),
+        dc->ConstPlaneRow(2, y + 1 - dc_y0),
+    };
+    float* JXL_RESTRICT rows_out[3] = {
+        smoothed.PlaneRow(0, task),
+        smoothed.PlaneRow(1, task),
+        smoothed.PlaneRow(2, task),
+    };
+    SmoothRow(dc_factors, rows_top, rows, rows_bottom, rows_out, xsize);
     return true;
   };
-  JXL_RETURN_IF_ERROR(RunOnPool(pool, 1, ysize - 1, ThreadPool::NoInit,
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, y1 - y0, ThreadPool::NoInit,
                                 process_row, "DCSmoothingRow"));
-  dc->Swap(smoothed);
+  if (top->xsize() != xsize || top->ysize() != 1) {
+    JXL_ASSIGN_OR_RETURN(*top, Image3F::Create(memory_manager, xsize, 1));
+  }
+  for (size_t c = 0; c < 3; c++) {
+    memcpy(top->PlaneRow(c, 0), dc->ConstPlaneRow(c, y1 - 1 - dc_y0),
+           xsize * sizeof(float));
+    for (size_t y = y0; y < y1; y++) {
+      memcpy(dc->PlaneRow(c, y - dc_y0), smoothed.ConstPlaneRow(c, y - y0),
+             xsize * sizeof(float));
+    }
+  }
   return true;
 }
 
@@ -303,6 +378,15 @@ Status AdaptiveDCSmoothing(JxlMemoryManager* memory_manager,
                                                    dc, pool);
 }
 
+HWY_EXPORT(AdaptiveDCSmoothingRows);
+Status AdaptiveDCSmoothingRows(JxlMemoryManager* memory_manager,
+                               const float* dc_factors, Image3F* dc,
+                               size_t dc_y0, size_t y0, size_t y1, size_t ysize,
+                               Image3F* top, ThreadPool* pool) {
+  return HWY_DYNAMIC_DISPATCH(AdaptiveDCSmoothingRows)(
+      memory_manager, dc_factors, dc, dc_y0, y0, y1, ysize, top, pool);
+}
+
 void DequantDC(const Rect& r, Image3F* dc, ImageB* quant_dc, const Image& in,
                const float* dc_factors, float mul, const float* cfl_factors,
                const YCbCrChromaSubsampling& chroma_subsampling,
@@ -8,6 +8,8 @@
 
 #include <jxl/memory_manager.h>
 
+#include <cstddef>
+
 #include "lib/jxl/ac_context.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
@@ -26,6 +28,15 @@ Status AdaptiveDCSmoothing(JxlMemoryManager* memory_manager,
                            const float* dc_factors, Image3F* dc,
                            ThreadPool* pool);
 
+// Same as AdaptiveDCSmoothing, for the rows [y0, y1) of a DC image of `ysize`
+// rows of which `dc` holds the rows from `dc_y0` on, including row y1 unless
+// it is past the end. Rows are smoothed in order: `top` holds the original
+// values of row y0 - 1, and is set to those of row y1 - 1.
+Status AdaptiveDCSmoothingRows(JxlMemoryManager* memory_manager,
+                               const float* dc_factors, Image3F* dc,
+                               size_t dc_y0, size_t y0, size_t y1, size_t ysize,
+                               Image3F* top, ThreadPool* pool);
+
 void DequantDC(const Rect& r, Image3F* dc, ImageB* quant_dc, const Image& in,
                const float* dc_factors, float mul, const float* cfl_factors,
                const YCbCrChromaSubsampling& chroma_subsampling,
@@ -5,6 +5,10 @@
 
 #include "lib/jxl/dct_scales.h"
 
+#include <cmath>
+#include <cstddef>
+
+#include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 
 namespace jxl {
@@ -31,4 +35,26 @@ constexpr float WcMultipliers<128>::kMultipliers[];
 constexpr float WcMultipliers<256>::kMultipliers[];
 #endif
 
+namespace {
+
+// The multipliers of DCTHalvingMultipliers for N = 2, 4, ..., 256, one after
+// the other; those for N start at N - 2.
+struct HalvingMultipliers {
+  HalvingMultipliers() {
+    for (size_t n = 2; n <= 256; n *= 2) {
+      for (size_t k = 0; k < n; k++) {
+        values[n - 2 + k] = static_cast<float>(std::cos(k * kPi / (2 * n)));
+      }
+    }
+  }
+  float values[2 * 256 - 2];
+};
+
+}  // namespace
+
+const float* DCTHalvingMultipliers(size_t n) {
+  static const HalvingMultipliers kMultipliers;
+  return kMultipliers.values + n - 2;
+}
+
 }  // namespace jxl
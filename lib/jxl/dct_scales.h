@@ -368,6 +368,14 @@ struct WcMultipliers<256> {
   };
 };
 
+// By the same reasoning, the coefficient k of the N/2-DCT whose pixels are the
+// averages of pairs of pixels of a N-DCT is c[k] * cos(k/(2N) pi) for k = 0,
+// and c[k] * cos(k/(2N) pi) - c[N-k] * cos((N-k)/(2N) pi) for 0 < k < N/2: the
+// frequencies above N/2 alias to lower ones with the opposite sign, and N/2
+// itself averages to zero. Returns cos(k/(2N) pi) for 0 <= k < N, for N a
+// power of two between 2 and 256.
+const float* DCTHalvingMultipliers(size_t n);
+
 // Apply the DCT algorithm-intrinsic constants to DCTResampleScale.
 template <size_t FROM, size_t TO>
 constexpr float DCTTotalResampleScale(size_t x) {
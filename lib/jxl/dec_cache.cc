@@ -5,16 +5,20 @@
 
 #include "lib/jxl/dec_cache.h"
 
+#include <jxl/decode.h>
 #include <jxl/memory_manager.h>
+#include <jxl/types.h>
 
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
+#include <vector>
 
 #include "lib/jxl/ac_strategy.h"
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/blending.h"
 #include "lib/jxl/coeff_order.h"
@@ -96,6 +100,51 @@ Status GroupDecCache::InitOnce(JxlMemoryManager* memory_manager,
   return true;
 }
 
+std::vector<ImageOutputPlane> GetImageOutputPlanes(JxlImageOutLayout layout,
+                                                   const JxlPixelFormat& format,
+                                                   size_t xsize, size_t ysize) {
+  const size_t bytes = format.data_type == JXL_TYPE_UINT8   ? 1
+                       : format.data_type == JXL_TYPE_FLOAT ? 4
+                                                            : 2;
+  const size_t chroma_xsize = DivCeil(xsize, 2);
+  const size_t chroma_ysize = DivCeil(ysize, 2);
+  std::vector<ImageOutputPlane> planes;
+  const auto add_plane = [&](size_t row_size, size_t plane_ysize) {
+    ImageOutputPlane plane;
+    plane.offset = planes.empty() ? 0
+                                  : planes.back().offset +
+                                        planes.back().stride *
+                                            planes.back().ysize;
+    plane.row_size = row_size;
+    plane.stride = row_size;
+    if (format.align > 1) {
+      plane.stride = DivCeil(row_size, format.align) * format.align;
+    }
+    plane.ysize = plane_ysize;
+    planes.push_back(plane);
+  };
+  switch (layout) {
+    case JXL_IMAGE_OUT_INTERLEAVED:
+      add_plane(xsize * bytes * format.num_channels, ysize);
+      break;
+    case JXL_IMAGE_OUT_PLANAR:
+      for (size_t c = 0; c < format.num_channels; ++c) {
+        add_plane(xsize * bytes, ysize);
+      }
+      break;
+    case JXL_IMAGE_OUT_I420:
+      add_plane(xsize, ysize);
+      add_plane(chroma_xsize, chroma_ysize);
+      add_plane(chroma_xsize, chroma_ysize);
+      break;
+    case JXL_IMAGE_OUT_P010:
+      add_plane(xsize * 2, ysize);
+      add_plane(chroma_xsize * 4, chroma_ysize);
+      break;
+  }
+  return planes;
+}
+
 // Initialize the decoder state after all of DC is decoded.
 Status PassesDecoderState::InitForAC(size_t num_passes, ThreadPool* pool) {
   shared_storage.coeff_order_size = 0;
@@ -119,8 +168,9 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
                                            PipelineOptions options) {
   JxlMemoryManager* memory_manager = this->memory_manager();
   size_t num_c = 3 + frame_header.nonserialized_metadata->m.num_extra_channels;
-  bool render_noise =
-      (options.render_noise && (frame_header.flags & FrameHeader::kNoise) != 0);
+  bool render_noise = (options.render_noise &&
+                       (frame_header.flags & FrameHeader::kNoise) != 0 &&
+                       output_shift == 0);
   size_t num_tmp_c = render_noise ? 3 : 0;
 
   if (frame_header.CanBeReferenced()) {
@@ -133,6 +183,9 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
   if (options.use_slow_render_pipeline) {
     builder.UseSimpleImplementation();
   }
+  if (options.groups_in_row_order) {
+    builder.RenderGroupsInRowOrder();
+  }
 
   if (!frame_header.chroma_subsampling.Is444()) {
     for (size_t c = 0; c < 3; c++) {
@@ -147,24 +200,27 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
   }
 
-  if (frame_header.loop_filter.gab) {
+  if (frame_header.loop_filter.gab && output_shift == 0) {
     JXL_RETURN_IF_ERROR(
         builder.AddStage(GetGaborishStage(frame_header.loop_filter)));
   }
 
-  {
+  if (output_shift == 0) {
     const LoopFilter& lf = frame_header.loop_filter;
     if (lf.epf_iters >= 3) {
       JXL_RETURN_IF_ERROR(
-          builder.AddStage(GetEPFStage(lf, sigma, EpfStage::Zero)));
+          builder.AddStage(GetEPFStage(lf, sigma, &shared->block_y0,
+                                       EpfStage::Zero)));
     }
     if (lf.epf_iters >= 1) {
       JXL_RETURN_IF_ERROR(
-          builder.AddStage(GetEPFStage(lf, sigma, EpfStage::One)));
+          builder.AddStage(GetEPFStage(lf, sigma, &shared->block_y0,
+                                       EpfStage::One)));
     }
     if (lf.epf_iters >= 2) {
       JXL_RETURN_IF_ERROR(
-          builder.AddStage(GetEPFStage(lf, sigma, EpfStage::Two)));
+          builder.AddStage(GetEPFStage(lf, sigma, &shared->block_y0,
+                                       EpfStage::Two)));
     }
   }
 
@@ -235,23 +291,35 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
   }
 
-  if (fast_xyb_srgb8_conversion) {
+  if (fast_xyb_srgb_conversion) {
 #if !JXL_HIGH_PRECISION
     JXL_ENSURE(!NeedsBlending(frame_header));
     JXL_ENSURE(!frame_header.CanBeReferenced() ||
                frame_header.save_before_color_transform);
     JXL_ENSURE(!options.render_spotcolors ||
                !metadata->Find(ExtraChannel::kSpotColor));
-    bool is_rgba = (main_output.format.num_channels == 4);
-    uint8_t* rgb_output = reinterpret_cast<uint8_t*>(main_output.buffer);
-    JXL_RETURN_IF_ERROR(builder.AddStage(
-        GetFastXYBTosRGB8Stage(rgb_output, main_output.stride, width, height,
-                               is_rgba, has_alpha, alpha_c)));
+    JXL_RETURN_IF_ERROR(builder.AddStage(GetFastXYBTosRGBStage(
+        main_output, width, height, has_alpha, alpha_c,
+        output_encoding_info.opsin_params, memory_manager)));
 #endif
   } else {
     bool linear = false;
+    // For YCbCr output, frames stored as YCbCr are written as they are, unless
+    // a later stage needs RGB: convert_ycbcr then adds the conversion.
+    bool ycbcr_input = false;
+    const auto convert_ycbcr = [&]() -> Status {
+      if (!ycbcr_input) return true;
+      ycbcr_input = false;
+      return builder.AddStage(GetYCbCrStage());
+    };
     if (frame_header.color_transform == ColorTransform::kYCbCr) {
-      JXL_RETURN_IF_ERROR(builder.AddStage(GetYCbCrStage()));
+      if (main_output.buffer &&
+          (main_output.layout == JXL_IMAGE_OUT_I420 ||
+           main_output.layout == JXL_IMAGE_OUT_P010)) {
+        ycbcr_input = true;
+      } else {
+        JXL_RETURN_IF_ERROR(builder.AddStage(GetYCbCrStage()));
+      }
     } else if (frame_header.color_transform == ColorTransform::kXYB) {
       JXL_RETURN_IF_ERROR(builder.AddStage(GetXYBStage(output_encoding_info)));
       if (output_encoding_info.color_encoding.GetColorSpace() !=
@@ -261,6 +329,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }  // Nothing to do for kNone.
 
     if (options.coalescing && NeedsBlending(frame_header)) {
+      JXL_RETURN_IF_ERROR(convert_ycbcr());
       if (linear) {
         JXL_RETURN_IF_ERROR(
             builder.AddStage(GetFromLinearStage(output_encoding_info)));
@@ -272,6 +341,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
 
     if (options.coalescing && frame_header.CanBeReferenced() &&
         !frame_header.save_before_color_transform) {
+      JXL_RETURN_IF_ERROR(convert_ycbcr());
       if (linear) {
         JXL_RETURN_IF_ERROR(
             builder.AddStage(GetFromLinearStage(output_encoding_info)));
@@ -283,6 +353,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
 
     if (options.render_spotcolors &&
         frame_header.nonserialized_metadata->m.Find(ExtraChannel::kSpotColor)) {
+      JXL_RETURN_IF_ERROR(convert_ycbcr());
       for (size_t i = 0; i < metadata->extra_channel_info.size(); i++) {
         // Don't use Find() because there may be multiple spot color channels.
         const ExtraChannelInfo& eci = metadata->extra_channel_info[i];
@@ -295,6 +366,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
 
     auto tone_mapping_stage = GetToneMappingStage(output_encoding_info);
     if (tone_mapping_stage) {
+      JXL_RETURN_IF_ERROR(convert_ycbcr());
       if (!linear) {
         auto to_linear_stage = GetToLinearStage(output_encoding_info);
         if (!to_linear_stage) {
@@ -332,8 +404,20 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
         // - mixing_color_and_grey: cms stage can't handle that
         // TODO(firsching): remove "mixing_color_and_grey" condition after
         // adding support for greyscale to cms stage.
-        JXL_RETURN_IF_ERROR(
-            builder.AddStage(GetFromLinearStage(output_encoding_info)));
+        // Integer RGB output is quantized right after this stage, which
+        // allows evaluating the transfer function from a table; not when
+        // alpha is divided out afterwards, as that amplifies the error.
+        const JxlDataType data_type = main_output.format.data_type;
+        size_t lut_bits = 0;
+        if ((main_output.callback.IsPresent() || main_output.buffer) &&
+            (data_type == JXL_TYPE_UINT8 || data_type == JXL_TYPE_UINT16) &&
+            main_output.bits_per_sample <= 16 && !unpremul_alpha &&
+            (main_output.layout == JXL_IMAGE_OUT_INTERLEAVED ||
+             main_output.layout == JXL_IMAGE_OUT_PLANAR)) {
+          lut_bits = main_output.bits_per_sample;
+        }
+        JXL_RETURN_IF_ERROR(builder.AddStage(
+            GetFromLinearStage(output_encoding_info, lut_bits)));
       } else {
         if (!output_encoding_info.linear_color_encoding.CreateICC()) {
           return JXL_FAILURE("Failed to create ICC");
@@ -347,6 +431,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     } else {
       auto cms_stage = GetCmsStage(output_encoding_info, false);
       if (cms_stage) {
+        JXL_RETURN_IF_ERROR(convert_ycbcr());
         JXL_RETURN_IF_ERROR(builder.AddStage(std::move(cms_stage)));
       }
     }
@@ -354,15 +439,20 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
 
     if (main_output.callback.IsPresent() || main_output.buffer) {
       JXL_RETURN_IF_ERROR(builder.AddStage(GetWriteToOutputStage(
-          main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
-          undo_orientation, extra_output, memory_manager)));
+          main_output, Rect(output_x0, output_y0, width, height), has_alpha,
+          unpremul_alpha, alpha_c, undo_orientation, ycbcr_input,
+          extra_output, memory_manager)));
     } else {
       JXL_RETURN_IF_ERROR(builder.AddStage(
           GetWriteToImageBundleStage(decoded, output_encoding_info)));
     }
   }
-  JXL_ASSIGN_OR_RETURN(render_pipeline,
-                       std::move(builder).Finalize(shared->frame_dim));
+  JXL_ASSIGN_OR_RETURN(
+      render_pipeline,
+      std::move(builder).Finalize(
+          output_shift == 0 ? shared->frame_dim
+                            : shared->frame_dim.Downsampled(output_shift)));
+  render_pipeline->SetTrace(trace);
   return render_pipeline->IsInitialized();
 }
 
@@ -24,6 +24,7 @@
 #include "lib/jxl/common.h"
 #include "lib/jxl/dct_util.h"
 #include "lib/jxl/dec_ans.h"
+#include "lib/jxl/dec_trace.h"
 #include "lib/jxl/dec_xyb.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/frame_header.h"
@@ -75,12 +76,29 @@ struct ImageOutput {
   // Callback for line-by-line output.
   PixelCallback callback;
   // Pixel buffer for image output.
-  void* buffer;
+  void* buffer = nullptr;
   size_t buffer_size;
   // Length of a row of image_buffer in bytes (based on oriented width).
   size_t stride;
+  // Memory layout of image_buffer; callbacks are always interleaved.
+  JxlImageOutLayout layout = JXL_IMAGE_OUT_INTERLEAVED;
 };
 
+// A plane of an image output buffer: byte offset in the buffer, length of a row
+// in bytes without and with padding, and number of rows.
+struct ImageOutputPlane {
+  size_t offset;
+  size_t row_size;
+  size_t stride;
+  size_t ysize;
+};
+
+// Returns the planes of an image output buffer of xsize x ysize pixels in the
+// given layout and format; an interleaved buffer has a single plane.
+std::vector<ImageOutputPlane> GetImageOutputPlanes(JxlImageOutLayout layout,
+                                                   const JxlPixelFormat& format,
+                                                   size_t xsize, size_t ysize);
+
 // Per-frame decoder state. All the images here should be accessed through a
 // group rect (either with block units or pixel units).
 struct PassesDecoderState {
@@ -103,17 +121,22 @@ struct PassesDecoderState {
   float x_dm_multiplier;
   float b_dm_multiplier;
 
-  // Sigma values for EPF.
+  // Sigma values for EPF, for the block rows from shared->block_y0 on.
   ImageF sigma;
 
   // Image dimensions before applying undo_orientation.
   size_t width;
   size_t height;
+  // Origin of the region of the image (of size width x height) that is written
+  // to main_output and extra_output, before applying undo_orientation.
+  size_t output_x0;
+  size_t output_y0;
   ImageOutput main_output;
   std::vector<ImageOutput> extra_output;
 
-  // Whether to use int16 float-XYB-to-uint8-srgb conversion.
-  bool fast_xyb_srgb8_conversion;
+  // Whether to convert from XYB to sRGB and write the main output in a single
+  // render pipeline stage.
+  bool fast_xyb_srgb_conversion;
 
   // If true, the RGBA output will be unpremultiplied before writing to the
   // output.
@@ -123,6 +146,11 @@ struct PassesDecoderState {
   // intended display orientation.
   Orientation undo_orientation;
 
+  // If non-zero, the frame is rendered at 1/2^output_shift of its size, with
+  // width and height in that scale. The restoration filters and the noise
+  // are then skipped.
+  size_t output_shift;
+
   // Used for seeding noise.
   size_t visible_frame_index = 0;
   size_t nonvisible_frame_index = 0;
@@ -136,6 +164,9 @@ struct PassesDecoderState {
   // Rendering pipeline.
   std::unique_ptr<RenderPipeline> render_pipeline;
 
+  // Receives trace events of frame decoding, null if tracing is disabled.
+  const DecoderTrace* trace = nullptr;
+
   // Storage for the current frame if it can be referenced by future frames.
   ImageBundle frame_storage_for_referencing;
 
@@ -144,6 +175,8 @@ struct PassesDecoderState {
     bool coalescing;
     bool render_spotcolors;
     bool render_noise;
+    // Whether the groups are decoded one group row after the other.
+    bool groups_in_row_order = false;
   };
 
   JxlMemoryManager* memory_manager() const { return shared->memory_manager; }
@@ -163,26 +196,37 @@ struct PassesDecoderState {
 
     main_output.callback = PixelCallback();
     main_output.buffer = nullptr;
+    main_output.layout = JXL_IMAGE_OUT_INTERLEAVED;
     extra_output.clear();
+    output_x0 = 0;
+    output_y0 = 0;
 
-    fast_xyb_srgb8_conversion = false;
+    fast_xyb_srgb_conversion = false;
     unpremul_alpha = false;
     undo_orientation = Orientation::kIdentity;
+    output_shift = 0;
 
     used_acs = 0;
 
     upsampler8x = GetUpsamplingStage(memory_manager,
                                      shared->metadata->transform_data, 0, 3);
     if (frame_header.loop_filter.epf_iters > 0) {
-      JXL_ASSIGN_OR_RETURN(
-          sigma,
-          ImageF::Create(memory_manager,
-                         shared->frame_dim.xsize_blocks + 2 * kSigmaPadding,
-                         shared->frame_dim.ysize_blocks + 2 * kSigmaPadding));
+      JXL_RETURN_IF_ERROR(AllocateSigma());
     }
     return true;
   }
 
+  // Allocates the sigma image for the block rows held by the per-block images
+  // of *shared, see PassesSharedState::block_y0.
+  Status AllocateSigma() {
+    JXL_ASSIGN_OR_RETURN(
+        sigma,
+        ImageF::Create(memory_manager(),
+                       shared->frame_dim.xsize_blocks + 2 * kSigmaPadding,
+                       shared->block_rows + 2 * kSigmaPadding));
+    return true;
+  }
+
   // Initialize the decoder state after all of DC is decoded.
   Status InitForAC(size_t num_passes, ThreadPool* pool);
 };
@@ -27,6 +27,7 @@
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/blending.h"
 #include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/coeff_order.h"
 #include "lib/jxl/coeff_order_fwd.h"
@@ -40,6 +41,7 @@
 #include "lib/jxl/dec_modular.h"
 #include "lib/jxl/dec_noise.h"
 #include "lib/jxl/dec_patch_dictionary.h"
+#include "lib/jxl/dec_trace.h"
 #include "lib/jxl/entropy_coder.h"
 #include "lib/jxl/epf.h"
 #include "lib/jxl/fields.h"
@@ -60,6 +62,10 @@
 namespace jxl {
 
 namespace {
+// Block rows above the current row of DC groups that are kept when a frame is
+// decoded in rows, for the filters that read the blocks next to a group.
+constexpr size_t kBlockWindowMargin = 8;
+
 Status DecodeGlobalDCInfo(BitReader* reader, bool is_jpeg,
                           PassesDecoderState* state, ThreadPool* pool) {
   JXL_RETURN_IF_ERROR(state->shared_storage.quantizer.Decode(reader));
@@ -172,8 +178,11 @@ Status FrameDecoder::InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
       NumTocEntries(num_groups, frame_dim_.num_dc_groups, num_passes);
   std::vector<uint32_t> sizes;
   std::vector<coeff_order_t> permutation;
-  JXL_RETURN_IF_ERROR(
-      ReadToc(memory_manager, toc_entries, br, &sizes, &permutation));
+  {
+    TraceScope trace_scope(dec_state_->trace, "TOC");
+    JXL_RETURN_IF_ERROR(
+        ReadToc(memory_manager, toc_entries, br, &sizes, &permutation));
+  }
   bool have_permutation = !permutation.empty();
   toc_.resize(toc_entries);
   section_sizes_sum_ = 0;
@@ -214,10 +223,18 @@ Status FrameDecoder::InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
 }
 
 Status FrameDecoder::InitFrameOutput() {
-  JXL_RETURN_IF_ERROR(
-      InitializePassesSharedState(frame_header_, &dec_state_->shared_storage));
+  row_streaming_ = row_streaming_requested_ && CanDecodeInRows();
+  // In rows, the per-block images hold the current and the next row of DC
+  // groups, and a margin above them.
+  const size_t ysize_blocks =
+      row_streaming_ ? std::min(frame_dim_.ysize_blocks,
+                                kBlockWindowMargin + 2 * frame_dim_.group_dim)
+                     : 0;
+  JXL_RETURN_IF_ERROR(InitializePassesSharedState(
+      frame_header_, &dec_state_->shared_storage, /*encoder=*/false,
+      ysize_blocks));
   JXL_RETURN_IF_ERROR(dec_state_->Init(frame_header_));
-  modular_frame_decoder_.Init(frame_dim_);
+  modular_frame_decoder_.Init(frame_dim_, /*defer_full_image=*/row_streaming_);
 
   if (decoded_->IsJPEG()) {
     if (frame_header_.encoding == FrameEncoding::kModular) {
@@ -267,6 +284,7 @@ Status FrameDecoder::InitFrameOutput() {
 }
 
 Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
+  TraceScope trace_scope(dec_state_->trace, "DCGlobal");
   PassesSharedState& shared = dec_state_->shared_storage;
   JxlMemoryManager* memory_manager = shared.memory_manager;
   if (frame_header_.flags & FrameHeader::kPatches) {
@@ -306,8 +324,9 @@ Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
         frame_dim_.xsize_upsampled, frame_dim_.ysize_upsampled,
         dec_state_->shared->cmap.base()));
   }
+  TraceScope modular_trace_scope(dec_state_->trace, "ModularGlobal");
   Status dec_status = modular_frame_decoder_.DecodeGlobalInfo(
-      br, frame_header_, /*allow_truncated_group=*/false);
+      br, frame_header_, /*allow_truncated_group=*/false, pool_);
   if (dec_status.IsFatalError()) return dec_status;
   if (dec_status) {
     decoded_dc_global_ = true;
@@ -341,6 +360,78 @@ Status FrameDecoder::ProcessDCGroup(size_t dc_group_id, BitReader* br) {
   return true;
 }
 
+std::vector<uint8_t> FrameDecoder::GroupsNeededForOutput() const {
+  // Low resolution pixels around the output region that are decoded as well:
+  // enough for the filters, upsampling and noise stages to see the same input
+  // as for the whole image, and for the 8x8 DC pixels next to skipped DC
+  // groups (which are smoothed with unknown neighbours) to not reach the
+  // region.
+  constexpr size_t kMargin = 4 * kBlockDim;
+  const size_t xsize = frame_dim_.xsize_upsampled;
+  const size_t ysize = frame_dim_.ysize_upsampled;
+  const size_t x0 = dec_state_->output_x0;
+  const size_t y0 = dec_state_->output_y0;
+  if (x0 == 0 && y0 == 0 && dec_state_->width >= xsize &&
+      dec_state_->height >= ysize) {
+    return {};
+  }
+  // A frame rendered at reduced scale is never cropped.
+  if (dec_state_->output_shift != 0) return {};
+  // Only the visible frames are cropped: other frames may be referenced by
+  // later frames at any position, and frames that do not cover the image are
+  // rendered together with the image area around them.
+  if (!dec_state_->main_output.callback.IsPresent() &&
+      !dec_state_->main_output.buffer) {
+    return {};
+  }
+  if (!coalescing_ || decoded_->IsJPEG() || frame_header_.CanBeReferenced() ||
+      frame_header_.custom_size_or_origin ||
+      (frame_header_.frame_type != FrameType::kRegularFrame &&
+       frame_header_.frame_type != FrameType::kSkipProgressive)) {
+    return {};
+  }
+  // With a full modular image, the groups are only rendered after all of them
+  // are decoded.
+  if (modular_frame_decoder_.KeepsFullImage()) return {};
+
+  const size_t upsampling = frame_header_.upsampling;
+  const size_t group_dim = frame_dim_.group_dim;
+  const size_t rx0 = x0 / upsampling;
+  const size_t ry0 = y0 / upsampling;
+  const size_t rx1 = DivCeil(x0 + dec_state_->width, upsampling) + kMargin;
+  const size_t ry1 = DivCeil(y0 + dec_state_->height, upsampling) + kMargin;
+  const size_t gx0 = (rx0 > kMargin ? rx0 - kMargin : 0) / group_dim;
+  const size_t gy0 = (ry0 > kMargin ? ry0 - kMargin : 0) / group_dim;
+  const size_t gx1 = std::min(DivCeil(rx1, group_dim), frame_dim_.xsize_groups);
+  const size_t gy1 = std::min(DivCeil(ry1, group_dim), frame_dim_.ysize_groups);
+  std::vector<uint8_t> needed(frame_dim_.num_groups, 0);
+  for (size_t gy = gy0; gy < gy1; ++gy) {
+    for (size_t gx = gx0; gx < gx1; ++gx) {
+      needed[gy * frame_dim_.xsize_groups + gx] = 1;
+    }
+  }
+  return needed;
+}
+
+bool FrameDecoder::CanRenderAtScale(size_t scale) const {
+  if (scale != 2 && scale != 4 && scale != 8) return false;
+  // Only the simple VarDCT frames: the filters that work on full resolution
+  // pixels (upsampling, patches, splines, blending) are not available at a
+  // reduced scale, and neither are the frames that later frames refer to.
+  if (frame_header_.encoding != FrameEncoding::kVarDCT ||
+      decoded_->IsJPEG() || frame_header_.CanBeReferenced() ||
+      frame_header_.custom_size_or_origin || NeedsBlending(frame_header_) ||
+      (frame_header_.frame_type != FrameType::kRegularFrame &&
+       frame_header_.frame_type != FrameType::kSkipProgressive)) {
+    return false;
+  }
+  constexpr uint64_t kFeatures = FrameHeader::kPatches | FrameHeader::kSplines;
+  return frame_header_.upsampling == 1 &&
+         frame_header_.chroma_subsampling.Is444() &&
+         (frame_header_.flags & kFeatures) == 0 &&
+         frame_header_.nonserialized_metadata->m.num_extra_channels == 0;
+}
+
 Status FrameDecoder::FinalizeDC() {
   // Do Adaptive DC smoothing if enabled. This *must* happen between all the
   // ProcessDCGroup and ProcessACGroup.
@@ -357,6 +448,18 @@ Status FrameDecoder::FinalizeDC() {
   return true;
 }
 
+Status FrameDecoder::PreparePipeline() {
+  PassesDecoderState::PipelineOptions pipeline_options;
+  pipeline_options.use_slow_render_pipeline = use_slow_rendering_pipeline_;
+  pipeline_options.coalescing = coalescing_;
+  pipeline_options.render_spotcolors = render_spotcolors_;
+  pipeline_options.render_noise = true;
+  pipeline_options.groups_in_row_order = row_streaming_;
+  return dec_state_->PreparePipeline(
+      frame_header_, &frame_header_.nonserialized_metadata->m, decoded_,
+      pipeline_options);
+}
+
 Status FrameDecoder::AllocateOutput() {
   if (allocated_) return true;
   modular_frame_decoder_.MaybeDropFullImage();
@@ -369,6 +472,7 @@ Status FrameDecoder::AllocateOutput() {
 
 Status FrameDecoder::ProcessACGlobal(BitReader* br) {
   JXL_ENSURE(finalized_dc_);
+  TraceScope trace_scope(dec_state_->trace, "ACGlobal");
   JxlMemoryManager* memory_manager = dec_state_->memory_manager();
 
   // Decode AC group.
@@ -403,9 +507,12 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
       size_t num_contexts =
           dec_state_->shared->num_histograms *
           dec_state_->shared_storage.block_ctx_map.NumACContexts();
-      JXL_RETURN_IF_ERROR(DecodeHistograms(memory_manager, br, num_contexts,
-                                           &dec_state_->code[i],
-                                           &dec_state_->context_map[i]));
+      {
+        TraceScope histo_trace_scope(dec_state_->trace, "DecodeHistograms");
+        JXL_RETURN_IF_ERROR(DecodeHistograms(memory_manager, br,
+                                             num_contexts, &dec_state_->code[i],
+                                             &dec_state_->context_map[i]));
+      }
       // Add extra values to enable the cheat in hot loop of DecodeACVarBlock.
       dec_state_->context_map[i].resize(
           num_contexts + kZeroDensityContextLimit - kZeroDensityContextCount);
@@ -478,6 +585,27 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
   return true;
 }
 
+Status FrameDecoder::RenderGroupsFromDC() {
+  const auto prepare_storage = [this](const size_t num_threads) -> Status {
+    JXL_RETURN_IF_ERROR(
+        PrepareStorage(num_threads, decoded_passes_per_ac_group_.size()));
+    return true;
+  };
+  const auto process_group = [this](const uint32_t g,
+                                    size_t thread) -> Status {
+    PassesReaders readers = {};
+    JXL_RETURN_IF_ERROR(ProcessACGroup(
+        g, readers, /*num_passes=*/0, GetStorageLocation(thread, g),
+        /*force_draw=*/true, /*dc_only=*/true));
+    decoded_passes_per_ac_group_[g] = frame_header_.passes.num_passes;
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, decoded_passes_per_ac_group_.size(),
+                                prepare_storage, process_group,
+                                "RenderGroupFromDC"));
+  return true;
+}
+
 Status FrameDecoder::ProcessACGroup(size_t ac_group_id, PassesReaders& br,
                                     size_t num_passes, size_t thread,
                                     bool force_draw, bool dc_only) {
@@ -492,6 +620,7 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id, PassesReaders& br,
               ") group_dim: %" PRIuS " decoded passes: %u new passes: %" PRIuS,
               ac_group_id, gx, gy, group_dim,
               decoded_passes_per_ac_group_[ac_group_id], num_passes);
+  TraceScope trace_scope(dec_state_->trace, "ACGroup", ac_group_id);
 
   RenderPipelineInput render_pipeline_input =
       dec_state_->render_pipeline->GetInputBuffers(ac_group_id, thread);
@@ -501,6 +630,8 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id, PassesReaders& br,
   if (frame_header_.encoding == FrameEncoding::kVarDCT) {
     JXL_RETURN_IF_ERROR(group_dec_caches_[thread].InitOnce(
         memory_manager, frame_header_.passes.num_passes, dec_state_->used_acs));
+    TraceScope group_trace_scope(dec_state_->trace, "DecodeGroup",
+                                 ac_group_id);
     JXL_RETURN_IF_ERROR(DecodeGroup(
         frame_header_, br.data(), num_passes, ac_group_id, dec_state_,
         &group_dec_caches_[thread], thread, render_pipeline_input,
@@ -514,35 +645,52 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id, PassesReaders& br,
   size_t pass0 = decoded_passes_per_ac_group_[ac_group_id];
   size_t pass1 =
       force_draw ? frame_header_.passes.num_passes : pass0 + num_passes;
-  for (size_t i = pass0; i < pass1; ++i) {
-    int minShift;
-    int maxShift;
-    frame_header_.passes.GetDownsamplingBracket(i, minShift, maxShift);
-    bool modular_pass_ready = true;
-    JXL_DEBUG_V(2, "Decoding modular in group %d pass %d",
-                static_cast<int>(ac_group_id), static_cast<int>(i));
-    if (i < pass0 + num_passes) {  // i.e. i - pass0 < num_passes
-      BitReader* r = br[i - pass0];
-      JXL_ENSURE(r);
-      JXL_DEBUG_V(2, "Bit reader position: %" PRIuS " / %" PRIuS,
-                  r->TotalBitsConsumed(), r->TotalBytes() * kBitsPerByte);
-      JXL_RETURN_IF_ERROR(modular_frame_decoder_.DecodeGroup(
-          frame_header_, mrect, r, minShift, maxShift,
-          ModularStreamId::ModularAC(ac_group_id, i),
-          /*zerofill=*/false, dec_state_, &render_pipeline_input,
-          /*allow_truncated=*/false, &modular_pass_ready));
-    } else {
-      JXL_RETURN_IF_ERROR(modular_frame_decoder_.DecodeGroup(
-          frame_header_, mrect, nullptr, minShift, maxShift,
-          ModularStreamId::ModularAC(ac_group_id, i), /*zerofill=*/true,
-          dec_state_, &render_pipeline_input,
-          /*allow_truncated=*/false, &modular_pass_ready));
+  // This runs in a task of pool_, so only split single groups further if the
+  // runner supports nested calls, and if there are fewer groups than threads
+  // (see PrepareStorage): otherwise all the threads already have a group.
+  ThreadPool* group_pool =
+      (pool_ != nullptr && pool_->AllowNesting() && use_task_id_) ? pool_
+                                                                  : nullptr;
+  {
+    // VarDCT frames only have modular data in the AC groups for their extra
+    // channels.
+    const bool has_modular_data =
+        pass0 < pass1 && dec_state_->trace != nullptr &&
+        modular_frame_decoder_.HasGroupChannels();
+    TraceScope modular_trace_scope(
+        has_modular_data ? dec_state_->trace : nullptr, "ModularGroup",
+        ac_group_id);
+    for (size_t i = pass0; i < pass1; ++i) {
+      int minShift;
+      int maxShift;
+      frame_header_.passes.GetDownsamplingBracket(i, minShift, maxShift);
+      bool modular_pass_ready = true;
+      JXL_DEBUG_V(2, "Decoding modular in group %d pass %d",
+                  static_cast<int>(ac_group_id), static_cast<int>(i));
+      if (i < pass0 + num_passes) {  // i.e. i - pass0 < num_passes
+        BitReader* r = br[i - pass0];
+        JXL_ENSURE(r);
+        JXL_DEBUG_V(2, "Bit reader position: %" PRIuS " / %" PRIuS,
+                    r->TotalBitsConsumed(), r->TotalBytes() * kBitsPerByte);
+        JXL_RETURN_IF_ERROR(modular_frame_decoder_.DecodeGroup(
+            frame_header_, mrect, r, minShift, maxShift,
+            ModularStreamId::ModularAC(ac_group_id, i),
+            /*zerofill=*/false, dec_state_, &render_pipeline_input,
+            /*allow_truncated=*/false, &modular_pass_ready, group_pool));
+      } else {
+        JXL_RETURN_IF_ERROR(modular_frame_decoder_.DecodeGroup(
+            frame_header_, mrect, nullptr, minShift, maxShift,
+            ModularStreamId::ModularAC(ac_group_id, i), /*zerofill=*/true,
+            dec_state_, &render_pipeline_input,
+            /*allow_truncated=*/false, &modular_pass_ready));
+      }
+      if (modular_pass_ready) modular_ready = true;
     }
-    if (modular_pass_ready) modular_ready = true;
   }
   decoded_passes_per_ac_group_[ac_group_id] += num_passes;
 
-  if ((frame_header_.flags & FrameHeader::kNoise) != 0) {
+  if ((frame_header_.flags & FrameHeader::kNoise) != 0 &&
+      dec_state_->output_shift == 0) {
     PrepareNoiseInput(*dec_state_, frame_dim_, frame_header_, ac_group_id,
                       thread);
   }
@@ -557,6 +705,158 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id, PassesReaders& br,
   return true;
 }
 
+bool FrameDecoder::CanDecodeInRows() const {
+  // Only the frames of the main image that are decoded in a single pass and
+  // are not kept for later frames.
+  if (frame_header_.nonserialized_is_preview || decoded_->IsJPEG() ||
+      frame_header_.CanBeReferenced() || frame_header_.custom_size_or_origin ||
+      NeedsBlending(frame_header_) ||
+      (frame_header_.frame_type != FrameType::kRegularFrame &&
+       frame_header_.frame_type != FrameType::kSkipProgressive)) {
+    return false;
+  }
+  if (use_slow_rendering_pipeline_ || frame_header_.passes.num_passes != 1 ||
+      (frame_header_.flags & FrameHeader::kUseDcFrame) ||
+      !frame_header_.chroma_subsampling.Is444() || frame_dim_.num_groups == 1) {
+    return false;
+  }
+  // With extra channels upsampled differently, the modular DC groups hold
+  // pixels of the full image.
+  for (size_t ecups : frame_header_.extra_channel_upsampling) {
+    if (ecups != frame_header_.upsampling) return false;
+  }
+  // A crop region or a reduced scale skips the sections of whole groups,
+  // which the decoding in rows expects to all be present. They are only known
+  // once the output is set.
+  const ImageOutput& output = dec_state_->main_output;
+  if ((output.callback.IsPresent() || output.buffer) &&
+      (dec_state_->output_shift != 0 || dec_state_->output_x0 != 0 ||
+       dec_state_->output_y0 != 0 ||
+       dec_state_->width < frame_dim_.xsize_upsampled ||
+       dec_state_->height < frame_dim_.ysize_upsampled)) {
+    return false;
+  }
+  return true;
+}
+
+Status FrameDecoder::LeaveRowStreaming() {
+  JXL_DEBUG_V(2, "Frame not decodable in rows, decoding it whole");
+  row_streaming_ = false;
+  PassesSharedState& shared = dec_state_->shared_storage;
+  JXL_RETURN_IF_ERROR(shared.AllocateBlockImages(frame_dim_.ysize_blocks));
+  shared.ac_strategy.FillInvalid();
+  if (frame_header_.loop_filter.epf_iters > 0) {
+    JXL_RETURN_IF_ERROR(dec_state_->AllocateSigma());
+  }
+  modular_frame_decoder_.Init(frame_dim_);
+  return true;
+}
+
+Status FrameDecoder::MoveBlockWindow(size_t block_y0) {
+  PassesSharedState& shared = dec_state_->shared_storage;
+  JXL_ENSURE(block_y0 >= shared.block_y0);
+  const size_t dy = block_y0 - shared.block_y0;
+  shared.ac_strategy.MoveRowsUp(dy);
+  MoveRowsUp(dy, &shared.raw_quant_field);
+  MoveRowsUp(dy, &shared.epf_sharpness);
+  MoveRowsUp(dy, &shared.quant_dc);
+  MoveRowsUp(dy, &shared.dc_storage);
+  MoveRowsUp(dy, &dec_state_->sigma);
+  // The block rows that enter the window are not decoded yet.
+  const size_t rows = shared.block_rows;
+  const size_t kept = rows > dy ? rows - dy : 0;
+  shared.ac_strategy.FillInvalid(
+      Rect(0, kept, frame_dim_.xsize_blocks, rows - kept));
+  shared.block_y0 = block_y0;
+  return true;
+}
+
+Status FrameDecoder::ProcessSectionsInRows(
+    const SectionInfo* sections, const std::vector<size_t>& dc_group_sec,
+    size_t ac_global_sec, const std::vector<std::vector<size_t>>& ac_group_sec,
+    SectionStatus* section_status) {
+  PassesSharedState& shared = dec_state_->shared_storage;
+  // All the sections are present: none of them is marked missing with num.
+  const size_t num = toc_.size();
+  const size_t xsize_dc_groups = frame_dim_.xsize_dc_groups;
+  const size_t xsize_groups = frame_dim_.xsize_groups;
+  const auto decode_dc_row = [&](size_t dy) -> Status {
+    const auto process_dc_group = [&](size_t dx, size_t thread) -> Status {
+      const size_t g = dy * xsize_dc_groups + dx;
+      JXL_ENSURE(dc_group_sec[g] != num);
+      TraceScope trace_scope(dec_state_->trace, "DCGroup", g);
+      JXL_RETURN_IF_ERROR(ProcessDCGroup(g, sections[dc_group_sec[g]].br));
+      section_status[dc_group_sec[g]] = SectionStatus::kDone;
+      return true;
+    };
+    return RunOnPool(pool_, 0, xsize_dc_groups, ThreadPool::NoInit,
+                     process_dc_group, "DecodeDCGroup");
+  };
+  const bool smooth_dc =
+      frame_header_.encoding == FrameEncoding::kVarDCT &&
+      !(frame_header_.flags & FrameHeader::kSkipAdaptiveDCSmoothing);
+  bool prepared_storage = false;
+
+  // Each row of DC groups is decoded one row ahead of its AC groups, since
+  // the DC smoothing of a row reads the row below it.
+  JXL_RETURN_IF_ERROR(decode_dc_row(0));
+  for (size_t dy = 0; dy < frame_dim_.ysize_dc_groups; ++dy) {
+    const bool last_row = dy + 1 == frame_dim_.ysize_dc_groups;
+    if (!last_row) {
+      JXL_RETURN_IF_ERROR(decode_dc_row(dy + 1));
+    }
+    // A DC group has group_dim block rows.
+    const size_t y0 = dy * frame_dim_.group_dim;
+    const size_t y1 =
+        std::min(y0 + frame_dim_.group_dim, frame_dim_.ysize_blocks);
+    if (smooth_dc) {
+      JXL_RETURN_IF_ERROR(AdaptiveDCSmoothingRows(
+          dec_state_->memory_manager(), shared.quantizer.MulDC(),
+          &shared.dc_storage, shared.block_y0, y0, y1, frame_dim_.ysize_blocks,
+          &dc_row_above_, pool_));
+    }
+    if (dy == 0) {
+      JXL_RETURN_IF_ERROR(PreparePipeline());
+      finalized_dc_ = true;
+      JXL_RETURN_IF_ERROR(AllocateOutput());
+      JXL_ENSURE(ac_global_sec != num);
+      JXL_RETURN_IF_ERROR(ProcessACGlobal(sections[ac_global_sec].br));
+      section_status[ac_global_sec] = SectionStatus::kDone;
+    }
+
+    // A DC group has kBlockDim rows of groups, each of which is complete
+    // before the next one starts.
+    const size_t gy1 =
+        std::min((dy + 1) * kBlockDim, frame_dim_.ysize_groups);
+    for (size_t gy = dy * kBlockDim; gy < gy1; ++gy) {
+      const auto prepare_storage = [&](size_t num_threads) -> Status {
+        // The storage is only prepared once, since this also initializes the
+        // pixel callback.
+        if (prepared_storage) return true;
+        prepared_storage = true;
+        return PrepareStorage(num_threads, xsize_groups);
+      };
+      const auto process_group = [&](size_t gx, size_t thread) -> Status {
+        const size_t g = gy * xsize_groups + gx;
+        JXL_ENSURE(ac_group_sec[g][0] != num);
+        PassesReaders readers = {};
+        readers[0] = sections[ac_group_sec[g][0]].br;
+        JXL_RETURN_IF_ERROR(ProcessACGroup(
+            g, readers, /*num_passes=*/1, GetStorageLocation(thread, gx),
+            /*force_draw=*/false, /*dc_only=*/false));
+        section_status[ac_group_sec[g][0]] = SectionStatus::kDone;
+        return true;
+      };
+      JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, xsize_groups, prepare_storage,
+                                    process_group, "DecodeGroup"));
+    }
+    if (!last_row) {
+      JXL_RETURN_IF_ERROR(MoveBlockWindow(y1 - kBlockWindowMargin));
+    }
+  }
+  return true;
+}
+
 void FrameDecoder::MarkSections(const SectionInfo* sections, size_t num,
                                 const SectionStatus* section_status) {
   num_sections_done_ += num;
@@ -572,6 +872,21 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
                                      SectionStatus* section_status) {
   if (num == 0) return true;  // Nothing to process
   std::fill(section_status, section_status + num, SectionStatus::kSkipped);
+  if (row_streaming_ && !dec_state_->main_output.callback.IsPresent() &&
+      !dec_state_->main_output.buffer) {
+    // The pixels are kept in the image bundle: there is nothing to save.
+    JXL_RETURN_IF_ERROR(LeaveRowStreaming());
+  }
+  if (row_streaming_ && !CanDecodeInRows()) {
+    // The output region or scale, which are set after InitFrameOutput, do not
+    // allow decoding in rows.
+    JXL_RETURN_IF_ERROR(LeaveRowStreaming());
+  }
+  if (row_streaming_ && num != toc_.size()) {
+    // Decoding in rows starts once all the sections are available, since the
+    // AC global section may come after the DC groups.
+    return true;
+  }
   size_t dc_global_sec = num;
   size_t ac_global_sec = num;
   std::vector<size_t> dc_group_sec(frame_dim_.num_dc_groups, num);
@@ -583,6 +898,7 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
   std::vector<size_t> desired_num_ac_passes(frame_dim_.num_groups);
   bool single_section =
       frame_dim_.num_groups == 1 && frame_header_.passes.num_passes == 1;
+  const size_t ac_global_index = frame_dim_.num_dc_groups + 1;
   if (single_section) {
     JXL_ENSURE(num == 1);
     JXL_ENSURE(sections[0].id == 0);
@@ -595,7 +911,6 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
       section_status[0] = SectionStatus::kDuplicate;
     }
   } else {
-    size_t ac_global_index = frame_dim_.num_dc_groups + 1;
     for (size_t i = 0; i < num; i++) {
       JXL_ENSURE(sections[i].id < processed_section_.size());
       if (processed_section_[sections[i].id]) {
@@ -642,11 +957,84 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
     }
   }
 
+  if (dc_global_sec != num && decoded_dc_global_ && !single_section) {
+    // Mark the groups that do not affect the output region as decoded. Their
+    // sections that were passed now are reported as done without being read;
+    // the caller skips the others using IsSectionDone.
+    std::vector<uint8_t> needed = GroupsNeededForOutput();
+    const auto skip_section = [&](size_t id, size_t* sec) {
+      if (*sec != num) {
+        section_status[*sec] = SectionStatus::kDone;
+        *sec = num;
+      } else if (!processed_section_[id]) {
+        processed_section_[id] = JXL_TRUE;
+        num_sections_done_++;
+      }
+    };
+    std::vector<uint8_t> dc_group_needed(
+        needed.empty() ? 0 : dc_group_sec.size(), 0);
+    for (size_t g = 0; g < needed.size(); ++g) {
+      const size_t gx = g % frame_dim_.xsize_groups;
+      const size_t gy = g / frame_dim_.xsize_groups;
+      const size_t dc_group =
+          (gy / kBlockDim) * frame_dim_.xsize_dc_groups + gx / kBlockDim;
+      if (needed[g]) {
+        dc_group_needed[dc_group] = 1;
+        continue;
+      }
+      const size_t num_passes = frame_header_.passes.num_passes;
+      for (size_t p = 0; p < num_passes; ++p) {
+        skip_section(ac_global_index + 1 + p * frame_dim_.num_groups + g,
+                     &ac_group_sec[g][p]);
+      }
+      decoded_passes_per_ac_group_[g] = num_passes;
+      desired_num_ac_passes[g] = 0;
+    }
+    if (dec_state_->output_shift == 3) {
+      // At 1/8 scale, the groups are drawn from the DC: none of the AC is
+      // read.
+      skip_section(ac_global_index, &ac_global_sec);
+      for (size_t g = 0; g < frame_dim_.num_groups; ++g) {
+        for (size_t p = 0; p < frame_header_.passes.num_passes; ++p) {
+          skip_section(ac_global_index + 1 + p * frame_dim_.num_groups + g,
+                       &ac_group_sec[g][p]);
+        }
+        desired_num_ac_passes[g] = 0;
+      }
+    }
+    for (size_t g = 0; g < dc_group_needed.size(); ++g) {
+      if (dc_group_needed[g]) continue;
+      skip_section(1 + g, &dc_group_sec[g]);
+      decoded_dc_groups_[g] = JXL_TRUE;
+      if (frame_header_.encoding == FrameEncoding::kVarDCT &&
+          !(frame_header_.flags & FrameHeader::kUseDcFrame)) {
+        // Adaptive DC smoothing reads the DC of neighbouring groups.
+        Image3F& dc = dec_state_->shared_storage.dc_storage;
+        for (size_t c = 0; c < 3; ++c) {
+          FillPlane(0.0f, &dc.Plane(c), frame_dim_.DCGroupRect(g));
+        }
+      }
+    }
+  }
+
+  if (row_streaming_ && decoded_dc_global_ &&
+      modular_frame_decoder_.KeepsFullImage()) {
+    // The groups are only rendered once all of them are decoded.
+    JXL_RETURN_IF_ERROR(LeaveRowStreaming());
+  }
+  if (row_streaming_) {
+    JXL_RETURN_IF_ERROR(ProcessSectionsInRows(
+        sections, dc_group_sec, ac_global_sec, ac_group_sec, section_status));
+    MarkSections(sections, num, section_status);
+    return true;
+  }
+
   if (decoded_dc_global_) {
     const auto process_section = [this, &dc_group_sec, &num, &sections,
                                   &section_status](size_t i,
                                                    size_t thread) -> Status {
       if (dc_group_sec[i] != num) {
+        TraceScope trace_scope(dec_state_->trace, "DCGroup", i);
         JXL_RETURN_IF_ERROR(ProcessDCGroup(i, sections[dc_group_sec[i]].br));
         section_status[dc_group_sec[i]] = SectionStatus::kDone;
       }
@@ -658,16 +1046,12 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
   }
 
   if (!HasDcGroupToDecode() && !finalized_dc_) {
-    PassesDecoderState::PipelineOptions pipeline_options;
-    pipeline_options.use_slow_render_pipeline = use_slow_rendering_pipeline_;
-    pipeline_options.coalescing = coalescing_;
-    pipeline_options.render_spotcolors = render_spotcolors_;
-    pipeline_options.render_noise = true;
-    JXL_RETURN_IF_ERROR(dec_state_->PreparePipeline(
-        frame_header_, &frame_header_.nonserialized_metadata->m, decoded_,
-        pipeline_options));
+    JXL_RETURN_IF_ERROR(PreparePipeline());
     JXL_RETURN_IF_ERROR(FinalizeDC());
     JXL_RETURN_IF_ERROR(AllocateOutput());
+    if (dec_state_->output_shift == 3 && !single_section) {
+      JXL_RETURN_IF_ERROR(RenderGroupsFromDC());
+    }
     if (progressive_detail_ >= JxlProgressiveDetail::kDC) {
       MarkSections(sections, num, section_status);
       return true;
@@ -743,6 +1127,10 @@ Status FrameDecoder::Flush() {
   if (has_blending && !is_finalized_) {
     return false;
   }
+  // Frames decoded in rows are only decoded once they are complete.
+  if (row_streaming_ && !is_finalized_) {
+    return false;
+  }
   // No early Flush() - nothing to do - if the frame is a kSkipProgressive
   // frame.
   if (frame_header_.frame_type == FrameType::kSkipProgressive &&
@@ -816,22 +1204,21 @@ bool FrameDecoder::HasEverything() const {
   return true;
 }
 
-int FrameDecoder::References() const {
-  if (is_finalized_) {
-    return 0;
-  }
-  if (!HasEverything()) return 0;
+namespace {
 
+// Dependencies of a frame that are known from its header: the reference frames
+// it is blended onto and the DC frame it reads from.
+int HeaderReferences(const FrameHeader& header) {
   int result = 0;
 
   // Blending
-  if (frame_header_.frame_type == FrameType::kRegularFrame ||
-      frame_header_.frame_type == FrameType::kSkipProgressive) {
-    bool cropped = frame_header_.custom_size_or_origin;
-    if (cropped || frame_header_.blending_info.mode != BlendMode::kReplace) {
-      result |= (1 << frame_header_.blending_info.source);
+  if (header.frame_type == FrameType::kRegularFrame ||
+      header.frame_type == FrameType::kSkipProgressive) {
+    bool cropped = header.custom_size_or_origin;
+    if (cropped || header.blending_info.mode != BlendMode::kReplace) {
+      result |= (1 << header.blending_info.source);
     }
-    const auto& extra = frame_header_.extra_channel_blending_info;
+    const auto& extra = header.extra_channel_blending_info;
     for (const auto& ecbi : extra) {
       if (cropped || ecbi.mode != BlendMode::kReplace) {
         result |= (1 << ecbi.source);
@@ -839,15 +1226,10 @@ int FrameDecoder::References() const {
     }
   }
 
-  // Patches
-  if (frame_header_.flags & FrameHeader::kPatches) {
-    result |= dec_state_->shared->image_features.patches.GetReferences();
-  }
-
   // DC Level
-  if (frame_header_.flags & FrameHeader::kUseDcFrame) {
+  if (header.flags & FrameHeader::kUseDcFrame) {
     // Reads from the next dc level
-    int dc_level = frame_header_.dc_level + 1;
+    int dc_level = header.dc_level + 1;
     // bits 16, 32, 64, 128 for DC level
     result |= (16 << (dc_level - 1));
   }
@@ -855,6 +1237,32 @@ int FrameDecoder::References() const {
   return result;
 }
 
+}  // namespace
+
+int FrameDecoder::References() const {
+  if (is_finalized_) {
+    return 0;
+  }
+  if (!HasEverything()) return 0;
+
+  int result = HeaderReferences(frame_header_);
+
+  // Patches
+  if (frame_header_.flags & FrameHeader::kPatches) {
+    result |= dec_state_->shared->image_features.patches.GetReferences();
+  }
+
+  return result;
+}
+
+int FrameDecoder::MaxReferences(const FrameHeader& header) {
+  int result = HeaderReferences(header);
+  if (header.flags & FrameHeader::kPatches) {
+    result |= 0xF;
+  }
+  return result;
+}
+
 Status FrameDecoder::FinalizeFrame() {
   if (is_finalized_) {
     return JXL_FAILURE("FinalizeFrame called multiple times");
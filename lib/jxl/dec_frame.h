@@ -17,6 +17,7 @@
 #include <utility>
 #include <vector>
 
+#include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
@@ -27,6 +28,7 @@
 #include "lib/jxl/dec_modular.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/frame_header.h"
+#include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_metadata.h"
 
@@ -56,6 +58,9 @@ class FrameDecoder {
 
   void SetRenderSpotcolors(bool rsc) { render_spotcolors_ = rsc; }
   void SetCoalescing(bool c) { coalescing_ = c; }
+  // Decodes the frame one row of DC groups at a time if it allows it, see
+  // JxlDecoderSetRowStreaming. Must be called before InitFrameOutput.
+  void SetRowStreaming(bool rs) { row_streaming_requested_ = rs; }
 
   // Read FrameHeader and table of contents from the given BitReader.
   Status InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
@@ -119,9 +124,18 @@ class FrameDecoder {
   // soon as the frame header is known.
   static int SavedAs(const FrameHeader& header);
 
+  // Returns a superset of References computed from the frame header alone:
+  // frames with patches are assumed to depend on all of reference frames 0-3,
+  // since the patch references are only known once the frame is decoded.
+  static int MaxReferences(const FrameHeader& header);
+
   uint64_t SumSectionSizes() const { return section_sizes_sum_; }
   const std::vector<TocEntry>& Toc() const { return toc_; }
 
+  // Returns whether the section with logical index `id` was processed or does
+  // not need to be, e.g. because it is outside of the output region.
+  bool IsSectionDone(size_t id) const { return processed_section_[id] != 0; }
+
   const FrameHeader& GetFrameHeader() const { return frame_header_; }
 
   // Returns whether a DC image has been decoded, accessible at low resolution
@@ -145,6 +159,8 @@ class FrameDecoder {
     bool single_section =
         frame_dim_.num_groups == 1 && frame_header_.passes.num_passes == 1;
     if (frame_header_.frame_type != kSkipProgressive &&
+        // Frames decoded in rows are only decoded once they are complete.
+        !row_streaming_ &&
         // If there's only one group and one pass, there is no separate section
         // for DC and the entire full resolution image is available at once.
         !single_section &&
@@ -217,7 +233,7 @@ class FrameDecoder {
     dec_state_->extra_output.clear();
 #if !JXL_HIGH_PRECISION
     if (dec_state_->main_output.buffer &&
-        (format.data_type == JXL_TYPE_UINT8) && (format.num_channels >= 3) &&
+        (format.data_type != JXL_TYPE_FLOAT) && (format.num_channels >= 3) &&
         !dec_state_->unpremul_alpha &&
         (dec_state_->undo_orientation == Orientation::kIdentity) &&
         decoded_->metadata()->xyb_encoded &&
@@ -225,12 +241,48 @@ class FrameDecoder {
         dec_state_->output_encoding_info.all_default_opsin &&
         (dec_state_->output_encoding_info.desired_intensity_target ==
          dec_state_->output_encoding_info.orig_intensity_target) &&
-        HasFastXYBTosRGB8() && frame_header_.needs_color_transform()) {
-      dec_state_->fast_xyb_srgb8_conversion = true;
+        frame_header_.needs_color_transform()) {
+      dec_state_->fast_xyb_srgb_conversion = true;
     }
 #endif
   }
 
+  // Restricts the output set with SetImageOutput to the region of the image
+  // that starts at (x0, y0), given before undoing the orientation; the size of
+  // the region is that of the output. Groups of the frame that do not affect
+  // the region are then not decoded, if the frame is not needed by later
+  // frames. Must be called after SetImageOutput.
+  void SetImageOutputOrigin(size_t x0, size_t y0) const {
+    dec_state_->output_x0 = x0;
+    dec_state_->output_y0 = y0;
+    // The fast XYB to sRGB stage always writes whole rows of the image.
+    dec_state_->fast_xyb_srgb_conversion = false;
+  }
+
+  // Writes the output buffer set with SetImageOutput in the given layout. Must
+  // be called after SetImageOutput.
+  void SetImageOutputLayout(JxlImageOutLayout layout) const {
+    dec_state_->main_output.layout = layout;
+    // The fast XYB to sRGB stage only writes interleaved pixels.
+    if (layout != JXL_IMAGE_OUT_INTERLEAVED) {
+      dec_state_->fast_xyb_srgb_conversion = false;
+    }
+  }
+
+  // Returns whether the frame can be rendered directly at 1/scale of its size
+  // with SetImageOutputScale; scale is 2, 4 or 8.
+  bool CanRenderAtScale(size_t scale) const;
+
+  // Renders the frame at 1/scale of its size, from reduced inverse transforms
+  // or, for scale 8, from the DC alone without reading the AC. The size given
+  // to SetImageOutput must be the reduced one. Must be called after
+  // SetImageOutput, and only if CanRenderAtScale(scale).
+  void SetImageOutputScale(size_t scale) const {
+    dec_state_->output_shift = CeilLog2Nonzero(scale);
+    // The fast XYB to sRGB stage only supports full resolution frames.
+    dec_state_->fast_xyb_srgb_conversion = false;
+  }
+
   void AddExtraChannelOutput(void* buffer, size_t buffer_size, size_t xsize,
                              JxlPixelFormat format, size_t bits_per_sample) {
     ImageOutput out;
@@ -247,15 +299,38 @@ class FrameDecoder {
 
   Status ProcessDCGlobal(BitReader* br);
   Status ProcessDCGroup(size_t dc_group_id, BitReader* br);
+  // Returns, for each AC group, whether it affects the output region; empty if
+  // all groups must be decoded.
+  std::vector<uint8_t> GroupsNeededForOutput() const;
   Status FinalizeDC();
+  Status PreparePipeline();
   Status AllocateOutput();
   Status ProcessACGlobal(BitReader* br);
+  // Draws all the groups from the DC, when rendering at 1/8 scale.
+  Status RenderGroupsFromDC();
   Status ProcessACGroup(size_t ac_group_id, PassesReaders& br,
                         size_t num_passes, size_t thread, bool force_draw,
                         bool dc_only);
   void MarkSections(const SectionInfo* sections, size_t num,
                     const SectionStatus* section_status);
 
+  // Returns whether the frame can be decoded one row of DC groups at a time,
+  // with the per-block images holding a window of block rows.
+  bool CanDecodeInRows() const;
+  // Reallocates the per-block images for the whole frame, before any group is
+  // decoded, for frames that turn out not to be decodable in rows.
+  Status LeaveRowStreaming();
+  // Decodes all the sections of the frame, given at once, in rows of DC
+  // groups; the arguments are those computed by ProcessSections.
+  Status ProcessSectionsInRows(
+      const SectionInfo* sections, const std::vector<size_t>& dc_group_sec,
+      size_t ac_global_sec,
+      const std::vector<std::vector<size_t>>& ac_group_sec,
+      SectionStatus* section_status);
+  // Moves the window of block rows held by the per-block images down so that
+  // it starts at block row `block_y0`.
+  Status MoveBlockWindow(size_t block_y0);
+
   // Allocates storage for parallel decoding using up to `num_threads` threads
   // of up to `num_tasks` tasks. The value of `thread` passed to
   // `GetStorageLocation` must be smaller than the `num_threads` value passed
@@ -316,6 +391,12 @@ class FrameDecoder {
   ModularFrameDecoder modular_frame_decoder_;
   bool render_spotcolors_ = true;
   bool coalescing_ = true;
+  bool row_streaming_requested_ = false;
+  // Whether the frame is decoded in rows, see CanDecodeInRows.
+  bool row_streaming_ = false;
+  // Original DC values of the last block row smoothed so far, when decoding
+  // in rows.
+  Image3F dc_row_above_;
 
   std::vector<uint8_t> processed_section_;
   std::vector<uint8_t> decoded_passes_per_ac_group_;
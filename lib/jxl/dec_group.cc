@@ -189,6 +189,8 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
   // TODO(veluca): investigate cache usage in this function.
   const Rect block_rect =
       dec_state->shared->frame_dim.BlockGroupRect(group_idx);
+  // Where the blocks of the group are in the per-block images and the DC.
+  const Rect storage_rect = dec_state->shared->BlockStorageRect(block_rect);
   const AcStrategyImage& ac_strategy = dec_state->shared->ac_strategy;
 
   const size_t xsize_blocks = block_rect.xsize();
@@ -207,6 +209,9 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
   for (size_t c = 0; c < 3; c++) {
     idct_stride[c] = render_pipeline_input.GetBuffer(c).first->PixelsPerRow();
   }
+  // Size of a block in the rendered frame.
+  const size_t output_shift = dec_state->output_shift;
+  const size_t output_block_dim = kBlockDim >> output_shift;
 
   HWY_ALIGN int32_t scaled_qtable[64 * 3];
 
@@ -261,12 +266,16 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
   size_t hshift[3] = {cs.HShift(0), cs.HShift(1), cs.HShift(2)};
   size_t vshift[3] = {cs.VShift(0), cs.VShift(1), cs.VShift(2)};
   Rect r[3];
+  Rect dc_rect[3];
   for (size_t i = 0; i < 3; i++) {
     r[i] =
         Rect(block_rect.x0() >> hshift[i], block_rect.y0() >> vshift[i],
              block_rect.xsize() >> hshift[i], block_rect.ysize() >> vshift[i]);
-    if (!r[i].IsInside({0, 0, dec_state->shared->dc->Plane(i).xsize(),
-                        dec_state->shared->dc->Plane(i).ysize()})) {
+    dc_rect[i] = Rect(storage_rect.x0() >> hshift[i],
+                      storage_rect.y0() >> vshift[i], r[i].xsize(),
+                      r[i].ysize());
+    if (!dc_rect[i].IsInside({0, 0, dec_state->shared->dc->Plane(i).xsize(),
+                              dec_state->shared->dc->Plane(i).ysize()})) {
       return JXL_FAILURE("Frame dimensions are too big for the image.");
     }
   }
@@ -276,16 +285,16 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
     size_t sby[3] = {by >> vshift[0], by >> vshift[1], by >> vshift[2]};
 
     const int32_t* JXL_RESTRICT row_quant =
-        block_rect.ConstRow(dec_state->shared->raw_quant_field, by);
+        storage_rect.ConstRow(dec_state->shared->raw_quant_field, by);
 
     const float* JXL_RESTRICT dc_rows[3] = {
-        r[0].ConstPlaneRow(*dec_state->shared->dc, 0, sby[0]),
-        r[1].ConstPlaneRow(*dec_state->shared->dc, 1, sby[1]),
-        r[2].ConstPlaneRow(*dec_state->shared->dc, 2, sby[2]),
+        dc_rect[0].ConstPlaneRow(*dec_state->shared->dc, 0, sby[0]),
+        dc_rect[1].ConstPlaneRow(*dec_state->shared->dc, 1, sby[1]),
+        dc_rect[2].ConstPlaneRow(*dec_state->shared->dc, 2, sby[2]),
     };
 
     const size_t ty = (block_rect.y0() + by) / kColorTileDimInBlocks;
-    AcStrategyRow acs_row = ac_strategy.ConstRow(block_rect, by);
+    AcStrategyRow acs_row = ac_strategy.ConstRow(storage_rect, by);
 
     const int8_t* JXL_RESTRICT row_cmap[3] = {
         dec_state->shared->cmap.ytox_map.ConstRow(ty),
@@ -297,7 +306,8 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
     int16_t* JXL_RESTRICT jpeg_row[3];
     for (size_t c = 0; c < 3; c++) {
       const auto& buffer = render_pipeline_input.GetBuffer(c);
-      idct_row[c] = buffer.second.Row(buffer.first, sby[c] * kBlockDim);
+      idct_row[c] =
+          buffer.second.Row(buffer.first, sby[c] * output_block_dim);
       if (jpeg_data) {
         auto& component = jpeg_data->components[jpeg_c_map[c]];
         jpeg_row[c] =
@@ -426,6 +436,16 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
               return JXL_FAILURE("JPEG DCT coefficients out of range");
             }
           }
+        } else if (output_shift == 3) {
+          // Each block is a single pixel of the output: its DC.
+          for (size_t c = 0; c < 3; c++) {
+            for (size_t iy = 0; iy < acs.covered_blocks_y(); iy++) {
+              for (size_t ix = 0; ix < llf_x; ix++) {
+                idct_row[c][iy * idct_stride[c] + bx + ix] =
+                    dc_rows[c][iy * dc_stride + bx + ix];
+              }
+            }
+          }
         } else {
           HWY_ALIGN float* const block = group_dec_cache->dec_group_block;
           // Dequantize and add predictions.
@@ -443,9 +463,16 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
               continue;
             }
             // IDCT
-            float* JXL_RESTRICT idct_pos = idct_row[c] + sbx[c] * kBlockDim;
-            TransformToPixels(acs.Strategy(), block + c * size, idct_pos,
-                              idct_stride[c], group_dec_cache->scratch_space);
+            float* JXL_RESTRICT idct_pos =
+                idct_row[c] + sbx[c] * output_block_dim;
+            if (output_shift == 0) {
+              TransformToPixels(acs.Strategy(), block + c * size, idct_pos,
+                                idct_stride[c], group_dec_cache->scratch_space);
+            } else {
+              TransformToDownsampledPixels(
+                  acs.Strategy(), output_shift, block + c * size, idct_pos,
+                  idct_stride[c], group_dec_cache->scratch_space);
+            }
           }
         }
         bx += llf_x;
@@ -726,6 +753,31 @@ Status DecodeGroup(const FrameHeader& frame_header,
     *should_run_pipeline = draw != kDontDraw;
   }
 
+  if (draw == kDraw && num_passes == 0 && first_pass == 0 &&
+      dec_state->output_shift != 0) {
+    // At reduced scale, each DC value is drawn as a flat square of pixels.
+    const size_t output_block_dim = kBlockDim >> dec_state->output_shift;
+    const Rect src_rect =
+        dec_state->shared->frame_dim.BlockGroupRect(group_idx);
+    for (size_t c : {0, 1, 2}) {
+      const auto& buffer = render_pipeline_input.GetBuffer(c);
+      for (size_t y = 0; y < src_rect.ysize(); y++) {
+        const float* JXL_RESTRICT row_dc =
+            src_rect.ConstPlaneRow(*dec_state->shared->dc, c, y);
+        for (size_t iy = 0; iy < output_block_dim; iy++) {
+          float* JXL_RESTRICT row_out = buffer.second.Row(
+              buffer.first, y * output_block_dim + iy);
+          for (size_t x = 0; x < src_rect.xsize(); x++) {
+            for (size_t ix = 0; ix < output_block_dim; ix++) {
+              row_out[x * output_block_dim + ix] = row_dc[x];
+            }
+          }
+        }
+      }
+    }
+    return true;
+  }
+
   if (draw == kDraw && num_passes == 0 && first_pass == 0) {
     JXL_RETURN_IF_ERROR(group_dec_cache->InitDCBufferOnce(memory_manager));
     const YCbCrChromaSubsampling& cs = frame_header.chroma_subsampling;
@@ -801,8 +853,9 @@ Status DecodeGroup(const FrameHeader& frame_header,
   auto get_block = jxl::make_unique<GetBlockFromBitstream>();
   JXL_RETURN_IF_ERROR(get_block->Init(
       frame_header, readers, num_passes, group_idx, histo_selector_bits,
-      dec_state->shared->frame_dim.BlockGroupRect(group_idx), group_dec_cache,
-      dec_state, first_pass));
+      dec_state->shared->BlockStorageRect(
+          dec_state->shared->frame_dim.BlockGroupRect(group_idx)),
+      group_dec_cache, dec_state, first_pass));
 
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(DecodeGroupImpl)(
       frame_header, get_block.get(), group_dec_cache, dec_state, thread,
@@ -208,7 +208,8 @@ std::string ModularStreamId::DebugString() const {
 
 Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
                                              const FrameHeader& frame_header,
-                                             bool allow_truncated_group) {
+                                             bool allow_truncated_group,
+                                             ThreadPool* pool) {
   JxlMemoryManager* memory_manager = this->memory_manager();
   bool decode_color = frame_header.encoding == FrameEncoding::kModular;
   const auto& metadata = frame_header.nonserialized_metadata->m;
@@ -247,10 +248,25 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
     }
   }
 
+  // Deferred planes start as placeholders of a single pixel; the channel sizes
+  // are still those of the full image.
+  const bool defer = defer_full_image_;
   JXL_ASSIGN_OR_RETURN(
-      Image gi,
-      Image::Create(memory_manager, frame_dim.xsize, frame_dim.ysize,
-                    metadata.bit_depth.bits_per_sample, nb_chans + nb_extra));
+      Image gi, Image::Create(memory_manager, defer ? 1 : frame_dim.xsize,
+                              defer ? 1 : frame_dim.ysize,
+                              metadata.bit_depth.bits_per_sample,
+                              nb_chans + nb_extra));
+  gi.w = frame_dim.xsize;
+  gi.h = frame_dim.ysize;
+  const auto resize_channel = [defer](Channel& ch, size_t w,
+                                      size_t h) -> Status {
+    ch.w = w;
+    ch.h = h;
+    return defer ? true : ch.shrink();
+  };
+  for (Channel& ch : gi.channel) {
+    JXL_RETURN_IF_ERROR(resize_channel(ch, gi.w, gi.h));
+  }
 
   all_same_shift = true;
   if (frame_header.color_transform == ColorTransform::kYCbCr) {
@@ -261,7 +277,8 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
           DivCeil(frame_dim.xsize, 1 << gi.channel[c].hshift);
       size_t ysize_shifted =
           DivCeil(frame_dim.ysize, 1 << gi.channel[c].vshift);
-      JXL_RETURN_IF_ERROR(gi.channel[c].shrink(xsize_shifted, ysize_shifted));
+      JXL_RETURN_IF_ERROR(
+          resize_channel(gi.channel[c], xsize_shifted, ysize_shifted));
       if (gi.channel[c].hshift != gi.channel[0].hshift ||
           gi.channel[c].vshift != gi.channel[0].vshift)
         all_same_shift = false;
@@ -271,8 +288,8 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
   for (size_t ec = 0, c = nb_chans; ec < nb_extra; ec++, c++) {
     size_t ecups = frame_header.extra_channel_upsampling[ec];
     JXL_RETURN_IF_ERROR(
-        gi.channel[c].shrink(DivCeil(frame_dim.xsize_upsampled, ecups),
-                             DivCeil(frame_dim.ysize_upsampled, ecups)));
+        resize_channel(gi.channel[c], DivCeil(frame_dim.xsize_upsampled, ecups),
+                       DivCeil(frame_dim.ysize_upsampled, ecups)));
     gi.channel[c].hshift = gi.channel[c].vshift =
         CeilLog2Nonzero(ecups) - CeilLog2Nonzero(frame_header.upsampling);
     if (gi.channel[c].hshift != gi.channel[0].hshift ||
@@ -282,6 +299,14 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
 
   JXL_DEBUG_V(6, "DecodeGlobalInfo: full_image (w/o transforms) %s",
               gi.DebugString().c_str());
+  if (defer) {
+    // The channels that are small enough are decoded with the global info.
+    for (Channel& ch : gi.channel) {
+      if (ch.w <= frame_dim.group_dim && ch.h <= frame_dim.group_dim) {
+        JXL_RETURN_IF_ERROR(ch.shrink());
+      }
+    }
+  }
   ModularOptions options;
   options.max_chan_size = frame_dim.group_dim;
   options.group_dim = frame_dim.group_dim;
@@ -289,7 +314,7 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
       reader, gi, &global_header, ModularStreamId::Global().ID(frame_dim),
       &options,
       /*undo_transforms=*/false, &tree, &code, &context_map,
-      allow_truncated_group);
+      allow_truncated_group, pool);
   if (!allow_truncated_group) JXL_RETURN_IF_ERROR(dec_status);
   if (dec_status.IsFatalError()) {
     return JXL_FAILURE("Failed to decode global modular info");
@@ -312,13 +337,18 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
     }
   }
   full_image = std::move(gi);
+  if (defer && KeepsFullImage()) {
+    for (Channel& ch : full_image.channel) {
+      JXL_RETURN_IF_ERROR(ch.shrink());
+    }
+  }
   JXL_DEBUG_V(6, "DecodeGlobalInfo: full_image (with transforms) %s",
               full_image.DebugString().c_str());
   return dec_status;
 }
 
 void ModularFrameDecoder::MaybeDropFullImage() {
-  if (full_image.transform.empty() && !have_something && all_same_shift) {
+  if (!KeepsFullImage()) {
     use_full_image = false;
     JXL_DEBUG_V(6, "Dropping full image");
     for (auto& ch : full_image.channel) {
@@ -328,11 +358,20 @@ void ModularFrameDecoder::MaybeDropFullImage() {
   }
 }
 
+bool ModularFrameDecoder::HasGroupChannels() const {
+  for (size_t c = full_image.nb_meta_channels; c < full_image.channel.size();
+       c++) {
+    const Channel& fc = full_image.channel[c];
+    if (fc.w > frame_dim.group_dim || fc.h > frame_dim.group_dim) return true;
+  }
+  return false;
+}
+
 Status ModularFrameDecoder::DecodeGroup(
     const FrameHeader& frame_header, const Rect& rect, BitReader* reader,
     int minShift, int maxShift, const ModularStreamId& stream, bool zerofill,
     PassesDecoderState* dec_state, RenderPipelineInput* render_pipeline_input,
-    bool allow_truncated, bool* should_run_pipeline) {
+    bool allow_truncated, bool* should_run_pipeline, ThreadPool* pool) {
   JXL_DEBUG_V(6, "Decoding %s with rect %s and shift bracket %d..%d %s",
               stream.DebugString().c_str(), Description(rect).c_str(), minShift,
               maxShift, zerofill ? "using zerofill" : "");
@@ -390,7 +429,8 @@ Status ModularFrameDecoder::DecodeGroup(
   if (!zerofill) {
     auto status = ModularGenericDecompress(
         reader, gi, /*header=*/nullptr, stream.ID(frame_dim), &options,
-        /*undo_transforms=*/true, &tree, &code, &context_map, allow_truncated);
+        /*undo_transforms=*/true, &tree, &code, &context_map, allow_truncated,
+        pool);
     if (!allow_truncated) JXL_RETURN_IF_ERROR(status);
     if (status.IsFatalError()) return status;
   }
@@ -456,7 +496,8 @@ Status ModularFrameDecoder::DecodeVarDCTDC(const FrameHeader& frame_header,
     return JXL_FAILURE("Failed to decode VarDCT DC group (DC group id %d)",
                        static_cast<int>(group_id));
   }
-  DequantDC(r, &dec_state->shared_storage.dc_storage,
+  DequantDC(dec_state->shared->BlockStorageRect(r),
+            &dec_state->shared_storage.dc_storage,
             &dec_state->shared_storage.quant_dc, image,
             dec_state->shared->quantizer.MulDC(), mul,
             dec_state->shared->cmap.base().DCFactors(),
@@ -503,13 +544,18 @@ Status ModularFrameDecoder::DecodeAcMetadata(const FrameHeader& frame_header,
   size_t num = 0;
   bool is444 = frame_header.chroma_subsampling.Is444();
   auto& ac_strategy = dec_state->shared_storage.ac_strategy;
-  size_t xlim = std::min(ac_strategy.xsize(), r.x0() + r.xsize());
-  size_t ylim = std::min(ac_strategy.ysize(), r.y0() + r.ysize());
+  // The per-block images may only hold a window of block rows.
+  const Rect storage_rect = dec_state->shared->BlockStorageRect(r);
+  const size_t block_y0 = dec_state->shared->block_y0;
+  size_t xlim = std::min(frame_dim.xsize_blocks, r.x0() + r.xsize());
+  size_t ylim = std::min(frame_dim.ysize_blocks, r.y0() + r.ysize());
   uint32_t local_used_acs = 0;
   for (size_t iy = 0; iy < r.ysize(); iy++) {
     size_t y = r.y0() + iy;
-    int32_t* row_qf = r.Row(&dec_state->shared_storage.raw_quant_field, iy);
-    uint8_t* row_epf = r.Row(&dec_state->shared_storage.epf_sharpness, iy);
+    int32_t* row_qf =
+        storage_rect.Row(&dec_state->shared_storage.raw_quant_field, iy);
+    uint8_t* row_epf =
+        storage_rect.Row(&dec_state->shared_storage.epf_sharpness, iy);
     int32_t* row_in_1 = image.channel[2].plane.Row(0);
     int32_t* row_in_2 = image.channel[2].plane.Row(1);
     int32_t* row_in_3 = image.channel[3].plane.Row(iy);
@@ -520,7 +566,7 @@ Status ModularFrameDecoder::DecodeAcMetadata(const FrameHeader& frame_header,
         return JXL_FAILURE("Corrupted sharpness field");
       }
       row_epf[ix] = sharpness;
-      if (ac_strategy.IsValid(x, y)) {
+      if (ac_strategy.IsValid(x, y - block_y0)) {
         continue;
       }
 
@@ -547,8 +593,8 @@ Status ModularFrameDecoder::DecodeAcMetadata(const FrameHeader& frame_header,
       if (next_y_dct_block > next_y_ac_block || next_y_dct_block > ylim) {
         return JXL_FAILURE("Invalid AC strategy, y overflow");
       }
-      JXL_RETURN_IF_ERROR(
-          ac_strategy.SetNoBoundsCheck(x, y, AcStrategyType(row_in_1[num])));
+      JXL_RETURN_IF_ERROR(ac_strategy.SetNoBoundsCheck(
+          x, y - block_y0, AcStrategyType(row_in_1[num])));
       row_qf[ix] = 1 + std::max<int32_t>(0, std::min(Quantizer::kQuantMax - 1,
                                                      row_in_2[num]));
       num++;
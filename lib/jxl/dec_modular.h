@@ -95,15 +95,27 @@ class ModularFrameDecoder {
  public:
   explicit ModularFrameDecoder(JxlMemoryManager* memory_manager)
       : memory_manager_(memory_manager), full_image(memory_manager) {}
-  void Init(const FrameDimensions& new_frame_dim) { frame_dim = new_frame_dim; }
+  // If `defer_full_image` is true, the planes of the full image that are only
+  // filled by the groups are not allocated unless KeepsFullImage(), for frames
+  // that are decoded in rows.
+  void Init(const FrameDimensions& new_frame_dim,
+            bool defer_full_image = false) {
+    frame_dim = new_frame_dim;
+    defer_full_image_ = defer_full_image;
+  }
+  // `pool`, if given, may be used to decode the channels of a single group
+  // in parallel; DecodeGroup is usually called from a task of `pool` already,
+  // so it should only be passed if nesting is allowed.
   Status DecodeGlobalInfo(BitReader* reader, const FrameHeader& frame_header,
-                          bool allow_truncated_group);
+                          bool allow_truncated_group,
+                          ThreadPool* pool = nullptr);
   Status DecodeGroup(const FrameHeader& frame_header, const Rect& rect,
                      BitReader* reader, int minShift, int maxShift,
                      const ModularStreamId& stream, bool zerofill,
                      PassesDecoderState* dec_state,
                      RenderPipelineInput* render_pipeline_input,
-                     bool allow_truncated, bool* should_run_pipeline = nullptr);
+                     bool allow_truncated, bool* should_run_pipeline = nullptr,
+                     ThreadPool* pool = nullptr);
   // Decodes a VarDCT DC group (`group_id`) from the given `reader`.
   Status DecodeVarDCTDC(const FrameHeader& frame_header, size_t group_id,
                         BitReader* reader, PassesDecoderState* dec_state);
@@ -127,6 +139,16 @@ class ModularFrameDecoder {
   bool have_dc() const { return have_something; }
   void MaybeDropFullImage();
   bool UsesFullImage() const { return use_full_image; }
+  // Whether some channels are larger than a group, and therefore decoded in
+  // the AC groups. Valid once the global info is decoded.
+  bool HasGroupChannels() const;
+  // Whether the full image is still used after MaybeDropFullImage, i.e. the
+  // groups are rendered only by FinalizeDecoding. Valid once the global info
+  // is decoded.
+  bool KeepsFullImage() const {
+    return use_full_image &&
+           (!full_image.transform.empty() || have_something || !all_same_shift);
+  }
   JxlMemoryManager* memory_manager() const { return memory_manager_; }
 
  private:
@@ -142,6 +164,7 @@ class ModularFrameDecoder {
   bool do_color;
   bool have_something;
   bool use_full_image = true;
+  bool defer_full_image_ = false;
   bool all_same_shift;
   Tree tree;
   ANSCode code;
@@ -0,0 +1,116 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_DEC_TRACE_H_
+#define LIB_JXL_DEC_TRACE_H_
+
+// Trace events of the decoder, see JxlDecoderSetTraceCallback.
+
+#include <jxl/decode.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "lib/jxl/base/common.h"
+
+namespace jxl {
+
+// Forwards trace events to the callback of the API. Decoding code holds a
+// const DecoderTrace* that is null when tracing is disabled, so that a disabled
+// trace point only costs a branch.
+class DecoderTrace {
+ public:
+  DecoderTrace() = default;
+  DecoderTrace(JxlDecoderTraceCallback callback, void* opaque)
+      : callback_(callback),
+        opaque_(opaque),
+        threads_(callback ? jxl::make_unique<Threads>() : nullptr) {}
+
+  bool enabled() const { return callback_ != nullptr; }
+
+  // Makes the current thread the one with thread_id 0, called when the user
+  // calls into the decoder.
+  void SetCallingThread() {
+    if (!threads_) return;
+    std::lock_guard<std::mutex> lock(threads_->mutex);
+    threads_->ids[0] = std::this_thread::get_id();
+  }
+
+  static uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Emits an event of the current thread.
+  void Emit(JxlDecoderTraceEventType type, const char* name, int64_t group_id,
+            uint64_t timestamp_ns) const {
+    JxlDecoderTraceEvent event;
+    event.type = type;
+    event.name = name;
+    event.group_id = static_cast<int32_t>(group_id);
+    event.thread_id = ThreadId();
+    event.timestamp_ns = timestamp_ns;
+    callback_(opaque_, &event);
+  }
+
+ private:
+  // The threads that emitted events, by thread_id. The thread indices given
+  // by the parallel runner are not used, since the calling thread may also
+  // run tasks, and the decoder passes storage indices rather than thread
+  // indices to some of them.
+  struct Threads {
+    std::mutex mutex;
+    std::vector<std::thread::id> ids = {std::this_thread::get_id()};
+  };
+
+  uint32_t ThreadId() const {
+    const std::thread::id id = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(threads_->mutex);
+    for (size_t i = 0; i < threads_->ids.size(); ++i) {
+      if (threads_->ids[i] == id) return static_cast<uint32_t>(i);
+    }
+    threads_->ids.push_back(id);
+    return static_cast<uint32_t>(threads_->ids.size() - 1);
+  }
+
+  JxlDecoderTraceCallback callback_ = nullptr;
+  void* opaque_ = nullptr;
+  std::unique_ptr<Threads> threads_;
+};
+
+// Emits a begin event when constructed and the matching end event when
+// destroyed, if `trace` is not null.
+class TraceScope {
+ public:
+  TraceScope(const DecoderTrace* trace, const char* name,
+             int64_t group_id = -1)
+      : trace_(trace), name_(name), group_id_(group_id) {
+    if (trace_) {
+      trace_->Emit(JXL_DEC_TRACE_BEGIN, name_, group_id_, DecoderTrace::Now());
+    }
+  }
+  ~TraceScope() {
+    if (trace_) {
+      trace_->Emit(JXL_DEC_TRACE_END, name_, group_id_, DecoderTrace::Now());
+    }
+  }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const DecoderTrace* trace_;
+  const char* name_;
+  int64_t group_id_;
+};
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_DEC_TRACE_H_
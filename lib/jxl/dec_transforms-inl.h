@@ -688,6 +688,181 @@ HWY_MAYBE_UNUSED void TransformToPixels(const AcStrategyType strategy,
   }
 }
 
+// Halves the size of a DCT of size n along the dimension with the given
+// stride, so that its pixels are the averages of pairs of the original pixels.
+void HalveDCT(float* JXL_RESTRICT coefficients, size_t n, size_t stride) {
+  const float* multipliers = DCTHalvingMultipliers(n);
+  for (size_t k = 1; k < n / 2; k++) {
+    coefficients[k * stride] =
+        coefficients[k * stride] * multipliers[k] -
+        coefficients[(n - k) * stride] * multipliers[n - k];
+  }
+}
+
+// Computes the ROWS x COLS block downsampled by 2^SHIFT in both directions,
+// i.e. the averages of its 2^SHIFT x 2^SHIFT squares of pixels, with a smaller
+// IDCT. Overwrites the coefficients.
+template <size_t ROWS, size_t COLS, size_t SHIFT>
+void DownsampledIDCT(float* JXL_RESTRICT coefficients,
+                     float* JXL_RESTRICT pixels, size_t pixels_stride,
+                     float* JXL_RESTRICT scratch_space) {
+  // Same layout as in ComputeScaledIDCT.
+  constexpr size_t kRows = ROWS < COLS ? ROWS : COLS;
+  constexpr size_t kCols = ROWS < COLS ? COLS : ROWS;
+  for (size_t s = 0; s < SHIFT; s++) {
+    for (size_t y = 0; y < kRows; y++) {
+      HalveDCT(coefficients + y * kCols, kCols >> s, 1);
+    }
+  }
+  for (size_t s = 0; s < SHIFT; s++) {
+    for (size_t x = 0; x < (kCols >> SHIFT); x++) {
+      HalveDCT(coefficients + x, kRows >> s, kCols);
+    }
+  }
+  // Keep only the low frequencies, in a smaller block.
+  for (size_t y = 0; y < (kRows >> SHIFT); y++) {
+    for (size_t x = 0; x < (kCols >> SHIFT); x++) {
+      coefficients[y * (kCols >> SHIFT) + x] = coefficients[y * kCols + x];
+    }
+  }
+  ComputeScaledIDCT<(ROWS >> SHIFT), (COLS >> SHIFT)>()(
+      coefficients, DCTTo(pixels, pixels_stride), scratch_space);
+}
+
+template <size_t SHIFT>
+void TransformToDownsampledPixels(const AcStrategyType strategy,
+                                  float* JXL_RESTRICT coefficients,
+                                  float* JXL_RESTRICT pixels,
+                                  size_t pixels_stride, float* scratch_space) {
+  using Type = AcStrategyType;
+  switch (strategy) {
+    case Type::DCT: {
+      DownsampledIDCT<8, 8, SHIFT>(coefficients, pixels, pixels_stride,
+                                   scratch_space);
+      break;
+    }
+    case Type::DCT16X16: {
+      DownsampledIDCT<16, 16, SHIFT>(coefficients, pixels, pixels_stride,
+                                     scratch_space);
+      break;
+    }
+    case Type::DCT16X8: {
+      DownsampledIDCT<16, 8, SHIFT>(coefficients, pixels, pixels_stride,
+                                    scratch_space);
+      break;
+    }
+    case Type::DCT8X16: {
+      DownsampledIDCT<8, 16, SHIFT>(coefficients, pixels, pixels_stride,
+                                    scratch_space);
+      break;
+    }
+    case Type::DCT32X8: {
+      DownsampledIDCT<32, 8, SHIFT>(coefficients, pixels, pixels_stride,
+                                    scratch_space);
+      break;
+    }
+    case Type::DCT8X32: {
+      DownsampledIDCT<8, 32, SHIFT>(coefficients, pixels, pixels_stride,
+                                    scratch_space);
+      break;
+    }
+    case Type::DCT32X16: {
+      DownsampledIDCT<32, 16, SHIFT>(coefficients, pixels, pixels_stride,
+                                     scratch_space);
+      break;
+    }
+    case Type::DCT16X32: {
+      DownsampledIDCT<16, 32, SHIFT>(coefficients, pixels, pixels_stride,
+                                     scratch_space);
+      break;
+    }
+    case Type::DCT32X32: {
+      DownsampledIDCT<32, 32, SHIFT>(coefficients, pixels, pixels_stride,
+                                     scratch_space);
+      break;
+    }
+    case Type::DCT64X32: {
+      DownsampledIDCT<64, 32, SHIFT>(coefficients, pixels, pixels_stride,
+                                     scratch_space);
+      break;
+    }
+    case Type::DCT32X64: {
+      DownsampledIDCT<32, 64, SHIFT>(coefficients, pixels, pixels_stride,
+                                     scratch_space);
+      break;
+    }
+    case Type::DCT64X64: {
+      DownsampledIDCT<64, 64, SHIFT>(coefficients, pixels, pixels_stride,
+                                     scratch_space);
+      break;
+    }
+    case Type::DCT128X64: {
+      DownsampledIDCT<128, 64, SHIFT>(coefficients, pixels, pixels_stride,
+                                      scratch_space);
+      break;
+    }
+    case Type::DCT64X128: {
+      DownsampledIDCT<64, 128, SHIFT>(coefficients, pixels, pixels_stride,
+                                      scratch_space);
+      break;
+    }
+    case Type::DCT128X128: {
+      DownsampledIDCT<128, 128, SHIFT>(coefficients, pixels, pixels_stride,
+                                       scratch_space);
+      break;
+    }
+    case Type::DCT256X128: {
+      DownsampledIDCT<256, 128, SHIFT>(coefficients, pixels, pixels_stride,
+                                       scratch_space);
+      break;
+    }
+    case Type::DCT128X256: {
+      DownsampledIDCT<128, 256, SHIFT>(coefficients, pixels, pixels_stride,
+                                       scratch_space);
+      break;
+    }
+    case Type::DCT256X256: {
+      DownsampledIDCT<256, 256, SHIFT>(coefficients, pixels, pixels_stride,
+                                       scratch_space);
+      break;
+    }
+    default: {
+      // The other transforms cover a single 8x8 block: average its pixels.
+      constexpr size_t kSize = 1 << SHIFT;
+      HWY_ALIGN float block[kDCTBlockSize];
+      TransformToPixels(strategy, coefficients, block, kBlockDim,
+                        scratch_space);
+      for (size_t y = 0; y < (kBlockDim >> SHIFT); y++) {
+        for (size_t x = 0; x < (kBlockDim >> SHIFT); x++) {
+          float sum = 0;
+          for (size_t iy = 0; iy < kSize; iy++) {
+            for (size_t ix = 0; ix < kSize; ix++) {
+              sum += block[(y * kSize + iy) * kBlockDim + x * kSize + ix];
+            }
+          }
+          pixels[y * pixels_stride + x] = sum * (1.0f / (kSize * kSize));
+        }
+      }
+      break;
+    }
+  }
+}
+
+// Like TransformToPixels, but writes the block downsampled by 2^shift in both
+// directions, for shift 1 or 2. Overwrites the coefficients.
+HWY_MAYBE_UNUSED void TransformToDownsampledPixels(
+    const AcStrategyType strategy, size_t shift,
+    float* JXL_RESTRICT coefficients, float* JXL_RESTRICT pixels,
+    size_t pixels_stride, float* scratch_space) {
+  if (shift == 1) {
+    TransformToDownsampledPixels<1>(strategy, coefficients, pixels,
+                                    pixels_stride, scratch_space);
+  } else {
+    TransformToDownsampledPixels<2>(strategy, coefficients, pixels,
+                                    pixels_stride, scratch_space);
+  }
+}
+
 HWY_MAYBE_UNUSED void LowestFrequenciesFromDC(const AcStrategyType strategy,
                                               const float* dc, size_t dc_stride,
                                               float* llf,
@@ -101,17 +101,6 @@ Status OpsinToLinear(const Image3F& opsin, const Rect& rect, ThreadPool* pool,
                                              opsin_params);
 }
 
-#if !JXL_HIGH_PRECISION
-HWY_EXPORT(HasFastXYBTosRGB8);
-bool HasFastXYBTosRGB8() { return HWY_DYNAMIC_DISPATCH(HasFastXYBTosRGB8)(); }
-
-HWY_EXPORT(FastXYBTosRGB8);
-Status FastXYBTosRGB8(const float* input[4], uint8_t* output, bool is_rgba,
-                      size_t xsize) {
-  return HWY_DYNAMIC_DISPATCH(FastXYBTosRGB8)(input, output, is_rgba, xsize);
-}
-#endif  // !JXL_HIGH_PRECISION
-
 void OpsinParams::Init(float intensity_target) {
   InitSIMDInverseMatrix(GetOpsinAbsorbanceInverseMatrix(), inverse_opsin_matrix,
                         intensity_target);
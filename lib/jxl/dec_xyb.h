@@ -81,12 +81,6 @@ Status OpsinToLinear(const Image3F& opsin, const Rect& rect, ThreadPool* pool,
                      Image3F* JXL_RESTRICT linear,
                      const OpsinParams& opsin_params);
 
-#if !JXL_HIGH_PRECISION
-bool HasFastXYBTosRGB8();
-Status FastXYBTosRGB8(const float* input[4], uint8_t* output, bool is_rgba,
-                      size_t xsize);
-#endif  // !JXL_HIGH_PRECISION
-
 }  // namespace jxl
 
 #endif  // LIB_JXL_DEC_XYB_H_
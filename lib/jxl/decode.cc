@@ -32,6 +32,8 @@
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/dec_cache.h"
+#include "lib/jxl/dec_external_image.h"
+#include "lib/jxl/dec_trace.h"
 #include "lib/jxl/image_metadata.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 #include "lib/jxl/padded_bytes.h"
@@ -50,8 +52,11 @@
 #include "lib/jxl/frame_header.h"
 #include "lib/jxl/headers.h"
 #include "lib/jxl/icc_codec.h"
+#include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
+#include "lib/jxl/image_ops.h"
 #include "lib/jxl/memory_manager_internal.h"
+#include "lib/jxl/pooled_memory_manager.h"
 
 namespace {
 
@@ -230,17 +235,40 @@ struct FrameRef {
   int saved_as;
 };
 
+// Where an internal frame starts in the input, and the state of the container
+// at that point, to resume decoding from the frame after a seek.
+struct FrameStart {
+  // Offset of the frame header in the input file, or kUnknownFilePos if the
+  // header was buffered across container boxes.
+  size_t file_pos;
+  size_t box_contents_begin;
+  size_t box_contents_end;
+  bool box_contents_unbounded;
+  bool last_codestream_seen;
+  // Index of the external frame that this internal frame is part of.
+  size_t external_index;
+  // Whether this is the last internal frame of its external frame, and if so
+  // the duration of the external frame.
+  bool is_last_of_still;
+  uint32_t duration;
+};
+
+constexpr size_t kUnknownFilePos = ~size_t{0};
+
 /*
 Given list of frame references to storage slots, and storage slots in which this
 frame is saved, computes which frames are required to decode the frame at the
 given index and any frames after it. The frames on which this depends are
 returned as a vector of their indices, in no particular order. The given index
 must be smaller than saved_as.size(), and references.size() must equal
-saved_as.size(). Any frames beyond saved_as and references are considered
-unknown future frames and must be treated as if something depends on them.
+saved_as.size(). The frames from index onwards are decoded, so only the storage
+slots they read before overwriting them are required. Unless all_frames_known
+is set, any frames beyond saved_as and references are considered unknown future
+frames and must be treated as if something depends on them.
 */
 std::vector<size_t> GetFrameDependencies(size_t index,
-                                         const std::vector<FrameRef>& refs) {
+                                         const std::vector<FrameRef>& refs,
+                                         bool all_frames_known) {
   JXL_DASSERT(index < refs.size());
 
   std::vector<size_t> result;
@@ -270,15 +298,24 @@ std::vector<size_t> GetFrameDependencies(size_t index,
   stack.push_back(index);
   seen[index] = 1;
 
-  // For frames after index, assume they can depend on any of the 8 storage
-  // slots, so push the frame for each stored reference to the stack and result.
-  // All frames after index are treated as having unknown references and with
-  // the possibility that there are more frames after the last known.
-  // TODO(lode): take values of saved_as and references after index, and a
-  // input flag indicating if they are all frames of the image, to further
-  // optimize this.
+  // Storage slots read by the frame at index or a later frame before one of
+  // them overwrites the slot. Frames whose references are not known yet have
+  // all bits set in their references.
+  int read_slots = 0;
+  int overwritten_slots = 0;
+  for (size_t i = index; i < refs.size(); ++i) {
+    read_slots |= refs[i].reference & ~overwritten_slots;
+    overwritten_slots |= refs[i].saved_as;
+  }
+  // Unknown frames after the last known one can read any slot.
+  if (!all_frames_known) read_slots |= ~overwritten_slots;
+
+  // Push the frame for each stored reference that is read to the stack and
+  // result.
   for (size_t s = 0; s < kNumStorage; ++s) {
-    size_t frame_ref = storage[s][index];
+    if (index == 0) break;  // first frame cannot have references
+    if (!(read_slots & (1 << s))) continue;
+    size_t frame_ref = storage[s][index - 1];
     if (frame_ref == invalid) continue;
     if (seen[frame_ref]) continue;
     stack.push_back(frame_ref);
@@ -358,10 +395,19 @@ struct JxlDecoderFrameIndexBox {
 
 }  // namespace jxl
 
+static JxlDecoderStatus ParseBoxHeader(const uint8_t* in, size_t size,
+                                       size_t pos, size_t file_pos,
+                                       JxlBoxType type, uint64_t* box_size,
+                                       uint64_t* header_size);
+
 // NOLINTNEXTLINE(clang-analyzer-optin.performance.Padding)
 struct JxlDecoder {
   JxlDecoder() = default;
 
+  // Wraps the memory manager passed at creation. Declared first, so that all
+  // other members have released their buffers when it is destroyed.
+  jxl::PooledMemoryManager buffer_pool;
+  // The buffer pool; used for all allocations of the decoder.
   JxlMemoryManager memory_manager;
   std::unique_ptr<jxl::ThreadPool> thread_pool;
 
@@ -425,6 +471,7 @@ struct JxlDecoder {
   bool unpremul_alpha;
   bool render_spotcolors;
   bool coalescing;
+  bool row_streaming;
   float desired_intensity_target;
 
   // Bitfield, for which informative events (JXL_DEC_BASIC_INFO, etc...) the
@@ -449,6 +496,20 @@ struct JxlDecoder {
   // Set to true if either an image out buffer or an image out callback was set.
   bool image_out_buffer_set;
 
+  // Region of the main image that is output, in oriented coordinates. A zero
+  // size means the whole image.
+  size_t crop_x0;
+  size_t crop_y0;
+  size_t crop_xsize;
+  size_t crop_ysize;
+
+  // The main image is output at 1/output_scale of its size.
+  uint32_t output_scale;
+  // Memory layout of the image output buffer of the main image.
+  JxlImageOutLayout image_out_layout;
+  // Set by JxlDecoderSetTraceCallback, disabled by default.
+  jxl::DecoderTrace trace;
+
   // Owned by the caller, buffer for preview or full resolution image.
   void* image_out_buffer;
   JxlImageOutInitCallback image_out_init_callback;
@@ -508,6 +569,12 @@ struct JxlDecoder {
   size_t external_frames;
 
   std::vector<FrameRef> frame_refs;
+  // Start of each internal frame in the input, the frame index used for
+  // seeking.
+  std::vector<FrameStart> frame_starts;
+  // Whether the header of the last frame of the codestream was seen, so that
+  // frame_refs and frame_starts list all frames.
+  bool all_frames_seen;
 
   // Translates external frame index to internal frame index. The external
   // index is the index of user-visible frames. The internal index can be larger
@@ -568,6 +635,15 @@ struct JxlDecoder {
   const uint8_t* next_in;
   size_t avail_in;
   bool input_closed;
+  // The whole input was given by JxlDecoderSetResidentInput and stays valid,
+  // so the codestream is read in place, also across container boxes.
+  bool input_resident;
+  // In resident mode, codestream bytes of the current and next container boxes
+  // joined for a header that crosses a box boundary. Only valid if
+  // resident_stitch_size is not zero, which is the size requested by the last
+  // RequestMoreInput.
+  std::vector<uint8_t> resident_stitched;
+  size_t resident_stitch_size;
 
   void AdvanceInput(size_t size) {
     JXL_DASSERT(avail_in >= size);
@@ -586,6 +662,7 @@ struct JxlDecoder {
   }
 
   void AdvanceCodestream(size_t size) {
+    resident_stitch_size = 0;
     size_t avail_codestream = AvailableCodestream();
     if (codestream_copy.empty()) {
       if (size <= avail_codestream) {
@@ -608,7 +685,61 @@ struct JxlDecoder {
     }
   }
 
+  // In resident mode, gets the codestream bytes that follow next_in in the
+  // input: the rest of the current container box, followed by the contents of
+  // the next jxlp boxes.
+  void GetResidentCodestream(
+      std::vector<jxl::Span<const uint8_t>>* fragments) const {
+    fragments->clear();
+    fragments->push_back(jxl::Bytes(next_in, AvailableCodestream()));
+    if (!have_container || box_contents_unbounded || last_codestream_seen) {
+      return;
+    }
+    size_t pos = box_contents_end - file_pos;
+    while (pos < avail_in) {
+      JxlBoxType type;
+      uint64_t box_size;
+      uint64_t header_size;
+      if (ParseBoxHeader(next_in, avail_in, pos, file_pos + pos, type,
+                         &box_size, &header_size) != JXL_DEC_SUCCESS) {
+        return;
+      }
+      bool last_box = (box_size == 0 || box_size >= avail_in - pos);
+      size_t end = last_box ? avail_in : pos + box_size;
+      if (memcmp(type, "jxlp", 4) == 0) {
+        size_t begin = pos + header_size + 4;
+        if (begin > end) return;
+        fragments->push_back(jxl::Bytes(next_in + begin, end - begin));
+        // The high bit of the index marks the last jxlp box.
+        if (LoadBE32(next_in + pos + header_size) & 0x80000000) return;
+      } else if (memcmp(type, "jxlc", 4) == 0) {
+        return;
+      }
+      if (last_box) return;
+      pos = end;
+    }
+  }
+
   JxlDecoderStatus RequestMoreInput() {
+    if (input_resident) {
+      // All input is there, so more codestream can only come from the next
+      // container boxes: join them to the current one, growing the joined
+      // size geometrically to bound the bytes copied for each header.
+      size_t avail_codestream = AvailableCodestream();
+      if (codestream_pos == 0 && avail_codestream > 0) {
+        std::vector<jxl::Span<const uint8_t>> fragments;
+        GetResidentCodestream(&fragments);
+        size_t total = 0;
+        for (const auto& fragment : fragments) total += fragment.size();
+        size_t have = resident_stitch_size != 0 ? resident_stitched.size()
+                                                : avail_codestream;
+        if (have < total) {
+          resident_stitch_size =
+              std::min(total, std::max<size_t>(2 * have, have + 4096));
+        }
+      }
+      return JXL_DEC_NEED_MORE_INPUT;
+    }
     if (codestream_copy.empty()) {
       size_t avail_codestream = AvailableCodestream();
       codestream_copy.insert(codestream_copy.end(), next_in,
@@ -621,6 +752,30 @@ struct JxlDecoder {
     return JXL_DEC_NEED_MORE_INPUT;
   }
 
+  // Returns the position in the input file of the first byte of the span
+  // returned by GetCodestreamInput, or kUnknownFilePos if that span was
+  // buffered from several container boxes.
+  size_t CodestreamInputFilePos() const {
+    if (codestream_copy.empty()) return file_pos;
+    // next_in is at codestream_copy.size() - codestream_unconsumed.
+    size_t next_in_pos = codestream_copy.size() - codestream_unconsumed;
+    if (codestream_pos >= next_in_pos) {
+      return file_pos + (codestream_pos - next_in_pos);
+    }
+    size_t buffered = next_in_pos - codestream_pos;
+    if (buffered > file_pos ||
+        (have_container && file_pos - buffered < box_contents_begin)) {
+      return kUnknownFilePos;
+    }
+    return file_pos - buffered;
+  }
+
+  // Whether RequestMoreInput asked for joined codestream that
+  // GetCodestreamInput did not provide yet.
+  bool ResidentStitchPending() const {
+    return resident_stitch_size > resident_stitched.size();
+  }
+
   JxlDecoderStatus GetCodestreamInput(jxl::Span<const uint8_t>* span) {
     if (codestream_copy.empty() && codestream_pos > 0) {
       size_t avail_codestream = AvailableCodestream();
@@ -631,6 +786,19 @@ struct JxlDecoder {
         return RequestMoreInput();
       }
     }
+    if (resident_stitch_size != 0) {
+      std::vector<jxl::Span<const uint8_t>> fragments;
+      GetResidentCodestream(&fragments);
+      resident_stitched.clear();
+      for (const auto& fragment : fragments) {
+        size_t size = std::min(fragment.size(),
+                               resident_stitch_size - resident_stitched.size());
+        resident_stitched.insert(resident_stitched.end(), fragment.data(),
+                                 fragment.data() + size);
+      }
+      *span = jxl::Bytes(resident_stitched.data(), resident_stitched.size());
+      return JXL_DEC_SUCCESS;
+    }
     if (codestream_pos > codestream_copy.size()) {
       return JXL_API_ERROR("Internal: codestream_pos > codestream_copy.size()");
     }
@@ -740,6 +908,9 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->next_in = nullptr;
   dec->avail_in = 0;
   dec->input_closed = false;
+  dec->input_resident = false;
+  dec->resident_stitched.clear();
+  dec->resident_stitch_size = 0;
 
   dec->passes_state.reset();
   dec->frame_dec.reset();
@@ -774,13 +945,23 @@ void JxlDecoderReset(JxlDecoder* dec) {
   dec->unpremul_alpha = false;
   dec->render_spotcolors = true;
   dec->coalescing = true;
+  dec->row_streaming = false;
   dec->desired_intensity_target = 0;
   dec->orig_events_wanted = 0;
   dec->events_wanted = 0;
   dec->frame_refs.clear();
+  dec->frame_starts.clear();
+  dec->all_frames_seen = false;
   dec->frame_external_to_internal.clear();
   dec->frame_required.clear();
   dec->decompress_boxes = false;
+  dec->crop_x0 = 0;
+  dec->crop_y0 = 0;
+  dec->crop_xsize = 0;
+  dec->crop_ysize = 0;
+  dec->output_scale = 1;
+  dec->image_out_layout = JXL_IMAGE_OUT_INTERLEAVED;
+  dec->trace = jxl::DecoderTrace();
 }
 
 JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
@@ -793,7 +974,8 @@ JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
   if (!alloc) return nullptr;
   // Placement new constructor on allocated memory
   JxlDecoder* dec = new (alloc) JxlDecoder();
-  dec->memory_manager = local_memory_manager;
+  dec->buffer_pool.SetUpstream(local_memory_manager);
+  dec->memory_manager = *dec->buffer_pool.get();
 
   JxlDecoderReset(dec);
 
@@ -802,7 +984,7 @@ JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
 
 void JxlDecoderDestroy(JxlDecoder* dec) {
   if (dec) {
-    JxlMemoryManager local_memory_manager = dec->memory_manager;
+    JxlMemoryManager local_memory_manager = dec->buffer_pool.upstream();
     // Call destructor directly since custom free function is used.
     dec->~JxlDecoder();
     jxl::MemoryManagerFree(&local_memory_manager, dec);
@@ -828,8 +1010,8 @@ void JxlDecoderSkipFrames(JxlDecoder* dec, size_t amount) {
   if (next_frame < dec->frame_external_to_internal.size()) {
     size_t internal_index = dec->frame_external_to_internal[next_frame];
     if (internal_index < dec->frame_refs.size()) {
-      std::vector<size_t> deps =
-          GetFrameDependencies(internal_index, dec->frame_refs);
+      std::vector<size_t> deps = GetFrameDependencies(
+          internal_index, dec->frame_refs, dec->all_frames_seen);
 
       dec->frame_required.resize(internal_index + 1, 0);
       for (size_t idx : deps) {
@@ -856,6 +1038,142 @@ JxlDecoderStatus JxlDecoderSkipCurrentFrame(JxlDecoder* dec) {
   return JXL_DEC_SUCCESS;
 }
 
+namespace {
+
+// Gets the range [begin, end) of internal frames that make up the external
+// frame with the given index. Returns false if the headers of these frames were
+// not all seen yet.
+bool GetIndexedFrameRange(const JxlDecoder* dec, size_t index, size_t* begin,
+                          size_t* end) {
+  if (index >= dec->frame_external_to_internal.size()) return false;
+  *begin = dec->frame_external_to_internal[index];
+  *end = index + 1 < dec->frame_external_to_internal.size()
+             ? dec->frame_external_to_internal[index + 1]
+             : dec->frame_starts.size();
+  return *begin < *end && dec->frame_starts[*end - 1].is_last_of_still;
+}
+
+// Returns the earliest external frame from which decoding must start to
+// reconstruct the external frame with the given index.
+size_t GetKeyframe(const JxlDecoder* dec, size_t index) {
+  size_t internal_index = dec->frame_external_to_internal[index];
+  std::vector<size_t> deps = GetFrameDependencies(
+      internal_index, dec->frame_refs, dec->all_frames_seen);
+  for (size_t idx : deps) {
+    internal_index = std::min(internal_index, idx);
+  }
+  return dec->frame_starts[internal_index].external_index;
+}
+
+}  // namespace
+
+size_t JxlDecoderGetNumIndexedFrames(const JxlDecoder* dec) {
+  size_t num_frames = dec->frame_external_to_internal.size();
+  size_t begin;
+  size_t end;
+  if (num_frames > 0 &&
+      !GetIndexedFrameRange(dec, num_frames - 1, &begin, &end)) {
+    num_frames--;
+  }
+  return num_frames;
+}
+
+JxlDecoderStatus JxlDecoderGetFrameIndexEntry(const JxlDecoder* dec,
+                                              size_t index,
+                                              JxlFrameIndexEntry* entry) {
+  size_t begin;
+  size_t end;
+  if (!GetIndexedFrameRange(dec, index, &begin, &end)) {
+    return JXL_API_ERROR("frame is not indexed");
+  }
+  const FrameStart& start = dec->frame_starts[begin];
+  entry->file_offset = start.file_pos == kUnknownFilePos
+                           ? JXL_FRAME_OFFSET_UNKNOWN
+                           : static_cast<uint64_t>(start.file_pos);
+  entry->duration = dec->frame_starts[end - 1].duration;
+  entry->keyframe = static_cast<uint32_t>(GetKeyframe(dec, index));
+  entry->references = 0;
+  entry->saved_as = 0;
+  for (size_t i = begin; i < end; ++i) {
+    entry->references |= dec->frame_refs[i].reference & 0xF;
+    entry->saved_as |= dec->frame_refs[i].saved_as & 0xF;
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSeekToFrame(JxlDecoder* dec, size_t index,
+                                       uint64_t* file_offset) {
+  if (dec->stage == DecoderStage::kError) {
+    return JXL_API_ERROR("cannot seek after the decoder encountered an error");
+  }
+  if (!dec->got_all_headers) {
+    return JXL_API_ERROR("cannot seek before the headers are decoded");
+  }
+  size_t begin;
+  size_t end;
+  if (!GetIndexedFrameRange(dec, index, &begin, &end)) {
+    return JXL_API_ERROR("frame is not indexed");
+  }
+  size_t keyframe = GetKeyframe(dec, index);
+  size_t keyframe_internal = dec->frame_external_to_internal[keyframe];
+  const FrameStart& start = dec->frame_starts[keyframe_internal];
+  if (start.file_pos == kUnknownFilePos) {
+    return JXL_API_ERROR("position of the keyframe is unknown");
+  }
+
+  // Resume the codestream at the header of the keyframe, with the container
+  // state at that point; the image headers stay decoded.
+  dec->stage = DecoderStage::kStarted;
+  dec->events_wanted =
+      dec->orig_events_wanted &
+      ~(JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING | JXL_DEC_PREVIEW_IMAGE |
+        JXL_DEC_JPEG_RECONSTRUCTION);
+  dec->file_pos = start.file_pos;
+  dec->box_stage = BoxStage::kCodestream;
+  dec->box_contents_begin = start.box_contents_begin;
+  dec->box_contents_end = start.box_contents_end;
+  dec->box_contents_unbounded = start.box_contents_unbounded;
+  dec->last_codestream_seen = start.last_codestream_seen;
+  dec->header_size = 0;
+  dec->box_event = false;
+  dec->box_out_buffer_set_current_box = false;
+  dec->next_in = nullptr;
+  dec->avail_in = 0;
+  dec->input_closed = false;
+  dec->input_resident = false;
+  dec->resident_stitch_size = 0;
+  dec->codestream_copy.clear();
+  dec->codestream_unconsumed = 0;
+  dec->codestream_pos = 0;
+  dec->codestream_bits_ahead = 0;
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  dec->recon_output_jpeg = JpegReconStage::kNone;
+#endif
+
+  dec->got_preview_image = true;
+  dec->preview_frame = false;
+  dec->image_out_buffer_set = false;
+  dec->extra_channel_output.clear();
+  dec->frame_dec.reset();
+  dec->ib.reset();
+  dec->next_section = 0;
+  dec->section_processed.clear();
+  dec->frame_stage = FrameStage::kHeader;
+  dec->remaining_frame_size = 0;
+  dec->is_last_of_still = false;
+  dec->is_last_total = false;
+  dec->skipping_frame = false;
+  dec->skip_frames = 0;
+  dec->internal_frames = keyframe_internal;
+  dec->external_frames = keyframe;
+  // Decodes only the frames between the keyframe and the requested frame that
+  // the requested frame depends on.
+  JxlDecoderSkipFrames(dec, index - keyframe);
+
+  *file_offset = start.file_pos;
+  return JXL_DEC_SUCCESS;
+}
+
 JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque) {
@@ -868,6 +1186,21 @@ JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetParallelRunnerNesting(JxlDecoder* dec,
+                                                    JXL_BOOL allow_nesting) {
+  if (!dec->thread_pool) {
+    return JXL_API_ERROR("parallel runner not set");
+  }
+  dec->thread_pool->SetAllowNesting(FROM_JXL_BOOL(allow_nesting));
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetBufferPoolLimit(JxlDecoder* dec,
+                                              size_t max_bytes) {
+  dec->buffer_pool.SetMaxRetainedBytes(max_bytes);
+  return JXL_DEC_SUCCESS;
+}
+
 size_t JxlDecoderSizeHintBasicInfo(const JxlDecoder* dec) {
   if (dec->got_basic_info) return 0;
   return dec->basic_info_size_hint;
@@ -920,6 +1253,106 @@ JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec, JXL_BOOL coalescing) {
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetCropRegion(JxlDecoder* dec, size_t x0,
+                                         size_t y0, size_t xsize,
+                                         size_t ysize) {
+  if (!dec->got_basic_info) {
+    return JXL_API_ERROR("Basic info not yet available");
+  }
+  if (!dec->coalescing) {
+    return JXL_API_ERROR("Crop region requires coalescing");
+  }
+  if (dec->image_out_buffer_set) {
+    return JXL_API_ERROR("Crop region must be set before the output buffer");
+  }
+  const size_t image_xsize =
+      dec->metadata.oriented_xsize(dec->keep_orientation);
+  const size_t image_ysize =
+      dec->metadata.oriented_ysize(dec->keep_orientation);
+  if (xsize == 0 || ysize == 0 || x0 > image_xsize ||
+      xsize > image_xsize - x0 || y0 > image_ysize ||
+      ysize > image_ysize - y0) {
+    return JXL_API_ERROR("Crop region outside of the image");
+  }
+  if (x0 == 0 && y0 == 0 && xsize == image_xsize && ysize == image_ysize) {
+    xsize = ysize = 0;
+  }
+  if (xsize != 0 && dec->output_scale != 1) {
+    return JXL_API_ERROR("Crop region cannot be combined with an output scale");
+  }
+  if (xsize != 0 && dec->row_streaming) {
+    return JXL_API_ERROR("Crop region cannot be combined with row streaming");
+  }
+  dec->crop_x0 = x0;
+  dec->crop_y0 = y0;
+  dec->crop_xsize = xsize;
+  dec->crop_ysize = ysize;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetOutputScale(JxlDecoder* dec, uint32_t scale) {
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+    return JXL_API_ERROR("Output scale must be 1, 2, 4 or 8");
+  }
+  if (dec->image_out_buffer_set) {
+    return JXL_API_ERROR("Output scale must be set before the output buffer");
+  }
+  if (scale != 1 && dec->crop_xsize != 0) {
+    return JXL_API_ERROR("Output scale cannot be combined with a crop region");
+  }
+  if (scale != 1 && dec->image_out_layout != JXL_IMAGE_OUT_INTERLEAVED) {
+    return JXL_API_ERROR("Output scale cannot be combined with a layout");
+  }
+  if (scale != 1 && dec->row_streaming) {
+    return JXL_API_ERROR("Output scale cannot be combined with row streaming");
+  }
+  dec->output_scale = scale;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetImageOutLayout(JxlDecoder* dec,
+                                             JxlImageOutLayout layout) {
+  if (layout != JXL_IMAGE_OUT_INTERLEAVED && layout != JXL_IMAGE_OUT_PLANAR &&
+      layout != JXL_IMAGE_OUT_I420 && layout != JXL_IMAGE_OUT_P010) {
+    return JXL_API_ERROR("Invalid image out layout");
+  }
+  if (dec->image_out_buffer_set) {
+    return JXL_API_ERROR("Image out layout must be set before the buffer");
+  }
+  if (layout != JXL_IMAGE_OUT_INTERLEAVED && dec->output_scale != 1) {
+    return JXL_API_ERROR("Image out layout cannot be combined with a scale");
+  }
+  dec->image_out_layout = layout;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetRowStreaming(JxlDecoder* dec,
+                                           JXL_BOOL row_streaming) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set row streaming option before starting");
+  }
+  if (row_streaming && dec->output_scale != 1) {
+    return JXL_API_ERROR("Row streaming cannot be combined with a scale");
+  }
+  if (row_streaming && dec->crop_xsize != 0) {
+    // The crop region is kept by JxlDecoderRewind.
+    return JXL_API_ERROR("Row streaming cannot be combined with a crop region");
+  }
+  dec->row_streaming = FROM_JXL_BOOL(row_streaming);
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetTraceCallback(JxlDecoder* dec,
+                                            JxlDecoderTraceCallback callback,
+                                            void* opaque) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR(
+        "JxlDecoderSetTraceCallback must be called before starting");
+  }
+  dec->trace = jxl::DecoderTrace(callback, opaque);
+  return JXL_DEC_SUCCESS;
+}
+
 namespace {
 // helper function to get the dimensions of the current image buffer
 void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
@@ -940,6 +1373,66 @@ void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
     }
   }
 }
+
+bool HasCropRegion(const JxlDecoder* dec) {
+  return dec->crop_xsize != 0 && !dec->frame_header->nonserialized_is_preview;
+}
+
+// The preview is always output at full size.
+size_t GetOutputScale(const JxlDecoder* dec) {
+  return dec->frame_header->nonserialized_is_preview ? 1 : dec->output_scale;
+}
+
+// The preview is always output interleaved.
+JxlImageOutLayout GetOutputLayout(const JxlDecoder* dec) {
+  return dec->frame_header->nonserialized_is_preview ? JXL_IMAGE_OUT_INTERLEAVED
+                                                     : dec->image_out_layout;
+}
+
+// Dimensions of the output buffer: those of the current image buffer,
+// restricted to the crop region or reduced by the output scale if any.
+void GetOutputDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
+  if (HasCropRegion(dec)) {
+    xsize = dec->crop_xsize;
+    ysize = dec->crop_ysize;
+    return;
+  }
+  GetCurrentDimensions(dec, xsize, ysize);
+  const size_t scale = GetOutputScale(dec);
+  xsize = jxl::DivCeil(xsize, scale);
+  ysize = jxl::DivCeil(ysize, scale);
+}
+
+// Whether the current frame is rendered at full resolution and downsampled
+// afterwards, because it cannot be rendered at the output scale directly.
+bool DownsamplesOutput(const JxlDecoder* dec) {
+  const size_t scale = GetOutputScale(dec);
+  return scale != 1 && !dec->frame_dec->CanRenderAtScale(scale);
+}
+
+// Returns the top left corner of the crop region in the coordinates of the
+// image as stored in the codestream, i.e. before undoing the orientation.
+void GetStoredCropOrigin(const JxlDecoder* dec, size_t& x0, size_t& y0) {
+  size_t xbegin = dec->crop_x0;
+  size_t ybegin = dec->crop_y0;
+  size_t xsize = dec->crop_xsize;
+  size_t ysize = dec->crop_ysize;
+  if (!dec->keep_orientation) {
+    const uint32_t orientation = dec->metadata.m.orientation;
+    if (orientation > 4) {
+      std::swap(xbegin, ybegin);
+      std::swap(xsize, ysize);
+    }
+    const bool flip_x = orientation == 2 || orientation == 3 ||
+                        orientation == 7 || orientation == 8;
+    const bool flip_y = orientation == 3 || orientation == 4 ||
+                        orientation == 6 || orientation == 7;
+    if (flip_x) xbegin = dec->metadata.xsize() - xbegin - xsize;
+    if (flip_y) ybegin = dec->metadata.ysize() - ybegin - ysize;
+  }
+  x0 = xbegin;
+  y0 = ybegin;
+}
 }  // namespace
 
 namespace jxl {
@@ -1093,9 +1586,79 @@ JxlDecoderStatus JxlDecoderReadAllHeaders(JxlDecoder* dec) {
   return JXL_DEC_SUCCESS;
 }
 
+size_t GetOutputStride(size_t xsize, const JxlPixelFormat& format) {
+  size_t stride = DivCeil(
+      xsize * format.num_channels * BitsPerChannel(format.data_type),
+      kBitsPerByte);
+  if (format.align > 1) stride = DivCeil(stride, format.align) * format.align;
+  return stride;
+}
+
+// Writes the frame that was rendered to dec->ib at full resolution to the
+// output buffers, downsampled by the output scale.
+Status WriteDownsampledOutput(JxlDecoder* dec) {
+  const size_t scale = dec->output_scale;
+  const ImageBundle& full = *dec->ib;
+  ImageBundle ib(&dec->memory_manager, &dec->image_metadata);
+  JXL_ASSIGN_OR_RETURN(Image3F color, DownsampleImage(full.color(), scale));
+  JXL_RETURN_IF_ERROR(ib.SetFromImage(std::move(color), full.c_current()));
+  std::vector<ImageF> extra_channels;
+  for (const ImageF& channel : full.extra_channels()) {
+    JXL_ASSIGN_OR_RETURN(ImageF downsampled, DownsampleImage(channel, scale));
+    extra_channels.emplace_back(std::move(downsampled));
+  }
+  JXL_RETURN_IF_ERROR(ib.SetExtraChannels(std::move(extra_channels)));
+
+  const Orientation undo_orientation = dec->keep_orientation
+                                           ? Orientation::kIdentity
+                                           : dec->metadata.m.GetOrientation();
+  const size_t xsize = static_cast<uint32_t>(undo_orientation) > 4
+                           ? ib.ysize()
+                           : ib.xsize();
+  const JxlPixelFormat& format = dec->image_out_format;
+  const bool float_out = format.data_type == JXL_TYPE_FLOAT ||
+                         format.data_type == JXL_TYPE_FLOAT16;
+  JXL_RETURN_IF_ERROR(ConvertToExternal(
+      ib, GetBitDepth(dec->image_out_bit_depth, dec->metadata.m, format),
+      float_out, format.num_channels, format.endianness,
+      GetOutputStride(xsize, format), dec->thread_pool.get(),
+      dec->image_out_buffer, dec->image_out_size,
+      PixelCallback{dec->image_out_init_callback, dec->image_out_run_callback,
+                    dec->image_out_destroy_callback,
+                    dec->image_out_init_opaque},
+      undo_orientation, dec->unpremul_alpha && ib.AlphaIsPremultiplied()));
+  for (size_t i = 0; i < dec->extra_channel_output.size(); ++i) {
+    const ExtraChannelOutput& extra = dec->extra_channel_output[i];
+    if (!extra.buffer) continue;
+    const ImageF* channels[] = {&ib.extra_channels()[i]};
+    const bool ec_float_out = extra.format.data_type == JXL_TYPE_FLOAT ||
+                              extra.format.data_type == JXL_TYPE_FLOAT16;
+    JXL_RETURN_IF_ERROR(ConvertChannelsToExternal(
+        channels, 1,
+        GetBitDepth(dec->image_out_bit_depth,
+                    dec->metadata.m.extra_channel_info[i], extra.format),
+        ec_float_out, extra.format.endianness,
+        GetOutputStride(xsize, extra.format), dec->thread_pool.get(),
+        extra.buffer, extra.buffer_size, PixelCallback(), undo_orientation));
+  }
+  return true;
+}
+
 JxlDecoderStatus JxlDecoderProcessSections(JxlDecoder* dec) {
   Span<const uint8_t> span;
   JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
+  // In resident mode, sections are read in place from the current and the
+  // next container boxes.
+  std::vector<Span<const uint8_t>> fragments;
+  if (dec->input_resident) {
+    dec->GetResidentCodestream(&fragments);
+  } else {
+    fragments.push_back(span);
+  }
+  // Sections that cross a box boundary are copied here.
+  std::vector<std::vector<uint8_t>> joined_sections;
+  size_t fragment = 0;
+  size_t fragment_begin = 0;
   const auto& toc = dec->frame_dec->Toc();
   size_t pos = 0;
   std::vector<jxl::FrameDecoder::SectionInfo> section_info;
@@ -1105,12 +1668,42 @@ JxlDecoderStatus JxlDecoderProcessSections(JxlDecoder* dec) {
       pos += toc[i].size;
       continue;
     }
+    if (dec->frame_dec->IsSectionDone(toc[i].id)) {
+      // Not needed for the output region: skipped without reading it.
+      dec->section_processed[i] = 1;
+      pos += toc[i].size;
+      continue;
+    }
     size_t id = toc[i].id;
     size_t size = toc[i].size;
-    if (OutOfBounds(pos, size, span.size())) {
+    while (fragment + 1 < fragments.size() &&
+           pos >= fragment_begin + fragments[fragment].size()) {
+      fragment_begin += fragments[fragment].size();
+      ++fragment;
+    }
+    Span<const uint8_t> bytes;
+    const size_t offset = pos - fragment_begin;
+    if (offset > fragments[fragment].size()) {
       break;
     }
-    auto* br = new jxl::BitReader(jxl::Bytes(span.data() + pos, size));
+    if (!OutOfBounds(offset, size, fragments[fragment].size())) {
+      bytes = jxl::Bytes(fragments[fragment].data() + offset, size);
+    } else {
+      std::vector<uint8_t> joined;
+      for (size_t f = fragment; f < fragments.size() && joined.size() < size;
+           ++f) {
+        size_t begin = (f == fragment) ? offset : 0;
+        size_t n = std::min(size - joined.size(), fragments[f].size() - begin);
+        joined.insert(joined.end(), fragments[f].data() + begin,
+                      fragments[f].data() + begin + n);
+      }
+      if (joined.size() < size) {
+        break;
+      }
+      joined_sections.push_back(std::move(joined));
+      bytes = jxl::Bytes(joined_sections.back());
+    }
+    auto* br = new jxl::BitReader(bytes);
     section_info.emplace_back(jxl::FrameDecoder::SectionInfo{br, id, i});
     section_status.emplace_back();
     pos += size;
@@ -1242,12 +1835,15 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       if (!dec->jpeg_decoder.SetImageBundleJpegData(dec->ib.get()))
         return JXL_DEC_ERROR;
 #endif
+      dec->passes_state->trace = dec->trace.enabled() ? &dec->trace : nullptr;
       dec->frame_dec = jxl::make_unique<FrameDecoder>(
           dec->passes_state.get(), dec->metadata, dec->thread_pool.get(),
           /*use_slow_rendering_pipeline=*/false);
+      dec->frame_dec->SetRowStreaming(dec->row_streaming);
       dec->frame_header = jxl::make_unique<FrameHeader>(&dec->metadata);
       Span<const uint8_t> span;
       JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
+      const size_t frame_file_pos = dec->CodestreamInputFilePos();
       auto reader = GetBitReader(span);
       jxl::Status status = dec->frame_dec->InitFrame(
           reader.get(), dec->ib.get(), dec->preview_frame);
@@ -1316,15 +1912,22 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       }
 
       if (internal_frame_index >= dec->frame_refs.size()) {
-        // add the value 0xff (which means all references) to new slots: we only
-        // know the references of the frame at FinalizeFrame, and fill in the
-        // correct values there. As long as this information is not known, the
-        // worst case where the frame depends on all storage slots is assumed.
-        dec->frame_refs.emplace_back(FrameRef{0xFF, saved_as});
-        if (dec->frame_refs.size() != internal_frame_index + 1) {
+        // We only know the exact references of the frame at FinalizeFrame, and
+        // fill in the correct values there. As long as this information is not
+        // known, the worst case allowed by the frame header is assumed.
+        int references = FrameDecoder::MaxReferences(*dec->frame_header);
+        dec->frame_refs.emplace_back(FrameRef{references, saved_as});
+        dec->frame_starts.emplace_back(FrameStart{
+            frame_file_pos, dec->box_contents_begin, dec->box_contents_end,
+            dec->box_contents_unbounded, dec->last_codestream_seen,
+            external_frame_index, dec->is_last_of_still,
+            dec->frame_header->animation_frame.duration});
+        if (dec->frame_refs.size() != internal_frame_index + 1 ||
+            dec->frame_starts.size() != internal_frame_index + 1) {
           return JXL_API_ERROR("internal");
         }
       }
+      if (dec->is_last_total) dec->all_frames_seen = true;
 
       if (dec->skipping_frame) {
         // Whether this frame could be referenced by any future frame: either
@@ -1403,10 +2006,11 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         }
       }
 
-      if (dec->image_out_buffer_set) {
+      // Frames that are downsampled afterwards are rendered to dec->ib.
+      if (dec->image_out_buffer_set && !DownsamplesOutput(dec)) {
         size_t xsize;
         size_t ysize;
-        GetCurrentDimensions(dec, xsize, ysize);
+        GetOutputDimensions(dec, xsize, ysize);
         size_t bits_per_sample = GetBitDepth(
             dec->image_out_bit_depth, dec->metadata.m, dec->image_out_format);
         dec->frame_dec->SetImageOutput(
@@ -1416,6 +2020,18 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
             reinterpret_cast<uint8_t*>(dec->image_out_buffer),
             dec->image_out_size, xsize, ysize, dec->image_out_format,
             bits_per_sample, dec->unpremul_alpha, !dec->keep_orientation);
+        if (HasCropRegion(dec)) {
+          size_t x0;
+          size_t y0;
+          GetStoredCropOrigin(dec, x0, y0);
+          dec->frame_dec->SetImageOutputOrigin(x0, y0);
+        }
+        if (GetOutputScale(dec) != 1) {
+          dec->frame_dec->SetImageOutputScale(GetOutputScale(dec));
+        }
+        if (GetOutputLayout(dec) != JXL_IMAGE_OUT_INTERLEAVED) {
+          dec->frame_dec->SetImageOutputLayout(GetOutputLayout(dec));
+        }
         for (size_t i = 0; i < dec->extra_channel_output.size(); ++i) {
           const auto& extra = dec->extra_channel_output[i];
           size_t ec_bits_per_sample =
@@ -1482,6 +2098,10 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         return JXL_DEC_FULL_IMAGE;
       }
 #endif
+      if (dec->image_out_buffer_set && dec->is_last_of_still &&
+          !dec->skipping_frame && DownsamplesOutput(dec)) {
+        JXL_API_RETURN_IF_ERROR(WriteDownsampledOutput(dec));
+      }
       if (dec->preview_frame || dec->is_last_of_still) {
         dec->image_out_buffer_set = false;
         dec->extra_channel_output.clear();
@@ -1527,6 +2147,14 @@ JxlDecoderStatus JxlDecoderSetInput(JxlDecoder* dec, const uint8_t* data,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetResidentInput(JxlDecoder* dec,
+                                            const uint8_t* data, size_t size) {
+  JXL_API_RETURN_IF_ERROR(JxlDecoderSetInput(dec, data, size));
+  dec->input_closed = true;
+  dec->input_resident = true;
+  return JXL_DEC_SUCCESS;
+}
+
 size_t JxlDecoderReleaseInput(JxlDecoder* dec) {
   size_t result = dec->avail_in;
   dec->next_in = nullptr;
@@ -1907,6 +2535,10 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
       }
 #endif
       if (status == JXL_DEC_NEED_MORE_INPUT) {
+        if (dec->ResidentStitchPending()) {
+          // Retry with the codestream of the next boxes joined to the input.
+          continue;
+        }
         if (dec->file_pos == dec->box_contents_end &&
             !dec->box_contents_unbounded) {
           dec->box_stage = BoxStage::kHeader;
@@ -2029,6 +2661,7 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
         "Cannot keep using decoder after it encountered an error, use "
         "JxlDecoderReset to reset it");
   }
+  dec->trace.SetCallingThread();
 
   if (!dec->got_signature) {
     JxlSignature sig = JxlSignatureCheck(dec->next_in, dec->avail_in);
@@ -2333,10 +2966,20 @@ JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec) {
     // to work correctly.
     return JXL_DEC_ERROR;
   }
+  if (dec->image_out_layout == JXL_IMAGE_OUT_I420 ||
+      dec->image_out_layout == JXL_IMAGE_OUT_P010) {
+    // A flush draws parts of the frame that are drawn again later, while
+    // the chroma samples of the YCbCr layouts are written once per frame.
+    return JXL_DEC_ERROR;
+  }
 
+  dec->trace.SetCallingThread();
   if (!dec->frame_dec->Flush()) {
     return JXL_DEC_ERROR;
   }
+  if (DownsamplesOutput(dec)) {
+    JXL_API_RETURN_IF_ERROR(jxl::WriteDownsampledOutput(dec));
+  }
 
   return JXL_DEC_SUCCESS;
 }
@@ -2355,7 +2998,7 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetCms(JxlDecoder* dec,
 static JxlDecoderStatus GetMinSize(const JxlDecoder* dec,
                                    const JxlPixelFormat* format,
                                    size_t num_channels, size_t* min_size,
-                                   bool preview) {
+                                   bool preview, JxlImageOutLayout layout) {
   size_t bits;
   JxlDecoderStatus status = PrepareSizeCheck(dec, format, &bits);
   if (status != JXL_DEC_SUCCESS) return status;
@@ -2365,7 +3008,14 @@ static JxlDecoderStatus GetMinSize(const JxlDecoder* dec,
     xsize = dec->metadata.oriented_preview_xsize(dec->keep_orientation);
     ysize = dec->metadata.oriented_preview_ysize(dec->keep_orientation);
   } else {
-    GetCurrentDimensions(dec, xsize, ysize);
+    GetOutputDimensions(dec, xsize, ysize);
+  }
+  if (layout != JXL_IMAGE_OUT_INTERLEAVED) {
+    const std::vector<jxl::ImageOutputPlane> planes =
+        jxl::GetImageOutputPlanes(layout, *format, xsize, ysize);
+    const jxl::ImageOutputPlane& last = planes.back();
+    *min_size = last.offset + last.stride * (last.ysize - 1) + last.row_size;
+    return JXL_DEC_SUCCESS;
   }
   if (num_channels == 0) num_channels = format->num_channels;
   size_t row_size =
@@ -2384,7 +3034,8 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderPreviewOutBufferSize(
       !dec->image_metadata.color_encoding.IsGray()) {
     return JXL_API_ERROR("Number of channels is too low for color output");
   }
-  return GetMinSize(dec, format, 0, size, true);
+  return GetMinSize(dec, format, 0, size, /*preview=*/true,
+                    JXL_IMAGE_OUT_INTERLEAVED);
 }
 
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetPreviewOutBuffer(
@@ -2421,8 +3072,22 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderImageOutBufferSize(
       !dec->image_metadata.color_encoding.IsGray()) {
     return JXL_API_ERROR("Number of channels is too low for color output");
   }
+  const JxlImageOutLayout layout = dec->image_out_layout;
+  if (layout == JXL_IMAGE_OUT_I420 &&
+      (format->num_channels != 3 || format->data_type != JXL_TYPE_UINT8)) {
+    return JXL_API_ERROR("I420 output requires 3 channels of JXL_TYPE_UINT8");
+  }
+  if (layout == JXL_IMAGE_OUT_P010 &&
+      (format->num_channels != 3 || format->data_type != JXL_TYPE_UINT16)) {
+    return JXL_API_ERROR("P010 output requires 3 channels of JXL_TYPE_UINT16");
+  }
+  if ((layout == JXL_IMAGE_OUT_I420 || layout == JXL_IMAGE_OUT_P010) &&
+      !dec->keep_orientation &&
+      static_cast<int>(dec->metadata.m.GetOrientation()) > 4) {
+    return JXL_API_ERROR("YCbCr output cannot undo a transposing orientation");
+  }
 
-  return GetMinSize(dec, format, 0, size, false);
+  return GetMinSize(dec, format, 0, size, /*preview=*/false, layout);
 }
 
 JxlDecoderStatus JxlDecoderSetImageOutBuffer(JxlDecoder* dec,
@@ -2468,7 +3133,8 @@ JxlDecoderStatus JxlDecoderExtraChannelBufferSize(const JxlDecoder* dec,
     return JXL_API_ERROR("Invalid extra channel index");
   }
 
-  return GetMinSize(dec, format, 1, size, false);
+  return GetMinSize(dec, format, 1, size, /*preview=*/false,
+                    JXL_IMAGE_OUT_INTERLEAVED);
 }
 
 JxlDecoderStatus JxlDecoderSetExtraChannelBuffer(JxlDecoder* dec,
@@ -2538,6 +3204,10 @@ JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
     return JXL_API_ERROR("All callbacks are required");
   }
 
+  if (dec->image_out_layout != JXL_IMAGE_OUT_INTERLEAVED) {
+    return JXL_API_ERROR("Image out callbacks require the interleaved layout");
+  }
+
   // Perform error checking for invalid format.
   size_t bits_sink;
   JxlDecoderStatus status = PrepareSizeCheck(dec, format, &bits_sink);
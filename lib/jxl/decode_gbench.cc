@@ -0,0 +1,279 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/codestream_header.h>
+#include <jxl/color_encoding.h>
+#include <jxl/decode.h>
+#include <jxl/encode.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "benchmark/benchmark.h"
+
+namespace jxl {
+namespace {
+
+#define BM_CHECK(C)          \
+  if (!(C)) {                \
+    state.SkipWithError(#C); \
+    return;                  \
+  }
+
+enum InputMode : int64_t {
+  // JxlDecoderSetInput with chunks of kChunkSize bytes.
+  kChunked = 0,
+  // JxlDecoderSetInput with the whole file.
+  kWhole = 1,
+  // JxlDecoderSetResidentInput with the whole file.
+  kResident = 2,
+};
+
+constexpr size_t kChunkSize = 64 << 10;
+
+void AppendBE32(uint32_t value, std::vector<uint8_t>* out) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<uint8_t>(value >> shift));
+  }
+}
+
+void AppendBoxHeader(const char* type, size_t contents_size,
+                     std::vector<uint8_t>* out) {
+  AppendBE32(static_cast<uint32_t>(contents_size + 8), out);
+  out->insert(out->end(), type, type + 4);
+}
+
+// Lossy 2048x2048 image in a container with its codestream split in jxlp
+// boxes of kChunkSize bytes, as written by a streaming encoder.
+std::vector<uint8_t> LargeBoxedImage() {
+  const size_t xsize = 2048;
+  const size_t ysize = 2048;
+  std::vector<uint8_t> pixels(xsize * ysize * 3);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      uint8_t* p = &pixels[(y * xsize + x) * 3];
+      p[0] = static_cast<uint8_t>(x ^ y);
+      p[1] = static_cast<uint8_t>((x * y) >> 6);
+      p[2] = static_cast<uint8_t>(x + 3 * y);
+    }
+  }
+  std::vector<uint8_t> codestream;
+  JxlEncoder* enc = JxlEncoderCreate(nullptr);
+  JxlBasicInfo basic_info;
+  JxlEncoderInitBasicInfo(&basic_info);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JxlEncoderFrameSettings* settings =
+      JxlEncoderFrameSettingsCreate(enc, nullptr);
+  if (JxlEncoderSetBasicInfo(enc, &basic_info) != JXL_ENC_SUCCESS ||
+      JxlEncoderSetColorEncoding(enc, &color_encoding) != JXL_ENC_SUCCESS ||
+      JxlEncoderFrameSettingsSetOption(settings, JXL_ENC_FRAME_SETTING_EFFORT,
+                                       3) != JXL_ENC_SUCCESS ||
+      JxlEncoderAddImageFrame(settings, &format, pixels.data(),
+                              pixels.size()) != JXL_ENC_SUCCESS) {
+    JxlEncoderDestroy(enc);
+    return {};
+  }
+  JxlEncoderCloseInput(enc);
+  codestream.resize(1 << 20);
+  size_t pos = 0;
+  JxlEncoderStatus status = JXL_ENC_NEED_MORE_OUTPUT;
+  while (status == JXL_ENC_NEED_MORE_OUTPUT) {
+    if (pos == codestream.size()) codestream.resize(codestream.size() * 2);
+    uint8_t* next_out = codestream.data() + pos;
+    size_t avail_out = codestream.size() - pos;
+    status = JxlEncoderProcessOutput(enc, &next_out, &avail_out);
+    pos = next_out - codestream.data();
+  }
+  JxlEncoderDestroy(enc);
+  if (status != JXL_ENC_SUCCESS) return {};
+  codestream.resize(pos);
+
+  // Signature and ftyp boxes.
+  std::vector<uint8_t> file = {0,   0,   0,   0xc, 'J', 'X', 'L', ' ',
+                               0xd, 0xa, 0x87, 0xa};
+  AppendBoxHeader("ftyp", 12, &file);
+  const char kBrand[] = "jxl \0\0\0\0jxl ";
+  file.insert(file.end(), kBrand, kBrand + 12);
+  uint32_t index = 0;
+  for (size_t begin = 0; begin < codestream.size(); begin += kChunkSize) {
+    size_t size = std::min(kChunkSize, codestream.size() - begin);
+    AppendBoxHeader("jxlp", size + 4, &file);
+    bool last = begin + size == codestream.size();
+    AppendBE32(index++ | (last ? 0x80000000u : 0), &file);
+    file.insert(file.end(), codestream.begin() + begin,
+                codestream.begin() + begin + size);
+  }
+  return file;
+}
+
+// Decodes a large image split in jxlp boxes with the input mode given as
+// argument. The reported peak RSS is that of the whole process, run a single
+// input mode per process (--benchmark_filter) to compare them.
+void BM_DecodeInputMode(benchmark::State& state) {
+  static const std::vector<uint8_t> file = LargeBoxedImage();
+  BM_CHECK(!file.empty());
+  const InputMode mode = static_cast<InputMode>(state.range(0));
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels;
+
+  for (auto _ : state) {
+    (void)_;
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    BM_CHECK(dec != nullptr);
+    BM_CHECK(JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE) ==
+             JXL_DEC_SUCCESS);
+    size_t pos = 0;
+    size_t avail = mode == kChunked ? std::min(kChunkSize, file.size())
+                                    : file.size();
+    if (mode == kResident) {
+      BM_CHECK(JxlDecoderSetResidentInput(dec, file.data(), file.size()) ==
+               JXL_DEC_SUCCESS);
+    } else {
+      BM_CHECK(JxlDecoderSetInput(dec, file.data(), avail) == JXL_DEC_SUCCESS);
+      if (mode == kWhole) JxlDecoderCloseInput(dec);
+    }
+    for (;;) {
+      JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+      if (status == JXL_DEC_NEED_MORE_INPUT) {
+        BM_CHECK(mode == kChunked && pos + avail < file.size());
+        size_t remaining = JxlDecoderReleaseInput(dec);
+        pos += avail - remaining;
+        avail = std::min(remaining + kChunkSize, file.size() - pos);
+        BM_CHECK(JxlDecoderSetInput(dec, file.data() + pos, avail) ==
+                 JXL_DEC_SUCCESS);
+        if (pos + avail == file.size()) JxlDecoderCloseInput(dec);
+      } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+        size_t buffer_size;
+        BM_CHECK(JxlDecoderImageOutBufferSize(dec, &format, &buffer_size) ==
+                 JXL_DEC_SUCCESS);
+        pixels.resize(buffer_size);
+        BM_CHECK(JxlDecoderSetImageOutBuffer(dec, &format, pixels.data(),
+                                             pixels.size()) ==
+                 JXL_DEC_SUCCESS);
+      } else if (status == JXL_DEC_FULL_IMAGE) {
+        continue;
+      } else {
+        BM_CHECK(status == JXL_DEC_SUCCESS);
+        break;
+      }
+    }
+    JxlDecoderDestroy(dec);
+  }
+
+  state.SetBytesProcessed(file.size() * state.iterations());
+#if !defined(_WIN32)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+    const double max_rss_bytes = usage.ru_maxrss;
+#else
+    const double max_rss_bytes = usage.ru_maxrss * 1024.0;
+#endif
+    state.counters["peak_rss_MiB"] = max_rss_bytes / (1 << 20);
+  }
+#endif
+}
+
+BENCHMARK(BM_DecodeInputMode)
+    ->Arg(kChunked)
+    ->Arg(kWhole)
+    ->Arg(kResident)
+    ->Unit(benchmark::kMillisecond);
+
+// Decodes a lossy image to an RGBA buffer of the data type given as first
+// argument; the second argument selects output to a callback, which the
+// decoder serves with separate XYB, from-linear and write stages instead of
+// the fused XYB to sRGB stage.
+void BM_DecodeXYBToOutput(benchmark::State& state) {
+  static const std::vector<uint8_t> file = LargeBoxedImage();
+  BM_CHECK(!file.empty());
+  JxlPixelFormat format = {4, static_cast<JxlDataType>(state.range(0)),
+                           JXL_NATIVE_ENDIAN, 0};
+  const bool use_callback = state.range(1) != 0;
+  std::vector<uint8_t> pixels;
+  size_t xsize = 0;
+  size_t ysize = 0;
+
+  struct Output {
+    uint8_t* pixels;
+    size_t stride;
+    size_t bytes_per_pixel;
+  } output;
+  const auto callback = [](void* opaque, size_t x, size_t y, size_t num_pixels,
+                           const void* row) {
+    const Output* out = static_cast<const Output*>(opaque);
+    memcpy(out->pixels + out->stride * y + out->bytes_per_pixel * x, row,
+           out->bytes_per_pixel * num_pixels);
+  };
+
+  for (auto _ : state) {
+    (void)_;
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    BM_CHECK(dec != nullptr);
+    BM_CHECK(JxlDecoderSubscribeEvents(
+                 dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) ==
+             JXL_DEC_SUCCESS);
+    BM_CHECK(JxlDecoderSetInput(dec, file.data(), file.size()) ==
+             JXL_DEC_SUCCESS);
+    JxlDecoderCloseInput(dec);
+    for (;;) {
+      JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+      if (status == JXL_DEC_BASIC_INFO) {
+        JxlBasicInfo info;
+        BM_CHECK(JxlDecoderGetBasicInfo(dec, &info) == JXL_DEC_SUCCESS);
+        xsize = info.xsize;
+        ysize = info.ysize;
+      } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+        size_t buffer_size;
+        BM_CHECK(JxlDecoderImageOutBufferSize(dec, &format, &buffer_size) ==
+                 JXL_DEC_SUCCESS);
+        pixels.resize(buffer_size);
+        if (use_callback) {
+          const size_t bytes_per_pixel = buffer_size / (xsize * ysize);
+          output = {pixels.data(), bytes_per_pixel * xsize, bytes_per_pixel};
+          BM_CHECK(JxlDecoderSetImageOutCallback(dec, &format, callback,
+                                                 &output) == JXL_DEC_SUCCESS);
+        } else {
+          BM_CHECK(JxlDecoderSetImageOutBuffer(dec, &format, pixels.data(),
+                                               pixels.size()) ==
+                   JXL_DEC_SUCCESS);
+        }
+      } else if (status == JXL_DEC_FULL_IMAGE) {
+        continue;
+      } else {
+        BM_CHECK(status == JXL_DEC_SUCCESS);
+        break;
+      }
+    }
+    JxlDecoderDestroy(dec);
+  }
+
+  state.counters["MP/s"] = benchmark::Counter(
+      xsize * ysize * 1e-6 * state.iterations(), benchmark::Counter::kIsRate);
+}
+
+BENCHMARK(BM_DecodeXYBToOutput)
+    ->Args({JXL_TYPE_UINT8, 0})
+    ->Args({JXL_TYPE_UINT8, 1})
+    ->Args({JXL_TYPE_UINT16, 0})
+    ->Args({JXL_TYPE_UINT16, 1})
+    ->Args({JXL_TYPE_FLOAT16, 0})
+    ->Args({JXL_TYPE_FLOAT16, 1})
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace jxl
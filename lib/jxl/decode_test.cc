@@ -19,15 +19,20 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <utility>
 #include <vector>
@@ -66,6 +71,7 @@
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 #include "lib/jxl/padded_bytes.h"
+#include "lib/jxl/render_pipeline/stage_xyb.h"
 #include "lib/jxl/test_image.h"
 #include "lib/jxl/test_memory_manager.h"
 #include "lib/jxl/test_utils.h"
@@ -658,6 +664,63 @@ TEST(DecodeTest, CustomAllocTest) {
   EXPECT_LE(1, counters.frees);
 }
 
+// Decoding the same image again after JxlDecoderReset reuses the buffers of
+// the first decode, unless the buffer pool is disabled.
+TEST(DecodeTest, BufferPoolTest) {
+  struct CalledCounters {
+    int allocs = 0;
+    int frees = 0;
+  };
+  JxlMemoryManager mm;
+  mm.alloc = [](void* opaque, size_t size) {
+    reinterpret_cast<CalledCounters*>(opaque)->allocs++;
+    return malloc(size);
+  };
+  mm.free = [](void* opaque, void* address) {
+    reinterpret_cast<CalledCounters*>(opaque)->frees++;
+    free(address);
+  };
+
+  size_t xsize = 300;
+  size_t ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+
+  // Allocations of the last decode, without and with pooling.
+  std::vector<int> last_allocs;
+  for (size_t max_bytes : {size_t{0}, size_t{64} << 20}) {
+    CalledCounters counters;
+    mm.opaque = &counters;
+    JxlDecoder* dec = JxlDecoderCreate(&mm);
+    ASSERT_NE(nullptr, dec);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetBufferPoolLimit(dec, max_bytes));
+    std::vector<int> allocs_per_decode;
+    std::vector<uint8_t> first_pixels;
+    for (size_t i = 0; i < 3; ++i) {
+      int allocs_before = counters.allocs;
+      std::vector<uint8_t> decoded = jxl::DecodeWithAPI(
+          dec, jxl::Bytes(compressed.data(), compressed.size()), format,
+          /*use_callback=*/false, /*set_buffer_early=*/false,
+          /*use_resizable_runner=*/false, /*require_boxes=*/false,
+          /*expect_success=*/true);
+      allocs_per_decode.push_back(counters.allocs - allocs_before);
+      if (i == 0) first_pixels = decoded;
+      EXPECT_EQ(first_pixels, decoded);
+      JxlDecoderReset(dec);
+    }
+    last_allocs.push_back(allocs_per_decode.back());
+    if (max_bytes != 0) {
+      EXPECT_LT(allocs_per_decode[2], allocs_per_decode[0]);
+    }
+    JxlDecoderDestroy(dec);
+    EXPECT_EQ(counters.allocs, counters.frees);
+  }
+  EXPECT_LT(last_allocs[1], last_allocs[0]);
+}
+
 // TODO(lode): add multi-threaded test when multithreaded pixel decoding from
 // API is implemented.
 TEST(DecodeTest, DefaultParallelRunnerTest) {
@@ -1556,6 +1619,806 @@ JXL_GTEST_INSTANTIATE_TEST_SUITE_P(DecodeTest, DecodeTestParam,
                                    testing::ValuesIn(GeneratePixelTests()),
                                    PixelTestDescription);
 
+namespace {
+
+// Decodes the image with the output restricted to the given region; decodes
+// the whole image if xsize is zero.
+std::vector<uint8_t> DecodeCropRegion(const std::vector<uint8_t>& compressed,
+                                      const JxlPixelFormat& format, size_t x0,
+                                      size_t y0, size_t xsize, size_t ysize) {
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(),
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  JxlDecoderCloseInput(dec.get());
+  std::vector<uint8_t> pixels;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_BASIC_INFO) {
+      if (xsize != 0) {
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSetCropRegion(dec.get(), x0, y0, xsize, ysize));
+      }
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      size_t buffer_size;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderImageOutBufferSize(
+                                     dec.get(), &format, &buffer_size));
+      pixels.resize(buffer_size);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels.data(),
+                                            pixels.size()));
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      continue;
+    } else {
+      EXPECT_EQ(JXL_DEC_SUCCESS, status);
+      break;
+    }
+  }
+  return pixels;
+}
+
+}  // namespace
+
+// The pixels decoded with a crop region are those of the region in the full
+// image.
+TEST(DecodeTest, CropRegionTest) {
+  size_t xsize = 700;
+  size_t ysize = 600;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  for (bool lossless : {false, true}) {
+    for (JxlOrientation orientation :
+         {JXL_ORIENT_IDENTITY, JXL_ORIENT_ROTATE_90_CW, JXL_ORIENT_ROTATE_180,
+          JXL_ORIENT_TRANSPOSE}) {
+      jxl::TestCodestreamParams params;
+      if (lossless) {
+        params.cparams.SetLossless();
+        params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+      }
+      params.orientation = orientation;
+      std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+          jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+      std::vector<uint8_t> full =
+          DecodeCropRegion(compressed, format, 0, 0, 0, 0);
+      // Dimensions of the oriented image.
+      size_t full_xsize = orientation > 4 ? ysize : xsize;
+      size_t full_ysize = orientation > 4 ? xsize : ysize;
+      ASSERT_EQ(full_xsize * full_ysize * 3, full.size());
+      const size_t regions[][4] = {
+          {0, 0, 50, 40}, {300, 260, 123, 77}, {full_xsize - 33, 10, 33, 300}};
+      for (const auto& region : regions) {
+        const size_t x0 = region[0];
+        const size_t y0 = region[1];
+        const size_t crop_xsize = region[2];
+        const size_t crop_ysize = region[3];
+        std::vector<uint8_t> crop = DecodeCropRegion(
+            compressed, format, x0, y0, crop_xsize, crop_ysize);
+        ASSERT_EQ(crop_xsize * crop_ysize * 3, crop.size());
+        for (size_t y = 0; y < crop_ysize; ++y) {
+          const uint8_t* expected = &full[((y0 + y) * full_xsize + x0) * 3];
+          ASSERT_TRUE(std::equal(expected, expected + crop_xsize * 3,
+                                 &crop[y * crop_xsize * 3]))
+              << "lossless " << lossless << " orientation " << orientation
+              << " region " << x0 << "," << y0 << " row " << y;
+        }
+      }
+    }
+  }
+}
+
+TEST(DecodeTest, CropRegionErrorTest) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO));
+  // Basic info not yet available.
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCropRegion(dec.get(), 0, 0, 1, 1));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCropRegion(dec.get(), 0, 0, 0, 1));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCropRegion(dec.get(), 0, 0, 124, 1));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCropRegion(dec.get(), 1, 70, 10, 8));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetCropRegion(dec.get(), 100, 70, 23, 7));
+}
+
+namespace {
+
+struct TraceLog {
+  std::mutex mutex;
+  std::vector<JxlDecoderTraceEvent> events;
+  // The thread that emitted each event.
+  std::vector<std::thread::id> threads;
+};
+
+void AppendTraceEvent(void* opaque, const JxlDecoderTraceEvent* event) {
+  TraceLog* log = static_cast<TraceLog*>(opaque);
+  std::lock_guard<std::mutex> lock(log->mutex);
+  log->events.push_back(*event);
+  log->threads.push_back(std::this_thread::get_id());
+}
+
+}  // namespace
+
+TEST(DecodeTest, TraceCallbackTest) {
+  size_t xsize = 300;
+  size_t ysize = 280;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  TraceLog log;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetTraceCallback(dec.get(), AppendTraceEvent, &log));
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  jxl::DecodeWithAPI(
+      dec.get(), jxl::Bytes(compressed.data(), compressed.size()), format,
+      /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  // Decoding has started.
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetTraceCallback(dec.get(), nullptr, nullptr));
+
+  // The events of each thread are nested and in time order.
+  std::map<uint32_t, std::vector<const JxlDecoderTraceEvent*>> open;
+  std::map<uint32_t, uint64_t> last_timestamp;
+  std::map<std::string, int> num_begins;
+  for (const JxlDecoderTraceEvent& event : log.events) {
+    std::vector<const JxlDecoderTraceEvent*>& stack = open[event.thread_id];
+    EXPECT_LE(last_timestamp[event.thread_id], event.timestamp_ns);
+    last_timestamp[event.thread_id] = event.timestamp_ns;
+    if (event.type == JXL_DEC_TRACE_BEGIN) {
+      stack.push_back(&event);
+      num_begins[event.name]++;
+      continue;
+    }
+    ASSERT_FALSE(stack.empty());
+    EXPECT_STREQ(stack.back()->name, event.name);
+    EXPECT_EQ(stack.back()->group_id, event.group_id);
+    stack.pop_back();
+  }
+  for (const auto& thread : open) {
+    EXPECT_TRUE(thread.second.empty());
+  }
+  EXPECT_EQ(1, num_begins["TOC"]);
+  EXPECT_EQ(1, num_begins["DCGlobal"]);
+  EXPECT_EQ(1, num_begins["DCGroup"]);
+  EXPECT_EQ(1, num_begins["ACGlobal"]);
+  EXPECT_EQ(1, num_begins["DecodeHistograms"]);
+  // 2x2 AC groups.
+  EXPECT_EQ(4, num_begins["ACGroup"]);
+  EXPECT_EQ(4, num_begins["DecodeGroup"]);
+  EXPECT_EQ(4, num_begins["RenderPipeline"]);
+  // The image has no extra channels, so no modular data in the AC groups.
+  EXPECT_EQ(0, num_begins["ModularGroup"]);
+}
+
+TEST(DecodeTest, TraceCallbackThreadIdsTest) {
+  size_t xsize = 600;
+  size_t ysize = 500;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  params.cparams.SetLossless();
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(nullptr, 4);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetParallelRunner(dec.get(), JxlThreadParallelRunner,
+                                        runner.get()));
+  TraceLog log;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetTraceCallback(dec.get(), AppendTraceEvent, &log));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  JxlDecoderCloseInput(dec.get());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels_out(xsize * ysize * 3);
+  EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels_out.data(),
+                                        pixels_out.size()));
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec.get()));
+
+  // Each thread_id is one thread, 0 is this one, and worker threads of the
+  // runner have other ids.
+  std::map<uint32_t, std::thread::id> thread_of_id;
+  std::map<std::thread::id, uint32_t> id_of_thread;
+  std::map<std::string, int> num_begins;
+  for (size_t i = 0; i < log.events.size(); ++i) {
+    const JxlDecoderTraceEvent& event = log.events[i];
+    auto inserted = thread_of_id.emplace(event.thread_id, log.threads[i]);
+    EXPECT_EQ(inserted.first->second, log.threads[i]);
+    auto inserted_id = id_of_thread.emplace(log.threads[i], event.thread_id);
+    EXPECT_EQ(inserted_id.first->second, event.thread_id);
+    if (event.type == JXL_DEC_TRACE_BEGIN) num_begins[event.name]++;
+  }
+  ASSERT_EQ(1u, thread_of_id.count(0));
+  EXPECT_EQ(std::this_thread::get_id(), thread_of_id[0]);
+  EXPECT_EQ(1, num_begins["TOC"]);
+  // Lossless frames are modular: 3x2 AC groups with modular data.
+  EXPECT_EQ(6, num_begins["ACGroup"]);
+  EXPECT_EQ(6, num_begins["ModularGroup"]);
+  EXPECT_EQ(0, num_begins["DecodeGroup"]);
+}
+
+namespace {
+
+// Decodes the image to RGB floats at 1/scale of its size.
+std::vector<float> DecodeAtScale(const std::vector<uint8_t>& compressed,
+                                 uint32_t scale) {
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(),
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  JxlDecoderCloseInput(dec.get());
+  JxlPixelFormat format = {3, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
+  std::vector<float> pixels;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_BASIC_INFO) {
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetOutputScale(dec.get(), scale));
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      size_t buffer_size;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderImageOutBufferSize(
+                                     dec.get(), &format, &buffer_size));
+      pixels.resize(buffer_size / sizeof(float));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels.data(),
+                                            buffer_size));
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      continue;
+    } else {
+      EXPECT_EQ(JXL_DEC_SUCCESS, status);
+      break;
+    }
+  }
+  return pixels;
+}
+
+}  // namespace
+
+// The pixels decoded at a reduced scale are close to the averages of the
+// squares of pixels of the full image; exactly so for lossless images, which
+// are downsampled after decoding.
+TEST(DecodeTest, OutputScaleTest) {
+  size_t xsize = 700;
+  size_t ysize = 600;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  for (bool lossless : {false, true}) {
+    for (JxlOrientation orientation :
+         {JXL_ORIENT_IDENTITY, JXL_ORIENT_ROTATE_90_CW}) {
+      jxl::TestCodestreamParams params;
+      if (lossless) {
+        params.cparams.SetLossless();
+        params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+      }
+      params.orientation = orientation;
+      std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+          jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+      std::vector<float> full = DecodeAtScale(compressed, 1);
+      // Dimensions of the oriented image.
+      size_t full_xsize = orientation > 4 ? ysize : xsize;
+      size_t full_ysize = orientation > 4 ? xsize : ysize;
+      ASSERT_EQ(full_xsize * full_ysize * 3, full.size());
+      for (uint32_t scale : {2, 4, 8}) {
+        std::vector<float> reduced = DecodeAtScale(compressed, scale);
+        size_t reduced_xsize = jxl::DivCeil(full_xsize, scale);
+        size_t reduced_ysize = jxl::DivCeil(full_ysize, scale);
+        ASSERT_EQ(reduced_xsize * reduced_ysize * 3, reduced.size());
+        double total_error = 0;
+        float max_error = 0;
+        for (size_t y = 0; y < reduced_ysize; ++y) {
+          for (size_t x = 0; x < reduced_xsize; ++x) {
+            for (size_t c = 0; c < 3; ++c) {
+              float sum = 0;
+              size_t count = 0;
+              for (size_t iy = y * scale;
+                   iy < std::min(full_ysize, (y + 1) * scale); ++iy) {
+                for (size_t ix = x * scale;
+                     ix < std::min(full_xsize, (x + 1) * scale); ++ix) {
+                  sum += full[(iy * full_xsize + ix) * 3 + c];
+                  count++;
+                }
+              }
+              float error = std::abs(
+                  reduced[(y * reduced_xsize + x) * 3 + c] - sum / count);
+              total_error += error;
+              max_error = std::max(max_error, error);
+            }
+          }
+        }
+        if (lossless) {
+          EXPECT_LT(max_error, 1e-4f) << "orientation " << orientation
+                                      << " scale " << scale;
+        } else {
+          // The restoration filters are skipped at reduced scale.
+          EXPECT_LT(total_error / reduced.size(), 0.02)
+              << "orientation " << orientation << " scale " << scale;
+        }
+      }
+    }
+  }
+}
+
+TEST(DecodeTest, OutputScaleErrorTest) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetOutputScale(dec.get(), 0));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetOutputScale(dec.get(), 3));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetOutputScale(dec.get(), 16));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetOutputScale(dec.get(), 4));
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  size_t buffer_size;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size));
+  EXPECT_EQ(31u * 20u * 3u, buffer_size);
+  // A crop region and a scale cannot be combined.
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCropRegion(dec.get(), 0, 0, 10, 10));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetOutputScale(dec.get(), 1));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetCropRegion(dec.get(), 0, 0, 10, 10));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetOutputScale(dec.get(), 2));
+}
+
+TEST(DecodeTest, ResidentInputTest) {
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  // The jxlp boxes split small images within the headers, and larger ones
+  // within the sections.
+  for (size_t xsize : {11, 300}) {
+    size_t ysize = xsize * 2 / 3;
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+    for (CodeStreamBoxFormat box_format :
+         {CodeStreamBoxFormat::kCSBF_None, CodeStreamBoxFormat::kCSBF_Single,
+          CodeStreamBoxFormat::kCSBF_Multi,
+          CodeStreamBoxFormat::kCSBF_Multi_Zero_Terminated,
+          CodeStreamBoxFormat::kCSBF_Multi_First_Empty,
+          CodeStreamBoxFormat::kCSBF_Multi_Last_Empty_Other}) {
+      jxl::TestCodestreamParams params;
+      // Lossless to verify pixels exactly after roundtrip.
+      params.cparams.SetLossless();
+      params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+      params.box_format = box_format;
+      std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+          jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+
+      JxlDecoder* dec = JxlDecoderCreate(nullptr);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetResidentInput(dec, compressed.data(),
+                                           compressed.size()));
+      EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetInput(dec, compressed.data(),
+                                                  compressed.size()));
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+      std::vector<uint8_t> pixels2(xsize * ysize * 6);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, pixels2.data(),
+                                            pixels2.size()));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(0u, jxl::test::ComparePixels(pixels.data(), pixels2.data(),
+                                             xsize, ysize, format, format));
+      JxlDecoderDestroy(dec);
+
+      // Without a copy, the sections are read from the caller's buffer when
+      // the image is decoded, so changing them after the headers shows up in
+      // the result. (Sections that straddle two boxes are joined when they
+      // are read, but the small image has its headers split, so only check
+      // the large one.)
+      if (xsize < 300) continue;
+      dec = JxlDecoderCreate(nullptr);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetResidentInput(dec, compressed.data(),
+                                           compressed.size()));
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+      std::fill(compressed.end() - compressed.size() / 4, compressed.end(), 0);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, pixels2.data(),
+                                            pixels2.size()));
+      JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+      if (status == JXL_DEC_FULL_IMAGE) {
+        EXPECT_NE(0u, jxl::test::ComparePixels(pixels.data(), pixels2.data(),
+                                               xsize, ysize, format, format));
+      } else {
+        EXPECT_EQ(JXL_DEC_ERROR, status);
+      }
+      JxlDecoderDestroy(dec);
+    }
+  }
+}
+
+namespace {
+
+// The output region {x0, y0, xsize, ysize} of a decode; the whole image if
+// xsize is zero.
+using CropRegion = std::array<size_t, 4>;
+
+// Decodes the image to a buffer in the given layout, on num_threads worker
+// threads, or on the calling thread if zero.
+std::vector<uint8_t> DecodeWithLayout(const std::vector<uint8_t>& compressed,
+                                      const JxlPixelFormat& format,
+                                      JxlImageOutLayout layout,
+                                      const CropRegion& crop = {},
+                                      size_t num_threads = 0) {
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  JxlThreadParallelRunnerPtr runner;
+  if (num_threads != 0) {
+    runner = JxlThreadParallelRunnerMake(nullptr, num_threads);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetParallelRunner(dec.get(), JxlThreadParallelRunner,
+                                          runner.get()));
+  }
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(),
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutLayout(dec.get(), layout));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  JxlDecoderCloseInput(dec.get());
+  std::vector<uint8_t> pixels;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_BASIC_INFO) {
+      if (crop[2] != 0) {
+        EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCropRegion(dec.get(), crop[0],
+                                                           crop[1], crop[2],
+                                                           crop[3]));
+      }
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      size_t buffer_size;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderImageOutBufferSize(
+                                     dec.get(), &format, &buffer_size));
+      pixels.resize(buffer_size);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels.data(),
+                                            pixels.size()));
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      continue;
+    } else {
+      EXPECT_EQ(JXL_DEC_SUCCESS, status);
+      break;
+    }
+  }
+  return pixels;
+}
+
+// Checks the I420 and P010 output of the image, or of the crop region of size
+// xsize x ysize, against YCbCr 4:2:0 computed from its RGB output, and that
+// the output does not depend on the number of threads.
+void CheckYCbCrOutput(const std::vector<uint8_t>& compressed, size_t xsize,
+                      size_t ysize, const CropRegion& crop = {}) {
+  JxlPixelFormat float_format = {3, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> rgb_bytes = DecodeWithLayout(
+      compressed, float_format, JXL_IMAGE_OUT_INTERLEAVED, crop);
+  ASSERT_EQ(xsize * ysize * 3 * sizeof(float), rgb_bytes.size());
+  std::vector<float> rgb(xsize * ysize * 3);
+  memcpy(rgb.data(), rgb_bytes.data(), rgb_bytes.size());
+  // Full range BT.601, chroma averaged over 2x2 pixels.
+  const size_t chroma_xsize = jxl::DivCeil(xsize, 2);
+  const size_t chroma_ysize = jxl::DivCeil(ysize, 2);
+  std::vector<float> luma(xsize * ysize);
+  std::vector<float> cb(chroma_xsize * chroma_ysize);
+  std::vector<float> cr(chroma_xsize * chroma_ysize);
+  std::vector<size_t> count(chroma_xsize * chroma_ysize);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      const float* p = &rgb[(y * xsize + x) * 3];
+      const float value = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+      luma[y * xsize + x] = value;
+      const size_t i = (y / 2) * chroma_xsize + x / 2;
+      cb[i] += (p[2] - value) / 1.772f;
+      cr[i] += (p[0] - value) / 1.402f;
+      count[i]++;
+    }
+  }
+  for (size_t i = 0; i < cb.size(); ++i) {
+    cb[i] /= count[i];
+    cr[i] /= count[i];
+  }
+  const auto expected = [](float value, float offset, float max_value) {
+    return std::min(std::max((value + offset) * max_value, 0.0f), max_value);
+  };
+
+  JxlPixelFormat format8 = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> i420 =
+      DecodeWithLayout(compressed, format8, JXL_IMAGE_OUT_I420, crop);
+  for (size_t num_threads : {1, 4}) {
+    ASSERT_EQ(i420, DecodeWithLayout(compressed, format8, JXL_IMAGE_OUT_I420,
+                                     crop, num_threads))
+        << num_threads << " threads";
+  }
+  ASSERT_EQ(xsize * ysize + 2 * chroma_xsize * chroma_ysize, i420.size());
+  const uint8_t* i420_cb = &i420[xsize * ysize];
+  const uint8_t* i420_cr = i420_cb + chroma_xsize * chroma_ysize;
+  for (size_t i = 0; i < luma.size(); ++i) {
+    ASSERT_NEAR(expected(luma[i], 0, 255), i420[i], 2.0f) << "pixel " << i;
+  }
+  for (size_t i = 0; i < cb.size(); ++i) {
+    ASSERT_NEAR(expected(cb[i], 128.0f / 255, 255), i420_cb[i], 2.0f)
+        << "chroma " << i;
+    ASSERT_NEAR(expected(cr[i], 128.0f / 255, 255), i420_cr[i], 2.0f)
+        << "chroma " << i;
+  }
+
+  JxlPixelFormat format16 = {3, JXL_TYPE_UINT16, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> p010_bytes =
+      DecodeWithLayout(compressed, format16, JXL_IMAGE_OUT_P010, crop);
+  for (size_t num_threads : {1, 4}) {
+    ASSERT_EQ(p010_bytes, DecodeWithLayout(compressed, format16,
+                                           JXL_IMAGE_OUT_P010, crop,
+                                           num_threads))
+        << num_threads << " threads";
+  }
+  ASSERT_EQ((xsize * ysize + 2 * chroma_xsize * chroma_ysize) * 2,
+            p010_bytes.size());
+  std::vector<uint16_t> p010(p010_bytes.size() / 2);
+  memcpy(p010.data(), p010_bytes.data(), p010_bytes.size());
+  for (size_t i = 0; i < p010.size(); ++i) {
+    ASSERT_EQ(0, p010[i] & 63) << "sample " << i;
+  }
+  for (size_t i = 0; i < luma.size(); ++i) {
+    ASSERT_NEAR(expected(luma[i], 0, 1023), p010[i] >> 6, 1.5f)
+        << "pixel " << i;
+  }
+  const uint16_t* p010_chroma = &p010[xsize * ysize];
+  for (size_t i = 0; i < cb.size(); ++i) {
+    ASSERT_NEAR(expected(cb[i], 512.0f / 1023, 1023), p010_chroma[2 * i] >> 6,
+                1.5f)
+        << "chroma " << i;
+    ASSERT_NEAR(expected(cr[i], 512.0f / 1023, 1023),
+                p010_chroma[2 * i + 1] >> 6, 1.5f)
+        << "chroma " << i;
+  }
+}
+
+}  // namespace
+
+// The planar layout holds the same samples as the interleaved one.
+TEST(DecodeTest, PlanarOutputTest) {
+  size_t xsize = 301;
+  size_t ysize = 203;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 4, 0);
+  for (JxlOrientation orientation :
+       {JXL_ORIENT_IDENTITY, JXL_ORIENT_ROTATE_90_CW}) {
+    jxl::TestCodestreamParams params;
+    params.orientation = orientation;
+    std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+        jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 4, params);
+    size_t out_xsize = orientation > 4 ? ysize : xsize;
+    size_t out_ysize = orientation > 4 ? xsize : ysize;
+    for (JxlDataType data_type : {JXL_TYPE_UINT8, JXL_TYPE_FLOAT16}) {
+      JxlPixelFormat format = {4, data_type, JXL_NATIVE_ENDIAN, 0};
+      const size_t bytes = data_type == JXL_TYPE_UINT8 ? 1 : 2;
+      std::vector<uint8_t> interleaved =
+          DecodeWithLayout(compressed, format, JXL_IMAGE_OUT_INTERLEAVED);
+      std::vector<uint8_t> planar =
+          DecodeWithLayout(compressed, format, JXL_IMAGE_OUT_PLANAR);
+      ASSERT_EQ(out_xsize * out_ysize * 4 * bytes, interleaved.size());
+      ASSERT_EQ(interleaved.size(), planar.size());
+      const size_t plane_size = out_xsize * out_ysize * bytes;
+      for (size_t i = 0; i < out_xsize * out_ysize; ++i) {
+        for (size_t c = 0; c < 4; ++c) {
+          ASSERT_EQ(0, memcmp(&interleaved[(i * 4 + c) * bytes],
+                              &planar[c * plane_size + i * bytes], bytes))
+              << "orientation " << orientation << " pixel " << i
+              << " channel " << c;
+        }
+      }
+    }
+  }
+}
+
+TEST(DecodeTest, YCbCrOutputTest) {
+  for (bool lossless : {false, true}) {
+    for (JxlOrientation orientation :
+         {JXL_ORIENT_IDENTITY, JXL_ORIENT_FLIP_HORIZONTAL,
+          JXL_ORIENT_FLIP_VERTICAL, JXL_ORIENT_ROTATE_180}) {
+      // Odd sizes larger than a group: with a flip, or with a crop region at
+      // odd coordinates, the boundaries of the groups are at odd rows and
+      // columns of the output, so that 2x2 blocks straddle groups.
+      size_t xsize = 301;
+      size_t ysize = 283;
+      std::vector<uint8_t> pixels =
+          jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+      jxl::TestCodestreamParams params;
+      if (lossless) {
+        params.cparams.SetLossless();
+        params.cparams.speed_tier = jxl::SpeedTier::kThunder;
+      }
+      params.orientation = orientation;
+      std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+          jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+      SCOPED_TRACE(testing::Message() << "lossless " << lossless
+                                      << " orientation " << orientation);
+      CheckYCbCrOutput(compressed, xsize, ysize);
+      CheckYCbCrOutput(compressed, 297, 271, {3, 5, 297, 271});
+      CheckYCbCrOutput(compressed, 260, 262, {1, 0, 260, 262});
+    }
+  }
+}
+
+// Recompressed JPEG images are output from their YCbCr samples.
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, YCbCrOutputJPEGTest) {
+  TEST_LIBJPEG_SUPPORT();
+  size_t xsize = 123;
+  size_t ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> jpeg_codestream;
+  jxl::TestCodestreamParams params;
+  params.jpeg_codestream = &jpeg_codestream;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  CheckYCbCrOutput(compressed, xsize, ysize);
+}
+
+// A flush is refused with a YCbCr layout, and the decode then completes as
+// usual.
+TEST(DecodeTest, YCbCrLayoutFlushTest) {
+  size_t xsize = 333;
+  size_t ysize = 300;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> expected =
+      DecodeWithLayout(compressed, format, JXL_IMAGE_OUT_I420);
+
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(),
+                                      JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutLayout(dec.get(), JXL_IMAGE_OUT_I420));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size() - 1));
+  EXPECT_EQ(JXL_DEC_FRAME, JxlDecoderProcessInput(dec.get()));
+  size_t buffer_size;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size));
+  std::vector<uint8_t> decoded(buffer_size);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutBuffer(dec.get(), &format, decoded.data(),
+                                        decoded.size()));
+  EXPECT_EQ(JXL_DEC_NEED_MORE_INPUT, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderFlushImage(dec.get()));
+
+  size_t consumed = compressed.size() - 1 - JxlDecoderReleaseInput(dec.get());
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec.get(), compressed.data() + consumed,
+                               compressed.size() - consumed));
+  JxlDecoderCloseInput(dec.get());
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(expected, decoded);
+}
+
+TEST(DecodeTest, ImageOutLayoutErrorTest) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  params.orientation = JXL_ORIENT_TRANSPOSE;
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3, params);
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec.get(),
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetImageOutLayout(
+                               dec.get(), static_cast<JxlImageOutLayout>(4)));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec.get(), compressed.data(),
+                                                compressed.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutLayout(dec.get(), JXL_IMAGE_OUT_I420));
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  size_t buffer_size;
+  // The orientation transposes the image.
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetKeepOrientation(dec.get(), JXL_TRUE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size));
+  EXPECT_EQ(123u * 77u + 2u * 62u * 39u, buffer_size);
+  format.data_type = JXL_TYPE_UINT16;
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size));
+  format.num_channels = 4;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutLayout(dec.get(), JXL_IMAGE_OUT_PLANAR));
+  format.align = 16;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size));
+  EXPECT_EQ(256u * 77u * 3u + 256u * 76u + 246u, buffer_size);
+  // A layout cannot be combined with a scale or with callbacks.
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetOutputScale(dec.get(), 2));
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetImageOutCallback(
+                dec.get(), &format,
+                [](void*, size_t, size_t, size_t, const void*) {}, nullptr));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutLayout(dec.get(), JXL_IMAGE_OUT_INTERLEAVED));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetOutputScale(dec.get(), 2));
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetImageOutLayout(dec.get(), JXL_IMAGE_OUT_PLANAR));
+}
+
+// Output written by the fused XYB to sRGB stage, used for buffers, matches that
+// of the separate stages, used for callbacks.
+TEST(DecodeTest, FastXYBTosRGBTest) {
+  size_t xsize = 301;
+  size_t ysize = 203;
+  for (size_t num_channels : {3, 4}) {
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(xsize, ysize, num_channels, 0);
+    jxl::TestCodestreamParams params;
+    std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+        jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, num_channels,
+        params);
+    for (JxlDataType data_type :
+         {JXL_TYPE_UINT8, JXL_TYPE_UINT16, JXL_TYPE_FLOAT16}) {
+      for (JxlEndianness endianness : {JXL_NATIVE_ENDIAN, JXL_BIG_ENDIAN}) {
+        for (uint32_t out_channels : {3, 4}) {
+          JxlPixelFormat format = {out_channels, data_type, endianness, 0};
+          SCOPED_TRACE(testing::Message()
+                       << "image channels " << num_channels << " format "
+                       << out_channels << " " << data_type << " "
+                       << endianness);
+          std::vector<uint8_t> fused = jxl::DecodeWithAPI(
+              jxl::Bytes(compressed.data(), compressed.size()), format,
+              /*use_callback=*/false, /*set_buffer_early=*/false,
+              /*use_resizable_runner=*/false, /*require_boxes=*/false,
+              /*expect_success=*/true);
+          std::vector<uint8_t> separate = jxl::DecodeWithAPI(
+              jxl::Bytes(compressed.data(), compressed.size()), format,
+              /*use_callback=*/true, /*set_buffer_early=*/false,
+              /*use_resizable_runner=*/false, /*require_boxes=*/false,
+              /*expect_success=*/true);
+          ASSERT_EQ(separate.size(), fused.size());
+          if (data_type == JXL_TYPE_UINT8 &&
+              jxl::FastXYBTosRGBStageIsApproximate()) {
+            // The NEON fixed point conversion of 8-bit samples is only close.
+            for (size_t i = 0; i < fused.size(); ++i) {
+              ASSERT_NEAR(separate[i], fused[i], 3) << "sample " << i;
+            }
+          } else {
+            EXPECT_EQ(separate, fused);
+          }
+        }
+      }
+    }
+  }
+}
+
 TEST(DecodeTest, PixelTestWithICCProfileLossless) {
   JxlDecoder* dec = JxlDecoderCreate(nullptr);
 
@@ -3381,6 +4244,125 @@ TEST(DecodeTest, SkipFrameWithBlendingTest) {
   JxlDecoderDestroy(dec);
 }
 
+TEST(DecodeTest, FrameIndexSeekTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  size_t xsize = 90;
+  size_t ysize = 120;
+  constexpr size_t num_frames = 10;
+  // Frames 0 and 6 replace the previous frame, the others are blended onto it.
+  constexpr size_t kKeyframe = 6;
+  std::vector<uint8_t> frames[num_frames];
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+
+  auto io = jxl::make_unique<jxl::CodecInOut>(memory_manager);
+  ASSERT_TRUE(io->SetSize(xsize, ysize));
+  io->metadata.m.SetUintSamples(16);
+  io->metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+  io->metadata.m.have_animation = true;
+  io->frames.clear();
+  io->frames.reserve(num_frames);
+
+  for (size_t i = 0; i < num_frames; ++i) {
+    std::vector<uint8_t> frame =
+        jxl::test::GetSomeTestImage(xsize, ysize, 3, i * 2);
+    jxl::ImageBundle bundle(memory_manager, &io->metadata.m);
+    EXPECT_TRUE(ConvertFromExternal(jxl::Bytes(frame.data(), frame.size()),
+                                    xsize, ysize,
+                                    jxl::ColorEncoding::SRGB(/*is_gray=*/false),
+                                    /*bits_per_sample=*/16, format,
+                                    /*pool=*/nullptr, &bundle));
+    bundle.duration = 5 + i;
+    bundle.use_for_next_frame = true;
+    if (i != 0 && i != kKeyframe) {
+      bundle.blend = true;
+      bundle.blendmode = jxl::BlendMode::kMul;
+    }
+    io->frames.push_back(std::move(bundle));
+  }
+
+  jxl::CompressParams cparams;
+  cparams.SetLossless();  // Lossless to verify pixels exactly after roundtrip.
+  cparams.speed_tier = jxl::SpeedTier::kThunder;
+  std::vector<uint8_t> compressed;
+  EXPECT_TRUE(jxl::test::EncodeFile(cparams, io.get(), &compressed));
+
+  // Decode all frames sequentially, to compare the seeked frames with.
+  {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, compressed.data(),
+                                                  compressed.size()));
+    for (auto& frame : frames) {
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+      frame.resize(xsize * ysize * 6);
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                     dec, &format, frame.data(), frame.size()));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    }
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+  }
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE));
+  uint64_t file_offset;
+  EXPECT_EQ(0u, JxlDecoderGetNumIndexedFrames(dec));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSeekToFrame(dec, 0, &file_offset));
+
+  // First pass: skip all frames, which only indexes them.
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  JxlDecoderSkipFrames(dec, num_frames);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderReleaseInput(dec);
+
+  ASSERT_EQ(num_frames, JxlDecoderGetNumIndexedFrames(dec));
+  JxlFrameIndexEntry entries[num_frames];
+  for (size_t i = 0; i < num_frames; ++i) {
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetFrameIndexEntry(dec, i, &entries[i]));
+    EXPECT_EQ(5 + i, entries[i].duration);
+    EXPECT_EQ(i < kKeyframe ? 0 : kKeyframe, entries[i].keyframe);
+    EXPECT_EQ(i == 0 || i == kKeyframe, entries[i].references == 0);
+    // The last frame cannot be referenced.
+    EXPECT_EQ(i + 1 != num_frames, entries[i].saved_as != 0);
+    EXPECT_LT(entries[i].file_offset, compressed.size());
+    if (i > 0) EXPECT_GT(entries[i].file_offset, entries[i - 1].file_offset);
+  }
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderGetFrameIndexEntry(dec, num_frames, &entries[0]));
+
+  for (size_t target : {8, 2, 6, 9, 0}) {
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSeekToFrame(dec, target, &file_offset));
+    EXPECT_EQ(entries[entries[target].keyframe].file_offset, file_offset);
+    // Only the input from the keyframe on is provided.
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data() + file_offset,
+                                 compressed.size() - file_offset));
+    for (size_t i = target; i < num_frames; ++i) {
+      EXPECT_EQ(JXL_DEC_FRAME, JxlDecoderProcessInput(dec));
+      JxlFrameHeader frame_header;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetFrameHeader(dec, &frame_header));
+      EXPECT_EQ(entries[i].duration, frame_header.duration);
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+      std::vector<uint8_t> pixels(xsize * ysize * 6);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, pixels.data(),
+                                            pixels.size()));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(0u, jxl::test::ComparePixels(frames[i].data(), pixels.data(),
+                                             xsize, ysize, format, format));
+    }
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderReleaseInput(dec);
+  }
+
+  JxlDecoderDestroy(dec);
+}
+
 TEST(DecodeTest, SkipFrameWithAlphaBlendingTest) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
   size_t xsize = 90;
@@ -951,7 +951,7 @@ Status FindBestQuantization(const FrameHeader& frame_header,
       tf.IsPQ() || tf.IsHLG()
           ? frame_header.nonserialized_metadata->m.IntensityTarget()
           : 80.f;
-  JxlButteraugliComparator comparator(params, cms);
+  JxlButteraugliComparator comparator(params, cms, pool);
   JXL_RETURN_IF_ERROR(comparator.SetLinearReferenceImage(linear));
   bool lower_is_better =
       (comparator.GoodQualityScore() < comparator.BadQualityScore());
@@ -960,6 +960,8 @@ Status FindBestQuantization(const FrameHeader& frame_header,
                                        Rect(quant_field), original_butteraugli,
                                        &quant_field));
   ImageF tile_distmap;
+  ImageF diffmap;
+  ImageBundle prev_dec_linear(memory_manager);
   JXL_ASSIGN_OR_RETURN(
       ImageF initial_quant_field,
       ImageF::Create(memory_manager, quant_field.xsize(), quant_field.ysize()));
@@ -979,8 +981,12 @@ Status FindBestQuantization(const FrameHeader& frame_header,
 
   constexpr int kOriginalComparisonRound = 1;
   int iters = kDefaultButteraugliIters;
+  // The diffmap is only updated incrementally where the many iterations make
+  // it worth it, since it then matches the full diffmap only up to rounding.
+  bool incremental_diffmap = false;
   if (cparams.speed_tier <= SpeedTier::kTortoise) {
     iters = kMaxButteraugliIters;
+    incremental_diffmap = true;
   }
   for (int i = 0; i < iters + 1; ++i) {
     if (JXL_DEBUG_ADAPTIVE_QUANTIZATION) {
@@ -998,8 +1004,15 @@ Status FindBestQuantization(const FrameHeader& frame_header,
         ImageBundle dec_linear,
         RoundtripImage(frame_header, opsin, enc_state, cms, pool));
     float score;
-    ImageF diffmap;
-    JXL_RETURN_IF_ERROR(comparator.CompareWith(dec_linear, &diffmap, &score));
+    if (i == 0 || !lower_is_better || !incremental_diffmap) {
+      JXL_RETURN_IF_ERROR(
+          comparator.CompareWith(dec_linear, &diffmap, &score));
+    } else {
+      // Usually only the blocks whose quantization changed decode
+      // differently, so only the diffmap around them is computed again.
+      JXL_RETURN_IF_ERROR(comparator.CompareIncrementally(
+          prev_dec_linear, dec_linear, &diffmap, &score));
+    }
     if (!lower_is_better) {
       score = -score;
       ScaleImage(-1.0f, &diffmap);
@@ -1029,6 +1042,7 @@ Status FindBestQuantization(const FrameHeader& frame_header,
     }
 
     if (i == iters) break;
+    prev_dec_linear = std::move(dec_linear);
 
     double kPow[8] = {
         0.2, 0.2, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
@@ -14,6 +14,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <limits>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -22,6 +23,7 @@
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/dec_ans.h"
@@ -614,6 +616,26 @@ const AEH::AllowedCounts AEH::allowed_counts = [] {
   return result;
 }();
 
+// Builds the encoding tables of a normalized histogram and writes it to
+// `writer`, if any. Returns the estimated cost.
+StatusOr<size_t> StoreANSEncodingData(ANSEncodingHistogram& normalized,
+                                      size_t log_alpha_size,
+                                      ANSEncSymbolInfo* info,
+                                      BitWriter* writer) {
+  // TODO(eustas): fix: 2KiB on stack
+  AliasTable::Entry a[ANS_MAX_ALPHABET_SIZE];
+
+  JXL_RETURN_IF_ERROR(
+      InitAliasTable(normalized.Counts(), ANS_LOG_TAB_SIZE, log_alpha_size, a));
+  normalized.ANSBuildInfoTable(a, log_alpha_size, info);
+  if (writer != nullptr) {
+    // size_t start = writer->BitsWritten();
+    JXL_RETURN_IF_ERROR(normalized.Encode(writer));
+    // return writer->BitsWritten() - start;
+  }
+  return static_cast<size_t>(ceilf(normalized.Cost()));
+}
+
 }  // namespace
 
 StatusOr<float> Histogram::ANSPopulationCost() const {
@@ -673,19 +695,7 @@ StatusOr<size_t> EntropyEncodingData::BuildAndStoreANSEncodingData(
   JXL_ASSIGN_OR_RETURN(
       ANSEncodingHistogram normalized,
       ANSEncodingHistogram::ComputeBest(histogram, ans_histogram_strategy));
-
-  // TODO(eustas): fix: 2KiB on stack
-  AliasTable::Entry a[ANS_MAX_ALPHABET_SIZE];
-
-  JXL_RETURN_IF_ERROR(
-      InitAliasTable(normalized.Counts(), ANS_LOG_TAB_SIZE, log_alpha_size, a));
-  normalized.ANSBuildInfoTable(a, log_alpha_size, info);
-  if (writer != nullptr) {
-    // size_t start = writer->BitsWritten();
-    JXL_RETURN_IF_ERROR(normalized.Encode(writer));
-    // return writer->BitsWritten() - start;
-  }
-  return static_cast<size_t>(ceilf(normalized.Cost()));
+  return StoreANSEncodingData(normalized, log_alpha_size, info, writer);
 }
 
 namespace {
@@ -712,7 +722,7 @@ Histogram HistogramFromSymbolInfo(
 Status EntropyEncodingData::ChooseUintConfigs(
     JxlMemoryManager* memory_manager, const HistogramParams& params,
     const std::vector<std::vector<Token>>& tokens,
-    std::vector<Histogram>& clustered_histograms) {
+    std::vector<Histogram>& clustered_histograms, ThreadPool* pool) {
   // Set sane default `log_alpha_size`.
   if (use_prefix_code) {
     log_alpha_size = PREFIX_MAX_BITS;
@@ -828,11 +838,15 @@ Status EntropyEncodingData::ChooseUintConfigs(
   // and therefore will not be used
   size_t max_alpha = ANS_MAX_ALPHABET_SIZE;
 
-  JXL_ASSIGN_OR_RETURN(
-      AlignedMemory tmp,
-      AlignedMemory::Create(memory_manager, (max_histo_volume + max_vec_size) *
-                                                sizeof(uint32_t)));
-  for (size_t h = 0; h < num_histo; h++) {
+  // The configs of the histograms are chosen in parallel. Each one gets a
+  // token buffer of its own size, so that the buffers of all running tasks
+  // together are no larger than the tokens.
+  const auto choose_config = [&](const uint32_t h,
+                                 size_t /* thread */) -> Status {
+    JXL_ASSIGN_OR_RETURN(
+        AlignedMemory tmp,
+        AlignedMemory::Create(memory_manager, (histo_volume[h] + max_vec_size) *
+                                                  sizeof(uint32_t)));
     float best_cost = std::numeric_limits<float>::max();
     for (HybridUintConfig cfg : configs) {
       uint32_t max_v = max_value_per_histo[h];
@@ -868,8 +882,15 @@ Status EntropyEncodingData::ChooseUintConfigs(
         clustered_histograms[h].swap(histo);
       }
     }
-  }
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_histo, ThreadPool::NoInit,
+                                choose_config, "ChooseUintConfigs"));
 
+  JXL_ASSIGN_OR_RETURN(
+      AlignedMemory tmp,
+      AlignedMemory::Create(memory_manager, (max_histo_volume + max_vec_size) *
+                                                sizeof(uint32_t)));
   size_t max_tok = 0;
   for (size_t h = 0; h < num_histo; ++h) {
     Histogram& histo = clustered_histograms[h];
@@ -916,7 +937,7 @@ StatusOr<size_t> EntropyEncodingData::BuildAndStoreEntropyCodes(
     JxlMemoryManager* memory_manager, const HistogramParams& params,
     const std::vector<std::vector<Token>>& tokens,
     const std::vector<Histogram>& builder, BitWriter* writer, LayerType layer,
-    AuxOut* aux_out) {
+    AuxOut* aux_out, ThreadPool* pool) {
   const size_t prev_histograms = encoding_info.size();
   std::vector<Histogram> clustered_histograms;
   for (size_t i = 0; i < prev_histograms; ++i) {
@@ -928,9 +949,13 @@ StatusOr<size_t> EntropyEncodingData::BuildAndStoreEntropyCodes(
   if (builder.size() > 1) {
     if (!ans_fuzzer_friendly_) {
       std::vector<uint32_t> histogram_symbols;
-      JXL_RETURN_IF_ERROR(ClusterHistograms(params, builder, kClustersLimit,
-                                            &clustered_histograms,
-                                            &histogram_symbols));
+      {
+        PhaseTimer timer(aux_out, EncPhase::HistogramClustering,
+                         builder.size());
+        JXL_RETURN_IF_ERROR(ClusterHistograms(params, builder, kClustersLimit,
+                                              &clustered_histograms,
+                                              &histogram_symbols, pool));
+      }
       for (size_t c = 0; c < builder.size(); ++c) {
         context_map[context_offset + c] =
             static_cast<uint8_t>(histogram_symbols[c]);
@@ -965,7 +990,8 @@ StatusOr<size_t> EntropyEncodingData::BuildAndStoreEntropyCodes(
   }
 
   JXL_RETURN_IF_ERROR(
-      ChooseUintConfigs(memory_manager, params, tokens, clustered_histograms));
+      ChooseUintConfigs(memory_manager, params, tokens, clustered_histograms,
+                        pool));
 
   SizeWriter size_writer;  // Used if writer == nullptr to estimate costs.
   size_t cost = use_prefix_code ? 1 : 3;
@@ -988,6 +1014,27 @@ StatusOr<size_t> EntropyEncodingData::BuildAndStoreEntropyCodes(
     }
   }
   cost += size_writer.size;
+
+  // Normalizing an ANS histogram searches over all the shifts, which is
+  // expensive, so it is done in parallel; the histograms are still written in
+  // order below.
+  std::vector<std::unique_ptr<ANSEncodingHistogram>> normalized;
+  if (!use_prefix_code) {
+    normalized.resize(clustered_histograms.size() - prev_histograms);
+    const auto normalize = [&](const uint32_t i,
+                               size_t /* thread */) -> Status {
+      JXL_ASSIGN_OR_RETURN(
+          ANSEncodingHistogram histo,
+          ANSEncodingHistogram::ComputeBest(
+              clustered_histograms[prev_histograms + i],
+              params.ans_histogram_strategy));
+      normalized[i] = jxl::make_unique<ANSEncodingHistogram>(std::move(histo));
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, normalized.size(),
+                                  ThreadPool::NoInit, normalize,
+                                  "NormalizeHistograms"));
+  }
   for (size_t c = prev_histograms; c < clustered_histograms.size(); ++c) {
     size_t alphabet_size = clustered_histograms[c].alphabet_size();
     encoding_info.emplace_back();
@@ -998,10 +1045,19 @@ StatusOr<size_t> EntropyEncodingData::BuildAndStoreEntropyCodes(
       histo_writer = &encoded_histograms.back();
     }
     const auto& body = [&]() -> Status {
-      JXL_ASSIGN_OR_RETURN(size_t ans_cost,
-                           BuildAndStoreANSEncodingData(
-                               memory_manager, params.ans_histogram_strategy,
-                               clustered_histograms[c], histo_writer));
+      size_t ans_cost;
+      if (use_prefix_code) {
+        JXL_ASSIGN_OR_RETURN(ans_cost,
+                             BuildAndStoreANSEncodingData(
+                                 memory_manager, params.ans_histogram_strategy,
+                                 clustered_histograms[c], histo_writer));
+      } else {
+        JXL_ASSIGN_OR_RETURN(
+            ans_cost, StoreANSEncodingData(*normalized[c - prev_histograms],
+                                           log_alpha_size,
+                                           encoding_info.back().data(),
+                                           histo_writer));
+      }
       cost += ans_cost;
       return true;
     };
@@ -1083,13 +1139,19 @@ StatusOr<size_t> BuildAndEncodeHistograms(
     JxlMemoryManager* memory_manager, const HistogramParams& params,
     size_t num_contexts, std::vector<std::vector<Token>>& tokens,
     EntropyEncodingData* codes, BitWriter* writer, LayerType layer,
-    AuxOut* aux_out) {
+    AuxOut* aux_out, ThreadPool* pool) {
   // TODO(Ivan): presumably not needed - default
   // if (params.initialize_global_state) codes->lz77.enabled = false;
   codes->lz77.nonserialized_distance_context = num_contexts;
   codes->lz77.min_symbol = params.force_huffman ? 512 : 224;
-  std::vector<std::vector<Token>> tokens_lz77 =
-      ApplyLZ77(params, num_contexts, tokens, codes->lz77);
+  std::vector<std::vector<Token>> tokens_lz77;
+  {
+    size_t num_tokens = 0;
+    for (const auto& t : tokens) num_tokens += t.size();
+    PhaseTimer timer(aux_out, EncPhase::Lz77, num_tokens);
+    JXL_ASSIGN_OR_RETURN(tokens_lz77, ApplyLZ77(params, num_contexts, tokens,
+                                                codes->lz77, pool));
+  }
   if (!tokens_lz77.empty()) codes->lz77.enabled = true;
   if (ans_fuzzer_friendly_) {
     codes->lz77.length_uint_config = HybridUintConfig(10, 0, 0);
@@ -1215,7 +1277,8 @@ StatusOr<size_t> BuildAndEncodeHistograms(
     JXL_ASSIGN_OR_RETURN(
         size_t entropy_bits,
         codes->BuildAndStoreEntropyCodes(memory_manager, params, tokens,
-                                         builder, writer, layer, aux_out));
+                                         builder, writer, layer, aux_out,
+                                         pool));
     cost += entropy_bits;
     return true;
   };
@@ -1323,6 +1386,7 @@ size_t WriteTokens(const std::vector<Token>& tokens,
 Status WriteTokens(const std::vector<Token>& tokens,
                    const EntropyEncodingData& codes, size_t context_offset,
                    BitWriter* writer, LayerType layer, AuxOut* aux_out) {
+  PhaseTimer timer(aux_out, EncPhase::TokenWriting, tokens.size());
   // Theoretically, we could have 15 prefix code bits + 31 extra bits.
   return writer->WithMaxBits(
       46 * tokens.size() + 32 * 1024 * 4, layer, aux_out, [&] {
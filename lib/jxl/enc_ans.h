@@ -25,6 +25,7 @@ namespace jxl {
 
 struct AuxOut;
 enum class LayerType : uint8_t;
+class ThreadPool;
 
 #define USE_MULT_BY_RECIPROCAL
 
@@ -106,7 +107,7 @@ struct EntropyEncodingData {
       JxlMemoryManager* memory_manager, const HistogramParams& params,
       const std::vector<std::vector<Token>>& tokens,
       const std::vector<Histogram>& builder, BitWriter* writer, LayerType layer,
-      AuxOut* aux_out);
+      AuxOut* aux_out, ThreadPool* pool = nullptr);
 
   StatusOr<size_t> BuildAndStoreANSEncodingData(
       JxlMemoryManager* memory_manager,
@@ -117,7 +118,8 @@ struct EntropyEncodingData {
   Status ChooseUintConfigs(JxlMemoryManager* memory_manager,
                            const HistogramParams& params,
                            const std::vector<std::vector<Token>>& tokens,
-                           std::vector<Histogram>& clustered_histograms);
+                           std::vector<Histogram>& clustered_histograms,
+                           ThreadPool* pool);
 };
 
 // Writes the context map to the bitstream and concatenates the individual
@@ -129,12 +131,14 @@ Status EncodeHistograms(const EntropyEncodingData& codes, BitWriter* writer,
 // estimate of the total bits used for encoding the stream. If `writer` ==
 // nullptr, the bit estimate will not take into account the context map (which
 // does not get written if `num_contexts` == 1).
+// If `pool` is given, clustering and the search for the histogram parameters
+// run on it; the result does not depend on the number of threads.
 // Returns cost
 StatusOr<size_t> BuildAndEncodeHistograms(
     JxlMemoryManager* memory_manager, const HistogramParams& params,
     size_t num_contexts, std::vector<std::vector<Token>>& tokens,
     EntropyEncodingData* codes, BitWriter* writer, LayerType layer,
-    AuxOut* aux_out);
+    AuxOut* aux_out, ThreadPool* pool = nullptr);
 
 // Write the tokens to a string.
 Status WriteTokens(const std::vector<Token>& tokens,
@@ -5,6 +5,7 @@
 
 #include "lib/jxl/enc_ans_simd.h"
 
+#include <cstddef>
 #include <cstdint>
 
 #include "lib/jxl/base/status.h"
@@ -22,7 +23,9 @@ namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::AllTrue;
 using hwy::HWY_NAMESPACE::And;
+using hwy::HWY_NAMESPACE::Eq;
 using hwy::HWY_NAMESPACE::Ge;
 using hwy::HWY_NAMESPACE::GetLane;
 using hwy::HWY_NAMESPACE::Gt;
@@ -224,6 +227,19 @@ uint32_t EstimateTokenCost(uint32_t* JXL_RESTRICT values, size_t len,
 #endif
 }
 
+size_t MatchLength(const uint32_t* a, const uint32_t* b, size_t max_len) {
+  const HWY_FULL(uint32_t) du;
+  size_t len = 0;
+  // Whole vectors, until one of them has a mismatch; the rest is scalar.
+  for (; len + Lanes(du) <= max_len; len += Lanes(du)) {
+    if (!AllTrue(du, Eq(LoadU(du, a + len), LoadU(du, b + len)))) break;
+  }
+  while (len < max_len && a[len] == b[len]) len++;
+  return len;
+}
+
+MatchLengthFunc ChooseMatchLength() { return &MatchLength; }
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -233,6 +249,7 @@ HWY_AFTER_NAMESPACE();
 namespace jxl {
 
 HWY_EXPORT(EstimateTokenCost);
+HWY_EXPORT(ChooseMatchLength);
 
 uint32_t EstimateTokenCost(uint32_t* JXL_RESTRICT values, size_t len,
                            HybridUintConfig cfg, AlignedMemory& tokens) {
@@ -240,5 +257,9 @@ uint32_t EstimateTokenCost(uint32_t* JXL_RESTRICT values, size_t len,
   return HWY_DYNAMIC_DISPATCH(EstimateTokenCost)(values, len, cfg, tokens);
 }
 
+MatchLengthFunc ChooseMatchLength() {
+  return HWY_DYNAMIC_DISPATCH(ChooseMatchLength)();
+}
+
 }  // namespace jxl
 #endif
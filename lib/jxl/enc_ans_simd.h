@@ -19,6 +19,15 @@ namespace jxl {
 uint32_t EstimateTokenCost(uint32_t* JXL_RESTRICT values, size_t len,
                            HybridUintConfig cfg, AlignedMemory& tokens);
 
+// Returns the number of equal values at the start of `a` and `b`, at most
+// `max_len`. The two ranges may overlap.
+using MatchLengthFunc = size_t (*)(const uint32_t* a, const uint32_t* b,
+                                   size_t max_len);
+
+// Returns the match length function of the best target for this CPU, so that
+// the LZ77 matcher dispatches once per chunk rather than once per candidate.
+MatchLengthFunc ChooseMatchLength();
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_ENC_ANS_SIMD_H_
@@ -83,6 +83,9 @@ void AuxOut::Assimilate(const AuxOut& victim) {
   num_dct32x64_blocks += victim.num_dct32x64_blocks;
   num_dct64_blocks += victim.num_dct64_blocks;
   num_butteraugli_iters += victim.num_butteraugli_iters;
+  for (size_t i = 0; i < kNumEncPhases; ++i) {
+    phases[i].Assimilate(victim.phases[i]);
+  }
 }
 
 void AuxOut::Print(size_t num_inputs) const {
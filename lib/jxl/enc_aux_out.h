@@ -9,6 +9,7 @@
 // Optional output information for debugging and analyzing size usage.
 
 #include <array>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 
@@ -40,6 +41,23 @@ constexpr uint8_t kNumImageLayers =
 
 const char* LayerName(LayerType layer);
 
+// For AuxOut::phases[] index. Same order as the phase keys of
+// JxlEncoderStatsKey.
+enum class EncPhase : uint8_t {
+  Xyb = 0,
+  AdaptiveQuantization,
+  AcStrategy,
+  Cfl,
+  Patches,
+  TreeLearning,
+  HistogramClustering,
+  Lz77,
+  TokenWriting,
+};
+
+constexpr uint8_t kNumEncPhases =
+    static_cast<uint8_t>(EncPhase::TokenWriting) + 1;
+
 // Statistics gathered during compression or decompression.
 struct AuxOut {
  private:
@@ -88,6 +106,25 @@ struct AuxOut {
     return layers[static_cast<uint8_t>(idx)];
   }
 
+  struct PhaseTotals {
+    void Assimilate(const PhaseTotals& victim) {
+      seconds += victim.seconds;
+      work += victim.work;
+    }
+
+    // Summed over all threads that ran the phase.
+    double seconds = 0.0;
+    // In units of the phase, e.g. pixels, blocks or tokens.
+    size_t work = 0;
+  };
+
+  std::array<PhaseTotals, kNumEncPhases> phases;
+
+  const PhaseTotals& phase(EncPhase idx) const {
+    return phases[static_cast<uint8_t>(idx)];
+  }
+  PhaseTotals& phase(EncPhase idx) { return phases[static_cast<uint8_t>(idx)]; }
+
   size_t num_blocks = 0;
 
   // Number of blocks that use larger DCT (set by ac_strategy).
@@ -105,6 +142,37 @@ struct AuxOut {
 
   int num_butteraugli_iters = 0;
 };
+
+// Adds the time between its construction and destruction, and the work given
+// to it, to a phase of `aux_out`. Does nothing if `aux_out` is null. Phases
+// that run in parallel are timed with one AuxOut per thread, which are then
+// assimilated.
+class PhaseTimer {
+ public:
+  PhaseTimer(AuxOut* aux_out, EncPhase phase, size_t work = 0)
+      : aux_out_(aux_out), phase_(phase), work_(work) {
+    if (aux_out_) start_ = std::chrono::steady_clock::now();
+  }
+  ~PhaseTimer() {
+    if (!aux_out_) return;
+    AuxOut::PhaseTotals& totals = aux_out_->phase(phase_);
+    totals.seconds += std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start_)
+                          .count();
+    totals.work += work_;
+  }
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+  void AddWork(size_t work) { work_ += work; }
+
+ private:
+  AuxOut* aux_out_;
+  EncPhase phase_;
+  size_t work_;
+  std::chrono::steady_clock::time_point start_;
+};
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_AUX_OUT_H_
@@ -8,9 +8,16 @@
 #include <jxl/cms_interface.h>
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
 
+#include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/butteraugli/butteraugli.h"
 #include "lib/jxl/color_encoding_internal.h"
@@ -21,9 +28,96 @@
 
 namespace jxl {
 
+namespace {
+
+// Granularity at which CompareIncrementally() tracks changed pixels.
+constexpr size_t kChangeTileDim = 64;
+// Number of tile rows whose diffmap is recomputed together.
+constexpr size_t kBandTiles = 4;
+
+// Stores in `rects` disjoint rects covering all the pixels of the diffmap that
+// can change when the distorted image changes from `a` to `b`.
+void DiffmapRectsToUpdate(const Image3F& a, const Image3F& b,
+                          std::vector<Rect>* rects) {
+  const size_t xsize = a.xsize();
+  const size_t ysize = a.ysize();
+  const size_t xtiles = DivCeil(xsize, kChangeTileDim);
+  const size_t ytiles = DivCeil(ysize, kChangeTileDim);
+  std::vector<uint8_t> changed(xtiles * ytiles);
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < ysize; ++y) {
+      const float* JXL_RESTRICT row_a = a.ConstPlaneRow(c, y);
+      const float* JXL_RESTRICT row_b = b.ConstPlaneRow(c, y);
+      uint8_t* changed_row = changed.data() + (y / kChangeTileDim) * xtiles;
+      for (size_t tx = 0; tx < xtiles; ++tx) {
+        const size_t x0 = tx * kChangeTileDim;
+        const size_t len = std::min(kChangeTileDim, xsize - x0);
+        if (!changed_row[tx] &&
+            memcmp(row_a + x0, row_b + x0, len * sizeof(float)) != 0) {
+          changed_row[tx] = 1;
+        }
+      }
+    }
+  }
+  // A diffmap tile must be updated if a changed pixel is close enough to it.
+  const size_t radius =
+      DivCeil(ButteraugliComparator::kDiffmapRadius, kChangeTileDim);
+  std::vector<uint8_t> dirty(xtiles * ytiles);
+  for (size_t ty = 0; ty < ytiles; ++ty) {
+    for (size_t tx = 0; tx < xtiles; ++tx) {
+      if (!changed[ty * xtiles + tx]) continue;
+      const size_t y1 = std::min(ytiles, ty + radius + 1);
+      const size_t x1 = std::min(xtiles, tx + radius + 1);
+      for (size_t y = ty > radius ? ty - radius : 0; y < y1; ++y) {
+        for (size_t x = tx > radius ? tx - radius : 0; x < x1; ++x) {
+          dirty[y * xtiles + x] = 1;
+        }
+      }
+    }
+  }
+  // Recomputing a gap between two dirty runs is cheaper than recomputing the
+  // borders that the two runs would need.
+  const size_t max_gap =
+      2 * ButteraugliComparator::kDiffmapRadius / kChangeTileDim;
+  rects->clear();
+  for (size_t band = 0; band < ytiles; band += kBandTiles) {
+    const size_t band_end = std::min(ytiles, band + kBandTiles);
+    std::vector<uint8_t> dirty_columns(xtiles);
+    size_t ty0 = band_end;
+    size_t ty1 = band;
+    for (size_t ty = band; ty < band_end; ++ty) {
+      for (size_t tx = 0; tx < xtiles; ++tx) {
+        if (!dirty[ty * xtiles + tx]) continue;
+        dirty_columns[tx] = 1;
+        ty0 = std::min(ty0, ty);
+        ty1 = ty + 1;
+      }
+    }
+    size_t tx0 = 0;
+    while (tx0 < xtiles) {
+      if (!dirty_columns[tx0]) {
+        ++tx0;
+        continue;
+      }
+      size_t tx1 = tx0 + 1;
+      for (size_t tx = tx1; tx < xtiles && tx <= tx1 + max_gap; ++tx) {
+        if (dirty_columns[tx]) tx1 = tx + 1;
+      }
+      const size_t x0 = tx0 * kChangeTileDim;
+      const size_t y0 = ty0 * kChangeTileDim;
+      rects->emplace_back(x0, y0, std::min(xsize, tx1 * kChangeTileDim) - x0,
+                          std::min(ysize, ty1 * kChangeTileDim) - y0);
+      tx0 = tx1;
+    }
+  }
+}
+
+}  // namespace
+
 JxlButteraugliComparator::JxlButteraugliComparator(
-    const ButteraugliParams& params, const JxlCmsInterface& cms)
-    : params_(params), cms_(cms) {}
+    const ButteraugliParams& params, const JxlCmsInterface& cms,
+    ThreadPool* pool)
+    : params_(params), cms_(cms), pool_(pool) {}
 
 Status JxlButteraugliComparator::SetReferenceImage(const ImageBundle& ref) {
   const ImageBundle* ref_linear_srgb;
@@ -34,8 +128,9 @@ Status JxlButteraugliComparator::SetReferenceImage(const ImageBundle& ref) {
                          /*pool=*/nullptr, &store, &ref_linear_srgb)) {
     return false;
   }
-  JXL_ASSIGN_OR_RETURN(comparator_, ButteraugliComparator::Make(
-                                        ref_linear_srgb->color(), params_));
+  JXL_ASSIGN_OR_RETURN(
+      comparator_,
+      ButteraugliComparator::Make(ref_linear_srgb->color(), params_, pool_));
   xsize_ = ref.xsize();
   ysize_ = ref.ysize();
   intensity_target_ = ref.metadata()->IntensityTarget();
@@ -45,7 +140,7 @@ Status JxlButteraugliComparator::SetReferenceImage(const ImageBundle& ref) {
 Status JxlButteraugliComparator::SetLinearReferenceImage(
     const Image3F& linear) {
   JXL_ASSIGN_OR_RETURN(comparator_,
-                       ButteraugliComparator::Make(linear, params_));
+                       ButteraugliComparator::Make(linear, params_, pool_));
   xsize_ = linear.xsize();
   ysize_ = linear.ysize();
   return true;
@@ -53,6 +148,23 @@ Status JxlButteraugliComparator::SetLinearReferenceImage(
 
 Status JxlButteraugliComparator::CompareWith(const ImageBundle& actual,
                                              ImageF* diffmap, float* score) {
+  return Compare(actual, /*previous=*/nullptr, diffmap, score);
+}
+
+Status JxlButteraugliComparator::CompareIncrementally(
+    const ImageBundle& previous, const ImageBundle& actual, ImageF* diffmap,
+    float* score) {
+  JXL_ENSURE(diffmap != nullptr);
+  if (previous.xsize() != actual.xsize() ||
+      previous.ysize() != actual.ysize()) {
+    return JXL_FAILURE("Images must have same size");
+  }
+  return Compare(actual, &previous, diffmap, score);
+}
+
+Status JxlButteraugliComparator::Compare(const ImageBundle& actual,
+                                         const ImageBundle* previous,
+                                         ImageF* diffmap, float* score) {
   if (!comparator_) {
     return JXL_FAILURE("Must set reference image first");
   }
@@ -70,8 +182,6 @@ Status JxlButteraugliComparator::CompareWith(const ImageBundle& actual,
     return false;
   }
 
-  JXL_ASSIGN_OR_RETURN(ImageF temp_diffmap,
-                       ImageF::Create(memory_manager, xsize_, ysize_));
   const Image3F* scaled_actual_linear_srgb = &actual_linear_srgb->color();
   Image3F scaled_actual_linear_srgb_store;
   if (intensity_target_ != 0 &&
@@ -93,6 +203,35 @@ Status JxlButteraugliComparator::CompareWith(const ImageBundle& actual,
       }
     }
   }
+
+  if (previous != nullptr) {
+    JXL_ENSURE(diffmap->xsize() == xsize_ && diffmap->ysize() == ysize_);
+    // The color conversion and scaling above are per pixel, so the converted
+    // images differ in the same pixels as the inputs.
+    std::vector<Rect> rects;
+    DiffmapRectsToUpdate(previous->color(), actual.color(), &rects);
+    // Each rect also reads its surroundings; updating the rects separately is
+    // only worth it if that is cheaper than computing the whole diffmap.
+    const size_t border = 2 * ButteraugliComparator::kDiffmapRadius;
+    size_t cost = 0;
+    for (const Rect& rect : rects) {
+      cost += std::min(xsize_, rect.xsize() + border) *
+              std::min(ysize_, rect.ysize() + border);
+    }
+    if (cost < xsize_ * ysize_) {
+      for (const Rect& rect : rects) {
+        JXL_RETURN_IF_ERROR(comparator_->DiffmapRect(*scaled_actual_linear_srgb,
+                                                     rect, *diffmap));
+      }
+      if (score != nullptr) {
+        *score = ButteraugliScoreFromDiffmap(*diffmap, &params_);
+      }
+      return true;
+    }
+  }
+
+  JXL_ASSIGN_OR_RETURN(ImageF temp_diffmap,
+                       ImageF::Create(memory_manager, xsize_, ysize_));
   JXL_RETURN_IF_ERROR(
       comparator_->Diffmap(*scaled_actual_linear_srgb, temp_diffmap));
 
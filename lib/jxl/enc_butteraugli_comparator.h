@@ -11,6 +11,7 @@
 
 #include <memory>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/butteraugli/butteraugli.h"
 #include "lib/jxl/enc_comparator.h"
@@ -21,8 +22,10 @@ namespace jxl {
 
 class JxlButteraugliComparator : public Comparator {
  public:
+  // Comparisons run on `pool` if it is not null.
   explicit JxlButteraugliComparator(const ButteraugliParams& params,
-                                    const JxlCmsInterface& cms);
+                                    const JxlCmsInterface& cms,
+                                    ThreadPool* pool = nullptr);
 
   Status SetReferenceImage(const ImageBundle& ref) override;
   Status SetLinearReferenceImage(const Image3F& linear);
@@ -30,12 +33,26 @@ class JxlButteraugliComparator : public Comparator {
   Status CompareWith(const ImageBundle& actual, ImageF* diffmap,
                      float* score) override;
 
+  // Same as CompareWith, but `diffmap` must hold the result of comparing with
+  // `previous`, which has the same size and metadata as `actual`. Only the
+  // parts of `diffmap` that are close to pixels in which `actual` differs from
+  // `previous` are computed again.
+  Status CompareIncrementally(const ImageBundle& previous,
+                              const ImageBundle& actual, ImageF* diffmap,
+                              float* score);
+
   float GoodQualityScore() const override;
   float BadQualityScore() const override;
 
  private:
+  // If `previous` is not null, only updates `diffmap` as described in
+  // CompareIncrementally.
+  Status Compare(const ImageBundle& actual, const ImageBundle* previous,
+                 ImageF* diffmap, float* score);
+
   ButteraugliParams params_;
   JxlCmsInterface cms_;
+  ThreadPool* pool_;
   std::unique_ptr<ButteraugliComparator> comparator_;
   size_t xsize_ = 0;
   size_t ysize_ = 0;
@@ -15,6 +15,9 @@
 #include <tuple>
 #include <vector>
 
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/enc_ans_params.h"
 
@@ -132,9 +135,30 @@ float HistogramKLDivergence(const Histogram& actual, const Histogram& coding) {
   return total_cost - actual.entropy;
 }
 
+// Histograms per task when computing distances to a single histogram.
+constexpr size_t kHistogramsPerTask = 16;
+
+// Calls func(i) for all i in [0, num) on the pool, in tasks of
+// kHistogramsPerTask consecutive indices.
+template <class Func>
+Status ForEachHistogram(ThreadPool* pool, size_t num, const Func& func,
+                        const char* caller) {
+  const auto process_chunk = [&](const uint32_t chunk,
+                                 size_t /* thread */) -> Status {
+    size_t end = std::min(num, (chunk + 1) * kHistogramsPerTask);
+    for (size_t i = chunk * kHistogramsPerTask; i < end; i++) {
+      JXL_RETURN_IF_ERROR(func(i));
+    }
+    return true;
+  };
+  return RunOnPool(pool, 0, DivCeil(num, kHistogramsPerTask),
+                   ThreadPool::NoInit, process_chunk, caller);
+}
+
 // First step of a k-means clustering with a fancy distance metric.
 Status FastClusterHistograms(const std::vector<Histogram>& in,
-                             size_t max_histograms, std::vector<Histogram>* out,
+                             size_t max_histograms, ThreadPool* pool,
+                             std::vector<Histogram>* out,
                              std::vector<uint32_t>* histogram_symbols) {
   const size_t prev_histograms = out->size();
   out->reserve(max_histograms);
@@ -142,6 +166,13 @@ Status FastClusterHistograms(const std::vector<Histogram>& in,
   histogram_symbols->resize(in.size(), max_histograms);
 
   std::vector<float> dists(in.size(), std::numeric_limits<float>::max());
+  JXL_RETURN_IF_ERROR(ForEachHistogram(
+      pool, in.size(),
+      [&](size_t i) -> Status {
+        if (in[i].total_count != 0) HistogramEntropy(in[i]);
+        return true;
+      },
+      "HistogramEntropy"));
   size_t largest_idx = 0;
   for (size_t i = 0; i < in.size(); i++) {
     if (in[i].total_count == 0) {
@@ -149,7 +180,6 @@ Status FastClusterHistograms(const std::vector<Histogram>& in,
       dists[i] = 0.0f;
       continue;
     }
-    HistogramEntropy(in[i]);
     if (in[i].total_count > in[largest_idx].total_count) {
       largest_idx = i;
     }
@@ -159,12 +189,17 @@ Status FastClusterHistograms(const std::vector<Histogram>& in,
     for (size_t j = 0; j < prev_histograms; ++j) {
       HistogramEntropy((*out)[j]);
     }
-    for (size_t i = 0; i < in.size(); i++) {
-      if (dists[i] == 0.0f) continue;
-      for (size_t j = 0; j < prev_histograms; ++j) {
-        dists[i] = std::min(HistogramKLDivergence(in[i], (*out)[j]), dists[i]);
-      }
-    }
+    JXL_RETURN_IF_ERROR(ForEachHistogram(
+        pool, in.size(),
+        [&](size_t i) -> Status {
+          if (dists[i] == 0.0f) return true;
+          for (size_t j = 0; j < prev_histograms; ++j) {
+            dists[i] =
+                std::min(HistogramKLDivergence(in[i], (*out)[j]), dists[i]);
+          }
+          return true;
+        },
+        "HistogramKLDivergence"));
     auto max_dist = std::max_element(dists.begin(), dists.end());
     if (*max_dist > 0.0f) {
       largest_idx = max_dist - dists.begin();
@@ -176,33 +211,79 @@ Status FastClusterHistograms(const std::vector<Histogram>& in,
     (*histogram_symbols)[largest_idx] = out->size();
     out->push_back(in[largest_idx]);
     dists[largest_idx] = 0.0f;
+    JXL_RETURN_IF_ERROR(ForEachHistogram(
+        pool, in.size(),
+        [&](size_t i) -> Status {
+          if (dists[i] == 0.0f) return true;
+          dists[i] = std::min(HistogramDistance(in[i], out->back()), dists[i]);
+          return true;
+        },
+        "HistogramDistance"));
     largest_idx = 0;
     for (size_t i = 0; i < in.size(); i++) {
       if (dists[i] == 0.0f) continue;
-      dists[i] = std::min(HistogramDistance(in[i], out->back()), dists[i]);
       if (dists[i] > dists[largest_idx]) largest_idx = i;
     }
     if (dists[largest_idx] < kMinDistanceForDistinct) break;
   }
 
+  // Each remaining histogram joins the closest cluster, which changes that
+  // cluster for the histograms that come after it. The distances of a batch of
+  // histograms to all clusters are computed in parallel; the distances to
+  // clusters that changed earlier in the batch are then recomputed in order.
+  std::vector<size_t> remaining;
   for (size_t i = 0; i < in.size(); i++) {
-    if ((*histogram_symbols)[i] != max_histograms) continue;
-    size_t best = 0;
-    float best_dist = std::numeric_limits<float>::max();
-    for (size_t j = 0; j < out->size(); j++) {
-      float dist = j < prev_histograms ? HistogramKLDivergence(in[i], (*out)[j])
-                                       : HistogramDistance(in[i], (*out)[j]);
-      if (dist < best_dist) {
-        best = j;
-        best_dist = dist;
+    if ((*histogram_symbols)[i] == max_histograms) remaining.push_back(i);
+  }
+  const size_t num_clusters = out->size();
+  const size_t batch_size =
+      pool == nullptr ? 1 : Clamp1<size_t>(num_clusters / 4, 1, 64);
+  std::vector<float> batch_dists(batch_size * num_clusters);
+  std::vector<uint8_t> changed(num_clusters);
+  std::vector<size_t> changed_clusters;
+  const auto cluster_distance = [&](size_t i, size_t j) {
+    return j < prev_histograms ? HistogramKLDivergence(in[i], (*out)[j])
+                               : HistogramDistance(in[i], (*out)[j]);
+  };
+  for (size_t start = 0; start < remaining.size(); start += batch_size) {
+    const size_t num = std::min(batch_size, remaining.size() - start);
+    const auto compute_dists = [&](const uint32_t k,
+                                   size_t /* thread */) -> Status {
+      for (size_t j = 0; j < num_clusters; j++) {
+        batch_dists[k * num_clusters + j] =
+            cluster_distance(remaining[start + k], j);
       }
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num, ThreadPool::NoInit,
+                                  compute_dists, "ClusterDistances"));
+    for (size_t k = 0; k < num; k++) {
+      size_t i = remaining[start + k];
+      float* JXL_RESTRICT row = batch_dists.data() + k * num_clusters;
+      for (size_t j : changed_clusters) {
+        row[j] = cluster_distance(i, j);
+      }
+      size_t best = 0;
+      float best_dist = std::numeric_limits<float>::max();
+      for (size_t j = 0; j < num_clusters; j++) {
+        if (row[j] < best_dist) {
+          best = j;
+          best_dist = row[j];
+        }
+      }
+      JXL_ENSURE(best_dist < std::numeric_limits<float>::max());
+      if (best >= prev_histograms) {
+        (*out)[best].AddHistogram(in[i]);
+        HistogramEntropy((*out)[best]);
+        if (!changed[best]) {
+          changed[best] = 1;
+          changed_clusters.push_back(best);
+        }
+      }
+      (*histogram_symbols)[i] = best;
     }
-    JXL_ENSURE(best_dist < std::numeric_limits<float>::max());
-    if (best >= prev_histograms) {
-      (*out)[best].AddHistogram(in[i]);
-      HistogramEntropy((*out)[best]);
-    }
-    (*histogram_symbols)[i] = best;
+    for (size_t j : changed_clusters) changed[j] = 0;
+    changed_clusters.clear();
   }
   return true;
 }
@@ -260,7 +341,8 @@ void HistogramReindex(std::vector<Histogram>* out, size_t prev_histograms,
 Status ClusterHistograms(const HistogramParams& params,
                          const std::vector<Histogram>& in,
                          size_t max_histograms, std::vector<Histogram>* out,
-                         std::vector<uint32_t>* histogram_symbols) {
+                         std::vector<uint32_t>* histogram_symbols,
+                         ThreadPool* pool) {
   size_t prev_histograms = out->size();
   max_histograms = std::min(max_histograms, params.max_histograms);
   max_histograms = std::min(max_histograms, in.size());
@@ -269,13 +351,17 @@ Status ClusterHistograms(const HistogramParams& params,
   }
 
   JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(FastClusterHistograms)(
-      in, prev_histograms + max_histograms, out, histogram_symbols));
+      in, prev_histograms + max_histograms, pool, out, histogram_symbols));
 
   if (prev_histograms == 0 &&
       params.clustering == HistogramParams::ClusteringType::kBest) {
-    for (auto& histo : *out) {
-      JXL_ASSIGN_OR_RETURN(histo.entropy, histo.ANSPopulationCost());
-    }
+    const auto compute_cost = [&](const uint32_t i,
+                                  size_t /* thread */) -> Status {
+      JXL_ASSIGN_OR_RETURN((*out)[i].entropy, (*out)[i].ANSPopulationCost());
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, out->size(), ThreadPool::NoInit,
+                                  compute_cost, "ANSPopulationCost"));
     uint32_t next_version = 2;
     std::vector<uint32_t> version(out->size(), 1);
     std::vector<uint32_t> renumbering(out->size());
@@ -298,15 +384,31 @@ Status ClusterHistograms(const HistogramParams& params,
       }
     };
 
-    // Create list of all pairs by increasing merging cost.
-    std::priority_queue<HistogramPair> pairs_to_merge;
-    for (uint32_t i = 0; i < out->size(); i++) {
-      for (uint32_t j = i + 1; j < out->size(); j++) {
+    // Cost of merging histograms i and j, computed on the pool for all j.
+    const size_t num_clusters = out->size();
+    std::vector<float> merge_costs(num_clusters);
+    const auto compute_merge_costs = [&](uint32_t i, uint32_t begin) {
+      const auto compute_merge_cost = [&](const uint32_t j,
+                                          size_t /* thread */) -> Status {
+        merge_costs[j] = 0;
+        if (j == i || version[j] == 0) return true;
         Histogram histo;
         histo.AddHistogram((*out)[i]);
         histo.AddHistogram((*out)[j]);
-        JXL_ASSIGN_OR_RETURN(float cost, histo.ANSPopulationCost());
-        cost -= (*out)[i].entropy + (*out)[j].entropy;
+        JXL_ASSIGN_OR_RETURN(merge_costs[j], histo.ANSPopulationCost());
+        merge_costs[j] -= (*out)[i].entropy + (*out)[j].entropy;
+        return true;
+      };
+      return RunOnPool(pool, begin, num_clusters, ThreadPool::NoInit,
+                       compute_merge_cost, "ClusterMergeCost");
+    };
+
+    // Create list of all pairs by increasing merging cost.
+    std::priority_queue<HistogramPair> pairs_to_merge;
+    for (uint32_t i = 0; i < num_clusters; i++) {
+      JXL_RETURN_IF_ERROR(compute_merge_costs(i, i + 1));
+      for (uint32_t j = i + 1; j < num_clusters; j++) {
+        float cost = merge_costs[j];
         // Avoid enqueueing pairs that are not advantageous to merge.
         if (cost >= 0) continue;
         pairs_to_merge.push(
@@ -335,14 +437,11 @@ Status ClusterHistograms(const HistogramParams& params,
       }
       version[second] = 0;
       version[first] = next_version++;
-      for (uint32_t j = 0; j < out->size(); j++) {
+      JXL_RETURN_IF_ERROR(compute_merge_costs(first, 0));
+      for (uint32_t j = 0; j < num_clusters; j++) {
         if (j == first) continue;
         if (version[j] == 0) continue;
-        Histogram histo;
-        histo.AddHistogram((*out)[first]);
-        histo.AddHistogram((*out)[j]);
-        JXL_ASSIGN_OR_RETURN(float merge_cost, histo.ANSPopulationCost());
-        merge_cost -= (*out)[first].entropy + (*out)[j].entropy;
+        float merge_cost = merge_costs[j];
         // Avoid enqueueing pairs that are not advantageous to merge.
         if (merge_cost >= 0) continue;
         pairs_to_merge.push(
@@ -18,10 +18,13 @@
 
 namespace jxl {
 
+class ThreadPool;
+
 Status ClusterHistograms(const HistogramParams& params,
                          const std::vector<Histogram>& in,
                          size_t max_histograms, std::vector<Histogram>* out,
-                         std::vector<uint32_t>* histogram_symbols);
+                         std::vector<uint32_t>* histogram_symbols,
+                         ThreadPool* pool = nullptr);
 }  // namespace jxl
 
 #endif  // LIB_JXL_ENC_CLUSTER_H_
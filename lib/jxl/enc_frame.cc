@@ -15,7 +15,9 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <utility>
 #include <vector>
@@ -1223,7 +1225,8 @@ Status EncodeGlobalDCInfo(const PassesSharedState& shared, BitWriter* writer,
 // saves the histogram bitstreams in enc_state, the actual AC global bitstream
 // is written in OutputAcGlobal() function after all the groups are processed.
 Status EncodeGlobalACInfo(PassesEncoderState* enc_state, BitWriter* writer,
-                          ModularFrameEncoder* enc_modular, AuxOut* aux_out) {
+                          ModularFrameEncoder* enc_modular, ThreadPool* pool,
+                          AuxOut* aux_out) {
   PassesSharedState& shared = enc_state->shared;
   JxlMemoryManager* memory_manager = enc_state->memory_manager();
   JXL_RETURN_IF_ERROR(DequantMatricesEncode(memory_manager, shared.matrices,
@@ -1290,7 +1293,7 @@ Status EncodeGlobalACInfo(PassesEncoderState* enc_state, BitWriter* writer,
             memory_manager, hist_params,
             num_histogram_groups * shared.block_ctx_map.NumACContexts(),
             enc_state->passes[i].ac_tokens, &enc_state->passes[i].codes, writer,
-            LayerType::Ac, aux_out));
+            LayerType::Ac, aux_out, pool));
     (void)cost;
   }
 
@@ -1349,8 +1352,8 @@ Status EncodeGroups(const FrameHeader& frame_header,
     if (frame_header.encoding == FrameEncoding::kVarDCT) {
       JXL_RETURN_IF_ERROR(EncodeGlobalDCInfo(shared, get_output(0), aux_out));
     }
-    JXL_RETURN_IF_ERROR(enc_modular->EncodeGlobalInfo(enc_state->streaming_mode,
-                                                      get_output(0), aux_out));
+    JXL_RETURN_IF_ERROR(enc_modular->EncodeGlobalInfo(
+        enc_state->streaming_mode, get_output(0), aux_out, pool));
     JXL_RETURN_IF_ERROR(enc_modular->EncodeStream(get_output(0), aux_out,
                                                   LayerType::ModularGlobal,
                                                   ModularStreamId::Global()));
@@ -1420,7 +1423,7 @@ Status EncodeGroups(const FrameHeader& frame_header,
   }
   if (frame_header.encoding == FrameEncoding::kVarDCT) {
     JXL_RETURN_IF_ERROR(EncodeGlobalACInfo(
-        enc_state, get_output(global_ac_index), enc_modular, aux_out));
+        enc_state, get_output(global_ac_index), enc_modular, pool, aux_out));
   }
 
   const auto process_group = [&](const uint32_t group_index,
@@ -1576,6 +1579,8 @@ Status ComputeEncodingData(
                                              patch_rect.ysize()));
         linear = &linear_storage;
       }
+      PhaseTimer timer(aux_out, EncPhase::Xyb,
+                       patch_rect.xsize() * patch_rect.ysize());
       JXL_RETURN_IF_ERROR(ToXYB(c_enc, metadata->m.IntensityTarget(), black,
                                 pool, &color, cms, linear));
     } else {
@@ -1665,7 +1670,11 @@ Status ComputeEncodingData(
         (cparams.buffering && cparams.responsive < 0) ||
         !cparams.custom_fixed_tree.empty()) {
       // Use local trees if doing lossless modular, unless at very slow speeds.
-      JXL_RETURN_IF_ERROR(enc_modular.ComputeTree(pool));
+      {
+        PhaseTimer timer(aux_out, EncPhase::TreeLearning);
+        JXL_RETURN_IF_ERROR(enc_modular.ComputeTree(pool));
+        timer.AddWork(enc_modular.TreeSize());
+      }
       JXL_RETURN_IF_ERROR(enc_modular.ComputeTokens(pool));
     }
     mutable_frame_header.UpdateFlag(shared.image_features.patches.HasAny(),
@@ -2033,7 +2042,7 @@ JXL_NOINLINE Status EncodeFrameStreaming(
     const FrameInfo& frame_info, const CodecMetadata* metadata,
     JxlEncoderChunkedFrameAdapter& frame_data, const JxlCmsInterface& cms,
     ThreadPool* pool, JxlEncoderOutputProcessorWrapper* output_processor,
-    AuxOut* aux_out) {
+    AuxOut* aux_out, ModularDecisionCache* decision_cache) {
   auto enc_state = jxl::make_unique<PassesEncoderState>(memory_manager);
   SetProgressiveMode(cparams, &enc_state->progressive_splitter);
   FrameHeader frame_header(metadata);
@@ -2049,7 +2058,8 @@ JXL_NOINLINE Status EncodeFrameStreaming(
   const size_t num_passes = enc_state->progressive_splitter.GetNumPasses();
   JXL_ASSIGN_OR_RETURN(
       auto enc_modular,
-      ModularFrameEncoder::Create(memory_manager, frame_header, cparams, true));
+      ModularFrameEncoder::Create(memory_manager, frame_header, cparams, true,
+                                  decision_cache));
   std::vector<coeff_order_t> permutation;
   std::vector<size_t> dc_group_order;
   size_t group_size = frame_header.ToFrameDimensions().group_dim;
@@ -2156,7 +2166,8 @@ Status EncodeFrameOneShot(JxlMemoryManager* memory_manager,
                           JxlEncoderChunkedFrameAdapter& frame_data,
                           const JxlCmsInterface& cms, ThreadPool* pool,
                           JxlEncoderOutputProcessorWrapper* output_processor,
-                          AuxOut* aux_out) {
+                          AuxOut* aux_out,
+                          ModularDecisionCache* decision_cache) {
   auto enc_state = jxl::make_unique<PassesEncoderState>(memory_manager);
   SetProgressiveMode(cparams, &enc_state->progressive_splitter);
   FrameHeader frame_header(metadata);
@@ -2172,7 +2183,8 @@ Status EncodeFrameOneShot(JxlMemoryManager* memory_manager,
   const size_t num_passes = enc_state->progressive_splitter.GetNumPasses();
   JXL_ASSIGN_OR_RETURN(auto enc_modular,
                        ModularFrameEncoder::Create(memory_manager, frame_header,
-                                                   cparams, false));
+                                                   cparams, false,
+                                                   decision_cache));
   std::vector<std::unique_ptr<BitWriter>> group_codes;
   JXL_RETURN_IF_ERROR(ComputeEncodingData(
       cparams, frame_info, metadata, frame_data, jpeg_data.get(), 0, 0,
@@ -2197,8 +2209,104 @@ Status EncodeFrameOneShot(JxlMemoryManager* memory_manager,
   return true;
 }
 
+// Encodes the frame with the given `cparams`, without trying other settings.
+// Encoders of the same frame may share a `decision_cache`.
+Status EncodeFrameWithParams(JxlMemoryManager* memory_manager,
+                             CompressParams cparams,
+                             const FrameInfo& frame_info,
+                             const CodecMetadata* metadata,
+                             JxlEncoderChunkedFrameAdapter& frame_data,
+                             const JxlCmsInterface& cms, ThreadPool* pool,
+                             JxlEncoderOutputProcessorWrapper* output_processor,
+                             AuxOut* aux_out,
+                             ModularDecisionCache* decision_cache) {
+  JXL_RETURN_IF_ERROR(ParamsPostInit(&cparams));
+
+  if (cparams.butteraugli_distance < 0) {
+    return JXL_FAILURE("Expected non-negative distance");
+  }
+
+  if (cparams.progressive_dc < 0) {
+    if (cparams.progressive_dc != -1) {
+      return JXL_FAILURE("Invalid progressive DC setting value (%d)",
+                         cparams.progressive_dc);
+    }
+    cparams.progressive_dc = 0;
+  }
+  if (cparams.ec_resampling < cparams.resampling) {
+    cparams.ec_resampling = cparams.resampling;
+  }
+  if (cparams.resampling > 1 || frame_info.is_preview) {
+    cparams.progressive_dc = 0;
+  }
+
+  if (frame_info.dc_level + cparams.progressive_dc > 4) {
+    return JXL_FAILURE("Too many levels of progressive DC");
+  }
+
+  if (cparams.modular_mode == false &&
+      cparams.butteraugli_distance < kMinButteraugliDistance) {
+    return JXL_FAILURE("Butteraugli distance is too low (%f)",
+                       cparams.butteraugli_distance);
+  }
+
+  if (frame_data.IsJPEG()) {
+    cparams.gaborish = Override::kOff;
+    cparams.epf = 0;
+    cparams.modular_mode = false;
+  }
+
+  if (frame_data.xsize == 0 || frame_data.ysize == 0) {
+    return JXL_FAILURE("Empty image");
+  }
+
+  // Assert that this metadata is correctly set up for the compression params,
+  // this should have been done by enc_file.cc
+  JXL_ENSURE(metadata->m.xyb_encoded ==
+             (cparams.color_transform == ColorTransform::kXYB));
+
+  if (frame_data.IsJPEG() && cparams.color_transform == ColorTransform::kXYB) {
+    return JXL_FAILURE("Can't add JPEG frame to XYB codestream");
+  }
+
+  if (CanDoStreamingEncoding(cparams, frame_info, *metadata, frame_data)) {
+    return EncodeFrameStreaming(memory_manager, cparams, frame_info, metadata,
+                                frame_data, cms, pool, output_processor,
+                                aux_out, decision_cache);
+  } else {
+    return EncodeFrameOneShot(memory_manager, cparams, frame_info, metadata,
+                              frame_data, cms, pool, output_processor, aux_out,
+                              decision_cache);
+  }
+}
+
 }  // namespace
 
+std::vector<CompressParams> TectonicPlateProbeSettings(
+    const CompressParams& cparams_orig) {
+  std::vector<CompressParams> all_params;
+  CompressParams cparams_attempt = cparams_orig;
+  cparams_attempt.speed_tier = SpeedTier::kGlacier;
+
+  cparams_attempt.options.max_properties = 4;
+  cparams_attempt.options.nb_repeats = 1.0f;
+  cparams_attempt.modular_group_size_shift = 3;
+  cparams_attempt.palette_colors = 0;
+  cparams_attempt.options.predictor = Predictor::Variable;
+  cparams_attempt.channel_colors_percent = 80.f;
+  cparams_attempt.channel_colors_pre_transform_percent = 95.f;
+  cparams_attempt.options.wp_tree_mode = ModularOptions::TreeMode::kDefault;
+  cparams_attempt.patches = Override::kDefault;
+  all_params.push_back(cparams_attempt);
+  cparams_attempt.options.predictor = Predictor::Zero;
+  cparams_attempt.options.nb_repeats = 0.01f;
+  cparams_attempt.palette_colors = 70000;
+  cparams_attempt.patches = Override::kOff;
+  cparams_attempt.options.wp_tree_mode = ModularOptions::TreeMode::kNoWP;
+  all_params.push_back(cparams_attempt);
+  return all_params;
+}
+
 std::vector<CompressParams> TectonicPlateSettingsLessPalette(
     const CompressParams& cparams_orig) {
   std::vector<CompressParams> all_params;
@@ -2413,130 +2521,71 @@ Status EncodeFrame(JxlMemoryManager* memory_manager,
   }
   if (cparams.speed_tier == SpeedTier::kTectonicPlate) {
     // Test palette performance to inform later trials.
-    std::vector<CompressParams> all_params;
-    CompressParams cparams_attempt = cparams_orig;
-    cparams_attempt.speed_tier = SpeedTier::kGlacier;
-
-    cparams_attempt.options.max_properties = 4;
-    cparams_attempt.options.nb_repeats = 1.0f;
-    cparams_attempt.modular_group_size_shift = 3;
-    cparams_attempt.palette_colors = 0;
-    cparams_attempt.options.predictor = Predictor::Variable;
-    cparams_attempt.channel_colors_percent = 80.f;
-    cparams_attempt.channel_colors_pre_transform_percent = 95.f;
-    cparams_attempt.options.wp_tree_mode = ModularOptions::TreeMode::kDefault;
-    cparams_attempt.patches = Override::kDefault;
-    all_params.push_back(cparams_attempt);
-    cparams_attempt.options.predictor = Predictor::Zero;
-    cparams_attempt.options.nb_repeats = 0.01f;
-    cparams_attempt.palette_colors = 70000;
-    cparams_attempt.patches = Override::kOff;
-    cparams_attempt.options.wp_tree_mode = ModularOptions::TreeMode::kNoWP;
-    all_params.push_back(cparams_attempt);
-
-    std::vector<size_t> size;
-    size.resize(all_params.size());
+    std::vector<CompressParams> all_params =
+        TectonicPlateProbeSettings(cparams_orig);
+
+    // Most groups are the same for many variants, so they share the outcome
+    // of the RCT and weighted predictor searches.
+    ModularDecisionCache decision_cache;
+
+    // Only the smallest output of each round is kept, so that the winner does
+    // not need to be encoded again; ties go to the variant listed first. Each
+    // variant gathers its own statistics, and only those of the winner are
+    // reported.
+    struct Candidate {
+      size_t size = std::numeric_limits<size_t>::max();
+      size_t index = 0;
+      std::vector<uint8_t> bytes;
+      AuxOut aux_out;
+    };
+    Candidate best;
+    std::mutex best_mutex;
 
+    // There are fewer variants than threads, so let each variant use the pool
+    // as well; this runs sequentially unless the runner supports nesting.
     const auto process_variant = [&](size_t task, size_t) -> Status {
       JxlEncoderOutputProcessorWrapper local_output(memory_manager);
-      JXL_RETURN_IF_ERROR(EncodeFrame(memory_manager, all_params[task],
-                                      frame_info, metadata, frame_data, cms,
-                                      nullptr, &local_output, aux_out));
-      size[task] = local_output.CurrentPosition();
+      AuxOut local_aux_out;
+      JXL_RETURN_IF_ERROR(EncodeFrameWithParams(
+          memory_manager, all_params[task], frame_info, metadata, frame_data,
+          cms, pool, &local_output, aux_out ? &local_aux_out : nullptr,
+          &decision_cache));
+      JXL_RETURN_IF_ERROR(local_output.SetFinalizedPosition());
+      size_t size = local_output.CurrentPosition();
+      std::lock_guard<std::mutex> lock(best_mutex);
+      if (size < best.size || (size == best.size && task < best.index)) {
+        best.size = size;
+        best.index = task;
+        JXL_RETURN_IF_ERROR(local_output.CopyOutput(best.bytes));
+        best.aux_out = local_aux_out;
+      }
       return true;
     };
     JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, all_params.size(),
                                   ThreadPool::NoInit, process_variant,
                                   "Compress kTectonicPlate"));
 
-    std::vector<CompressParams> all_params_test = all_params;
-    std::vector<size_t> size_test = size;
-    size_t best_idx_test = 0;
+    Candidate best_test = std::move(best);
+    best = Candidate();
 
-    if (size_test[0] <= size_test[1]) {
+    if (best_test.index == 0) {
       all_params = TectonicPlateSettingsLessPalette(cparams_orig);
     } else {
-      best_idx_test = 1;
       all_params = TectonicPlateSettingsMorePalette(cparams_orig);
     }
 
-    size.clear();
-    size.resize(all_params.size());
-
     JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, all_params.size(),
                                   ThreadPool::NoInit, process_variant,
                                   "Compress kTectonicPlate"));
 
-    size_t best_idx = 0;
-    for (size_t i = 1; i < all_params.size(); i++) {
-      if (size[best_idx] > size[i]) {
-        best_idx = i;
-      }
-    }
-    if (size[best_idx] < size_test[best_idx_test]) {
-      cparams = all_params[best_idx];
-    } else {
-      cparams = all_params_test[best_idx_test];
-    }
+    const Candidate& winner = best.size < best_test.size ? best : best_test;
+    if (aux_out) aux_out->Assimilate(winner.aux_out);
+    return AppendData(*output_processor, winner.bytes);
   }
 
-  JXL_RETURN_IF_ERROR(ParamsPostInit(&cparams));
-
-  if (cparams.butteraugli_distance < 0) {
-    return JXL_FAILURE("Expected non-negative distance");
-  }
-
-  if (cparams.progressive_dc < 0) {
-    if (cparams.progressive_dc != -1) {
-      return JXL_FAILURE("Invalid progressive DC setting value (%d)",
-                         cparams.progressive_dc);
-    }
-    cparams.progressive_dc = 0;
-  }
-  if (cparams.ec_resampling < cparams.resampling) {
-    cparams.ec_resampling = cparams.resampling;
-  }
-  if (cparams.resampling > 1 || frame_info.is_preview) {
-    cparams.progressive_dc = 0;
-  }
-
-  if (frame_info.dc_level + cparams.progressive_dc > 4) {
-    return JXL_FAILURE("Too many levels of progressive DC");
-  }
-
-  if (cparams.modular_mode == false &&
-      cparams.butteraugli_distance < kMinButteraugliDistance) {
-    return JXL_FAILURE("Butteraugli distance is too low (%f)",
-                       cparams.butteraugli_distance);
-  }
-
-  if (frame_data.IsJPEG()) {
-    cparams.gaborish = Override::kOff;
-    cparams.epf = 0;
-    cparams.modular_mode = false;
-  }
-
-  if (frame_data.xsize == 0 || frame_data.ysize == 0) {
-    return JXL_FAILURE("Empty image");
-  }
-
-  // Assert that this metadata is correctly set up for the compression params,
-  // this should have been done by enc_file.cc
-  JXL_ENSURE(metadata->m.xyb_encoded ==
-             (cparams.color_transform == ColorTransform::kXYB));
-
-  if (frame_data.IsJPEG() && cparams.color_transform == ColorTransform::kXYB) {
-    return JXL_FAILURE("Can't add JPEG frame to XYB codestream");
-  }
-
-  if (CanDoStreamingEncoding(cparams, frame_info, *metadata, frame_data)) {
-    return EncodeFrameStreaming(memory_manager, cparams, frame_info, metadata,
-                                frame_data, cms, pool, output_processor,
-                                aux_out);
-  } else {
-    return EncodeFrameOneShot(memory_manager, cparams, frame_info, metadata,
-                              frame_data, cms, pool, output_processor, aux_out);
-  }
+  return EncodeFrameWithParams(memory_manager, cparams, frame_info, metadata,
+                               frame_data, cms, pool, output_processor, aux_out,
+                               /*decision_cache=*/nullptr);
 }
 
 Status EncodeFrame(JxlMemoryManager* memory_manager,
@@ -88,6 +88,18 @@ struct FrameInfo {
 // Checks and adjusts CompressParams when they are all initialized.
 Status ParamsPostInit(CompressParams* p);
 
+// Settings of the variants that EncodeFrame tries for lossless frames at
+// SpeedTier::kTectonicPlate. The probe settings are tried first; if the first
+// of them gives the smallest output, the settings with less palette are tried
+// next, otherwise those with more palette. The smallest output of all of them
+// is kept, the first one listed in case of a tie.
+std::vector<CompressParams> TectonicPlateProbeSettings(
+    const CompressParams& cparams_orig);
+std::vector<CompressParams> TectonicPlateSettingsLessPalette(
+    const CompressParams& cparams_orig);
+std::vector<CompressParams> TectonicPlateSettingsMorePalette(
+    const CompressParams& cparams_orig);
+
 // Encodes a single frame (including its header) into a byte stream.  Groups may
 // be processed in parallel by `pool`. metadata is the ImageMetadata encoded in
 // the codestream, and must be used for the FrameHeaders, do not use
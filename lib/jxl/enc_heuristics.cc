@@ -42,6 +42,7 @@
 #include "lib/jxl/dec_xyb.h"
 #include "lib/jxl/enc_ac_strategy.h"
 #include "lib/jxl/enc_adaptive_quantization.h"
+#include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_chroma_from_luma.h"
 #include "lib/jxl/enc_gaborish.h"
@@ -1119,6 +1120,8 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
     if (!frame_header.loop_filter.gab) {
       butteraugli_distance_for_iqf *= 0.62f;
     }
+    PhaseTimer timer(aux_out, EncPhase::AdaptiveQuantization,
+                     frame_dim.xsize_blocks * frame_dim.ysize_blocks);
     JXL_ASSIGN_OR_RETURN(
         initial_quant_field,
         InitialQuantField(butteraugli_distance_for_iqf, *opsin, rect, pool,
@@ -1152,6 +1155,8 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
                                           initial_quant_masking,
                                           initial_quant_masking1x1, &matrices));
 
+  // Phase timings of the tiles are accumulated per thread.
+  std::vector<std::unique_ptr<AuxOut>> aux_outs;
   auto process_tile = [&](const uint32_t tid, const size_t thread) -> Status {
     size_t n_enc_tiles = DivCeil(frame_dim.xsize_blocks, kEncTileDimInBlocks);
     size_t tx = tid % n_enc_tiles;
@@ -1163,10 +1168,14 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
     size_t bx1 =
         std::min((tx + 1) * kEncTileDimInBlocks, frame_dim.xsize_blocks);
     Rect r(bx0, by0, bx1 - bx0, by1 - by0);
+    const size_t num_blocks = r.xsize() * r.ysize();
+    AuxOut* thread_aux_out =
+        aux_outs.empty() ? nullptr : aux_outs[thread].get();
 
     // For speeds up to Wombat, we only compute the color correlation map
     // once we know the transform type and the quantization map.
     if (cparams.speed_tier <= SpeedTier::kSquirrel) {
+      PhaseTimer timer(thread_aux_out, EncPhase::Cfl, num_blocks);
       JXL_RETURN_IF_ERROR(cfl_heuristics.ComputeTile(
           r, *opsin, rect, matrices,
           /*ac_strategy=*/nullptr,
@@ -1175,19 +1184,27 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
     }
 
     // Choose block sizes.
-    JXL_RETURN_IF_ERROR(
-        acs_heuristics.ProcessRect(r, cmap, &ac_strategy, thread));
+    {
+      PhaseTimer timer(thread_aux_out, EncPhase::AcStrategy, num_blocks);
+      JXL_RETURN_IF_ERROR(
+          acs_heuristics.ProcessRect(r, cmap, &ac_strategy, thread));
+    }
 
     // Always set the initial quant field, so we can compute the CfL map with
     // more accuracy. The initial quant field might change in slower modes, but
     // adjusting the quant field with butteraugli when all the other encoding
     // parameters are fixed is likely a more reliable choice anyway.
-    JXL_RETURN_IF_ERROR(AdjustQuantField(
-        ac_strategy, r, cparams.butteraugli_distance, &initial_quant_field));
-    quantizer.SetQuantFieldRect(initial_quant_field, r, &raw_quant_field);
+    {
+      PhaseTimer timer(thread_aux_out, EncPhase::AdaptiveQuantization,
+                       num_blocks);
+      JXL_RETURN_IF_ERROR(AdjustQuantField(
+          ac_strategy, r, cparams.butteraugli_distance, &initial_quant_field));
+      quantizer.SetQuantFieldRect(initial_quant_field, r, &raw_quant_field);
+    }
 
     // Compute a non-default CfL map if we are at Hare speed, or slower.
     if (cparams.speed_tier <= SpeedTier::kHare) {
+      PhaseTimer timer(thread_aux_out, EncPhase::Cfl, num_blocks);
       JXL_RETURN_IF_ERROR(cfl_heuristics.ComputeTile(
           r, *opsin, rect, matrices, &ac_strategy, &raw_quant_field, &quantizer,
           /*fast=*/cparams.speed_tier >= SpeedTier::kWombat, thread, &cmap));
@@ -1199,10 +1216,19 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
   const auto prepare = [&](const size_t num_threads) -> Status {
     JXL_RETURN_IF_ERROR(acs_heuristics.PrepareForThreads(num_threads));
     JXL_RETURN_IF_ERROR(cfl_heuristics.PrepareForThreads(num_threads));
+    if (aux_out != nullptr) {
+      aux_outs.resize(num_threads);
+      for (auto& thread_aux_out : aux_outs) {
+        thread_aux_out = jxl::make_unique<AuxOut>();
+      }
+    }
     return true;
   };
   JXL_RETURN_IF_ERROR(
       RunOnPool(pool, 0, num_tiles, prepare, process_tile, "Enc Heuristics"));
+  for (const auto& thread_aux_out : aux_outs) {
+    aux_out->Assimilate(*thread_aux_out);
+  }
 
   JXL_RETURN_IF_ERROR(acs_heuristics.Finalize(frame_dim, ac_strategy, aux_out));
 
@@ -1210,6 +1236,8 @@ Status LossyFrameHeuristics(const FrameHeader& frame_header,
   if (!streaming_mode && !cparams.disable_perceptual_optimizations) {
     ImageB& epf_sharpness = shared.epf_sharpness;
     FillPlane(static_cast<uint8_t>(4), &epf_sharpness, Rect(epf_sharpness));
+    PhaseTimer timer(aux_out, EncPhase::AdaptiveQuantization,
+                     frame_dim.xsize_blocks * frame_dim.ysize_blocks);
     JXL_RETURN_IF_ERROR(FindBestQuantizer(frame_header, linear, *opsin,
                                           initial_quant_field, enc_state, cms,
                                           pool, aux_out));
@@ -22,11 +22,13 @@
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/fast_math-inl.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/enc_ans_params.h"
+#include "lib/jxl/enc_ans_simd.h"
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_cluster.h"
 #include "lib/jxl/enc_context_map.h"
@@ -212,6 +214,9 @@ struct HashChain {
 
   uint32_t maxchainlength = 256;  // window_size_ to allow all
 
+  // Dispatched once for the chain rather than for each candidate.
+  MatchLengthFunc match_length_ = ChooseMatchLength();
+
   HashChain(const Token* data, size_t size, size_t window_size,
             size_t min_length, size_t max_length, size_t distance_multiplier)
       : size_(size),
@@ -326,11 +331,7 @@ struct HashChain {
           i += r;
           j += r;
         }
-        while (i < end && data_[i] == data_[j]) {
-          i++;
-          j++;
-        }
-        len = i - pos;
+        len = i - pos + match_length_(&data_[i], &data_[j], end - i);
         // This can trigger even if the new length is slightly smaller than the
         // best length, because it is possible for a slightly cheaper distance
         // symbol to occur.
@@ -450,263 +451,362 @@ float DistCost(size_t dist) {
   return kCostTable[tok] + nbits;
 }
 
-std::vector<std::vector<Token>> ApplyLZ77_LZ77(
-    const HistogramParams& params, size_t num_contexts,
-    const std::vector<std::vector<Token>>& tokens, const LZ77Params& lz77) {
-  std::vector<std::vector<Token>> tokens_lz77(tokens.size());
-  // TODO(veluca): tune heuristics here.
-  SymbolCostEstimator sce(num_contexts, params.force_huffman, tokens, lz77);
-  float bit_decrease = 0;
-  size_t total_symbols = 0;
-  HybridUintConfig uint_config;
-  std::vector<float> sym_cost;
+// Streams that are longer than twice this many tokens are split into chunks
+// of at least this size, which are matched independently. Each chunk can refer
+// to the kWindowSize tokens before it, as a match over the whole stream would.
+// The split does not depend on the number of threads, and shorter streams are
+// matched as a whole.
+constexpr size_t kLZ77ChunkSize = 1 << 18;
+
+// Tokens [begin, end) of a stream, which can also refer to the `history`
+// tokens before `begin`.
+struct LZ77Chunk {
+  size_t stream;
+  size_t history;
+  size_t begin;
+  size_t end;
+};
+
+std::vector<LZ77Chunk> SplitIntoChunks(
+    const std::vector<std::vector<Token>>& tokens) {
+  std::vector<LZ77Chunk> chunks;
   for (size_t stream = 0; stream < tokens.size(); stream++) {
-    size_t distance_multiplier =
-        params.image_widths.size() > stream ? params.image_widths[stream] : 0;
-    const auto& in = tokens[stream];
-    auto& out = tokens_lz77[stream];
-    total_symbols += in.size();
-    // Cumulative sum of bit costs.
-    sym_cost.resize(in.size() + 1);
-    for (size_t i = 0; i < in.size(); i++) {
-      uint32_t tok, nbits, unused_bits;
-      uint_config.Encode(in[i].value, &tok, &nbits, &unused_bits);
-      sym_cost[i + 1] = sce.Bits(in[i].context, tok) + nbits + sym_cost[i];
+    const size_t size = tokens[stream].size();
+    const size_t num_chunks = std::max<size_t>(1, size / kLZ77ChunkSize);
+    for (size_t c = 0; c < num_chunks; c++) {
+      const size_t begin = size * c / num_chunks;
+      const size_t end = size * (c + 1) / num_chunks;
+      chunks.push_back({stream, std::min(begin, kWindowSize), begin, end});
     }
+  }
+  return chunks;
+}
 
-    out.reserve(in.size());
-    size_t max_distance = in.size();
-    size_t min_length = lz77.min_length;
-    JXL_DASSERT(min_length >= 3);
-    size_t max_length = in.size();
-
-    // Use next power of two as window size.
-    size_t window_size = 1;
-    while (window_size < max_distance && window_size < kWindowSize) {
-      window_size <<= 1;
+// Appends the tokens of each chunk to the output of its stream.
+std::vector<std::vector<Token>> JoinChunks(
+    size_t num_streams, const std::vector<LZ77Chunk>& chunks,
+    std::vector<std::vector<Token>>& chunk_tokens) {
+  std::vector<std::vector<Token>> tokens_lz77(num_streams);
+  for (size_t c = 0; c < chunks.size(); c++) {
+    auto& out = tokens_lz77[chunks[c].stream];
+    if (out.empty()) {
+      out.swap(chunk_tokens[c]);
+    } else {
+      out.insert(out.end(), chunk_tokens[c].begin(), chunk_tokens[c].end());
     }
+    std::vector<Token>().swap(chunk_tokens[c]);
+  }
+  return tokens_lz77;
+}
 
-    HashChain chain(in.data(), in.size(), window_size, min_length, max_length,
-                    distance_multiplier);
-    size_t len;
-    size_t dist_symbol;
+// Cumulative sum of the bit costs of the first `size` tokens of `in`.
+void ComputeSymbolCosts(const SymbolCostEstimator& sce, const Token* in,
+                        size_t size, std::vector<float>* sym_cost) {
+  HybridUintConfig uint_config;
+  sym_cost->resize(size + 1);
+  (*sym_cost)[0] = 0;
+  for (size_t i = 0; i < size; i++) {
+    uint32_t tok, nbits, unused_bits;
+    uint_config.Encode(in[i].value, &tok, &nbits, &unused_bits);
+    (*sym_cost)[i + 1] = sce.Bits(in[i].context, tok) + nbits + (*sym_cost)[i];
+  }
+}
 
-    const size_t max_lazy_match_len = 256;  // 0 to disable lazy matching
+// Hash chain over `in` that can refer to all of its `size` tokens, with
+// the first `history` ones already added.
+HashChain MakeHashChain(const Token* in, size_t history, size_t size,
+                        size_t min_length, size_t distance_multiplier) {
+  size_t max_distance = size;
+  size_t max_length = size;
+
+  // Use next power of two as window size.
+  size_t window_size = 1;
+  while (window_size < max_distance && window_size < kWindowSize) {
+    window_size <<= 1;
+  }
 
-    // Whether the next symbol was already updated (to test lazy matching)
-    bool already_updated = false;
-    for (size_t i = 0; i < in.size(); i++) {
-      out.push_back(in[i]);
-      if (!already_updated) chain.Update(i);
-      already_updated = false;
-      chain.FindMatch(i, max_distance, &dist_symbol, &len);
-      if (len >= min_length) {
-        if (len < max_lazy_match_len && i + 1 < in.size()) {
-          // Try length at next symbol lazy matching
-          chain.Update(i + 1);
-          already_updated = true;
-          size_t len2, dist_symbol2;
-          chain.FindMatch(i + 1, max_distance, &dist_symbol2, &len2);
-          if (len2 > len) {
-            // Use the lazy match. Add literal, and use the next length starting
-            // from the next byte.
-            ++i;
-            already_updated = false;
-            len = len2;
-            dist_symbol = dist_symbol2;
-            out.push_back(in[i]);
-          }
-        }
+  HashChain chain(in, size, window_size, min_length, max_length,
+                  distance_multiplier);
+  chain.Update(0, history);
+  return chain;
+}
 
-        float cost = sym_cost[i + len] - sym_cost[i];
-        size_t lz77_len = len - lz77.min_length;
-        float lz77_cost = LenCost(lz77_len) + DistCost(dist_symbol) +
-                          sce.AddSymbolCost(out.back().context);
-
-        if (lz77_cost <= cost) {
-          out.back().value = len - min_length;
-          out.back().is_lz77_length = true;
-          out.emplace_back(
-              static_cast<uint32_t>(lz77.nonserialized_distance_context),
-              static_cast<uint32_t>(dist_symbol));
-          bit_decrease += cost - lz77_cost;
-        } else {
-          // LZ77 match ignored, and symbol already pushed. Push all other
-          // symbols and skip.
-          for (size_t j = 1; j < len; j++) {
-            out.push_back(in[i + j]);
-          }
+// Greedy LZ77 with lazy matching of the tokens of `in` after the first
+// `history` ones. The bit savings of the matches are appended to
+// `bit_decreases`.
+void GreedyLZ77(const SymbolCostEstimator& sce, const LZ77Params& lz77,
+                const Token* in, size_t history, size_t size,
+                size_t distance_multiplier, std::vector<Token>* out,
+                std::vector<float>* bit_decreases) {
+  // Cumulative sum of bit costs.
+  std::vector<float> sym_cost;
+  ComputeSymbolCosts(sce, in, size, &sym_cost);
+
+  out->reserve(size - history);
+  size_t max_distance = size;
+  size_t min_length = lz77.min_length;
+  JXL_DASSERT(min_length >= 3);
+
+  HashChain chain =
+      MakeHashChain(in, history, size, min_length, distance_multiplier);
+  size_t len;
+  size_t dist_symbol;
+
+  const size_t max_lazy_match_len = 256;  // 0 to disable lazy matching
+
+  // Whether the next symbol was already updated (to test lazy matching)
+  bool already_updated = false;
+  for (size_t i = history; i < size; i++) {
+    out->push_back(in[i]);
+    if (!already_updated) chain.Update(i);
+    already_updated = false;
+    chain.FindMatch(i, max_distance, &dist_symbol, &len);
+    if (len >= min_length) {
+      if (len < max_lazy_match_len && i + 1 < size) {
+        // Try length at next symbol lazy matching
+        chain.Update(i + 1);
+        already_updated = true;
+        size_t len2, dist_symbol2;
+        chain.FindMatch(i + 1, max_distance, &dist_symbol2, &len2);
+        if (len2 > len) {
+          // Use the lazy match. Add literal, and use the next length starting
+          // from the next byte.
+          ++i;
+          already_updated = false;
+          len = len2;
+          dist_symbol = dist_symbol2;
+          out->push_back(in[i]);
         }
+      }
 
-        if (already_updated) {
-          chain.Update(i + 2, len - 2);
-          already_updated = false;
-        } else {
-          chain.Update(i + 1, len - 1);
+      float cost = sym_cost[i + len] - sym_cost[i];
+      size_t lz77_len = len - lz77.min_length;
+      float lz77_cost = LenCost(lz77_len) + DistCost(dist_symbol) +
+                        sce.AddSymbolCost(out->back().context);
+
+      if (lz77_cost <= cost) {
+        out->back().value = len - min_length;
+        out->back().is_lz77_length = true;
+        out->emplace_back(
+            static_cast<uint32_t>(lz77.nonserialized_distance_context),
+            static_cast<uint32_t>(dist_symbol));
+        bit_decreases->push_back(cost - lz77_cost);
+      } else {
+        // LZ77 match ignored, and symbol already pushed. Push all other
+        // symbols and skip.
+        for (size_t j = 1; j < len; j++) {
+          out->push_back(in[i + j]);
         }
-        i += len - 1;
+      }
+
+      if (already_updated) {
+        chain.Update(i + 2, len - 2);
+        already_updated = false;
       } else {
-        // Literal, already pushed
+        chain.Update(i + 1, len - 1);
       }
+      i += len - 1;
+    } else {
+      // Literal, already pushed
     }
   }
+}
 
+StatusOr<std::vector<std::vector<Token>>> ApplyLZ77_LZ77(
+    const HistogramParams& params, size_t num_contexts,
+    const std::vector<std::vector<Token>>& tokens, const LZ77Params& lz77,
+    ThreadPool* pool) {
+  // TODO(veluca): tune heuristics here.
+  SymbolCostEstimator sce(num_contexts, params.force_huffman, tokens, lz77);
+  const std::vector<LZ77Chunk> chunks = SplitIntoChunks(tokens);
+  std::vector<std::vector<Token>> chunk_tokens(chunks.size());
+  std::vector<std::vector<float>> bit_decreases(chunks.size());
+  const auto process_chunk = [&](const uint32_t c,
+                                 size_t /* thread */) -> Status {
+    const LZ77Chunk& chunk = chunks[c];
+    size_t distance_multiplier = params.image_widths.size() > chunk.stream
+                                     ? params.image_widths[chunk.stream]
+                                     : 0;
+    const size_t start = chunk.begin - chunk.history;
+    GreedyLZ77(sce, lz77, tokens[chunk.stream].data() + start, chunk.history,
+               chunk.end - start, distance_multiplier, &chunk_tokens[c],
+               &bit_decreases[c]);
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, chunks.size(), ThreadPool::NoInit,
+                                process_chunk, "LZ77"));
+
+  // Add up the savings in the same order as a serial pass would.
+  float bit_decrease = 0;
+  for (const auto& chunk_decreases : bit_decreases) {
+    for (float decrease : chunk_decreases) bit_decrease += decrease;
+  }
+  size_t total_symbols = 0;
+  for (const auto& stream : tokens) total_symbols += stream.size();
   if (bit_decrease > total_symbols * 0.2 + 16) {
-    return tokens_lz77;
+    return JoinChunks(tokens.size(), chunks, chunk_tokens);
   }
-  return {};
+  return std::vector<std::vector<Token>>();
 }
 
-std::vector<std::vector<Token>> ApplyLZ77_Optimal(
-    const HistogramParams& params, size_t num_contexts,
-    const std::vector<std::vector<Token>>& tokens, const LZ77Params& lz77) {
-  std::vector<std::vector<Token>> tokens_for_cost_estimate =
-      ApplyLZ77_LZ77(params, num_contexts, tokens, lz77);
-  // If greedy-LZ77 does not give better compression than no-lz77, no reason to
-  // run the optimal matching.
-  if (tokens_for_cost_estimate.empty()) return {};
-  SymbolCostEstimator sce(num_contexts + 1, params.force_huffman,
-                          tokens_for_cost_estimate, lz77);
-  std::vector<std::vector<Token>> tokens_lz77(tokens.size());
-  HybridUintConfig uint_config;
+// Shortest path through the tokens of `in` after the first `history` ones,
+// where edges are literals and all the matches found by the hash chain.
+void OptimalLZ77(const SymbolCostEstimator& sce, const LZ77Params& lz77,
+                 const Token* in, size_t history, size_t size,
+                 size_t distance_multiplier, std::vector<Token>* out) {
+  // Cumulative sum of bit costs.
   std::vector<float> sym_cost;
+  ComputeSymbolCosts(sce, in, size, &sym_cost);
+
+  out->reserve(size - history);
+  size_t max_distance = size;
+  size_t min_length = lz77.min_length;
+  JXL_DASSERT(min_length >= 3);
+
+  HashChain chain =
+      MakeHashChain(in, history, size, min_length, distance_multiplier);
+
+  struct MatchInfo {
+    uint32_t len;
+    uint32_t dist_symbol;
+    uint32_t ctx;
+    float total_cost = std::numeric_limits<float>::max();
+  };
+  // Total cost to encode the first N symbols after the history; the costs of
+  // symbol i are in prefix_costs[i - history].
+  std::vector<MatchInfo> prefix_costs(size - history + 1);
+  prefix_costs[0].total_cost = 0;
+
   std::vector<uint32_t> dist_symbols;
-  for (size_t stream = 0; stream < tokens.size(); stream++) {
-    size_t distance_multiplier =
-        params.image_widths.size() > stream ? params.image_widths[stream] : 0;
-    const auto& in = tokens[stream];
-    auto& out = tokens_lz77[stream];
-    // Cumulative sum of bit costs.
-    sym_cost.resize(in.size() + 1);
-    for (size_t i = 0; i < in.size(); i++) {
-      uint32_t tok, nbits, unused_bits;
-      uint_config.Encode(in[i].value, &tok, &nbits, &unused_bits);
-      sym_cost[i + 1] = sce.Bits(in[i].context, tok) + nbits + sym_cost[i];
+  size_t rle_length = 0;
+  size_t skip_lz77 = 0;
+  for (size_t i = history; i < size; i++) {
+    const size_t p = i - history;
+    chain.Update(i);
+    float lit_cost = prefix_costs[p].total_cost + sym_cost[i + 1] - sym_cost[i];
+    if (prefix_costs[p + 1].total_cost > lit_cost) {
+      prefix_costs[p + 1].dist_symbol = 0;
+      prefix_costs[p + 1].len = 1;
+      prefix_costs[p + 1].ctx = in[i].context;
+      prefix_costs[p + 1].total_cost = lit_cost;
     }
-
-    out.reserve(in.size());
-    size_t max_distance = in.size();
-    size_t min_length = lz77.min_length;
-    JXL_DASSERT(min_length >= 3);
-    size_t max_length = in.size();
-
-    // Use next power of two as window size.
-    size_t window_size = 1;
-    while (window_size < max_distance && window_size < kWindowSize) {
-      window_size <<= 1;
+    if (skip_lz77 > 0) {
+      skip_lz77--;
+      continue;
     }
-
-    HashChain chain(in.data(), in.size(), window_size, min_length, max_length,
-                    distance_multiplier);
-
-    struct MatchInfo {
-      uint32_t len;
-      uint32_t dist_symbol;
-      uint32_t ctx;
-      float total_cost = std::numeric_limits<float>::max();
-    };
-    // Total cost to encode the first N symbols.
-    std::vector<MatchInfo> prefix_costs(in.size() + 1);
-    prefix_costs[0].total_cost = 0;
-
-    size_t rle_length = 0;
-    size_t skip_lz77 = 0;
-    for (size_t i = 0; i < in.size(); i++) {
-      chain.Update(i);
-      float lit_cost =
-          prefix_costs[i].total_cost + sym_cost[i + 1] - sym_cost[i];
-      if (prefix_costs[i + 1].total_cost > lit_cost) {
-        prefix_costs[i + 1].dist_symbol = 0;
-        prefix_costs[i + 1].len = 1;
-        prefix_costs[i + 1].ctx = in[i].context;
-        prefix_costs[i + 1].total_cost = lit_cost;
-      }
-      if (skip_lz77 > 0) {
-        skip_lz77--;
-        continue;
-      }
-      dist_symbols.clear();
-      chain.FindMatches(i, max_distance,
-                        [&dist_symbols](size_t len, size_t dist_symbol) {
-                          if (dist_symbols.size() <= len) {
-                            dist_symbols.resize(len + 1, dist_symbol);
-                          }
-                          if (dist_symbol < dist_symbols[len]) {
-                            dist_symbols[len] = dist_symbol;
-                          }
-                        });
-      if (dist_symbols.size() <= min_length) continue;
-      {
-        size_t best_cost = dist_symbols.back();
-        for (size_t j = dist_symbols.size() - 1; j >= min_length; j--) {
-          if (dist_symbols[j] < best_cost) {
-            best_cost = dist_symbols[j];
-          }
-          dist_symbols[j] = best_cost;
-        }
-      }
-      for (size_t j = min_length; j < dist_symbols.size(); j++) {
-        // Cost model that uses results from lazy LZ77.
-        float lz77_cost = sce.LenCost(in[i].context, j - min_length, lz77) +
-                          sce.DistCost(dist_symbols[j], lz77);
-        float cost = prefix_costs[i].total_cost + lz77_cost;
-        if (prefix_costs[i + j].total_cost > cost) {
-          prefix_costs[i + j].len = j;
-          prefix_costs[i + j].dist_symbol = dist_symbols[j] + 1;
-          prefix_costs[i + j].ctx = in[i].context;
-          prefix_costs[i + j].total_cost = cost;
+    dist_symbols.clear();
+    chain.FindMatches(i, max_distance,
+                      [&dist_symbols](size_t len, size_t dist_symbol) {
+                        if (dist_symbols.size() <= len) {
+                          dist_symbols.resize(len + 1, dist_symbol);
+                        }
+                        if (dist_symbol < dist_symbols[len]) {
+                          dist_symbols[len] = dist_symbol;
+                        }
+                      });
+    if (dist_symbols.size() <= min_length) continue;
+    {
+      size_t best_cost = dist_symbols.back();
+      for (size_t j = dist_symbols.size() - 1; j >= min_length; j--) {
+        if (dist_symbols[j] < best_cost) {
+          best_cost = dist_symbols[j];
         }
-      }
-      // We are in a RLE sequence: skip all the symbols except the first 8 and
-      // the last 8. This avoid quadratic costs for sequences with long runs of
-      // the same symbol.
-      if ((dist_symbols.back() == 0 && distance_multiplier == 0) ||
-          (dist_symbols.back() == 1 && distance_multiplier != 0)) {
-        rle_length++;
-      } else {
-        rle_length = 0;
-      }
-      if (rle_length >= 8 && dist_symbols.size() > 9) {
-        skip_lz77 = dist_symbols.size() - 10;
-        rle_length = 0;
+        dist_symbols[j] = best_cost;
       }
     }
-    size_t pos = in.size();
-    while (pos > 0) {
-      bool is_lz77_length = prefix_costs[pos].dist_symbol != 0;
-      if (is_lz77_length) {
-        size_t dist_symbol = prefix_costs[pos].dist_symbol - 1;
-        out.emplace_back(
-            static_cast<uint32_t>(lz77.nonserialized_distance_context),
-            static_cast<uint32_t>(dist_symbol));
+    for (size_t j = min_length; j < dist_symbols.size(); j++) {
+      // Cost model that uses results from lazy LZ77.
+      float lz77_cost = sce.LenCost(in[i].context, j - min_length, lz77) +
+                        sce.DistCost(dist_symbols[j], lz77);
+      float cost = prefix_costs[p].total_cost + lz77_cost;
+      if (prefix_costs[p + j].total_cost > cost) {
+        prefix_costs[p + j].len = j;
+        prefix_costs[p + j].dist_symbol = dist_symbols[j] + 1;
+        prefix_costs[p + j].ctx = in[i].context;
+        prefix_costs[p + j].total_cost = cost;
       }
-      uint32_t val =
-          is_lz77_length
-              ? (prefix_costs[pos].len - static_cast<uint32_t>(min_length))
-              : in[pos - 1].value;
-      out.emplace_back(prefix_costs[pos].ctx, val);
-      out.back().is_lz77_length = is_lz77_length;
-      pos -= prefix_costs[pos].len;
     }
-    if (!out.empty()) std::reverse(out.begin(), out.end());
+    // We are in a RLE sequence: skip all the symbols except the first 8 and
+    // the last 8. This avoid quadratic costs for sequences with long runs of
+    // the same symbol.
+    if ((dist_symbols.back() == 0 && distance_multiplier == 0) ||
+        (dist_symbols.back() == 1 && distance_multiplier != 0)) {
+      rle_length++;
+    } else {
+      rle_length = 0;
+    }
+    if (rle_length >= 8 && dist_symbols.size() > 9) {
+      skip_lz77 = dist_symbols.size() - 10;
+      rle_length = 0;
+    }
   }
-  return tokens_lz77;
+  size_t pos = size - history;
+  while (pos > 0) {
+    bool is_lz77_length = prefix_costs[pos].dist_symbol != 0;
+    if (is_lz77_length) {
+      size_t dist_symbol = prefix_costs[pos].dist_symbol - 1;
+      out->emplace_back(
+          static_cast<uint32_t>(lz77.nonserialized_distance_context),
+          static_cast<uint32_t>(dist_symbol));
+    }
+    uint32_t val =
+        is_lz77_length
+            ? (prefix_costs[pos].len - static_cast<uint32_t>(min_length))
+            : in[history + pos - 1].value;
+    out->emplace_back(prefix_costs[pos].ctx, val);
+    out->back().is_lz77_length = is_lz77_length;
+    pos -= prefix_costs[pos].len;
+  }
+  if (!out->empty()) std::reverse(out->begin(), out->end());
+}
+
+StatusOr<std::vector<std::vector<Token>>> ApplyLZ77_Optimal(
+    const HistogramParams& params, size_t num_contexts,
+    const std::vector<std::vector<Token>>& tokens, const LZ77Params& lz77,
+    ThreadPool* pool) {
+  JXL_ASSIGN_OR_RETURN(
+      std::vector<std::vector<Token>> tokens_for_cost_estimate,
+      ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, pool));
+  // If greedy-LZ77 does not give better compression than no-lz77, no reason to
+  // run the optimal matching.
+  if (tokens_for_cost_estimate.empty()) {
+    return std::vector<std::vector<Token>>();
+  }
+  SymbolCostEstimator sce(num_contexts + 1, params.force_huffman,
+                          tokens_for_cost_estimate, lz77);
+  const std::vector<LZ77Chunk> chunks = SplitIntoChunks(tokens);
+  std::vector<std::vector<Token>> chunk_tokens(chunks.size());
+  const auto process_chunk = [&](const uint32_t c,
+                                 size_t /* thread */) -> Status {
+    const LZ77Chunk& chunk = chunks[c];
+    size_t distance_multiplier = params.image_widths.size() > chunk.stream
+                                     ? params.image_widths[chunk.stream]
+                                     : 0;
+    const size_t start = chunk.begin - chunk.history;
+    OptimalLZ77(sce, lz77, tokens[chunk.stream].data() + start, chunk.history,
+                chunk.end - start, distance_multiplier, &chunk_tokens[c]);
+    return true;
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, chunks.size(), ThreadPool::NoInit,
+                                process_chunk, "OptimalLZ77"));
+  return JoinChunks(tokens.size(), chunks, chunk_tokens);
 }
 
 }  // namespace
 
-std::vector<std::vector<Token>> ApplyLZ77(
+StatusOr<std::vector<std::vector<Token>>> ApplyLZ77(
     const HistogramParams& params, size_t num_contexts,
-    const std::vector<std::vector<Token>>& tokens, const LZ77Params& lz77) {
+    const std::vector<std::vector<Token>>& tokens, const LZ77Params& lz77,
+    ThreadPool* pool) {
   switch (params.lz77_method) {
     case HistogramParams::LZ77Method::kRLE:
       return ApplyLZ77_RLE(params, num_contexts, tokens, lz77);
     case HistogramParams::LZ77Method::kLZ77:
-      return ApplyLZ77_LZ77(params, num_contexts, tokens, lz77);
+      return ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, pool);
     case HistogramParams::LZ77Method::kOptimal:
-      return ApplyLZ77_Optimal(params, num_contexts, tokens, lz77);
+      return ApplyLZ77_Optimal(params, num_contexts, tokens, lz77, pool);
     default:
-      return {};
+      return std::vector<std::vector<Token>>();
   }
 }
 
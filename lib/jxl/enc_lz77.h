@@ -9,18 +9,24 @@
 #include <cstddef>
 #include <vector>
 
+#include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_ans_params.h"
 
 namespace jxl {
 
+class ThreadPool;
+
 // Returns a vector of token streams with the LZ77 compression applied
 // in accordance with parameters sent. If compression is not beneficial,
 // returns an empty vector.
-std::vector<std::vector<Token>> ApplyLZ77(
+// If `pool` is given, the streams are matched in parallel; the result does
+// not depend on the number of threads.
+StatusOr<std::vector<std::vector<Token>>> ApplyLZ77(
     const HistogramParams& params, size_t num_contexts,
-    const std::vector<std::vector<Token>>& tokens, const LZ77Params& lz77);
+    const std::vector<std::vector<Token>>& tokens, const LZ77Params& lz77,
+    ThreadPool* pool = nullptr);
 
 }  // namespace jxl
 
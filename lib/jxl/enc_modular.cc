@@ -286,6 +286,35 @@ float EstimateWPCost(const Image& img, size_t i) {
   return histo_cost + extra_bits;
 }
 
+enum class CachedSearch : uint32_t { kRCT, kWPMode };
+
+// Key of the outcome of `search` among its first `num_options` options on
+// `image`, for ModularDecisionCache.
+uint64_t DecisionKey(const Image& image, CachedSearch search,
+                     size_t num_options) {
+  uint64_t hash = 0;
+  const auto mix = [&hash](uint64_t value) {
+    hash = (hash ^ value) * 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 32;
+  };
+  mix(static_cast<uint32_t>(search));
+  mix(num_options);
+  mix(image.nb_meta_channels);
+  for (const Channel& ch : image.channel) {
+    mix(ch.w);
+    mix(ch.h);
+    mix(static_cast<uint32_t>(ch.hshift));
+    mix(static_cast<uint32_t>(ch.vshift));
+    for (size_t y = 0; y < ch.h; y++) {
+      const pixel_type* JXL_RESTRICT row = ch.Row(y);
+      for (size_t x = 0; x < ch.w; x++) {
+        mix(static_cast<uint32_t>(row[x]));
+      }
+    }
+  }
+  return hash;
+}
+
 bool do_transform(Image& image, const Transform& tr,
                   const weighted::Header& wp_header,
                   jxl::ThreadPool* pool = nullptr, bool force_jxlart = false) {
@@ -443,9 +472,11 @@ Status try_palettes(Image& gi, int& max_bitdepth, int& maxval,
 
 StatusOr<std::unique_ptr<ModularFrameEncoder>> ModularFrameEncoder::Create(
     JxlMemoryManager* memory_manager, const FrameHeader& frame_header,
-    const CompressParams& cparams_orig, bool streaming_mode) {
+    const CompressParams& cparams_orig, bool streaming_mode,
+    ModularDecisionCache* decision_cache) {
   auto self = std::unique_ptr<ModularFrameEncoder>(
       new ModularFrameEncoder(memory_manager));
+  self->decision_cache_ = decision_cache;
   JXL_RETURN_IF_ERROR(self->Init(frame_header, cparams_orig, streaming_mode));
   return self;
 }
@@ -1179,7 +1210,6 @@ Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
     std::vector<Tree> trees(useful_splits.size() - 1);
     const auto process_chunk = [&](const uint32_t chunk,
                                    size_t /* thread */) -> Status {
-      // TODO(veluca): parallelize more.
       uint32_t start = useful_splits[chunk];
       uint32_t stop = useful_splits[chunk + 1];
       while (start < stop && stream_images_[start].empty()) ++start;
@@ -1190,7 +1220,7 @@ Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
         JXL_ASSIGN_OR_RETURN(
             trees[chunk],
             LearnTree(stream_images_.data(), stream_options_.data(), start,
-                      stop, multiplier_info));
+                      stop, multiplier_info, pool));
       } else {
         size_t total_pixels = 0;
         for (size_t i = start; i < stop; i++) {
@@ -1205,9 +1235,16 @@ Status ModularFrameEncoder::ComputeTree(ThreadPool* pool) {
       }
       return true;
     };
-    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, useful_splits.size() - 1,
-                                  ThreadPool::NoInit, process_chunk,
-                                  "LearnTrees"));
+    // Learning a tree uses the pool too, which runs sequentially when nested
+    // unless the runner allows nesting, so don't go through the pool for a
+    // single chunk.
+    if (trees.size() == 1) {
+      JXL_RETURN_IF_ERROR(process_chunk(0, 0));
+    } else {
+      JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, useful_splits.size() - 1,
+                                    ThreadPool::NoInit, process_chunk,
+                                    "LearnTrees"));
+    }
     tree_.clear();
     JXL_RETURN_IF_ERROR(
         MergeTrees(trees, useful_splits, 0, useful_splits.size() - 1, &tree_));
@@ -1272,7 +1309,8 @@ Status ModularFrameEncoder::ComputeTokens(ThreadPool* pool) {
 
 Status ModularFrameEncoder::EncodeGlobalInfo(bool streaming_mode,
                                              BitWriter* writer,
-                                             AuxOut* aux_out) {
+                                             AuxOut* aux_out,
+                                             ThreadPool* pool) {
   JxlMemoryManager* memory_manager = writer->memory_manager();
   bool skip_rest = false;
   JXL_RETURN_IF_ERROR(
@@ -1296,7 +1334,8 @@ Status ModularFrameEncoder::EncodeGlobalInfo(bool streaming_mode,
     JXL_ASSIGN_OR_RETURN(
         size_t cost, BuildAndEncodeHistograms(
                          memory_manager, params, kNumTreeContexts, tree_tokens_,
-                         &tree_code, writer, LayerType::ModularTree, aux_out));
+                         &tree_code, writer, LayerType::ModularTree, aux_out,
+                         pool));
     (void)cost;
     JXL_RETURN_IF_ERROR(WriteTokens(tree_tokens_[0], tree_code, 0, writer,
                                     LayerType::ModularTree, aux_out));
@@ -1308,7 +1347,8 @@ Status ModularFrameEncoder::EncodeGlobalInfo(bool streaming_mode,
   JXL_ASSIGN_OR_RETURN(
       size_t cost, BuildAndEncodeHistograms(
                        memory_manager, params, (tree_.size() + 1) / 2, tokens_,
-                       &code_, writer, LayerType::ModularGlobal, aux_out));
+                       &code_, writer, LayerType::ModularGlobal, aux_out,
+                       pool));
   (void)cost;
   return true;
 }
@@ -1460,6 +1500,16 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
     }
     float best_cost = std::numeric_limits<float>::max();
     size_t best_rct = 0;
+    uint64_t cache_key = 0;
+    if (decision_cache_ && nb_rcts_to_try > 1) {
+      cache_key = DecisionKey(gi, CachedSearch::kRCT, nb_rcts_to_try);
+      uint32_t cached_rct;
+      if (decision_cache_->Lookup(cache_key, &cached_rct)) {
+        // Another encoder already searched this image, skip the search.
+        best_rct = cached_rct;
+        nb_rcts_to_try = 0;
+      }
+    }
     bool need_to_restore = (nb_rcts_to_try > 1);
     std::vector<Channel> orig;
     orig.reserve(3);
@@ -1502,6 +1552,7 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
       for (size_t c = 0; c < 3; ++c) {
         gi.channel[gi.nb_meta_channels + c].plane.Swap(orig[c].plane);
       }
+      if (decision_cache_) decision_cache_->Insert(cache_key, best_rct);
     }
     // Apply the best RCT to the image for future encoding.
     if (best_rct != 0) {
@@ -1521,6 +1572,15 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
   }
   if (nb_wp_modes > 1 &&
       PredictorHasWeighted(stream_options_[stream_id].predictor)) {
+    uint64_t cache_key = 0;
+    if (decision_cache_) {
+      cache_key = DecisionKey(gi, CachedSearch::kWPMode, nb_wp_modes);
+      uint32_t cached_mode;
+      if (decision_cache_->Lookup(cache_key, &cached_mode)) {
+        stream_options_[stream_id].wp_mode = cached_mode;
+        return true;
+      }
+    }
     float best_cost = std::numeric_limits<float>::max();
     stream_options_[stream_id].wp_mode = 0;
     for (size_t i = 0; i < nb_wp_modes; i++) {
@@ -1530,6 +1590,9 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
         stream_options_[stream_id].wp_mode = i;
       }
     }
+    if (decision_cache_) {
+      decision_cache_->Insert(cache_key, stream_options_[stream_id].wp_mode);
+    }
   }
   return true;
 }
@@ -12,6 +12,8 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "lib/jxl/base/compiler_specific.h"
@@ -38,11 +40,38 @@ namespace jxl {
 struct AuxOut;
 enum class LayerType : uint8_t;
 
+// Outcomes of the per-group RCT and weighted predictor searches, keyed by a
+// hash of the group image they were made on. The searches only look at the
+// pixels, so encoders of the same frame with different settings (as tried by
+// effort 11) can share them; a hash collision costs compression, never
+// correctness.
+class ModularDecisionCache {
+ public:
+  bool Lookup(uint64_t key, uint32_t* decision) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = decisions_.find(key);
+    if (it == decisions_.end()) return false;
+    *decision = it->second;
+    return true;
+  }
+
+  void Insert(uint64_t key, uint32_t decision) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    decisions_.emplace(key, decision);
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_map<uint64_t, uint32_t> decisions_;
+};
+
 class ModularFrameEncoder {
  public:
+  // If `decision_cache` is given, it must outlive the encoder.
   static StatusOr<std::unique_ptr<ModularFrameEncoder>> Create(
       JxlMemoryManager* memory_manager, const FrameHeader& frame_header,
-      const CompressParams& cparams_orig, bool streaming_mode);
+      const CompressParams& cparams_orig, bool streaming_mode,
+      ModularDecisionCache* decision_cache = nullptr);
   Status ComputeEncodingData(
       const FrameHeader& frame_header, const ImageMetadata& metadata,
       Image3F* JXL_RESTRICT color, const std::vector<ImageF>& extra_channels,
@@ -51,10 +80,12 @@ class ModularFrameEncoder {
       const JxlCmsInterface& cms, ThreadPool* pool, AuxOut* aux_out,
       bool do_color);
   Status ComputeTree(ThreadPool* pool);
+  // Number of nodes of the tree computed by ComputeTree.
+  size_t TreeSize() const { return tree_.size(); }
   Status ComputeTokens(ThreadPool* pool);
   // Encodes global info (tree + histograms) in the `writer`.
   Status EncodeGlobalInfo(bool streaming_mode, BitWriter* writer,
-                          AuxOut* aux_out);
+                          AuxOut* aux_out, ThreadPool* pool = nullptr);
   // Encodes a specific modular image (identified by `stream`) in the `writer`,
   // assigning bits to the provided `layer`.
   Status EncodeStream(BitWriter* writer, AuxOut* aux_out, LayerType layer,
@@ -105,6 +136,7 @@ class ModularFrameEncoder {
                              const ModularStreamId& stream, bool do_color,
                              bool groupwise);
   JxlMemoryManager* memory_manager_;
+  ModularDecisionCache* decision_cache_ = nullptr;
   std::vector<Image> stream_images_;
   std::vector<ModularOptions> stream_options_;
   std::vector<uint32_t> quants_;
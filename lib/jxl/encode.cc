@@ -1975,7 +1975,8 @@ JxlEncoder* JxlEncoderCreate(const JxlMemoryManager* memory_manager) {
       jxl::MemoryManagerAlloc(&local_memory_manager, sizeof(JxlEncoder));
   if (!alloc) return nullptr;
   JxlEncoder* enc = new (alloc) JxlEncoder();
-  enc->memory_manager = local_memory_manager;
+  enc->buffer_pool.SetUpstream(local_memory_manager);
+  enc->memory_manager = *enc->buffer_pool.get();
   // TODO(sboukortt): add an API function to set this.
   enc->cms = *JxlGetDefaultCms();
   enc->cms_set = true;
@@ -2018,7 +2019,7 @@ void JxlEncoderReset(JxlEncoder* enc) {
 
 void JxlEncoderDestroy(JxlEncoder* enc) {
   if (enc) {
-    JxlMemoryManager local_memory_manager = enc->memory_manager;
+    JxlMemoryManager local_memory_manager = enc->buffer_pool.upstream();
     // Call destructor directly since custom free function is used.
     enc->~JxlEncoder();
     jxl::MemoryManagerFree(&local_memory_manager, enc);
@@ -2084,6 +2085,22 @@ JxlEncoderStatus JxlEncoderSetParallelRunner(JxlEncoder* enc,
   return JxlErrorOrStatus::Success();
 }
 
+JxlEncoderStatus JxlEncoderSetParallelRunnerNesting(JxlEncoder* enc,
+                                                    JXL_BOOL allow_nesting) {
+  if (!enc->thread_pool) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "parallel runner not set");
+  }
+  enc->thread_pool->SetAllowNesting(FROM_JXL_BOOL(allow_nesting));
+  return JxlErrorOrStatus::Success();
+}
+
+JxlEncoderStatus JxlEncoderSetBufferPoolLimit(JxlEncoder* enc,
+                                              size_t max_bytes) {
+  enc->buffer_pool.SetMaxRetainedBytes(max_bytes);
+  return JxlErrorOrStatus::Success();
+}
+
 namespace {
 JxlEncoderStatus GetCurrentDimensions(
     const JxlEncoderFrameSettings* frame_settings, size_t& xsize,
@@ -2811,8 +2828,17 @@ JXL_EXPORT size_t JxlEncoderStatsGet(const JxlEncoderStats* stats,
     case JXL_ENC_STAT_NUM_BUTTERAUGLI_ITERS:
       return aux_out.num_butteraugli_iters;
     default:
-      return 0;
+      break;
   }
+  // Phase keys come in (time, work) pairs, in the order of EncPhase.
+  static_assert(JXL_ENC_NUM_STATS - JXL_ENC_STAT_XYB_TIME_US ==
+                    2 * jxl::kNumEncPhases,
+                "Phase keys do not match EncPhase");
+  if (key < JXL_ENC_STAT_XYB_TIME_US || key >= JXL_ENC_NUM_STATS) return 0;
+  const size_t index = key - JXL_ENC_STAT_XYB_TIME_US;
+  const auto& phase = aux_out.phases[index / 2];
+  if (index % 2 == 0) return static_cast<size_t>(phase.seconds * 1e6);
+  return phase.work;
 }
 
 JXL_EXPORT void JxlEncoderStatsMerge(JxlEncoderStats* stats,
@@ -0,0 +1,128 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/codestream_header.h>
+#include <jxl/color_encoding.h>
+#include <jxl/encode.h>
+#include <jxl/memory_manager.h>
+#include <jxl/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+namespace jxl {
+namespace {
+
+#define BM_CHECK(C)          \
+  if (!(C)) {                \
+    state.SkipWithError(#C); \
+    return;                  \
+  }
+
+struct AllocCounter {
+  size_t allocs = 0;
+};
+
+void* CountingAlloc(void* opaque, size_t size) {
+  static_cast<AllocCounter*>(opaque)->allocs++;
+  return malloc(size);
+}
+
+void CountingFree(void* /*opaque*/, void* address) { free(address); }
+
+// Frames of a gradient that moves by a few pixels per frame.
+std::vector<uint8_t> AnimationFrame(size_t xsize, size_t ysize, size_t frame) {
+  std::vector<uint8_t> pixels(xsize * ysize * 3);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      uint8_t* p = &pixels[(y * xsize + x) * 3];
+      p[0] = static_cast<uint8_t>(x + 3 * frame);
+      p[1] = static_cast<uint8_t>(y + 2 * frame);
+      p[2] = static_cast<uint8_t>((x ^ y) + frame);
+    }
+  }
+  return pixels;
+}
+
+// Encodes a 100-frame animation with one encoder; the argument is the buffer
+// pool limit in MiB, 0 disables the reuse of buffers across frames.
+void BM_EncodeAnimation(benchmark::State& state) {
+  const size_t kNumFrames = 100;
+  const size_t xsize = 256;
+  const size_t ysize = 256;
+  const size_t pool_limit = static_cast<size_t>(state.range(0)) << 20;
+
+  std::vector<std::vector<uint8_t>> frames;
+  for (size_t i = 0; i < kNumFrames; ++i) {
+    frames.push_back(AnimationFrame(xsize, ysize, i));
+  }
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+
+  AllocCounter counter;
+  JxlMemoryManager memory_manager;
+  memory_manager.opaque = &counter;
+  memory_manager.alloc = &CountingAlloc;
+  memory_manager.free = &CountingFree;
+
+  std::vector<uint8_t> compressed(1 << 20);
+  for (auto _ : state) {
+    (void)_;
+    JxlEncoder* enc = JxlEncoderCreate(&memory_manager);
+    BM_CHECK(enc != nullptr);
+    BM_CHECK(JxlEncoderSetBufferPoolLimit(enc, pool_limit) ==
+             JXL_ENC_SUCCESS);
+    JxlBasicInfo basic_info;
+    JxlEncoderInitBasicInfo(&basic_info);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    basic_info.have_animation = JXL_TRUE;
+    basic_info.animation.tps_numerator = 30;
+    basic_info.animation.tps_denominator = 1;
+    BM_CHECK(JxlEncoderSetBasicInfo(enc, &basic_info) == JXL_ENC_SUCCESS);
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+    BM_CHECK(JxlEncoderSetColorEncoding(enc, &color_encoding) ==
+             JXL_ENC_SUCCESS);
+    JxlEncoderFrameSettings* settings =
+        JxlEncoderFrameSettingsCreate(enc, nullptr);
+    BM_CHECK(JxlEncoderFrameSettingsSetOption(
+                 settings, JXL_ENC_FRAME_SETTING_EFFORT, 3) == JXL_ENC_SUCCESS);
+    JxlFrameHeader frame_header;
+    JxlEncoderInitFrameHeader(&frame_header);
+    frame_header.duration = 1;
+    BM_CHECK(JxlEncoderSetFrameHeader(settings, &frame_header) ==
+             JXL_ENC_SUCCESS);
+
+    for (const std::vector<uint8_t>& frame : frames) {
+      BM_CHECK(JxlEncoderAddImageFrame(settings, &format, frame.data(),
+                                       frame.size()) == JXL_ENC_SUCCESS);
+    }
+    JxlEncoderCloseInput(enc);
+    JxlEncoderStatus status = JXL_ENC_NEED_MORE_OUTPUT;
+    while (status == JXL_ENC_NEED_MORE_OUTPUT) {
+      uint8_t* next_out = compressed.data();
+      size_t avail_out = compressed.size();
+      status = JxlEncoderProcessOutput(enc, &next_out, &avail_out);
+    }
+    JxlEncoderDestroy(enc);
+    BM_CHECK(status == JXL_ENC_SUCCESS);
+  }
+
+  state.SetItemsProcessed(kNumFrames * state.iterations());
+  state.counters["allocs/frame"] = benchmark::Counter(
+      static_cast<double>(counter.allocs) / (kNumFrames * state.iterations()));
+}
+
+BENCHMARK(BM_EncodeAnimation)
+    ->Arg(0)
+    ->Arg(32)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace jxl
@@ -36,6 +36,7 @@
 #include "lib/jxl/jpeg/jpeg_data.h"
 #include "lib/jxl/memory_manager_internal.h"
 #include "lib/jxl/padded_bytes.h"
+#include "lib/jxl/pooled_memory_manager.h"
 
 namespace jxl {
 
@@ -596,6 +597,11 @@ jxl::Status AppendData(JxlEncoderOutputProcessorWrapper& output_processor,
 // JxlEncoderCreate.
 struct JxlEncoder {
   JxlEncoder() : output_processor(&memory_manager) {}
+  // Wraps the memory manager passed at creation, so that the planes and
+  // scratch buffers of one frame are reused by the next. Declared first, so
+  // that all other members have released their buffers when it is destroyed.
+  jxl::PooledMemoryManager buffer_pool;
+  // The buffer pool; used for all allocations of the encoder.
   JxlMemoryManager memory_manager;
   jxl::MemoryManagerUniquePtr<jxl::ThreadPool> thread_pool{
       nullptr, jxl::MemoryManagerDeleteHelper(&memory_manager)};
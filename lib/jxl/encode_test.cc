@@ -12,6 +12,8 @@
 #include <jxl/encode.h>
 #include <jxl/encode_cxx.h>
 #include <jxl/memory_manager.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
 #include <jxl/types.h>
 
 #include <cstddef>
@@ -174,6 +176,21 @@ TEST(EncodeTest, DefaultParallelRunnerTest) {
             JxlEncoderSetParallelRunner(enc.get(), nullptr, nullptr));
 }
 
+TEST(EncodeTest, ParallelRunnerNestingTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  // Requires a runner.
+  EXPECT_EQ(JXL_ENC_ERROR,
+            JxlEncoderSetParallelRunnerNesting(enc.get(), JXL_TRUE));
+  JxlThreadParallelRunnerPtr runner =
+      JxlThreadParallelRunnerMake(/*memory_manager=*/nullptr, 2);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetParallelRunner(enc.get(), JxlThreadParallelRunner,
+                                        runner.get()));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetParallelRunnerNesting(enc.get(), JXL_TRUE));
+}
+
 void VerifyFrameEncoding(size_t xsize, size_t ysize, JxlEncoder* enc,
                          const JxlEncoderFrameSettings* frame_settings,
                          size_t max_compressed_size,
@@ -1065,6 +1082,155 @@ static void ProcessEncoder(JxlEncoder* enc, std::vector<uint8_t>& compressed,
   EXPECT_EQ(JXL_ENC_SUCCESS, process_result);
 }
 
+// The frames of an animation reuse the buffers of the previous frames, unless
+// the buffer pool is disabled; the output does not depend on it.
+TEST(EncodeTest, BufferPoolTest) {
+  struct CalledCounters {
+    int allocs = 0;
+    int frees = 0;
+  };
+  JxlMemoryManager mm;
+  mm.alloc = [](void* opaque, size_t size) {
+    reinterpret_cast<CalledCounters*>(opaque)->allocs++;
+    return malloc(size);
+  };
+  mm.free = [](void* opaque, void* address) {
+    reinterpret_cast<CalledCounters*>(opaque)->frees++;
+    free(address);
+  };
+
+  size_t xsize = 300;
+  size_t ysize = 200;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+
+  std::vector<int> allocs;
+  std::vector<std::vector<uint8_t>> outputs;
+  for (size_t max_bytes : {size_t{0}, size_t{64} << 20}) {
+    CalledCounters counters;
+    mm.opaque = &counters;
+    JxlEncoder* enc = JxlEncoderCreate(&mm);
+    ASSERT_NE(nullptr, enc);
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBufferPoolLimit(enc, max_bytes));
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    basic_info.uses_original_profile = JXL_FALSE;
+    basic_info.have_animation = JXL_TRUE;
+    basic_info.animation.tps_numerator = 10;
+    basic_info.animation.tps_denominator = 1;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc, &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc, &color_encoding));
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc, nullptr);
+    JxlFrameHeader frame_header;
+    JxlEncoderInitFrameHeader(&frame_header);
+    frame_header.duration = 1;
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetFrameHeader(frame_settings, &frame_header));
+
+    int allocs_before = counters.allocs;
+    for (size_t i = 0; i < 4; ++i) {
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                        pixels.data(), pixels.size()));
+    }
+    JxlEncoderCloseInput(enc);
+    std::vector<uint8_t> compressed(64);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size();
+    ProcessEncoder(enc, compressed, next_out, avail_out);
+    allocs.push_back(counters.allocs - allocs_before);
+    outputs.push_back(compressed);
+
+    JxlEncoderDestroy(enc);
+    EXPECT_EQ(counters.allocs, counters.frees);
+  }
+  EXPECT_LT(allocs[1], allocs[0]);
+  EXPECT_EQ(outputs[0], outputs[1]);
+}
+
+// With the buffer pool enabled, frames of the same size as the previous ones
+// make no new large allocations.
+TEST(EncodeTest, BufferPoolSameSizeFramesTest) {
+  struct CalledCounters {
+    int large_allocs = 0;
+    int allocs = 0;
+    int frees = 0;
+  };
+  JxlMemoryManager mm;
+  mm.alloc = [](void* opaque, size_t size) {
+    CalledCounters* counters = reinterpret_cast<CalledCounters*>(opaque);
+    counters->allocs++;
+    // The pool adds a small header to the blocks it hands out.
+    if (size > jxl::PooledMemoryManager::kMinPooledSize + 64) {
+      counters->large_allocs++;
+    }
+    return malloc(size);
+  };
+  mm.free = [](void* opaque, void* address) {
+    reinterpret_cast<CalledCounters*>(opaque)->frees++;
+    free(address);
+  };
+  CalledCounters counters;
+  mm.opaque = &counters;
+
+  size_t xsize = 300;
+  size_t ysize = 200;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+
+  JxlEncoder* enc = JxlEncoderCreate(&mm);
+  ASSERT_NE(nullptr, enc);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetBufferPoolLimit(enc, size_t{256} << 20));
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = JXL_FALSE;
+  basic_info.have_animation = JXL_TRUE;
+  basic_info.animation.tps_numerator = 10;
+  basic_info.animation.tps_denominator = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc, &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetColorEncoding(enc, &color_encoding));
+  JxlEncoderFrameSettings* frame_settings =
+      JxlEncoderFrameSettingsCreate(enc, nullptr);
+  JxlFrameHeader frame_header;
+  JxlEncoderInitFrameHeader(&frame_header);
+  frame_header.duration = 1;
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameHeader(frame_settings, &frame_header));
+
+  std::vector<uint8_t> compressed(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size();
+  // Large allocations made while encoding each frame.
+  std::vector<int> large_allocs;
+  for (size_t i = 0; i < 3; ++i) {
+    int large_allocs_before = counters.large_allocs;
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      pixels.data(), pixels.size()));
+    ProcessEncoder(enc, compressed, next_out, avail_out);
+    large_allocs.push_back(counters.large_allocs - large_allocs_before);
+  }
+  JxlEncoderCloseInput(enc);
+  ProcessEncoder(enc, compressed, next_out, avail_out);
+  JxlEncoderDestroy(enc);
+  EXPECT_EQ(counters.allocs, counters.frees);
+
+  EXPECT_LT(0, large_allocs[0]);
+  EXPECT_EQ(0, large_allocs[1]);
+  EXPECT_EQ(0, large_allocs[2]);
+}
+
 TEST(EncodeTest, BasicInfoTest) {
   JxlEncoderPtr enc = JxlEncoderMake(nullptr);
   EXPECT_NE(nullptr, enc.get());
@@ -2127,3 +2293,66 @@ TEST(EncoderTest, CMYK) {
   EXPECT_TRUE(DecodeImageJXL(compressed.data(), compressed.size(), dparams,
                              nullptr, &ppf, nullptr));
 }
+
+// Each phase of the encoder records time and work in the statistics.
+TEST(EncodeTest, PhaseStatsTest) {
+  const size_t xsize = 256;
+  const size_t ysize = 256;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  for (bool lossless : {false, true}) {
+    SCOPED_TRACE(testing::Message() << "lossless " << lossless);
+    JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+    ASSERT_NE(nullptr, enc.get());
+    JxlEncoderFrameSettings* frame_settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    ASSERT_NE(nullptr, frame_settings);
+    JxlBasicInfo basic_info;
+    jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+    basic_info.xsize = xsize;
+    basic_info.ysize = ysize;
+    basic_info.uses_original_profile = TO_JXL_BOOL(lossless);
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+    JxlColorEncoding color_encoding;
+    JxlColorEncodingSetToSRGB(&color_encoding, JXL_FALSE);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+    if (lossless) {
+      EXPECT_EQ(JXL_ENC_SUCCESS,
+                JxlEncoderSetFrameLossless(frame_settings, JXL_TRUE));
+    }
+    JxlEncoderStats* stats = JxlEncoderStatsCreate();
+    JxlEncoderCollectStats(frame_settings, stats);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(frame_settings, &pixel_format,
+                                      pixels.data(), pixels.size()));
+    JxlEncoderCloseInput(enc.get());
+    std::vector<uint8_t> compressed(64);
+    uint8_t* next_out = compressed.data();
+    size_t avail_out = compressed.size();
+    ProcessEncoder(enc.get(), compressed, next_out, avail_out);
+
+    // Phases that run for every lossy or lossless encode at the default
+    // effort, by their time key; the work key follows it. LZ77 may find
+    // nothing to do in less than a microsecond.
+    EXPECT_GT(JxlEncoderStatsGet(stats, JXL_ENC_STAT_LZ77_TOKENS), 0u);
+    std::vector<JxlEncoderStatsKey> phases = {
+        JXL_ENC_STAT_HISTOGRAM_CLUSTERING_TIME_US,
+        JXL_ENC_STAT_TOKEN_WRITING_TIME_US};
+    if (lossless) {
+      phases.push_back(JXL_ENC_STAT_TREE_LEARNING_TIME_US);
+    } else {
+      phases.insert(phases.end(), {JXL_ENC_STAT_XYB_TIME_US,
+                                   JXL_ENC_STAT_ADAPTIVE_QUANTIZATION_TIME_US,
+                                   JXL_ENC_STAT_AC_STRATEGY_TIME_US,
+                                   JXL_ENC_STAT_CFL_TIME_US,
+                                   JXL_ENC_STAT_PATCHES_TIME_US});
+    }
+    for (JxlEncoderStatsKey time_key : phases) {
+      const auto work_key = static_cast<JxlEncoderStatsKey>(time_key + 1);
+      EXPECT_GT(JxlEncoderStatsGet(stats, time_key), 0u) << "key " << time_key;
+      EXPECT_GT(JxlEncoderStatsGet(stats, work_key), 0u) << "key " << work_key;
+    }
+    JxlEncoderStatsDestroy(stats);
+  }
+}
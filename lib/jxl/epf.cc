@@ -44,14 +44,15 @@ Status ComputeSigma(const LoopFilter& lf, const Rect& block_rect,
 
   const size_t sigma_stride = state->sigma.PixelsPerRow();
   const size_t sharpness_stride = state->shared->epf_sharpness.PixelsPerRow();
+  const Rect storage_rect = state->shared->BlockStorageRect(block_rect);
 
   for (size_t by = 0; by < block_rect.ysize(); ++by) {
-    float* JXL_RESTRICT sigma_row = block_rect.Row(&state->sigma, by);
+    float* JXL_RESTRICT sigma_row = storage_rect.Row(&state->sigma, by);
     const uint8_t* JXL_RESTRICT sharpness_row =
-        block_rect.ConstRow(state->shared->epf_sharpness, by);
-    AcStrategyRow acs_row = ac_strategy.ConstRow(block_rect, by);
+        storage_rect.ConstRow(state->shared->epf_sharpness, by);
+    AcStrategyRow acs_row = ac_strategy.ConstRow(storage_rect, by);
     const int32_t* const JXL_RESTRICT row_quant =
-        block_rect.ConstRow(state->shared->raw_quant_field, by);
+        storage_rect.ConstRow(state->shared->raw_quant_field, by);
 
     for (size_t bx = 0; bx < block_rect.xsize(); bx++) {
       AcStrategy acs = acs_row[bx];
@@ -19,6 +19,7 @@
 
 #include <hwy/foreach_target.h>
 
+#include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/random.h"
 #include "lib/jxl/cms/transfer_functions-inl.h"
 #include "lib/jxl/dec_xyb-inl.h"
@@ -180,6 +181,54 @@ HWY_NOINLINE void TestFast709EFD() {
   printf("max abs err %e\n", static_cast<double>(max_abs_err));
 }
 
+template <class Func>
+void TestTfLutAccuracy(const char* name, const Func& tf, float linear_below) {
+  constexpr size_t kNumTrials = 1 << 18;
+  HWY_FULL(float) d;
+  for (size_t bits : {8, 10, 12, 16}) {
+    const TfLut lut(tf, bits, linear_below);
+    const double quantum = 1.0 / ((1u << bits) - 1);
+    Rng rng(1);
+    double max_err = 0;
+    for (size_t i = 0; i < kNumTrials; i++) {
+      // Every other sample is log-uniform, to cover the lowest octaves.
+      const float f = (i & 1) ? std::exp2(rng.UniformF(-30.0f, 4.0f))
+                              : rng.UniformF(-0.25f, 1.25f);
+      const double actual = GetLane(lut.EncodedFromDisplay(d, Set(d, f)));
+      const double expected = tf(std::max(f, 0.0f));
+      // The output is clamped when it is quantized.
+      const double err = std::abs(Clamp1(actual, 0.0, 1.0) -
+                                  Clamp1(expected, 0.0, 1.0));
+      EXPECT_LT(err, 0.2 * quantum) << name << " " << bits << " f = " << f;
+      max_err = std::max(max_err, err);
+    }
+    printf("%s %" PRIuS " bits: max err %.3f quantization steps\n", name, bits,
+           max_err / quantum);
+  }
+}
+
+HWY_NOINLINE void TestTfLut() {
+  TestTfLutAccuracy(
+      "sRGB", [](double x) { return TF_SRGB::EncodedFromDisplay(x); },
+      0.0031308f);
+  TestTfLutAccuracy(
+      "709", [](double x) { return TF_709::EncodedFromDisplay(x); }, 0.018f);
+  TestTfLutAccuracy(
+      "HLG", [](double x) { return TF_HLG_Base::EncodedFromDisplay(x); }, 0);
+  for (float intensity_target : {203.0f, 1000.0f, 10000.0f}) {
+    TestTfLutAccuracy(
+        "PQ",
+        [intensity_target](double x) {
+          return TF_PQ_Base::EncodedFromDisplay(intensity_target, x);
+        },
+        0);
+  }
+  for (double gamma : {1.8, 2.2, 2.6}) {
+    TestTfLutAccuracy(
+        "gamma", [gamma](double x) { return std::pow(x, 1.0 / gamma); }, 0);
+  }
+}
+
 #if !JXL_HIGH_PRECISION
 HWY_NOINLINE void TestFastXYB() {
   if (!HasFastXYBTosRGB8()) return;
@@ -261,6 +310,7 @@ HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestFastErf);
 HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestCubeRoot);
 HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestFastSRGB);
 HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestFast709EFD);
+HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestTfLut);
 
 #if !JXL_HIGH_PRECISION
 HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestFastXYB);
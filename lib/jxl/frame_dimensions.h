@@ -59,6 +59,22 @@ struct FrameDimensions {
     num_dc_groups = xsize_dc_groups * ysize_dc_groups;
   }
 
+  // Returns the dimensions of the frame rendered at 1/2^shift of its size, for
+  // a frame without upsampling: groups, blocks and padding all shrink, but the
+  // number of groups stays the same.
+  FrameDimensions Downsampled(size_t shift) const {
+    FrameDimensions res = *this;
+    res.xsize = res.xsize_upsampled = DivCeil(xsize, 1 << shift);
+    res.ysize = res.ysize_upsampled = DivCeil(ysize, 1 << shift);
+    res.xsize_padded = res.xsize_upsampled_padded = xsize_padded >> shift;
+    res.ysize_padded = res.ysize_upsampled_padded = ysize_padded >> shift;
+    res.xsize_blocks = DivCeil(res.xsize_padded, kBlockDim);
+    res.ysize_blocks = DivCeil(res.ysize_padded, kBlockDim);
+    res.group_dim = group_dim >> shift;
+    res.dc_group_dim = dc_group_dim >> shift;
+    return res;
+  }
+
   Rect GroupRect(size_t group_index) const {
     const size_t gx = group_index % xsize_groups;
     const size_t gy = group_index / xsize_groups;
@@ -260,6 +260,23 @@ void ZeroFillImage(Image3<T>* image) {
   }
 }
 
+// Moves the rows from `dy` on to the top of the image, for images that hold a
+// sliding window of rows; the contents of the last `dy` rows are unspecified.
+template <typename T>
+void MoveRowsUp(size_t dy, Plane<T>* image) {
+  if (image->xsize() == 0) return;
+  for (size_t y = dy; y < image->ysize(); ++y) {
+    memcpy(image->Row(y - dy), image->ConstRow(y), image->xsize() * sizeof(T));
+  }
+}
+
+template <typename T>
+void MoveRowsUp(size_t dy, Image3<T>* image) {
+  for (size_t c = 0; c < 3; ++c) {
+    MoveRowsUp(dy, &image->Plane(c));
+  }
+}
+
 // Same as above, but operates in-place. Assumes that the `in` image was
 // allocated large enough.
 Status PadImageToBlockMultipleInPlace(Image3F* JXL_RESTRICT in,
@@ -511,11 +511,12 @@ JXL_INLINE pixel_type_w PredictOne(Predictor p, pixel_type_w left,
   }
 }
 
-template <int mode>
+// `Lookup` is MATreeLookup or any class with the same Lookup() method.
+template <int mode, typename Lookup>
 JXL_INLINE PredictionResult Predict(
     Properties *p, size_t w, const pixel_type *JXL_RESTRICT pp,
     const ptrdiff_t onerow, const size_t x, const size_t y, Predictor predictor,
-    const MATreeLookup *lookup, const Channel *references,
+    const Lookup *lookup, const Channel *references,
     weighted::State *wp_state, pixel_type_w *predictions) {
   // We start in position 3 because of 2 static properties + y.
   size_t offset = 3;
@@ -594,7 +595,7 @@ inline PredictionResult PredictNoTreeNoWP(size_t w,
                                           const pixel_type *JXL_RESTRICT pp,
                                           const ptrdiff_t onerow, const int x,
                                           const int y, Predictor predictor) {
-  return detail::Predict</*mode=*/0>(
+  return detail::Predict</*mode=*/0, MATreeLookup>(
       /*p=*/nullptr, w, pp, onerow, x, y, predictor, /*lookup=*/nullptr,
       /*references=*/nullptr, /*wp_state=*/nullptr, /*predictions=*/nullptr);
 }
@@ -604,47 +605,49 @@ inline PredictionResult PredictNoTreeWP(size_t w,
                                         const ptrdiff_t onerow, const int x,
                                         const int y, Predictor predictor,
                                         weighted::State *wp_state) {
-  return detail::Predict<detail::kUseWP>(
+  return detail::Predict<detail::kUseWP, MATreeLookup>(
       /*p=*/nullptr, w, pp, onerow, x, y, predictor, /*lookup=*/nullptr,
       /*references=*/nullptr, wp_state, /*predictions=*/nullptr);
 }
 
+template <typename Lookup>
 inline PredictionResult PredictTreeNoWP(Properties *p, size_t w,
                                         const pixel_type *JXL_RESTRICT pp,
                                         const ptrdiff_t onerow, const int x,
-                                        const int y,
-                                        const MATreeLookup &tree_lookup,
+                                        const int y, const Lookup &tree_lookup,
                                         const Channel &references) {
   return detail::Predict<detail::kUseTree>(
       p, w, pp, onerow, x, y, Predictor::Zero, &tree_lookup, &references,
       /*wp_state=*/nullptr, /*predictions=*/nullptr);
 }
 // Only use for y > 1, x > 1, x < w-2, and empty references
+template <typename Lookup>
 JXL_INLINE PredictionResult
 PredictTreeNoWPNEC(Properties *p, size_t w, const pixel_type *JXL_RESTRICT pp,
                    const ptrdiff_t onerow, const int x, const int y,
-                   const MATreeLookup &tree_lookup, const Channel &references) {
+                   const Lookup &tree_lookup, const Channel &references) {
   return detail::Predict<detail::kUseTree | detail::kNoEdgeCases>(
       p, w, pp, onerow, x, y, Predictor::Zero, &tree_lookup, &references,
       /*wp_state=*/nullptr, /*predictions=*/nullptr);
 }
 
+template <typename Lookup>
 inline PredictionResult PredictTreeWP(Properties *p, size_t w,
                                       const pixel_type *JXL_RESTRICT pp,
                                       const ptrdiff_t onerow, const int x,
-                                      const int y,
-                                      const MATreeLookup &tree_lookup,
+                                      const int y, const Lookup &tree_lookup,
                                       const Channel &references,
                                       weighted::State *wp_state) {
   return detail::Predict<detail::kUseTree | detail::kUseWP>(
       p, w, pp, onerow, x, y, Predictor::Zero, &tree_lookup, &references,
       wp_state, /*predictions=*/nullptr);
 }
+template <typename Lookup>
 JXL_INLINE PredictionResult PredictTreeWPNEC(Properties *p, size_t w,
                                              const pixel_type *JXL_RESTRICT pp,
                                              const ptrdiff_t onerow, const int x,
                                              const int y,
-                                             const MATreeLookup &tree_lookup,
+                                             const Lookup &tree_lookup,
                                              const Channel &references,
                                              weighted::State *wp_state) {
   return detail::Predict<detail::kUseTree | detail::kUseWP |
@@ -659,7 +662,8 @@ inline PredictionResult PredictLearn(Properties *p, size_t w,
                                      const int y, Predictor predictor,
                                      const Channel &references,
                                      weighted::State *wp_state) {
-  return detail::Predict<detail::kForceComputeProperties | detail::kUseWP>(
+  return detail::Predict<detail::kForceComputeProperties | detail::kUseWP,
+                         MATreeLookup>(
       p, w, pp, onerow, x, y, predictor, /*lookup=*/nullptr, &references,
       wp_state, /*predictions=*/nullptr);
 }
@@ -671,7 +675,8 @@ inline void PredictLearnAll(Properties *p, size_t w,
                             weighted::State *wp_state,
                             pixel_type_w *predictions) {
   detail::Predict<detail::kForceComputeProperties | detail::kUseWP |
-                  detail::kAllPredictions>(
+                      detail::kAllPredictions,
+                  MATreeLookup>(
       p, w, pp, onerow, x, y, Predictor::Zero,
       /*lookup=*/nullptr, &references, wp_state, predictions);
 }
@@ -682,7 +687,8 @@ inline PredictionResult PredictLearnNEC(Properties *p, size_t w,
                                         const Channel &references,
                                         weighted::State *wp_state) {
   return detail::Predict<detail::kForceComputeProperties | detail::kUseWP |
-                         detail::kNoEdgeCases>(
+                             detail::kNoEdgeCases,
+                         MATreeLookup>(
       p, w, pp, onerow, x, y, predictor, /*lookup=*/nullptr, &references,
       wp_state, /*predictions=*/nullptr);
 }
@@ -694,7 +700,8 @@ inline void PredictLearnAllNEC(Properties *p, size_t w,
                                weighted::State *wp_state,
                                pixel_type_w *predictions) {
   detail::Predict<detail::kForceComputeProperties | detail::kUseWP |
-                  detail::kAllPredictions | detail::kNoEdgeCases>(
+                      detail::kAllPredictions | detail::kNoEdgeCases,
+                  MATreeLookup>(
       p, w, pp, onerow, x, y, Predictor::Zero,
       /*lookup=*/nullptr, &references, wp_state, predictions);
 }
@@ -702,7 +709,7 @@ inline void PredictLearnAllNEC(Properties *p, size_t w,
 inline void PredictAllNoWP(size_t w, const pixel_type *JXL_RESTRICT pp,
                            const ptrdiff_t onerow, const int x, const int y,
                            pixel_type_w *predictions) {
-  detail::Predict<detail::kAllPredictions>(
+  detail::Predict<detail::kAllPredictions, MATreeLookup>(
       /*p=*/nullptr, w, pp, onerow, x, y, Predictor::Zero,
       /*lookup=*/nullptr,
       /*references=*/nullptr, /*wp_state=*/nullptr, predictions);
@@ -210,7 +210,7 @@ StatusOr<Tree> LearnTree(
     TreeSamples &&tree_samples, size_t total_pixels,
     const ModularOptions &options,
     const std::vector<ModularMultiplierInfo> &multiplier_info = {},
-    StaticPropRange static_prop_range = {}) {
+    StaticPropRange static_prop_range = {}, ThreadPool *pool = nullptr) {
   Tree tree;
   for (size_t i = 0; i < kNumStaticProperties; i++) {
     if (static_prop_range[i][1] == 0) {
@@ -231,7 +231,7 @@ StatusOr<Tree> LearnTree(
   JXL_RETURN_IF_ERROR(ComputeBestTree(
       tree_samples, options.splitting_heuristics_node_threshold * required_cost,
       multiplier_info, static_prop_range, options.fast_decode_multiplier,
-      &tree));
+      pool, &tree));
   return tree;
 }
 
@@ -555,7 +555,8 @@ Tree PredefinedTree(ModularOptions::TreeKind tree_kind, size_t total_pixels,
 StatusOr<Tree> LearnTree(
     const Image *images, const ModularOptions *options, const uint32_t start,
     const uint32_t stop,
-    const std::vector<ModularMultiplierInfo> &multiplier_info = {}) {
+    const std::vector<ModularMultiplierInfo> &multiplier_info = {},
+    ThreadPool *pool = nullptr) {
   TreeSamples tree_samples;
   JXL_RETURN_IF_ERROR(tree_samples.SetPredictor(options[start].predictor,
                                                 options[start].wp_tree_mode));
@@ -629,7 +630,7 @@ StatusOr<Tree> LearnTree(
   // TODO(veluca): parallelize more.
   JXL_ASSIGN_OR_RETURN(Tree tree,
                        LearnTree(std::move(tree_samples), total_pixels,
-                                 options[start], multiplier_info, range));
+                                 options[start], multiplier_info, range, pool));
   return tree;
 }
 
@@ -729,7 +730,9 @@ Status ModularGenericCompress(const Image &image, const ModularOptions &opts,
   // Compute tree.
   Tree tree;
   if (options.tree_kind == ModularOptions::TreeKind::kLearn) {
+    PhaseTimer timer(aux_out, EncPhase::TreeLearning);
     JXL_ASSIGN_OR_RETURN(tree, LearnTree(&image, &options, 0, 1));
+    timer.AddWork(tree.size());
   } else {
     size_t total_pixels = 0;
     for (size_t i = 0; i < nb_channels; i++) {
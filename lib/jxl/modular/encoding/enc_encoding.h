@@ -20,6 +20,7 @@
 namespace jxl {
 
 struct AuxOut;
+class ThreadPool;
 enum class LayerType : uint8_t;
 struct GroupHeader;
 
@@ -29,7 +30,8 @@ Tree PredefinedTree(ModularOptions::TreeKind tree_kind, size_t total_pixels,
 StatusOr<Tree> LearnTree(
     const Image *images, const ModularOptions *opts, uint32_t start,
     uint32_t stop,
-    const std::vector<ModularMultiplierInfo> &multiplier_info = {});
+    const std::vector<ModularMultiplierInfo> &multiplier_info = {},
+    ThreadPool *pool = nullptr);
 
 // Default single-image compress.
 Status ModularGenericCompress(const Image &image, const ModularOptions &opts,
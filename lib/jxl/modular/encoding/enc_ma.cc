@@ -18,6 +18,7 @@
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/modular/encoding/dec_ma.h"
@@ -138,7 +139,7 @@ void SplitTreeSamples(TreeSamples &tree_samples, size_t begin, size_t pos,
 }
 
 template <bool S>
-void CollectExtraBitsIncrease(TreeSamples &tree_samples,
+void CollectExtraBitsIncrease(const TreeSamples &tree_samples,
                               const std::vector<ResidualToken> &rtokens,
                               std::vector<int> &count_increase,
                               std::vector<size_t> &extra_bits_increase,
@@ -155,112 +156,113 @@ void CollectExtraBitsIncrease(TreeSamples &tree_samples,
   }
 }
 
-void FindBestSplit(TreeSamples &tree_samples, float threshold,
-                   const std::vector<ModularMultiplierInfo> &mul_info,
-                   StaticPropRange initial_static_prop_range,
-                   float fast_decode_multiplier, Tree *tree) {
-  struct NodeInfo {
-    size_t pos;
-    size_t begin;
-    size_t end;
-    uint64_t used_properties;
-    StaticPropRange static_prop_range;
-  };
-  std::vector<NodeInfo> nodes;
-  nodes.push_back(NodeInfo{0, 0, tree_samples.NumDistinctSamples(), 0,
-                           initial_static_prop_range});
+struct NodeInfo {
+  size_t pos;
+  size_t begin;
+  size_t end;
+  uint64_t used_properties;
+  StaticPropRange static_prop_range;
+};
 
-  size_t num_predictors = tree_samples.NumPredictors();
-  size_t num_properties = tree_samples.NumProperties();
+struct SplitInfo {
+  size_t prop = 0;
+  uint32_t val = 0;
+  size_t pos = 0;
+  float lcost = std::numeric_limits<float>::max();
+  float rcost = std::numeric_limits<float>::max();
+  Predictor lpred = Predictor::Zero;
+  Predictor rpred = Predictor::Zero;
+  float Cost() const { return lcost + rcost; }
+};
 
-  // TODO(veluca): consider parallelizing the search (processing multiple nodes
-  // at a time).
-  while (!nodes.empty()) {
-    size_t pos = nodes.back().pos;
-    size_t begin = nodes.back().begin;
-    size_t end = nodes.back().end;
-    uint64_t used_properties = nodes.back().used_properties;
-    StaticPropRange static_prop_range = nodes.back().static_prop_range;
-    nodes.pop_back();
-    if (begin == end) continue;
-
-    struct SplitInfo {
-      size_t prop = 0;
-      uint32_t val = 0;
-      size_t pos = 0;
-      float lcost = std::numeric_limits<float>::max();
-      float rcost = std::numeric_limits<float>::max();
-      Predictor lpred = Predictor::Zero;
-      Predictor rpred = Predictor::Zero;
-      float Cost() const { return lcost + rcost; }
-    };
+// Cheapest split of each kind; the final choice between kinds is made in
+// FindBestSplit.
+struct SplitCandidates {
+  SplitInfo static_constant;
+  SplitInfo static_split;
+  SplitInfo nonstatic;
+  SplitInfo nowp;
+};
 
-    SplitInfo best_split_static_constant;
-    SplitInfo best_split_static;
-    SplitInfo best_split_nonstatic;
-    SplitInfo best_split_nowp;
+// Histograms of the samples of a node, shared by all its candidate splits.
+struct NodeStats {
+  size_t max_symbols = 0;
+  std::vector<int32_t> counts;
+  std::vector<uint32_t> tot_extra_bits;
+  float base_bits = 0;
+  // Multiplier of a multiplier range that contains the node, or 0.
+  uint32_t multiplier = 0;
+  bool has_forced_split = false;
+  SplitInfo forced_split;
+};
 
-    JXL_DASSERT(begin <= end);
-    JXL_DASSERT(end <= tree_samples.NumDistinctSamples());
+void ComputeNodeStats(const TreeSamples &tree_samples, float threshold,
+                      const std::vector<ModularMultiplierInfo> &mul_info,
+                      const NodeInfo &node, Predictor predictor,
+                      NodeStats *stats) {
+  size_t begin = node.begin;
+  size_t end = node.end;
+  size_t num_predictors = tree_samples.NumPredictors();
 
-    // Compute the maximum token in the range.
-    size_t max_symbols = 0;
-    for (size_t pred = 0; pred < num_predictors; pred++) {
-      for (size_t i = begin; i < end; i++) {
-        uint32_t tok = tree_samples.Token(pred, i);
-        max_symbols = max_symbols > tok + 1 ? max_symbols : tok + 1;
-      }
+  JXL_DASSERT(begin <= end);
+  JXL_DASSERT(end <= tree_samples.NumDistinctSamples());
+
+  // Compute the maximum token in the range.
+  size_t max_symbols = 0;
+  for (size_t pred = 0; pred < num_predictors; pred++) {
+    for (size_t i = begin; i < end; i++) {
+      uint32_t tok = tree_samples.Token(pred, i);
+      max_symbols = max_symbols > tok + 1 ? max_symbols : tok + 1;
     }
-    max_symbols = Padded(max_symbols);
-    std::vector<int32_t> counts(max_symbols * num_predictors);
-    std::vector<uint32_t> tot_extra_bits(num_predictors);
-    for (size_t pred = 0; pred < num_predictors; pred++) {
-      size_t extra_bits = 0;
-      const std::vector<ResidualToken>& rtokens = tree_samples.RTokens(pred);
-      for (size_t i = begin; i < end; i++) {
-        const ResidualToken& rt = rtokens[i];
-        size_t count = tree_samples.Count(i);
-        size_t eb = rt.nbits * count;
-        counts[pred * max_symbols + rt.tok] += count;
-        extra_bits += eb;
-      }
-      tot_extra_bits[pred] = extra_bits;
+  }
+  max_symbols = Padded(max_symbols);
+  stats->max_symbols = max_symbols;
+  stats->counts.assign(max_symbols * num_predictors, 0);
+  stats->tot_extra_bits.assign(num_predictors, 0);
+  for (size_t pred = 0; pred < num_predictors; pred++) {
+    size_t extra_bits = 0;
+    const std::vector<ResidualToken> &rtokens = tree_samples.RTokens(pred);
+    for (size_t i = begin; i < end; i++) {
+      const ResidualToken &rt = rtokens[i];
+      size_t count = tree_samples.Count(i);
+      size_t eb = rt.nbits * count;
+      stats->counts[pred * max_symbols + rt.tok] += count;
+      extra_bits += eb;
     }
+    stats->tot_extra_bits[pred] = extra_bits;
+  }
 
-    float base_bits;
-    {
-      size_t pred = tree_samples.PredictorIndex((*tree)[pos].predictor);
-      base_bits =
-          EstimateBits(counts.data() + pred * max_symbols, max_symbols) +
-          tot_extra_bits[pred];
-    }
+  {
+    size_t pred = tree_samples.PredictorIndex(predictor);
+    stats->base_bits =
+        EstimateBits(stats->counts.data() + pred * max_symbols, max_symbols) +
+        stats->tot_extra_bits[pred];
+  }
 
-    SplitInfo *best = &best_split_nonstatic;
-
-    SplitInfo forced_split;
-    // The multiplier ranges cut halfway through the current ranges of static
-    // properties. We do this even if the current node is not a leaf, to
-    // minimize the number of nodes in the resulting tree.
-    for (const auto &mmi : mul_info) {
-      uint32_t axis;
-      uint32_t val;
-      IntersectionType t =
-          BoxIntersects(static_prop_range, mmi.range, axis, val);
-      if (t == IntersectionType::kNone) continue;
-      if (t == IntersectionType::kInside) {
-        (*tree)[pos].multiplier = mmi.multiplier;
-        break;
-      }
-      if (t == IntersectionType::kPartial) {
-        JXL_DASSERT(axis < kNumStaticProperties);
-        forced_split.val = tree_samples.QuantizeStaticProperty(axis, val);
-        forced_split.prop = axis;
-        forced_split.lcost = forced_split.rcost = base_bits / 2 - threshold;
-        forced_split.lpred = forced_split.rpred = (*tree)[pos].predictor;
-        best = &forced_split;
-        best->pos = begin;
-        JXL_DASSERT(best->prop == tree_samples.PropertyFromIndex(best->prop));
-        if (best->prop < tree_samples.NumStaticProps()) {
+  // The multiplier ranges cut halfway through the current ranges of static
+  // properties. We do this even if the current node is not a leaf, to
+  // minimize the number of nodes in the resulting tree.
+  for (const auto &mmi : mul_info) {
+    uint32_t axis;
+    uint32_t val;
+    IntersectionType t =
+        BoxIntersects(node.static_prop_range, mmi.range, axis, val);
+    if (t == IntersectionType::kNone) continue;
+    if (t == IntersectionType::kInside) {
+      stats->multiplier = mmi.multiplier;
+      break;
+    }
+    if (t == IntersectionType::kPartial) {
+      JXL_DASSERT(axis < kNumStaticProperties);
+      SplitInfo *best = &stats->forced_split;
+      stats->has_forced_split = true;
+      best->val = tree_samples.QuantizeStaticProperty(axis, val);
+      best->prop = axis;
+      best->lcost = best->rcost = stats->base_bits / 2 - threshold;
+      best->lpred = best->rpred = predictor;
+      best->pos = begin;
+      JXL_DASSERT(best->prop == tree_samples.PropertyFromIndex(best->prop));
+      if (best->prop < tree_samples.NumStaticProps()) {
         for (size_t x = begin; x < end; x++) {
           if (tree_samples.Property<true>(best->prop, x) <= best->val) {
             best->pos++;
@@ -274,227 +276,377 @@ void FindBestSplit(TreeSamples &tree_samples, float threshold,
           }
         }
       }
-        break;
+      break;
+    }
+  }
+}
+
+struct CostInfo {
+  float cost = std::numeric_limits<float>::max();
+  float extra_cost = 0;
+  float Cost() const { return cost + extra_cost; }
+  Predictor pred;  // will be uninitialized in some cases, but never used.
+};
+
+// Per-thread buffers for FindPropertySplits. count_increase and
+// extra_bits_increase are all zero between calls.
+struct SplitScratch {
+  std::vector<int> prop_value_used_count;
+  std::vector<int> count_increase;
+  std::vector<size_t> extra_bits_increase;
+  std::vector<CostInfo> costs_l;
+  std::vector<CostInfo> costs_r;
+  std::vector<int32_t> counts_above;
+  std::vector<int32_t> counts_below;
+};
+
+// For the given property, compute which of its values are used, and what
+// tokens correspond to those usages. Then, iterate through the values, and
+// compute the entropy of each side of the split (of the form `prop >
+// threshold`). Finally, find the split that minimizes the cost.
+void FindPropertySplits(const TreeSamples &tree_samples, float threshold,
+                        const NodeInfo &node, const NodeStats &stats,
+                        Predictor node_predictor, size_t prop,
+                        SplitScratch *scratch, SplitCandidates *candidates) {
+  size_t begin = node.begin;
+  size_t end = node.end;
+  size_t max_symbols = stats.max_symbols;
+  size_t num_predictors = tree_samples.NumPredictors();
+  std::vector<int> &prop_value_used_count = scratch->prop_value_used_count;
+  std::vector<int> &count_increase = scratch->count_increase;
+  std::vector<size_t> &extra_bits_increase = scratch->extra_bits_increase;
+  std::vector<CostInfo> &costs_l = scratch->costs_l;
+  std::vector<CostInfo> &costs_r = scratch->costs_r;
+  std::vector<int32_t> &counts_above = scratch->counts_above;
+  std::vector<int32_t> &counts_below = scratch->counts_below;
+
+  // The lower the threshold, the higher the expected noisiness of the
+  // estimate. Thus, discourage changing predictors.
+  float change_pred_penalty = 800.0f / (100.0f + threshold);
+
+  costs_l.clear();
+  costs_r.clear();
+  counts_above.resize(max_symbols);
+  counts_below.resize(max_symbols);
+  size_t prop_size = tree_samples.NumPropertyValues(prop);
+  if (extra_bits_increase.size() < prop_size) {
+    extra_bits_increase.resize(prop_size);
+  }
+  if (count_increase.size() < prop_size * max_symbols) {
+    count_increase.resize(prop_size * max_symbols);
+  }
+  // Clear prop_value_used_count (which cannot be cleared "on the go")
+  prop_value_used_count.clear();
+  prop_value_used_count.resize(prop_size);
+
+  size_t first_used = prop_size;
+  size_t last_used = 0;
+
+  // TODO(veluca): consider finding multiple splits along a single
+  // property at the same time, possibly with a bottom-up approach.
+  if (prop < tree_samples.NumStaticProps()) {
+    for (size_t i = begin; i < end; i++) {
+      size_t p = tree_samples.Property<true>(prop, i);
+      prop_value_used_count[p]++;
+      last_used = std::max(last_used, p);
+      first_used = std::min(first_used, p);
+    }
+  } else {
+    size_t prop_idx = prop - tree_samples.NumStaticProps();
+    for (size_t i = begin; i < end; i++) {
+      size_t p = tree_samples.Property<false>(prop_idx, i);
+      prop_value_used_count[p]++;
+      last_used = std::max(last_used, p);
+      first_used = std::min(first_used, p);
+    }
+  }
+  costs_l.resize(last_used - first_used);
+  costs_r.resize(last_used - first_used);
+  // For all predictors, compute the right and left costs of each split.
+  for (size_t pred = 0; pred < num_predictors; pred++) {
+    // Compute cost and histogram increments for each property value.
+    const std::vector<ResidualToken> &rtokens = tree_samples.RTokens(pred);
+    if (prop < tree_samples.NumStaticProps()) {
+      CollectExtraBitsIncrease<true>(tree_samples, rtokens, count_increase,
+                                     extra_bits_increase, begin, end, prop,
+                                     max_symbols);
+    } else {
+      CollectExtraBitsIncrease<false>(
+          tree_samples, rtokens, count_increase, extra_bits_increase, begin,
+          end, prop - tree_samples.NumStaticProps(), max_symbols);
+    }
+    memcpy(counts_above.data(), stats.counts.data() + pred * max_symbols,
+           max_symbols * sizeof counts_above[0]);
+    memset(counts_below.data(), 0, max_symbols * sizeof counts_below[0]);
+    size_t extra_bits_below = 0;
+    // Exclude last used: this ensures neither counts_above nor
+    // counts_below is empty.
+    for (size_t i = first_used; i < last_used; i++) {
+      if (!prop_value_used_count[i]) continue;
+      extra_bits_below += extra_bits_increase[i];
+      // The increase for this property value has been used, and will not
+      // be used again: clear it. Also below.
+      extra_bits_increase[i] = 0;
+      for (size_t sym = 0; sym < max_symbols; sym++) {
+        counts_above[sym] -= count_increase[i * max_symbols + sym];
+        counts_below[sym] += count_increase[i * max_symbols + sym];
+        count_increase[i * max_symbols + sym] = 0;
+      }
+      float rcost = EstimateBits(counts_above.data(), max_symbols) +
+                    stats.tot_extra_bits[pred] - extra_bits_below;
+      float lcost =
+          EstimateBits(counts_below.data(), max_symbols) + extra_bits_below;
+      JXL_DASSERT(extra_bits_below <= stats.tot_extra_bits[pred]);
+      float penalty = 0;
+      // Never discourage moving away from the Weighted predictor.
+      if (tree_samples.PredictorFromIndex(pred) != node_predictor &&
+          node_predictor != Predictor::Weighted) {
+        penalty = change_pred_penalty;
+      }
+      // If everything else is equal, disfavour Weighted (slower) and
+      // favour Zero (faster if it's the only predictor used in a
+      // group+channel combination)
+      if (tree_samples.PredictorFromIndex(pred) == Predictor::Weighted) {
+        penalty += 1e-8;
+      }
+      if (tree_samples.PredictorFromIndex(pred) == Predictor::Zero) {
+        penalty -= 1e-8;
+      }
+      if (rcost + penalty < costs_r[i - first_used].Cost()) {
+        costs_r[i - first_used].cost = rcost;
+        costs_r[i - first_used].extra_cost = penalty;
+        costs_r[i - first_used].pred = tree_samples.PredictorFromIndex(pred);
+      }
+      if (lcost + penalty < costs_l[i - first_used].Cost()) {
+        costs_l[i - first_used].cost = lcost;
+        costs_l[i - first_used].extra_cost = penalty;
+        costs_l[i - first_used].pred = tree_samples.PredictorFromIndex(pred);
       }
     }
+  }
+  // Iterate through the possible splits and find the one with minimum sum
+  // of costs of the two sides.
+  size_t split = begin;
+  for (size_t i = first_used; i < last_used; i++) {
+    if (!prop_value_used_count[i]) continue;
+    split += prop_value_used_count[i];
+    float rcost = costs_r[i - first_used].cost;
+    float lcost = costs_l[i - first_used].cost;
+    // WP was not used + we would use the WP property or predictor
+    bool adds_wp =
+        (tree_samples.PropertyFromIndex(prop) == kWPProp &&
+         (node.used_properties & (1LU << prop)) == 0) ||
+        ((costs_l[i - first_used].pred == Predictor::Weighted ||
+          costs_r[i - first_used].pred == Predictor::Weighted) &&
+         node_predictor != Predictor::Weighted);
+    bool zero_entropy_side = rcost == 0 || lcost == 0;
 
-    if (best != &forced_split) {
-      std::vector<int> prop_value_used_count;
-      std::vector<int> count_increase;
-      std::vector<size_t> extra_bits_increase;
-      // For each property, compute which of its values are used, and what
-      // tokens correspond to those usages. Then, iterate through the values,
-      // and compute the entropy of each side of the split (of the form `prop >
-      // threshold`). Finally, find the split that minimizes the cost.
-      struct CostInfo {
-        float cost = std::numeric_limits<float>::max();
-        float extra_cost = 0;
-        float Cost() const { return cost + extra_cost; }
-        Predictor pred;  // will be uninitialized in some cases, but never used.
-      };
-      std::vector<CostInfo> costs_l;
-      std::vector<CostInfo> costs_r;
-
-      std::vector<int32_t> counts_above(max_symbols);
-      std::vector<int32_t> counts_below(max_symbols);
-
-      // The lower the threshold, the higher the expected noisiness of the
-      // estimate. Thus, discourage changing predictors.
-      float change_pred_penalty = 800.0f / (100.0f + threshold);
-      for (size_t prop = 0; prop < num_properties && base_bits > threshold;
-           prop++) {
-        costs_l.clear();
-        costs_r.clear();
-        size_t prop_size = tree_samples.NumPropertyValues(prop);
-        if (extra_bits_increase.size() < prop_size) {
-          count_increase.resize(prop_size * max_symbols);
-          extra_bits_increase.resize(prop_size);
-        }
-        // Clear prop_value_used_count (which cannot be cleared "on the go")
-        prop_value_used_count.clear();
-        prop_value_used_count.resize(prop_size);
-
-        size_t first_used = prop_size;
-        size_t last_used = 0;
-
-        // TODO(veluca): consider finding multiple splits along a single
-        // property at the same time, possibly with a bottom-up approach.
-        if (prop < tree_samples.NumStaticProps()) {
-          for (size_t i = begin; i < end; i++) {
-            size_t p = tree_samples.Property<true>(prop, i);
-            prop_value_used_count[p]++;
-            last_used = std::max(last_used, p);
-            first_used = std::min(first_used, p);
-          }
-        } else {
-          size_t prop_idx = prop - tree_samples.NumStaticProps();
-          for (size_t i = begin; i < end; i++) {
-            size_t p = tree_samples.Property<false>(prop_idx, i);
-            prop_value_used_count[p]++;
-            last_used = std::max(last_used, p);
-            first_used = std::min(first_used, p);
-          }
-        }
-        costs_l.resize(last_used - first_used);
-        costs_r.resize(last_used - first_used);
-        // For all predictors, compute the right and left costs of each split.
-        for (size_t pred = 0; pred < num_predictors; pred++) {
-          // Compute cost and histogram increments for each property value.
-          const std::vector<ResidualToken> &rtokens =
-              tree_samples.RTokens(pred);
-          if (prop < tree_samples.NumStaticProps()) {
-            CollectExtraBitsIncrease<true>(tree_samples, rtokens,
-                                           count_increase, extra_bits_increase,
-                                           begin, end, prop, max_symbols);
-          } else {
-            CollectExtraBitsIncrease<false>(
-                tree_samples, rtokens, count_increase, extra_bits_increase,
-                begin, end, prop - tree_samples.NumStaticProps(), max_symbols);
-          }
-          memcpy(counts_above.data(), counts.data() + pred * max_symbols,
-                 max_symbols * sizeof counts_above[0]);
-          memset(counts_below.data(), 0, max_symbols * sizeof counts_below[0]);
-          size_t extra_bits_below = 0;
-          // Exclude last used: this ensures neither counts_above nor
-          // counts_below is empty.
-          for (size_t i = first_used; i < last_used; i++) {
-            if (!prop_value_used_count[i]) continue;
-            extra_bits_below += extra_bits_increase[i];
-            // The increase for this property value has been used, and will not
-            // be used again: clear it. Also below.
-            extra_bits_increase[i] = 0;
-            for (size_t sym = 0; sym < max_symbols; sym++) {
-              counts_above[sym] -= count_increase[i * max_symbols + sym];
-              counts_below[sym] += count_increase[i * max_symbols + sym];
-              count_increase[i * max_symbols + sym] = 0;
-            }
-            float rcost = EstimateBits(counts_above.data(), max_symbols) +
-                          tot_extra_bits[pred] - extra_bits_below;
-            float lcost = EstimateBits(counts_below.data(), max_symbols) +
-                          extra_bits_below;
-            JXL_DASSERT(extra_bits_below <= tot_extra_bits[pred]);
-            float penalty = 0;
-            // Never discourage moving away from the Weighted predictor.
-            if (tree_samples.PredictorFromIndex(pred) !=
-                    (*tree)[pos].predictor &&
-                (*tree)[pos].predictor != Predictor::Weighted) {
-              penalty = change_pred_penalty;
-            }
-            // If everything else is equal, disfavour Weighted (slower) and
-            // favour Zero (faster if it's the only predictor used in a
-            // group+channel combination)
-            if (tree_samples.PredictorFromIndex(pred) == Predictor::Weighted) {
-              penalty += 1e-8;
-            }
-            if (tree_samples.PredictorFromIndex(pred) == Predictor::Zero) {
-              penalty -= 1e-8;
-            }
-            if (rcost + penalty < costs_r[i - first_used].Cost()) {
-              costs_r[i - first_used].cost = rcost;
-              costs_r[i - first_used].extra_cost = penalty;
-              costs_r[i - first_used].pred =
-                  tree_samples.PredictorFromIndex(pred);
-            }
-            if (lcost + penalty < costs_l[i - first_used].Cost()) {
-              costs_l[i - first_used].cost = lcost;
-              costs_l[i - first_used].extra_cost = penalty;
-              costs_l[i - first_used].pred =
-                  tree_samples.PredictorFromIndex(pred);
-            }
-          }
-        }
-        // Iterate through the possible splits and find the one with minimum sum
-        // of costs of the two sides.
-        size_t split = begin;
-        for (size_t i = first_used; i < last_used; i++) {
-          if (!prop_value_used_count[i]) continue;
-          split += prop_value_used_count[i];
-          float rcost = costs_r[i - first_used].cost;
-          float lcost = costs_l[i - first_used].cost;
-          // WP was not used + we would use the WP property or predictor
-          bool adds_wp =
-              (tree_samples.PropertyFromIndex(prop) == kWPProp &&
-               (used_properties & (1LU << prop)) == 0) ||
-              ((costs_l[i - first_used].pred == Predictor::Weighted ||
-                costs_r[i - first_used].pred == Predictor::Weighted) &&
-               (*tree)[pos].predictor != Predictor::Weighted);
-          bool zero_entropy_side = rcost == 0 || lcost == 0;
-
-          SplitInfo &best_ref =
-              tree_samples.PropertyFromIndex(prop) < kNumStaticProperties
-                  ? (zero_entropy_side ? best_split_static_constant
-                                       : best_split_static)
-                  : (adds_wp ? best_split_nonstatic : best_split_nowp);
-          if (lcost + rcost < best_ref.Cost()) {
-            best_ref.prop = prop;
-            best_ref.val = i;
-            best_ref.pos = split;
-            best_ref.lcost = lcost;
-            best_ref.lpred = costs_l[i - first_used].pred;
-            best_ref.rcost = rcost;
-            best_ref.rpred = costs_r[i - first_used].pred;
-          }
-        }
-        // Clear extra_bits_increase and cost_increase for last_used.
-        extra_bits_increase[last_used] = 0;
-        for (size_t sym = 0; sym < max_symbols; sym++) {
-          count_increase[last_used * max_symbols + sym] = 0;
-        }
+    SplitInfo &best_ref =
+        tree_samples.PropertyFromIndex(prop) < kNumStaticProperties
+            ? (zero_entropy_side ? candidates->static_constant
+                                 : candidates->static_split)
+            : (adds_wp ? candidates->nonstatic : candidates->nowp);
+    if (lcost + rcost < best_ref.Cost()) {
+      best_ref.prop = prop;
+      best_ref.val = i;
+      best_ref.pos = split;
+      best_ref.lcost = lcost;
+      best_ref.lpred = costs_l[i - first_used].pred;
+      best_ref.rcost = rcost;
+      best_ref.rpred = costs_r[i - first_used].pred;
+    }
+  }
+  // Clear extra_bits_increase and cost_increase for last_used.
+  extra_bits_increase[last_used] = 0;
+  for (size_t sym = 0; sym < max_symbols; sym++) {
+    count_increase[last_used * max_symbols + sym] = 0;
+  }
+}
+
+// Keeps the earliest of equally good candidates, like a single pass over all
+// properties in order would.
+void MergeCandidates(const SplitCandidates &from, SplitCandidates *to) {
+  if (from.static_constant.Cost() < to->static_constant.Cost()) {
+    to->static_constant = from.static_constant;
+  }
+  if (from.static_split.Cost() < to->static_split.Cost()) {
+    to->static_split = from.static_split;
+  }
+  if (from.nonstatic.Cost() < to->nonstatic.Cost()) {
+    to->nonstatic = from.nonstatic;
+  }
+  if (from.nowp.Cost() < to->nowp.Cost()) {
+    to->nowp = from.nowp;
+  }
+}
+
+// The tree is grown one level at a time: the candidate splits of all the
+// nodes of a level, along all properties, are evaluated in parallel, and the
+// samples of each split node are then partitioned in parallel. The decision
+// for a node only depends on its own samples, so the resulting tree does not
+// depend on the number of threads.
+Status FindBestSplit(TreeSamples &tree_samples, float threshold,
+                     const std::vector<ModularMultiplierInfo> &mul_info,
+                     StaticPropRange initial_static_prop_range,
+                     float fast_decode_multiplier, ThreadPool *pool,
+                     Tree *tree) {
+  struct NodeSplit {
+    size_t begin;
+    size_t pos;
+    size_t end;
+    size_t prop;
+    uint32_t val;
+  };
+  struct PropertyTask {
+    uint32_t node;
+    uint32_t prop;
+  };
+
+  std::vector<NodeInfo> nodes;
+  nodes.push_back(NodeInfo{0, 0, tree_samples.NumDistinctSamples(), 0,
+                           initial_static_prop_range});
+
+  size_t num_properties = tree_samples.NumProperties();
+
+  std::vector<NodeInfo> next_nodes;
+  std::vector<NodeStats> stats;
+  std::vector<PropertyTask> tasks;
+  std::vector<SplitCandidates> candidates;
+  std::vector<NodeSplit> splits;
+  std::vector<SplitScratch> scratch;
+
+  while (!nodes.empty()) {
+    stats.clear();
+    stats.resize(nodes.size());
+    const auto compute_stats = [&](const uint32_t i,
+                                   size_t /* thread */) -> Status {
+      ComputeNodeStats(tree_samples, threshold, mul_info, nodes[i],
+                       (*tree)[nodes[i].pos].predictor, &stats[i]);
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, nodes.size(), ThreadPool::NoInit,
+                                  compute_stats, "MA node stats"));
+
+    tasks.clear();
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (stats[i].has_forced_split || stats[i].base_bits <= threshold) {
+        continue;
+      }
+      for (size_t prop = 0; prop < num_properties; prop++) {
+        tasks.push_back(PropertyTask{static_cast<uint32_t>(i),
+                                     static_cast<uint32_t>(prop)});
       }
+    }
+    candidates.clear();
+    candidates.resize(tasks.size());
+    const auto init_scratch = [&](size_t num_threads) -> Status {
+      if (scratch.size() < num_threads) scratch.resize(num_threads);
+      return true;
+    };
+    const auto find_splits = [&](const uint32_t task,
+                                 size_t thread) -> Status {
+      const NodeInfo &node = nodes[tasks[task].node];
+      FindPropertySplits(tree_samples, threshold, node, stats[tasks[task].node],
+                         (*tree)[node.pos].predictor, tasks[task].prop,
+                         &scratch[thread], &candidates[task]);
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, tasks.size(), init_scratch,
+                                  find_splits, "MA property splits"));
 
-      // Try to avoid introducing WP.
-      if (best_split_nowp.Cost() + threshold < base_bits &&
-          best_split_nowp.Cost() <= fast_decode_multiplier * best->Cost()) {
-        best = &best_split_nowp;
+    // Tasks are sorted by node, then by property.
+    size_t task = 0;
+    splits.clear();
+    next_nodes.clear();
+    for (size_t i = 0; i < nodes.size(); i++) {
+      size_t pos = nodes[i].pos;
+      const NodeStats &node_stats = stats[i];
+      if (node_stats.multiplier != 0) {
+        (*tree)[pos].multiplier = node_stats.multiplier;
       }
-      // Split along static props if possible and not significantly more
-      // expensive.
-      if (best_split_static.Cost() + threshold < base_bits &&
-          best_split_static.Cost() <= fast_decode_multiplier * best->Cost()) {
-        best = &best_split_static;
+      SplitCandidates node_candidates;
+      for (; task < tasks.size() && tasks[task].node == i; task++) {
+        MergeCandidates(candidates[task], &node_candidates);
       }
-      // Split along static props to create constant nodes if possible.
-      if (best_split_static_constant.Cost() + threshold < base_bits) {
-        best = &best_split_static_constant;
+      float base_bits = node_stats.base_bits;
+      const SplitInfo *best = &node_candidates.nonstatic;
+      if (node_stats.has_forced_split) {
+        best = &node_stats.forced_split;
+      } else {
+        // Try to avoid introducing WP.
+        if (node_candidates.nowp.Cost() + threshold < base_bits &&
+            node_candidates.nowp.Cost() <=
+                fast_decode_multiplier * best->Cost()) {
+          best = &node_candidates.nowp;
+        }
+        // Split along static props if possible and not significantly more
+        // expensive.
+        if (node_candidates.static_split.Cost() + threshold < base_bits &&
+            node_candidates.static_split.Cost() <=
+                fast_decode_multiplier * best->Cost()) {
+          best = &node_candidates.static_split;
+        }
+        // Split along static props to create constant nodes if possible.
+        if (node_candidates.static_constant.Cost() + threshold < base_bits) {
+          best = &node_candidates.static_constant;
+        }
       }
-    }
+      if (best->Cost() + threshold >= base_bits) continue;
 
-    if (best->Cost() + threshold < base_bits) {
       uint32_t p = tree_samples.PropertyFromIndex(best->prop);
       pixel_type dequant =
           tree_samples.UnquantizeProperty(best->prop, best->val);
       // Split node and try to split children.
       MakeSplitNode(pos, p, dequant, best->lpred, 0, best->rpred, 0, tree);
-      // "Sort" according to winning property
-      if (best->prop < tree_samples.NumStaticProps()) {
-        SplitTreeSamples<true>(tree_samples, begin, best->pos, end, best->prop,
-                               best->val);
-      } else {
-        SplitTreeSamples<false>(tree_samples, begin, best->pos, end,
-                                best->prop - tree_samples.NumStaticProps(),
-                                best->val);
-      }
+      size_t begin = nodes[i].begin;
+      size_t end = nodes[i].end;
+      splits.push_back(NodeSplit{begin, best->pos, end, best->prop, best->val});
+      uint64_t used_properties = nodes[i].used_properties;
       if (p >= kNumStaticProperties) {
         used_properties |= 1 << best->prop;
       }
+      const StaticPropRange &static_prop_range = nodes[i].static_prop_range;
       auto new_sp_range = static_prop_range;
       if (p < kNumStaticProperties) {
         JXL_DASSERT(static_cast<uint32_t>(dequant + 1) <= new_sp_range[p][1]);
         new_sp_range[p][1] = dequant + 1;
         JXL_DASSERT(new_sp_range[p][0] < new_sp_range[p][1]);
       }
-      nodes.push_back(NodeInfo{(*tree)[pos].rchild, begin, best->pos,
-                               used_properties, new_sp_range});
+      if (begin != best->pos) {
+        next_nodes.push_back(NodeInfo{(*tree)[pos].rchild, begin, best->pos,
+                                      used_properties, new_sp_range});
+      }
       new_sp_range = static_prop_range;
       if (p < kNumStaticProperties) {
         JXL_DASSERT(new_sp_range[p][0] <= static_cast<uint32_t>(dequant + 1));
         new_sp_range[p][0] = dequant + 1;
         JXL_DASSERT(new_sp_range[p][0] < new_sp_range[p][1]);
       }
-      nodes.push_back(NodeInfo{(*tree)[pos].lchild, best->pos, end,
-                               used_properties, new_sp_range});
+      if (best->pos != end) {
+        next_nodes.push_back(NodeInfo{(*tree)[pos].lchild, best->pos, end,
+                                      used_properties, new_sp_range});
+      }
     }
+
+    // "Sort" according to winning property. The sample ranges of the nodes
+    // of a level are disjoint.
+    const auto split_samples = [&](const uint32_t i,
+                                   size_t /* thread */) -> Status {
+      const NodeSplit &s = splits[i];
+      if (s.prop < tree_samples.NumStaticProps()) {
+        SplitTreeSamples<true>(tree_samples, s.begin, s.pos, s.end, s.prop,
+                               s.val);
+      } else {
+        SplitTreeSamples<false>(tree_samples, s.begin, s.pos, s.end,
+                                s.prop - tree_samples.NumStaticProps(), s.val);
+      }
+      return true;
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, splits.size(), ThreadPool::NoInit,
+                                  split_samples, "MA split samples"));
+    nodes.swap(next_nodes);
   }
+  return true;
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -510,7 +662,8 @@ HWY_EXPORT(FindBestSplit);  // Local function.
 Status ComputeBestTree(TreeSamples &tree_samples, float threshold,
                        const std::vector<ModularMultiplierInfo> &mul_info,
                        StaticPropRange static_prop_range,
-                       float fast_decode_multiplier, Tree *tree) {
+                       float fast_decode_multiplier, ThreadPool *pool,
+                       Tree *tree) {
   // TODO(veluca): take into account that different contexts can have different
   // uint configs.
   //
@@ -524,10 +677,9 @@ Status ComputeBestTree(TreeSamples &tree_samples, float threshold,
 
   JXL_ENSURE(tree_samples.NumDistinctSamples() <=
              std::numeric_limits<uint32_t>::max());
-  HWY_DYNAMIC_DISPATCH(FindBestSplit)
-  (tree_samples, threshold, mul_info, static_prop_range, fast_decode_multiplier,
-   tree);
-  return true;
+  return HWY_DYNAMIC_DISPATCH(FindBestSplit)(
+      tree_samples, threshold, mul_info, static_prop_range,
+      fast_decode_multiplier, pool, tree);
 }
 
 #if JXL_CXX_LANG < JXL_CXX_17
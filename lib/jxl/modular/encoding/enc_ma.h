@@ -21,6 +21,8 @@
 
 namespace jxl {
 
+class ThreadPool;
+
 struct ResidualToken {
   uint8_t tok;
   uint8_t nbits;
@@ -173,10 +175,13 @@ void CollectPixelSamples(const Image &image, const ModularOptions &options,
                          std::vector<pixel_type> &pixel_samples,
                          std::vector<pixel_type> &diff_samples);
 
+// If `pool` is given, the candidate splits of the nodes of each tree level are
+// evaluated in parallel. The resulting tree does not depend on the pool.
 Status ComputeBestTree(TreeSamples &tree_samples, float threshold,
                        const std::vector<ModularMultiplierInfo> &mul_info,
                        StaticPropRange static_prop_range,
-                       float fast_decode_multiplier, Tree *tree);
+                       float fast_decode_multiplier, ThreadPool *pool,
+                       Tree *tree);
 
 }  // namespace jxl
 #endif  // LIB_JXL_MODULAR_ENCODING_ENC_MA_H_
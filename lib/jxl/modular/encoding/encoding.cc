@@ -9,15 +9,19 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <mutex>
 #include <queue>
 #include <utility>
 #include <vector>
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/scope_guard.h"
 #include "lib/jxl/base/status.h"
@@ -144,7 +148,213 @@ FlatTree FilterTree(const Tree &global_tree,
   return output;
 }
 
+namespace {
+
+// Returns the depth of `tree` in decisions of the original tree, and stores
+// its number of leaves in `num_leaves`.
+size_t FlatTreeDepth(const FlatTree &tree, size_t *num_leaves) {
+  // Flat nodes are stored in BFS order, so children always come after their
+  // parent.
+  std::vector<size_t> node_depth(tree.size());
+  size_t depth = 0;
+  *num_leaves = 0;
+  for (size_t i = 0; i < tree.size(); i++) {
+    if (tree[i].property0 < 0) {
+      depth = std::max(depth, node_depth[i]);
+      ++*num_leaves;
+      continue;
+    }
+    for (size_t c = 0; c < 4; c++) {
+      node_depth[tree[i].childID + c] = node_depth[i] + 2;
+    }
+  }
+  return depth;
+}
+
+}  // namespace
+
+bool MATreeTableLookup::IsShallowOrBalanced(const FlatTree &tree) {
+  size_t num_leaves;
+  const size_t depth = FlatTreeDepth(tree, &num_leaves);
+  if (depth <= kShallowDepth) return true;
+  return depth <= kMaxDepth && (size_t{1} << depth) <= 2 * num_leaves;
+}
+
+bool MATreeTableLookup::Init(const FlatTree &tree, size_t max_leaves) {
+  size_t num_leaves;
+  const size_t depth = FlatTreeDepth(tree, &num_leaves);
+  if (depth > kMaxDepth || (size_t{1} << depth) > max_leaves) return false;
+
+  depth_ = depth;
+  // Splits below a leaf compare property 0 against 0; both sides lead to a
+  // copy of the same leaf.
+  splits_.assign((size_t{1} << depth_) - 1, Split{0, 0});
+  leaves_.resize(size_t{1} << depth_);
+  struct Pending {
+    size_t node;
+    size_t pos;
+    size_t level;
+  };
+  std::vector<Pending> pending = {{0, 0, 0}};
+  while (!pending.empty()) {
+    Pending cur = pending.back();
+    pending.pop_back();
+    const FlatDecisionNode &node = tree[cur.node];
+    if (node.property0 < 0) {
+      size_t shift = depth_ - cur.level;
+      size_t first = ((cur.pos + 1) << shift) - 1 - splits_.size();
+      std::fill(leaves_.begin() + first,
+                leaves_.begin() + first + (size_t{1} << shift),
+                MATreeLookup::LookupResult{node.childID, node.predictor,
+                                           node.predictor_offset,
+                                           node.multiplier});
+      continue;
+    }
+    // Same child order as MATreeLookup: the > side of each split comes first.
+    size_t gt = 2 * cur.pos + 1;
+    size_t le = 2 * cur.pos + 2;
+    splits_[cur.pos] = {static_cast<uint32_t>(node.property0),
+                        node.splitval0};
+    splits_[gt] = {static_cast<uint32_t>(node.properties[0]),
+                   node.splitvals[0]};
+    splits_[le] = {static_cast<uint32_t>(node.properties[1]),
+                   node.splitvals[1]};
+    pending.push_back({node.childID, 2 * gt + 1, cur.level + 2});
+    pending.push_back({node.childID + 1, 2 * gt + 2, cur.level + 2});
+    pending.push_back({node.childID + 2, 2 * le + 1, cur.level + 2});
+    pending.push_back({node.childID + 3, 2 * le + 2, cur.level + 2});
+  }
+  return true;
+}
+
 namespace detail {
+JXL_INLINE pixel_type MakePixel(uint64_t v, pixel_type multiplier,
+                                pixel_type_w offset) {
+  JXL_DASSERT((v & 0xFFFFFFFF) == v);
+  pixel_type_w val = static_cast<pixel_type_w>(UnpackSigned(v));
+  // if it overflows, it overflows, and we have a problem anyway
+  return val * multiplier + offset;
+}
+
+template <bool uses_lz77, typename Lookup>
+Status DecodeChannelTreeNoWP(
+    BitReader *br, ANSSymbolReader *reader, const Lookup &tree_lookup,
+    size_t num_props,
+    const std::array<pixel_type, kNumStaticProperties> &static_props,
+    pixel_type chan, Image *image) {
+  JxlMemoryManager *memory_manager = image->memory_manager();
+  Channel &channel = image->channel[chan];
+  Properties properties = Properties(num_props);
+  const ptrdiff_t onerow = channel.plane.PixelsPerRow();
+  JXL_ASSIGN_OR_RETURN(
+      Channel references,
+      Channel::Create(memory_manager,
+                      properties.size() - kNumNonrefProperties, channel.w));
+  for (size_t y = 0; y < channel.h; y++) {
+    pixel_type *JXL_RESTRICT p = channel.Row(y);
+    PrecomputeReferences(channel, y, *image, chan, &references);
+    InitPropsRow(&properties, static_props, y);
+    if (y > 1 && channel.w > 8 && references.w == 0) {
+      for (size_t x = 0; x < 2; x++) {
+        PredictionResult res =
+            PredictTreeNoWP(&properties, channel.w, p + x, onerow, x, y,
+                            tree_lookup, references);
+        uint64_t v =
+            reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
+      }
+      for (size_t x = 2; x < channel.w - 2; x++) {
+        PredictionResult res =
+            PredictTreeNoWPNEC(&properties, channel.w, p + x, onerow, x, y,
+                               tree_lookup, references);
+        uint64_t v = reader->ReadHybridUintClusteredInlined<uses_lz77>(
+            res.context, br);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
+      }
+      for (size_t x = channel.w - 2; x < channel.w; x++) {
+        PredictionResult res =
+            PredictTreeNoWP(&properties, channel.w, p + x, onerow, x, y,
+                            tree_lookup, references);
+        uint64_t v =
+            reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
+      }
+    } else {
+      for (size_t x = 0; x < channel.w; x++) {
+        PredictionResult res =
+            PredictTreeNoWP(&properties, channel.w, p + x, onerow, x, y,
+                            tree_lookup, references);
+        uint64_t v = reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(
+            res.context, br);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
+      }
+    }
+  }
+  return true;
+}
+
+template <bool uses_lz77, typename Lookup>
+Status DecodeChannelTreeWP(
+    BitReader *br, ANSSymbolReader *reader, const Lookup &tree_lookup,
+    const weighted::Header &wp_header, size_t num_props,
+    const std::array<pixel_type, kNumStaticProperties> &static_props,
+    pixel_type chan, Image *image) {
+  JxlMemoryManager *memory_manager = image->memory_manager();
+  Channel &channel = image->channel[chan];
+  Properties properties = Properties(num_props);
+  const ptrdiff_t onerow = channel.plane.PixelsPerRow();
+  JXL_ASSIGN_OR_RETURN(
+      Channel references,
+      Channel::Create(memory_manager,
+                      properties.size() - kNumNonrefProperties, channel.w));
+  weighted::State wp_state(wp_header, channel.w, channel.h);
+  for (size_t y = 0; y < channel.h; y++) {
+    pixel_type *JXL_RESTRICT p = channel.Row(y);
+    InitPropsRow(&properties, static_props, y);
+    PrecomputeReferences(channel, y, *image, chan, &references);
+    if (!uses_lz77 && y > 1 && channel.w > 8 && references.w == 0) {
+      for (size_t x = 0; x < 2; x++) {
+        PredictionResult res =
+            PredictTreeWP(&properties, channel.w, p + x, onerow, x, y,
+                          tree_lookup, references, &wp_state);
+        uint64_t v =
+            reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
+        wp_state.UpdateErrors(p[x], x, y, channel.w);
+      }
+      for (size_t x = 2; x < channel.w - 2; x++) {
+        PredictionResult res =
+            PredictTreeWPNEC(&properties, channel.w, p + x, onerow, x, y,
+                             tree_lookup, references, &wp_state);
+        uint64_t v = reader->ReadHybridUintClusteredInlined<uses_lz77>(
+            res.context, br);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
+        wp_state.UpdateErrors(p[x], x, y, channel.w);
+      }
+      for (size_t x = channel.w - 2; x < channel.w; x++) {
+        PredictionResult res =
+            PredictTreeWP(&properties, channel.w, p + x, onerow, x, y,
+                          tree_lookup, references, &wp_state);
+        uint64_t v =
+            reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
+        wp_state.UpdateErrors(p[x], x, y, channel.w);
+      }
+    } else {
+      for (size_t x = 0; x < channel.w; x++) {
+        PredictionResult res =
+            PredictTreeWP(&properties, channel.w, p + x, onerow, x, y,
+                          tree_lookup, references, &wp_state);
+        uint64_t v =
+            reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
+        wp_state.UpdateErrors(p[x], x, y, channel.w);
+      }
+    }
+  }
+  return true;
+}
+
 template <bool uses_lz77>
 Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
                                  const std::vector<uint8_t> &context_map,
@@ -154,7 +364,6 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
                                  TreeLut<uint8_t, false, false> &tree_lut,
                                  Image *image, uint32_t &fl_run,
                                  uint32_t &fl_v) {
-  JxlMemoryManager *memory_manager = image->memory_manager();
   Channel &channel = image->channel[chan];
 
   std::array<pixel_type, kNumStaticProperties> static_props = {
@@ -183,14 +392,6 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
   JXL_DEBUG_V(3, "Decoded MA tree with %" PRIuS " nodes", tree.size());
 
   // MAANS decode
-  const auto make_pixel = [](uint64_t v, pixel_type multiplier,
-                             pixel_type_w offset) -> pixel_type {
-    JXL_DASSERT((v & 0xFFFFFFFF) == v);
-    pixel_type_w val = static_cast<pixel_type_w>(UnpackSigned(v));
-    // if it overflows, it overflows, and we have a problem anyway
-    return val * multiplier + offset;
-  };
-
   if (tree.size() == 1) {
     // special optimized case: no meta-adaptation, so no need
     // to compute properties.
@@ -205,7 +406,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
         // Special-case: histogram has a single symbol, with no extra bits, and
         // we use ANS mode.
         JXL_DEBUG_V(8, "Fastest track.");
-        pixel_type v = make_pixel(value, multiplier, offset);
+        pixel_type v = MakePixel(value, multiplier, offset);
         for (size_t y = 0; y < channel.h; y++) {
           pixel_type *JXL_RESTRICT r = channel.Row(y);
           std::fill(r, r + channel.w, v);
@@ -228,7 +429,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
               uint32_t v =
                   reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(ctx_id,
                                                                          br);
-              r[x] = make_pixel(v, multiplier, offset);
+              r[x] = MakePixel(v, multiplier, offset);
             }
           }
         }
@@ -281,7 +482,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
           pixel_type guess = ClampedGradient(top, left, topleft);
           uint64_t v = reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(
               ctx_id, br);
-          r[x] = make_pixel(v, 1, guess);
+          r[x] = MakePixel(v, 1, guess);
         }
       }
       return true;
@@ -315,7 +516,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
         uint32_t ctx_id = tree_lut.context_lookup[pos];
         uint64_t v =
             reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(ctx_id, br);
-        r[x] = make_pixel(v, 1, guess);
+        r[x] = MakePixel(v, 1, guess);
       }
     }
   } else if (!uses_lz77 && is_wp_only && channel.w > 8) {
@@ -346,7 +547,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
         uint32_t ctx_id = tree_lut.context_lookup[pos];
         uint64_t v =
             reader->ReadHybridUintClusteredInlined<uses_lz77>(ctx_id, br);
-        r[x] = make_pixel(v, 1, guess);
+        r[x] = MakePixel(v, 1, guess);
         wp_state.UpdateErrors(r[x], x, y, channel.w);
       }
       for (x = 1; x + 1 < channel.w; x++) {
@@ -360,7 +561,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
         uint32_t ctx_id = tree_lut.context_lookup[pos];
         uint64_t v =
             reader->ReadHybridUintClusteredInlined<uses_lz77>(ctx_id, br);
-        r[x] = make_pixel(v, 1, guess);
+        r[x] = MakePixel(v, 1, guess);
         wp_state.UpdateErrors(r[x], x, y, channel.w);
       }
       {
@@ -374,115 +575,42 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
         uint32_t ctx_id = tree_lut.context_lookup[pos];
         uint64_t v =
             reader->ReadHybridUintClusteredInlined<uses_lz77>(ctx_id, br);
-        r[x] = make_pixel(v, 1, guess);
+        r[x] = MakePixel(v, 1, guess);
         wp_state.UpdateErrors(r[x], x, y, channel.w);
       }
     }
-  } else if (!tree_has_wp_prop_or_pred) {
-    // special optimized case: the weighted predictor and its properties are not
-    // used, so no need to compute weights and properties.
-    JXL_DEBUG_V(8, "Slow track.");
-    MATreeLookup tree_lookup(tree);
-    Properties properties = Properties(num_props);
-    const ptrdiff_t onerow = channel.plane.PixelsPerRow();
-    JXL_ASSIGN_OR_RETURN(
-        Channel references,
-        Channel::Create(memory_manager,
-                        properties.size() - kNumNonrefProperties, channel.w));
-    for (size_t y = 0; y < channel.h; y++) {
-      pixel_type *JXL_RESTRICT p = channel.Row(y);
-      PrecomputeReferences(channel, y, *image, chan, &references);
-      InitPropsRow(&properties, static_props, y);
-      if (y > 1 && channel.w > 8 && references.w == 0) {
-        for (size_t x = 0; x < 2; x++) {
-          PredictionResult res =
-              PredictTreeNoWP(&properties, channel.w, p + x, onerow, x, y,
-                              tree_lookup, references);
-          uint64_t v =
-              reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
-          p[x] = make_pixel(v, res.multiplier, res.guess);
-        }
-        for (size_t x = 2; x < channel.w - 2; x++) {
-          PredictionResult res =
-              PredictTreeNoWPNEC(&properties, channel.w, p + x, onerow, x, y,
-                                 tree_lookup, references);
-          uint64_t v = reader->ReadHybridUintClusteredInlined<uses_lz77>(
-              res.context, br);
-          p[x] = make_pixel(v, res.multiplier, res.guess);
-        }
-        for (size_t x = channel.w - 2; x < channel.w; x++) {
-          PredictionResult res =
-              PredictTreeNoWP(&properties, channel.w, p + x, onerow, x, y,
-                              tree_lookup, references);
-          uint64_t v =
-              reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
-          p[x] = make_pixel(v, res.multiplier, res.guess);
-        }
-      } else {
-        for (size_t x = 0; x < channel.w; x++) {
-          PredictionResult res =
-              PredictTreeNoWP(&properties, channel.w, p + x, onerow, x, y,
-                              tree_lookup, references);
-          uint64_t v = reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(
-              res.context, br);
-          p[x] = make_pixel(v, res.multiplier, res.guess);
-        }
-      }
-    }
   } else {
-    JXL_DEBUG_V(8, "Slowest track.");
-    MATreeLookup tree_lookup(tree);
-    Properties properties = Properties(num_props);
-    const ptrdiff_t onerow = channel.plane.PixelsPerRow();
-    JXL_ASSIGN_OR_RETURN(
-        Channel references,
-        Channel::Create(memory_manager,
-                        properties.size() - kNumNonrefProperties, channel.w));
-    weighted::State wp_state(wp_header, channel.w, channel.h);
-    for (size_t y = 0; y < channel.h; y++) {
-      pixel_type *JXL_RESTRICT p = channel.Row(y);
-      InitPropsRow(&properties, static_props, y);
-      PrecomputeReferences(channel, y, *image, chan, &references);
-      if (!uses_lz77 && y > 1 && channel.w > 8 && references.w == 0) {
-        for (size_t x = 0; x < 2; x++) {
-          PredictionResult res =
-              PredictTreeWP(&properties, channel.w, p + x, onerow, x, y,
-                            tree_lookup, references, &wp_state);
-          uint64_t v =
-              reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
-          p[x] = make_pixel(v, res.multiplier, res.guess);
-          wp_state.UpdateErrors(p[x], x, y, channel.w);
-        }
-        for (size_t x = 2; x < channel.w - 2; x++) {
-          PredictionResult res =
-              PredictTreeWPNEC(&properties, channel.w, p + x, onerow, x, y,
-                               tree_lookup, references, &wp_state);
-          uint64_t v = reader->ReadHybridUintClusteredInlined<uses_lz77>(
-              res.context, br);
-          p[x] = make_pixel(v, res.multiplier, res.guess);
-          wp_state.UpdateErrors(p[x], x, y, channel.w);
-        }
-        for (size_t x = channel.w - 2; x < channel.w; x++) {
-          PredictionResult res =
-              PredictTreeWP(&properties, channel.w, p + x, onerow, x, y,
-                            tree_lookup, references, &wp_state);
-          uint64_t v =
-              reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
-          p[x] = make_pixel(v, res.multiplier, res.guess);
-          wp_state.UpdateErrors(p[x], x, y, channel.w);
-        }
-      } else {
-        for (size_t x = 0; x < channel.w; x++) {
-          PredictionResult res =
-              PredictTreeWP(&properties, channel.w, p + x, onerow, x, y,
-                            tree_lookup, references, &wp_state);
-          uint64_t v =
-              reader->ReadHybridUintClustered<uses_lz77>(res.context, br);
-          p[x] = make_pixel(v, res.multiplier, res.guess);
-          wp_state.UpdateErrors(p[x], x, y, channel.w);
-        }
+    // Shallow or balanced trees that are not too deep for the size of the
+    // channel are expanded into a complete decision table, which is walked
+    // without data-dependent branches. Deep unbalanced trees would replicate
+    // many shallow leaves, and a walk of the tree does fewer comparisons.
+    MATreeTableLookup tree_table;
+    bool use_table = MATreeTableLookup::IsShallowOrBalanced(tree) &&
+                     tree_table.Init(tree, channel.w * channel.h / 8);
+    if (!tree_has_wp_prop_or_pred) {
+      // special optimized case: the weighted predictor and its properties are
+      // not used, so no need to compute weights and properties.
+      if (use_table) {
+        JXL_DEBUG_V(8, "Slow track, decision table.");
+        return DecodeChannelTreeNoWP<uses_lz77>(br, reader, tree_table,
+                                                num_props, static_props, chan,
+                                                image);
       }
+      JXL_DEBUG_V(8, "Slow track.");
+      return DecodeChannelTreeNoWP<uses_lz77>(br, reader, MATreeLookup(tree),
+                                              num_props, static_props, chan,
+                                              image);
+    }
+    if (use_table) {
+      JXL_DEBUG_V(8, "Slowest track, decision table.");
+      return DecodeChannelTreeWP<uses_lz77>(br, reader, tree_table, wp_header,
+                                            num_props, static_props, chan,
+                                            image);
     }
+    JXL_DEBUG_V(8, "Slowest track.");
+    return DecodeChannelTreeWP<uses_lz77>(br, reader, MATreeLookup(tree),
+                                          wp_header, num_props, static_props,
+                                          chan, image);
   }
   return true;
 }
@@ -507,6 +635,228 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
   }
 }
 
+namespace {
+
+// Properties that only depend on the position of a pixel (channel, group ID,
+// y and x), not on decoded pixel values.
+constexpr int32_t kNumPositionProperties = 4;
+
+// Below this many pixels, a group is not worth splitting across threads.
+constexpr size_t kMinPipelinedPixels = 1 << 16;
+
+}  // namespace
+
+bool IsPipelinedChannelTree(const FlatTree &tree, bool wp_only,
+                            bool gradient_only) {
+  // Trees with a fast track in DecodeModularChannelMAANS: a single leaf with
+  // the zero or the plain gradient predictor, or lookup tables on the WP or
+  // gradient property. These decode faster serially.
+  if (wp_only || gradient_only) return false;
+  if (tree.size() == 1 &&
+      (tree[0].predictor == Predictor::Zero ||
+       (tree[0].predictor == Predictor::Gradient &&
+        tree[0].predictor_offset == 0 && tree[0].multiplier == 1))) {
+    return false;
+  }
+  for (const auto &node : tree) {
+    if (node.property0 == -1) continue;
+    if (node.property0 >= kNumPositionProperties ||
+        node.properties[0] >= kNumPositionProperties ||
+        node.properties[1] >= kNumPositionProperties) {
+      return false;
+    }
+  }
+  return true;
+}
+
+namespace {
+
+struct PipelinedChannel {
+  pixel_type chan;
+  // Leaves hold clustered contexts.
+  FlatTree tree;
+  size_t num_props;
+  bool use_wp;
+};
+
+// Progress of the entropy decoding thread, shared with the threads that
+// reconstruct the channels.
+class PipelineProgress {
+ public:
+  explicit PipelineProgress(size_t num_channels)
+      : rows_decoded_(num_channels) {}
+
+  void SetRowsDecoded(size_t c, size_t rows) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      rows_decoded_[c] = rows;
+    }
+    cv_.notify_all();
+  }
+
+  void SetFailed() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      failed_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  // Waits until row `y` of channel `c` has been entropy decoded. Returns false
+  // if entropy decoding failed.
+  bool WaitForRow(size_t c, size_t y) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] { return failed_ || rows_decoded_[c] > y; });
+    return !failed_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<size_t> rows_decoded_;
+  bool failed_ = false;
+};
+
+// Reads the residuals of all the channels, in place of their pixels.
+template <bool uses_lz77>
+Status DecodeResiduals(BitReader *br, ANSSymbolReader *reader,
+                       size_t group_id,
+                       const std::vector<PipelinedChannel> &channels,
+                       Image *image, PipelineProgress *progress) {
+  for (size_t i = 0; i < channels.size(); i++) {
+    Channel &channel = image->channel[channels[i].chan];
+    MATreeLookup tree_lookup(channels[i].tree);
+    Properties properties(channels[i].num_props);
+    std::array<pixel_type, kNumStaticProperties> static_props = {
+        {channels[i].chan, static_cast<int>(group_id)}};
+    for (size_t y = 0; y < channel.h; y++) {
+      pixel_type *JXL_RESTRICT r = channel.Row(y);
+      InitPropsRow(&properties, static_props, y);
+      for (size_t x = 0; x < channel.w; x++) {
+        properties[3] = x;
+        uint32_t ctx_id = tree_lookup.Lookup(properties).context;
+        uint64_t v =
+            reader->ReadHybridUintClusteredMaybeInlined<uses_lz77>(ctx_id, br);
+        r[x] = UnpackSigned(v);
+      }
+      progress->SetRowsDecoded(i, y + 1);
+    }
+    if (!br->AllReadsWithinBounds()) {
+      return JXL_FAILURE("Truncated input");
+    }
+  }
+  return true;
+}
+
+// Turns the residuals of channel `i` into pixels, as soon as they are read.
+Status ReconstructChannel(size_t i, const PipelinedChannel &pc,
+                          size_t group_id, const weighted::Header &wp_header,
+                          Image *image, PipelineProgress *progress) {
+  Channel &channel = image->channel[pc.chan];
+  MATreeLookup tree_lookup(pc.tree);
+  Properties properties(pc.num_props);
+  std::array<pixel_type, kNumStaticProperties> static_props = {
+      {pc.chan, static_cast<int>(group_id)}};
+  const ptrdiff_t onerow = channel.plane.PixelsPerRow();
+  // The tree does not use properties of previous channels.
+  JXL_ASSIGN_OR_RETURN(
+      Channel references,
+      Channel::Create(image->memory_manager(), /*iw=*/0, channel.w));
+  weighted::State wp_state(wp_header, channel.w, channel.h);
+  for (size_t y = 0; y < channel.h; y++) {
+    // The entropy decoding task reports the error.
+    if (!progress->WaitForRow(i, y)) return true;
+    pixel_type *JXL_RESTRICT p = channel.Row(y);
+    InitPropsRow(&properties, static_props, y);
+    for (size_t x = 0; x < channel.w; x++) {
+      PredictionResult res =
+          pc.use_wp ? PredictTreeWP(&properties, channel.w, p + x, onerow, x, y,
+                                    tree_lookup, references, &wp_state)
+                    : PredictTreeNoWP(&properties, channel.w, p + x, onerow, x,
+                                      y, tree_lookup, references);
+      p[x] = static_cast<pixel_type_w>(p[x]) * res.multiplier + res.guess;
+      if (pc.use_wp) wp_state.UpdateErrors(p[x], x, y, channel.w);
+    }
+  }
+  return true;
+}
+
+// If the trees of all the channels from `*next_channel` on only split on
+// position properties and have no fast track (see IsPipelinedChannelTree),
+// the entropy coded stream can be read without
+// reconstructing any pixel. One task then reads the residuals while one task
+// per channel reconstructs the rows that have been read, and `*next_channel`
+// is moved past the decoded channels. Otherwise, nothing is read.
+Status DecodeChannelsPipelined(BitReader *br, ANSSymbolReader *reader,
+                               const std::vector<uint8_t> &context_map,
+                               const Tree &global_tree,
+                               const weighted::Header &wp_header,
+                               size_t group_id, const ModularOptions &options,
+                               ThreadPool *pool, Image *image,
+                               size_t *next_channel) {
+  std::vector<PipelinedChannel> channels;
+  size_t num_pixels = 0;
+  bool has_prediction = false;
+  size_t end_channel = *next_channel;
+  for (; end_channel < image->channel.size(); end_channel++) {
+    const Channel &channel = image->channel[end_channel];
+    if (end_channel >= image->nb_meta_channels &&
+        (channel.w > options.max_chan_size ||
+         channel.h > options.max_chan_size)) {
+      break;
+    }
+    if (!channel.w || !channel.h) continue;
+    PipelinedChannel pc;
+    pc.chan = end_channel;
+    std::array<pixel_type, kNumStaticProperties> static_props = {
+        {pc.chan, static_cast<int>(group_id)}};
+    bool wp_only;
+    bool gradient_only;
+    pc.tree = FilterTree(global_tree, static_props, &pc.num_props, &pc.use_wp,
+                         &wp_only, &gradient_only);
+    if (!IsPipelinedChannelTree(pc.tree, wp_only, gradient_only)) return true;
+    for (auto &node : pc.tree) {
+      if (node.property0 == -1) {
+        node.childID = context_map[node.childID];
+        has_prediction |= node.predictor != Predictor::Zero;
+      }
+    }
+    num_pixels += channel.w * channel.h;
+    channels.push_back(std::move(pc));
+  }
+  if (!has_prediction || num_pixels < kMinPipelinedPixels) return true;
+
+  JXL_DEBUG_V(8, "Pipelined track.");
+  PipelineProgress progress(channels.size());
+  std::atomic<uint32_t> next_role{0};
+  const auto process_role = [&](const uint32_t /*task*/,
+                                size_t /*thread*/) -> Status {
+    // Roles are handed out in the order in which tasks start: the entropy
+    // decoding task always starts first, so reconstruction tasks never wait
+    // for a task that has not started, even if the runner is sequential.
+    uint32_t role = next_role.fetch_add(1);
+    if (role == 0) {
+      Status status =
+          reader->UsesLZ77()
+              ? DecodeResiduals</*uses_lz77=*/true>(br, reader, group_id,
+                                                    channels, image, &progress)
+              : DecodeResiduals</*uses_lz77=*/false>(
+                    br, reader, group_id, channels, image, &progress);
+      if (!status) progress.SetFailed();
+      return status;
+    }
+    return ReconstructChannel(role - 1, channels[role - 1], group_id,
+                              wp_header, image, &progress);
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, channels.size() + 1,
+                                ThreadPool::NoInit, process_role,
+                                "DecodeModularPipelined"));
+  *next_channel = end_channel;
+  return true;
+}
+
+}  // namespace
+
 GroupHeader::GroupHeader() { Bundle::Init(this); }
 
 Status ValidateChannelDimensions(const Image &image,
@@ -537,7 +887,7 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
                      size_t group_id, ModularOptions *options,
                      const Tree *global_tree, const ANSCode *global_code,
                      const std::vector<uint8_t> *global_ctx_map,
-                     const bool allow_truncated_group) {
+                     const bool allow_truncated_group, ThreadPool *pool) {
   if (image.channel.empty()) return true;
   JxlMemoryManager *memory_manager = image.memory_manager();
 
@@ -632,6 +982,11 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
   // Read channels
   JXL_ASSIGN_OR_RETURN(ANSSymbolReader reader,
                        ANSSymbolReader::Create(code, br, distance_multiplier));
+  if (pool != nullptr && !allow_truncated_group) {
+    JXL_RETURN_IF_ERROR(DecodeChannelsPipelined(
+        br, &reader, *context_map, *tree, header.wp_header, group_id, *options,
+        pool, &image, &next_channel));
+  }
   auto tree_lut = jxl::make_unique<TreeLut<uint8_t, false, false>>();
   uint32_t fl_run = 0;
   uint32_t fl_v = 0;
@@ -670,7 +1025,7 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
                                 ModularOptions *options, bool undo_transforms,
                                 const Tree *tree, const ANSCode *code,
                                 const std::vector<uint8_t> *ctx_map,
-                                bool allow_truncated_group) {
+                                bool allow_truncated_group, ThreadPool *pool) {
   std::vector<std::pair<size_t, size_t>> req_sizes;
   req_sizes.reserve(image.channel.size());
   for (const auto &c : image.channel) {
@@ -680,7 +1035,7 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
   if (header == nullptr) header = &local_header;
   size_t bit_pos = br->TotalBitsConsumed();
   auto dec_status = ModularDecode(br, image, *header, group_id, options, tree,
-                                  code, ctx_map, allow_truncated_group);
+                                  code, ctx_map, allow_truncated_group, pool);
   if (!allow_truncated_group) JXL_RETURN_IF_ERROR(dec_status);
   if (dec_status.IsFatalError()) return dec_status;
   if (undo_transforms) image.undo_transforms(header->wp_header);
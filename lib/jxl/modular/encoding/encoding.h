@@ -25,6 +25,7 @@ namespace jxl {
 
 struct ANSCode;
 class BitReader;
+class ThreadPool;
 
 // Valid range of properties for using lookup tables instead of trees.
 constexpr int32_t kPropRangeFast = 512 << 4;
@@ -59,6 +60,13 @@ FlatTree FilterTree(const Tree &global_tree,
                     size_t *num_props, bool *use_wp, bool *wp_only,
                     bool *gradient_only);
 
+// Returns whether a channel with the given tree, as returned by FilterTree, is
+// decoded by ModularGenericDecompress with one thread reading the residuals
+// and another one reconstructing the pixels: the tree must only split on
+// properties of the pixel position, and have no faster serial track.
+bool IsPipelinedChannelTree(const FlatTree &tree, bool wp_only,
+                            bool gradient_only);
+
 template <typename T, bool HAS_OFFSETS, bool HAS_MULTIPLIERS>
 struct TreeLut {
   std::array<T, 2 * kPropRangeFast> context_lookup;
@@ -134,11 +142,55 @@ bool TreeToLookupTable(const FlatTree &tree,
   }
   return true;
 }
+
+// A FlatTree of bounded depth, expanded into a complete binary tree stored in
+// level order. Leaves that are shallower than the deepest one are replicated,
+// so every lookup does the same number of comparisons and the only branch is
+// the loop over levels, which is perfectly predictable for a given tree.
+class MATreeTableLookup {
+ public:
+  // Depth is counted in decisions of the original (non-flattened) tree.
+  static constexpr size_t kMaxDepth = 10;
+
+  // Trees of at most this depth always use the table.
+  static constexpr size_t kShallowDepth = 4;
+
+  // Whether the table is expected to be faster than walking the tree: the tree
+  // is at most kShallowDepth deep, or the table has at most twice as many
+  // leaves as the tree, so that lookups do few more comparisons than walks.
+  static bool IsShallowOrBalanced(const FlatTree &tree);
+
+  // Returns false if the tree is deeper than kMaxDepth, or if the table would
+  // have more than `max_leaves` leaves.
+  bool Init(const FlatTree &tree, size_t max_leaves);
+
+  JXL_INLINE MATreeLookup::LookupResult Lookup(
+      const Properties &properties) const {
+    uint32_t pos = 0;
+    for (size_t i = 0; i < depth_; i++) {
+      const Split &split = splits_[pos];
+      pos = 2 * pos + 1 + int{properties[split.property] <= split.splitval};
+    }
+    return leaves_[pos - splits_.size()];
+  }
+
+ private:
+  struct Split {
+    uint32_t property;
+    PropertyVal splitval;
+  };
+  size_t depth_ = 0;
+  std::vector<Split> splits_;
+  std::vector<MATreeLookup::LookupResult> leaves_;
+};
+
 // TODO(veluca): make cleaner interfaces.
 
 Status ValidateChannelDimensions(const Image &image,
                                  const ModularOptions &options);
 
+// If `pool` is given, channels whose tree only depends on the pixel position
+// are entropy decoded on one thread and reconstructed on others.
 Status ModularGenericDecompress(BitReader *br, Image &image,
                                 GroupHeader *header, size_t group_id,
                                 ModularOptions *options,
@@ -146,7 +198,8 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
                                 const Tree *tree = nullptr,
                                 const ANSCode *code = nullptr,
                                 const std::vector<uint8_t> *ctx_map = nullptr,
-                                bool allow_truncated_group = false);
+                                bool allow_truncated_group = false,
+                                ThreadPool *pool = nullptr);
 }  // namespace jxl
 
 #endif  // LIB_JXL_MODULAR_ENCODING_ENCODING_H_
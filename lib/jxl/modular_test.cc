@@ -6,8 +6,13 @@
 #include <jxl/cms.h>
 #include <jxl/encode.h>
 #include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
 #include <jxl/types.h>
 
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
@@ -37,6 +42,7 @@
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/enc_fields.h"
+#include "lib/jxl/enc_frame.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/enc_toc.h"
 #include "lib/jxl/fields.h"
@@ -47,6 +53,8 @@
 #include "lib/jxl/image_metadata.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/image_test_utils.h"
+#include "lib/jxl/modular/encoding/context_predict.h"
+#include "lib/jxl/modular/encoding/dec_ma.h"
 #include "lib/jxl/modular/encoding/enc_encoding.h"
 #include "lib/jxl/modular/encoding/encoding.h"
 #include "lib/jxl/modular/modular_image.h"
@@ -98,6 +106,121 @@ JXL_TSAN_SLOW_TEST(ModularTest, RoundtripLosslessGroups1024) {
   TestLosslessGroups(3);
 }
 
+// Number of tasks of the current thread that are running, in calls of
+// NestedTaskCountingRunner.
+thread_local size_t running_tasks = 0;
+
+// A JxlThreadParallelRunner that counts the tasks of nested calls, i.e. of
+// calls made from within a task.
+struct NestedTaskCounter {
+  JxlThreadParallelRunnerPtr runner;
+  std::atomic<size_t> num_nested_tasks{0};
+};
+
+struct CountedCall {
+  JxlParallelRunInit init;
+  JxlParallelRunFunction func;
+  void* jpegxl_opaque;
+};
+
+JxlParallelRetCode CountedInit(void* opaque, size_t num_threads) {
+  const CountedCall* call = static_cast<const CountedCall*>(opaque);
+  return call->init(call->jpegxl_opaque, num_threads);
+}
+
+void CountedFunc(void* opaque, uint32_t value, size_t thread_id) {
+  const CountedCall* call = static_cast<const CountedCall*>(opaque);
+  ++running_tasks;
+  call->func(call->jpegxl_opaque, value, thread_id);
+  --running_tasks;
+}
+
+JxlParallelRetCode NestedTaskCountingRunner(void* runner_opaque,
+                                            void* jpegxl_opaque,
+                                            JxlParallelRunInit init,
+                                            JxlParallelRunFunction func,
+                                            uint32_t start_range,
+                                            uint32_t end_range) {
+  NestedTaskCounter* counter = static_cast<NestedTaskCounter*>(runner_opaque);
+  if (running_tasks != 0) {
+    counter->num_nested_tasks += end_range - start_range;
+  }
+  CountedCall call = {init, func, jpegxl_opaque};
+  return JxlThreadParallelRunner(counter->runner.get(), &call, CountedInit,
+                                 CountedFunc, start_range, end_range);
+}
+
+TEST(ModularTest, RoundtripLosslessPipelinedGroup) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
+  TestImage t;
+  ASSERT_TRUE(t.DecodeFromBytes(orig));
+  t.ClearMetadata();
+  ASSERT_TRUE(t.SetDimensions(t.ppf().xsize() / 4, t.ppf().ysize() / 4));
+
+  extras::JXLCompressParams cparams;
+  cparams.distance = 0.0f;
+  // A single group, with a tree that does not depend on pixel values and a
+  // predictor without a fast track, so that the decoder reconstructs the
+  // channels while entropy decoding.
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR_GROUP_SIZE, 3);
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR_MA_TREE_LEARNING_PERCENT, 0);
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR_PREDICTOR,
+                    static_cast<int64_t>(Predictor::Select));
+  extras::JXLDecompressParams dparams;
+  dparams.accepted_formats = {{3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0}};
+  // The group is split across threads by a call to the runner from within
+  // the task that decodes it, which is the only nested call.
+  NestedTaskCounter counter;
+  counter.runner = JxlThreadParallelRunnerMake(nullptr, 4);
+  dparams.runner = NestedTaskCountingRunner;
+  dparams.runner_opaque = &counter;
+  dparams.runner_allows_nesting = true;
+
+  extras::PackedPixelFile ppf_out;
+  Roundtrip(t.ppf(), cparams, dparams, nullptr, &ppf_out);
+  EXPECT_EQ(0.0f, test::ComputeDistance2(t.ppf(), ppf_out));
+  // One task reads the residuals, and one per channel reconstructs it.
+  EXPECT_LE(2u, counter.num_nested_tasks.load());
+}
+
+TEST(ModularTest, EffortElevenMatchesWinningSettings) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const std::vector<uint8_t> orig =
+      ReadTestData("external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  auto io = jxl::make_unique<CodecInOut>(memory_manager);
+  ASSERT_TRUE(SetFromBytes(Bytes(orig), io.get()));
+  ASSERT_TRUE(io->ShrinkTo(64, 64));
+  CompressParams cparams;
+  cparams.SetLossless();
+  cparams.speed_tier = SpeedTier::kTectonicPlate;
+  test::ThreadPoolForTests pool(4);
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(test::EncodeFile(cparams, io.get(), &compressed, pool.get()));
+
+  // Plain encodes with each of the settings that effort 11 tries, keeping the
+  // first smallest one of each round.
+  size_t best_index = 0;
+  const auto smallest = [&](const std::vector<CompressParams>& all_params) {
+    std::vector<uint8_t> best;
+    for (size_t i = 0; i < all_params.size(); i++) {
+      std::vector<uint8_t> bytes;
+      EXPECT_TRUE(test::EncodeFile(all_params[i], io.get(), &bytes));
+      if (best.empty() || bytes.size() < best.size()) {
+        best = std::move(bytes);
+        best_index = i;
+      }
+    }
+    return best;
+  };
+  std::vector<uint8_t> expected =
+      smallest(TectonicPlateProbeSettings(cparams));
+  std::vector<uint8_t> second_round =
+      smallest(best_index == 0 ? TectonicPlateSettingsLessPalette(cparams)
+                               : TectonicPlateSettingsMorePalette(cparams));
+  if (second_round.size() < expected.size()) expected = second_round;
+  EXPECT_EQ(expected, compressed);
+}
+
 void TestLarge(size_t dim, size_t co_dim, size_t group_size_shift) {
   for (bool wide : {true, false}) {
     size_t w = dim;
@@ -628,5 +751,165 @@ TEST(ModularTest, UnsqueezeIntegerOverflow) {
   }
 }
 
+// Appends a random subtree of at most the given depth to `tree`, and returns
+// the position of its root. Leaves use their position as context.
+size_t AddRandomSubtree(size_t depth, Rng* rng, Tree* tree) {
+  size_t pos = tree->size();
+  tree->emplace_back();
+  if (depth == 0 || rng->Bernoulli(0.2f)) {
+    (*tree)[pos] = PropertyDecisionNode::Leaf(
+        static_cast<Predictor>(rng->UniformU(0, kNumModularPredictors)),
+        rng->UniformI(-2, 3), rng->UniformU(1, 3));
+    (*tree)[pos].lchild = pos;
+    return pos;
+  }
+  int property = rng->UniformI(0, kNumNonrefProperties);
+  int splitval = rng->UniformI(-8, 8);
+  size_t lchild = AddRandomSubtree(depth - 1, rng, tree);
+  size_t rchild = AddRandomSubtree(depth - 1, rng, tree);
+  (*tree)[pos] =
+      PropertyDecisionNode::Split(property, splitval, lchild, rchild);
+  return pos;
+}
+
+TEST(ModularTest, TreeTableLookupMatchesTree) {
+  Rng rng(0);
+  for (size_t i = 0; i < 100; i++) {
+    Tree tree;
+    AddRandomSubtree(MATreeTableLookup::kMaxDepth, &rng, &tree);
+    std::array<pixel_type, kNumStaticProperties> static_props = {
+        {static_cast<pixel_type>(rng.UniformI(0, 3)), 0}};
+    size_t num_props;
+    bool use_wp;
+    bool wp_only;
+    bool gradient_only;
+    FlatTree flat = FilterTree(tree, static_props, &num_props, &use_wp,
+                               &wp_only, &gradient_only);
+    MATreeLookup tree_lookup(flat);
+    MATreeTableLookup table_lookup;
+    ASSERT_TRUE(table_lookup.Init(flat, 1 << MATreeTableLookup::kMaxDepth));
+    Properties properties(num_props);
+    for (size_t j = 0; j < 1000; j++) {
+      InitPropsRow(&properties, static_props, rng.UniformI(0, 16));
+      for (size_t p = 3; p < num_props; p++) {
+        properties[p] = rng.UniformI(-10, 10);
+      }
+      MATreeLookup::LookupResult expected = tree_lookup.Lookup(properties);
+      MATreeLookup::LookupResult actual = table_lookup.Lookup(properties);
+      EXPECT_EQ(expected.context, actual.context);
+      EXPECT_EQ(expected.predictor, actual.predictor);
+      EXPECT_EQ(expected.offset, actual.offset);
+      EXPECT_EQ(expected.multiplier, actual.multiplier);
+    }
+  }
+}
+
+// Appends a tree of the given depth to `tree` and returns the position of its
+// root. If `chain`, the right child of every split is a leaf; otherwise the
+// tree is complete.
+size_t AddSplitTree(size_t depth, bool chain, Tree* tree) {
+  size_t pos = tree->size();
+  tree->emplace_back();
+  if (depth == 0) {
+    (*tree)[pos] = PropertyDecisionNode::Leaf(Predictor::Zero);
+    (*tree)[pos].lchild = pos;
+    return pos;
+  }
+  size_t lchild = AddSplitTree(depth - 1, chain, tree);
+  size_t rchild = AddSplitTree(chain ? 0 : depth - 1, chain, tree);
+  (*tree)[pos] = PropertyDecisionNode::Split(kNumStaticProperties,
+                                             static_cast<int>(depth), lchild,
+                                             rchild);
+  return pos;
+}
+
+TEST(ModularTest, TreeTableLookupOnlyForShallowOrBalancedTrees) {
+  const auto shallow_or_balanced = [](size_t depth, bool chain) {
+    Tree tree;
+    AddSplitTree(depth, chain, &tree);
+    std::array<pixel_type, kNumStaticProperties> static_props = {{0, 0}};
+    size_t num_props;
+    bool use_wp;
+    bool wp_only;
+    bool gradient_only;
+    FlatTree flat = FilterTree(tree, static_props, &num_props, &use_wp,
+                               &wp_only, &gradient_only);
+    return MATreeTableLookup::IsShallowOrBalanced(flat);
+  };
+  EXPECT_TRUE(shallow_or_balanced(MATreeTableLookup::kShallowDepth, true));
+  EXPECT_TRUE(shallow_or_balanced(MATreeTableLookup::kMaxDepth - 1, false));
+  EXPECT_TRUE(shallow_or_balanced(MATreeTableLookup::kMaxDepth, false));
+  EXPECT_FALSE(shallow_or_balanced(MATreeTableLookup::kMaxDepth, true));
+  EXPECT_FALSE(shallow_or_balanced(MATreeTableLookup::kMaxDepth + 2, false));
+}
+
+bool IsPipelined(const Tree& tree) {
+  std::array<pixel_type, kNumStaticProperties> static_props = {{0, 0}};
+  size_t num_props;
+  bool use_wp;
+  bool wp_only;
+  bool gradient_only;
+  FlatTree flat = FilterTree(tree, static_props, &num_props, &use_wp, &wp_only,
+                             &gradient_only);
+  return IsPipelinedChannelTree(flat, wp_only, gradient_only);
+}
+
+TEST(ModularTest, FastTrackTreesAreNotPipelined) {
+  // Single leaves with a fast track.
+  EXPECT_FALSE(IsPipelined({PropertyDecisionNode::Leaf(Predictor::Zero)}));
+  EXPECT_FALSE(IsPipelined({PropertyDecisionNode::Leaf(Predictor::Gradient)}));
+  EXPECT_FALSE(IsPipelined({PropertyDecisionNode::Leaf(Predictor::Weighted)}));
+  // Lookup table on the gradient property.
+  EXPECT_FALSE(IsPipelined({PropertyDecisionNode::Split(
+                               static_cast<int>(kGradientProp), 0, 1),
+                            PropertyDecisionNode::Leaf(Predictor::Gradient),
+                            PropertyDecisionNode::Leaf(Predictor::Gradient)}));
+  // Splits on decoded pixels.
+  EXPECT_FALSE(IsPipelined({PropertyDecisionNode::Split(
+                               static_cast<int>(kWPProp), 0, 1),
+                            PropertyDecisionNode::Leaf(Predictor::Select),
+                            PropertyDecisionNode::Leaf(Predictor::Left)}));
+
+  // Trees without a fast track whose contexts only depend on the position.
+  EXPECT_TRUE(IsPipelined({PropertyDecisionNode::Leaf(Predictor::Select)}));
+  EXPECT_TRUE(IsPipelined({PropertyDecisionNode::Leaf(Predictor::Left)}));
+  // Property 2 is the row.
+  EXPECT_TRUE(IsPipelined({PropertyDecisionNode::Split(2, 16, 1),
+                           PropertyDecisionNode::Leaf(Predictor::Weighted),
+                           PropertyDecisionNode::Leaf(Predictor::Gradient)}));
+}
+
+TEST(ModularTest, LearnTreeDoesNotDependOnThreads) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  JXL_TEST_ASSIGN_OR_DIE(Image image,
+                         Image::Create(memory_manager, 300, 200, 8, 3));
+  Rng rng(0);
+  for (Channel& ch : image.channel) {
+    for (size_t y = 0; y < ch.h; y++) {
+      pixel_type* row = ch.Row(y);
+      for (size_t x = 0; x < ch.w; x++) {
+        row[x] = ((x * 3 + y * 5) / 7 + rng.UniformI(0, 8)) & 255;
+      }
+    }
+  }
+  ModularOptions options;
+  options.predictor = Predictor::Variable;
+  options.nb_repeats = 1.0f;
+  JXL_TEST_ASSIGN_OR_DIE(Tree expected, LearnTree(&image, &options, 0, 1));
+  ASSERT_GT(expected.size(), 1u);
+  test::ThreadPoolForTests pool(4);
+  JXL_TEST_ASSIGN_OR_DIE(
+      Tree actual, LearnTree(&image, &options, 0, 1, {}, pool.get()));
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(expected[i].property, actual[i].property);
+    EXPECT_EQ(expected[i].splitval, actual[i].splitval);
+    EXPECT_EQ(expected[i].lchild, actual[i].lchild);
+    EXPECT_EQ(expected[i].rchild, actual[i].rchild);
+    EXPECT_EQ(expected[i].predictor, actual[i].predictor);
+    EXPECT_EQ(expected[i].multiplier, actual[i].multiplier);
+  }
+}
+
 }  // namespace
 }  // namespace jxl
@@ -19,9 +19,32 @@
 
 namespace jxl {
 
+Status PassesSharedState::AllocateBlockImages(size_t ysize_blocks) {
+  block_y0 = 0;
+  block_rows = ysize_blocks;
+  const size_t xsize_blocks = frame_dim.xsize_blocks;
+  JXL_ASSIGN_OR_RETURN(
+      ac_strategy,
+      AcStrategyImage::Create(memory_manager, xsize_blocks, ysize_blocks));
+  JXL_ASSIGN_OR_RETURN(raw_quant_field, ImageI::Create(memory_manager,
+                                                       xsize_blocks,
+                                                       ysize_blocks));
+  JXL_ASSIGN_OR_RETURN(epf_sharpness, ImageB::Create(memory_manager,
+                                                     xsize_blocks,
+                                                     ysize_blocks));
+  JXL_ASSIGN_OR_RETURN(quant_dc, ImageB::Create(memory_manager, xsize_blocks,
+                                                ysize_blocks));
+  if (dc == &dc_storage) {
+    JXL_ASSIGN_OR_RETURN(dc_storage, Image3F::Create(memory_manager,
+                                                     xsize_blocks,
+                                                     ysize_blocks));
+  }
+  return true;
+}
+
 Status InitializePassesSharedState(const FrameHeader& frame_header,
                                    PassesSharedState* JXL_RESTRICT shared,
-                                   bool encoder) {
+                                   bool encoder, size_t ysize_blocks) {
   JXL_ENSURE(frame_header.nonserialized_metadata != nullptr);
   shared->metadata = frame_header.nonserialized_metadata;
   shared->frame_dim = frame_header.ToFrameDimensions();
@@ -30,16 +53,6 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
   const FrameDimensions& frame_dim = shared->frame_dim;
   JxlMemoryManager* memory_manager = shared->memory_manager;
 
-  JXL_ASSIGN_OR_RETURN(
-      shared->ac_strategy,
-      AcStrategyImage::Create(memory_manager, frame_dim.xsize_blocks,
-                              frame_dim.ysize_blocks));
-  JXL_ASSIGN_OR_RETURN(shared->raw_quant_field,
-                       ImageI::Create(memory_manager, frame_dim.xsize_blocks,
-                                      frame_dim.ysize_blocks));
-  JXL_ASSIGN_OR_RETURN(shared->epf_sharpness,
-                       ImageB::Create(memory_manager, frame_dim.xsize_blocks,
-                                      frame_dim.ysize_blocks));
   JXL_ASSIGN_OR_RETURN(
       shared->cmap, ColorCorrelationMap::Create(memory_manager, frame_dim.xsize,
                                                 frame_dim.ysize));
@@ -55,10 +68,6 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
                                 kCoeffOrderMaxSize);
   }
 
-  JXL_ASSIGN_OR_RETURN(shared->quant_dc,
-                       ImageB::Create(memory_manager, frame_dim.xsize_blocks,
-                                      frame_dim.ysize_blocks));
-
   bool use_dc_frame = ((frame_header.flags & FrameHeader::kUseDcFrame) != 0u);
   if (!encoder && use_dc_frame) {
     if (frame_header.dc_level == 4) {
@@ -73,13 +82,14 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
           "with level %u",
           frame_header.dc_level, frame_header.dc_level + 1);
     }
-    ZeroFillImage(&shared->quant_dc);
   } else {
-    JXL_ASSIGN_OR_RETURN(shared->dc_storage,
-                         Image3F::Create(memory_manager, frame_dim.xsize_blocks,
-                                         frame_dim.ysize_blocks));
     shared->dc = &shared->dc_storage;
   }
+  JXL_RETURN_IF_ERROR(shared->AllocateBlockImages(
+      ysize_blocks == 0 ? frame_dim.ysize_blocks : ysize_blocks));
+  if (shared->dc != &shared->dc_storage) {
+    ZeroFillImage(&shared->quant_dc);
+  }
 
   return true;
 }
@@ -16,6 +16,7 @@
 #include "lib/jxl/ac_strategy.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/coeff_order_fwd.h"
@@ -85,6 +86,23 @@ struct PassesSharedState {
   Image3F dc_storage;
   const Image3F* JXL_RESTRICT dc = &dc_storage;
 
+  // The per-block images above (ac_strategy, raw_quant_field, epf_sharpness,
+  // quant_dc and dc_storage) hold the `block_rows` block rows of the frame
+  // from `block_y0` on. Unless a frame is decoded in rows, that is the whole
+  // frame and block_y0 is 0.
+  size_t block_y0 = 0;
+  size_t block_rows = 0;
+
+  // Returns where the blocks of `rect`, in block coordinates of the frame, are
+  // stored in the per-block images.
+  Rect BlockStorageRect(const Rect& rect) const {
+    return Rect(rect.x0(), rect.y0() - block_y0, rect.xsize(), rect.ysize());
+  }
+
+  // (Re)allocates the per-block images to hold `ysize_blocks` block rows from
+  // the top of the frame.
+  Status AllocateBlockImages(size_t ysize_blocks);
+
   BlockCtxMap block_ctx_map;
 
   Image3F dc_frames[4];
@@ -97,9 +115,12 @@ struct PassesSharedState {
 };
 
 // Initialized the state information that is shared between encoder and decoder.
+// The per-block images hold `ysize_blocks` block rows, or the whole frame if
+// it is 0.
 Status InitializePassesSharedState(const FrameHeader& frame_header,
                                    PassesSharedState* JXL_RESTRICT shared,
-                                   bool encoder = false);
+                                   bool encoder = false,
+                                   size_t ysize_blocks = 0);
 
 }  // namespace jxl
 
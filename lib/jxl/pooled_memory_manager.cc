@@ -0,0 +1,153 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/pooled_memory_manager.h"
+
+#include <jxl/memory_manager.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/memory_manager_internal.h"
+
+namespace jxl {
+
+namespace {
+
+// Each block starts with a header that holds its size class (zero if it is not
+// pooled); the header size keeps the alignment of the upstream allocator.
+constexpr size_t kHeaderSize = alignof(std::max_align_t);
+static_assert(kHeaderSize >= sizeof(size_t), "Header too small");
+
+// Sizes between two powers of two are split into 2^kLog2ClassesPerOctave
+// classes, which bounds the waste of rounding up to 12.5%.
+constexpr size_t kLog2ClassesPerOctave = 3;
+
+size_t& BlockSizeClass(void* block) { return *static_cast<size_t*>(block); }
+
+}  // namespace
+
+PooledMemoryManager::PooledMemoryManager() {
+  Status status = MemoryManagerInit(&upstream_, nullptr);
+  JXL_DASSERT(status);
+  (void)status;
+  outer_.opaque = this;
+  outer_.alloc = &Alloc;
+  outer_.free = &Free;
+}
+
+PooledMemoryManager::~PooledMemoryManager() { Trim(); }
+
+void PooledMemoryManager::SetMaxRetainedBytes(size_t max_retained_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_retained_bytes_.store(max_retained_bytes, std::memory_order_relaxed);
+  TrimToLocked(max_retained_bytes);
+}
+
+uint64_t PooledMemoryManager::NumReused() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_reused_;
+}
+
+uint64_t PooledMemoryManager::NumUpstreamAllocations() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_upstream_allocations_;
+}
+
+// static
+size_t PooledMemoryManager::SizeClass(size_t size) {
+  if (size < kMinPooledSize) return 0;
+  const size_t step = size_t{1} << (FloorLog2Nonzero(size) -
+                                    kLog2ClassesPerOctave);
+  const size_t size_class = (size + step - 1) & ~(step - 1);
+  // Overflow: do not pool.
+  return size_class < size ? 0 : size_class;
+}
+
+void* PooledMemoryManager::AllocateUpstream(size_t size) {
+  void* block = upstream_.alloc(upstream_.opaque, size);
+  if (block == nullptr) {
+    // The retained blocks may be what keeps the allocation from succeeding.
+    Trim();
+    block = upstream_.alloc(upstream_.opaque, size);
+  }
+  return block;
+}
+
+// static
+void* PooledMemoryManager::Alloc(void* opaque, size_t size) {
+  PooledMemoryManager* self = static_cast<PooledMemoryManager*>(opaque);
+  // Blocks allocated while pooling is disabled are freed upstream, so they
+  // need not be rounded up.
+  const size_t size_class =
+      self->max_retained_bytes_.load(std::memory_order_relaxed) != 0
+          ? SizeClass(size)
+          : 0;
+  if (size_class != 0) {
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    auto it = self->free_blocks_.find(size_class);
+    if (it != self->free_blocks_.end() && !it->second.empty()) {
+      void* block = it->second.back();
+      it->second.pop_back();
+      self->retained_bytes_ -= size_class;
+      self->num_reused_++;
+      return static_cast<uint8_t*>(block) + kHeaderSize;
+    }
+  }
+
+  const size_t block_size = (size_class != 0 ? size_class : size) + kHeaderSize;
+  if (block_size < size) return nullptr;
+  void* block = self->AllocateUpstream(block_size);
+  if (block == nullptr) return nullptr;
+  BlockSizeClass(block) = size_class;
+  {
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    self->num_upstream_allocations_++;
+  }
+  return static_cast<uint8_t*>(block) + kHeaderSize;
+}
+
+// static
+void PooledMemoryManager::Free(void* opaque, void* address) {
+  if (address == nullptr) return;
+  PooledMemoryManager* self = static_cast<PooledMemoryManager*>(opaque);
+  void* block = static_cast<uint8_t*>(address) - kHeaderSize;
+  const size_t size_class = BlockSizeClass(block);
+  if (size_class != 0) {
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    if (self->retained_bytes_ + size_class <=
+        self->max_retained_bytes_.load(std::memory_order_relaxed)) {
+      self->free_blocks_[size_class].push_back(block);
+      self->retained_bytes_ += size_class;
+      return;
+    }
+  }
+  self->upstream_.free(self->upstream_.opaque, block);
+}
+
+void PooledMemoryManager::TrimTo(size_t max_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TrimToLocked(max_bytes);
+}
+
+void PooledMemoryManager::TrimToLocked(size_t max_bytes) {
+  // Largest blocks first: they are the least likely to be reused.
+  for (auto it = free_blocks_.rbegin();
+       it != free_blocks_.rend() && retained_bytes_ > max_bytes; ++it) {
+    std::vector<void*>& blocks = it->second;
+    while (!blocks.empty() && retained_bytes_ > max_bytes) {
+      upstream_.free(upstream_.opaque, blocks.back());
+      blocks.pop_back();
+      retained_bytes_ -= it->first;
+    }
+  }
+}
+
+}  // namespace jxl
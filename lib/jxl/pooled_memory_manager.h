@@ -0,0 +1,86 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_POOLED_MEMORY_MANAGER_H_
+#define LIB_JXL_POOLED_MEMORY_MANAGER_H_
+
+// JxlMemoryManager that keeps released large blocks (image planes and other
+// scratch buffers) for reuse, to avoid allocator traffic when decoding many
+// similar frames or images.
+
+#include <jxl/memory_manager.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace jxl {
+
+class PooledMemoryManager {
+ public:
+  // Allocations smaller than this are passed through without pooling.
+  static constexpr size_t kMinPooledSize = 16 << 10;
+
+  PooledMemoryManager();
+  // Returns the retained blocks upstream; all blocks must have been freed.
+  ~PooledMemoryManager();
+
+  PooledMemoryManager(const PooledMemoryManager&) = delete;
+  PooledMemoryManager& operator=(const PooledMemoryManager&) = delete;
+
+  // Sets the manager that blocks are obtained from and returned to. Must be
+  // called before the first allocation and not changed afterwards.
+  void SetUpstream(const JxlMemoryManager& upstream) { upstream_ = upstream; }
+  const JxlMemoryManager& upstream() const { return upstream_; }
+
+  // The interface through which blocks are allocated from this pool.
+  JxlMemoryManager* get() { return &outer_; }
+
+  // At most "max_retained_bytes" of released blocks are kept; releases beyond
+  // that are returned upstream immediately. Zero, the default, disables
+  // pooling: allocations are then not rounded up to size classes.
+  void SetMaxRetainedBytes(size_t max_retained_bytes);
+
+  // Returns all retained blocks upstream.
+  void Trim() { TrimTo(0); }
+
+  // Number of allocations served from the pool / from upstream, since
+  // construction.
+  uint64_t NumReused() const;
+  uint64_t NumUpstreamAllocations() const;
+
+ private:
+  static void* Alloc(void* opaque, size_t size);
+  static void Free(void* opaque, void* address);
+
+  // Returns the size class of pooled allocations of "size" bytes, or zero if
+  // they are not pooled.
+  static size_t SizeClass(size_t size);
+
+  void* AllocateUpstream(size_t size);
+
+  // Caller must hold mutex_.
+  void TrimToLocked(size_t max_bytes);
+  void TrimTo(size_t max_bytes);
+
+  JxlMemoryManager upstream_;
+  JxlMemoryManager outer_;
+
+  mutable std::mutex mutex_;
+  // Released blocks (including their header), by size class.
+  std::map<size_t, std::vector<void*>> free_blocks_;
+  size_t retained_bytes_ = 0;
+  // Written under mutex_, but also read without it by Alloc.
+  std::atomic<size_t> max_retained_bytes_{0};
+  uint64_t num_reused_ = 0;
+  uint64_t num_upstream_allocations_ = 0;
+};
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_POOLED_MEMORY_MANAGER_H_
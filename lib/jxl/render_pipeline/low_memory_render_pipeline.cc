@@ -18,6 +18,7 @@
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_group_border.h"
+#include "lib/jxl/dec_trace.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
@@ -63,27 +64,32 @@ Status LowMemoryRenderPipeline::SaveBorders(size_t group_id, size_t c,
   if (gy > 0) {
     Rect from(group_data_x_border_, group_data_y_border_, x1 - x0,
               bordery_write);
-    Rect to(x0, (gy * 2 - 1) * bordery_write, x1 - x0, bordery_write);
+    Rect to(x0, HorizontalBorderSlot(gy * 2 - 1) * bordery_write, x1 - x0,
+            bordery_write);
     JXL_RETURN_IF_ERROR(CopyImageTo(from, in, to, &borders_horizontal_[c]));
   }
   if (gy + 1 < frame_dimensions_.ysize_groups) {
     Rect from(group_data_x_border_,
               group_data_y_border_ + y1 - y0 - bordery_write, x1 - x0,
               bordery_write);
-    Rect to(x0, (gy * 2) * bordery_write, x1 - x0, bordery_write);
+    Rect to(x0, HorizontalBorderSlot(gy * 2) * bordery_write, x1 - x0,
+            bordery_write);
     JXL_RETURN_IF_ERROR(CopyImageTo(from, in, to, &borders_horizontal_[c]));
   }
+  auto save_vertical = [&](size_t from_x, size_t slot) {
+    return ForEachVerticalBorderRun(
+        c, y0, y1 - y0, [&](size_t dy, size_t storage_y, size_t num) {
+          Rect from(from_x, group_data_y_border_ + dy, borderx_write, num);
+          Rect to(slot * borderx_write, storage_y, borderx_write, num);
+          return CopyImageTo(from, in, to, &borders_vertical_[c]);
+        });
+  };
   if (gx > 0) {
-    Rect from(group_data_x_border_, group_data_y_border_, borderx_write,
-              y1 - y0);
-    Rect to((gx * 2 - 1) * borderx_write, y0, borderx_write, y1 - y0);
-    JXL_RETURN_IF_ERROR(CopyImageTo(from, in, to, &borders_vertical_[c]));
+    JXL_RETURN_IF_ERROR(save_vertical(group_data_x_border_, gx * 2 - 1));
   }
   if (gx + 1 < frame_dimensions_.xsize_groups) {
-    Rect from(group_data_x_border_ + x1 - x0 - borderx_write,
-              group_data_y_border_, borderx_write, y1 - y0);
-    Rect to((gx * 2) * borderx_write, y0, borderx_write, y1 - y0);
-    JXL_RETURN_IF_ERROR(CopyImageTo(from, in, to, &borders_vertical_[c]));
+    JXL_RETURN_IF_ERROR(save_vertical(
+        group_data_x_border_ + x1 - x0 - borderx_write, gx * 2));
   }
   return true;
 }
@@ -137,7 +143,8 @@ Status LowMemoryRenderPipeline::LoadBorders(size_t group_id, size_t c,
   if (y0src < y0) {
     JXL_ENSURE(gy > 0);
     JXL_RETURN_IF_ERROR(CopyImageTo(
-        Rect(x0src, (gy * 2 - 2) * bordery_write, x1src - x0src, bordery_write),
+        Rect(x0src, HorizontalBorderSlot(gy * 2 - 2) * bordery_write,
+             x1src - x0src, bordery_write),
         borders_horizontal_[c],
         Rect(group_data_x_border_ + x0src - x0,
              group_data_y_border_ - bordery_write, x1src - x0src,
@@ -148,30 +155,35 @@ Status LowMemoryRenderPipeline::LoadBorders(size_t group_id, size_t c,
     // When copying the bottom border we must not be on the bottom groups.
     JXL_ENSURE(gy + 1 < frame_dimensions_.ysize_groups);
     JXL_RETURN_IF_ERROR(CopyImageTo(
-        Rect(x0src, (gy * 2 + 1) * bordery_write, x1src - x0src, bordery_write),
+        Rect(x0src, HorizontalBorderSlot(gy * 2 + 1) * bordery_write,
+             x1src - x0src, bordery_write),
         borders_horizontal_[c],
         Rect(group_data_x_border_ + x0src - x0, group_data_y_border_ + y1 - y0,
              x1src - x0src, bordery_write),
         out));
   }
+  auto load_vertical = [&](size_t slot, size_t to_x) {
+    return ForEachVerticalBorderRun(
+        c, y0src, y1src - y0src,
+        [&](size_t dy, size_t storage_y, size_t num) {
+          return CopyImageTo(
+              Rect(slot * borderx_write, storage_y, borderx_write, num),
+              borders_vertical_[c],
+              Rect(to_x, group_data_y_border_ + y0src + dy - y0, borderx_write,
+                   num),
+              out);
+        });
+  };
   if (x0src < x0) {
     JXL_ENSURE(gx > 0);
-    JXL_RETURN_IF_ERROR(CopyImageTo(
-        Rect((gx * 2 - 2) * borderx_write, y0src, borderx_write, y1src - y0src),
-        borders_vertical_[c],
-        Rect(group_data_x_border_ - borderx_write,
-             group_data_y_border_ + y0src - y0, borderx_write, y1src - y0src),
-        out));
+    JXL_RETURN_IF_ERROR(
+        load_vertical(gx * 2 - 2, group_data_x_border_ - borderx_write));
   }
   if (x1src > x1) {
     // When copying the right border we must not be on the rightmost groups.
     JXL_ENSURE(gx + 1 < frame_dimensions_.xsize_groups);
-    JXL_RETURN_IF_ERROR(CopyImageTo(
-        Rect((gx * 2 + 1) * borderx_write, y0src, borderx_write, y1src - y0src),
-        borders_vertical_[c],
-        Rect(group_data_x_border_ + x1 - x0, group_data_y_border_ + y0src - y0,
-             borderx_write, y1src - y0src),
-        out));
+    JXL_RETURN_IF_ERROR(
+        load_vertical(gx * 2 + 1, group_data_x_border_ + x1 - x0));
   }
   return true;
 }
@@ -204,6 +216,12 @@ Status LowMemoryRenderPipeline::EnsureBordersStorage() {
         DivCeil(frame_dimensions_.xsize_upsampled_padded, 1 << shifts[c].first);
     size_t downsampled_ysize = DivCeil(frame_dimensions_.ysize_upsampled_padded,
                                        1 << shifts[c].second);
+    if (groups_in_row_order_) {
+      // Only the borders of the current and of the previous group row are
+      // needed, see SaveBorders and LoadBorders.
+      num_yborders = std::min<size_t>(num_yborders, 4);
+      downsampled_ysize = std::min(downsampled_ysize, 2 * GroupInputYSize(c));
+    }
     Rect horizontal = Rect(0, 0, downsampled_xsize, bordery * num_yborders);
     if (!SameSize(horizontal, borders_horizontal_[c])) {
       JXL_ASSIGN_OR_RETURN(borders_horizontal_[c],
@@ -393,34 +411,15 @@ Status LowMemoryRenderPipeline::PrepareForThreadsInternal(size_t num,
                          kRenderPipelineXOffset));
     }
   }
-  // TODO(veluca): avoid reallocating buffers if not needed.
+  // Per-thread buffers are allocated by EnsureThreadBuffers, on first use.
   stage_data_.resize(num);
+  stage_time_ns_.resize(num);
   size_t upsampling = 1u << base_color_shift_;
   size_t group_dim = frame_dimensions_.group_dim * upsampling;
   size_t padding =
       2 * group_data_x_border_ * upsampling +  // maximum size of a rect
       2 * kRenderPipelineXOffset;              // extra padding for processing
-  size_t stage_buffer_xsize = group_dim + padding;
-  for (size_t t = 0; t < num; t++) {
-    stage_data_[t].resize(shifts.size());
-    for (size_t c = 0; c < shifts.size(); c++) {
-      stage_data_[t][c].resize(stages_.size());
-      size_t next_y_border = 0;
-      for (size_t i = stages_.size(); i-- > 0;) {
-        if (stages_[i]->GetChannelMode(c) ==
-            RenderPipelineChannelMode::kInOut) {
-          size_t stage_buffer_ysize =
-              2 * next_y_border + (1 << stages_[i]->settings_.shift_y);
-          stage_buffer_ysize = 1 << CeilLog2Nonzero(stage_buffer_ysize);
-          next_y_border = stages_[i]->settings_.border_y;
-          JXL_ASSIGN_OR_RETURN(
-              stage_data_[t][c][i],
-              ImageF::Create(memory_manager_, stage_buffer_xsize,
-                             stage_buffer_ysize));
-        }
-      }
-    }
-  }
+  stage_buffer_xsize_ = group_dim + padding;
   if (first_image_dim_stage_ != stages_.size()) {
     RectT<ptrdiff_t> image_rect(0, 0, frame_dimensions_.xsize_upsampled,
                               frame_dimensions_.ysize_upsampled);
@@ -433,16 +432,44 @@ Status LowMemoryRenderPipeline::PrepareForThreadsInternal(size_t num,
     size_t left_padding = image_rect.x0();
     size_t middle_padding = group_dim;
     size_t right_padding = full_image_xsize_ - image_rect.x1();
-    size_t out_of_frame_xsize =
+    out_of_frame_xsize_ =
         padding +
         std::max(left_padding, std::max(middle_padding, right_padding));
     out_of_frame_data_.resize(num);
-    for (size_t t = 0; t < num; t++) {
-      JXL_ASSIGN_OR_RETURN(
-          out_of_frame_data_[t],
-          ImageF::Create(memory_manager_, out_of_frame_xsize, shifts.size()));
+  }
+  return true;
+}
+
+Status LowMemoryRenderPipeline::EnsureThreadBuffers(size_t thread_id) {
+  JXL_ENSURE(thread_id < stage_data_.size());
+  const auto& shifts = channel_shifts_[0];
+  auto& stage_data = stage_data_[thread_id];
+  if (stage_data.empty()) {
+    stage_data.resize(shifts.size());
+    for (size_t c = 0; c < shifts.size(); c++) {
+      stage_data[c].resize(stages_.size());
+      size_t next_y_border = 0;
+      for (size_t i = stages_.size(); i-- > 0;) {
+        if (stages_[i]->GetChannelMode(c) ==
+            RenderPipelineChannelMode::kInOut) {
+          size_t stage_buffer_ysize =
+              2 * next_y_border + (1 << stages_[i]->settings_.shift_y);
+          stage_buffer_ysize = 1 << CeilLog2Nonzero(stage_buffer_ysize);
+          next_y_border = stages_[i]->settings_.border_y;
+          JXL_ASSIGN_OR_RETURN(
+              stage_data[c][i],
+              ImageF::Create(memory_manager_, stage_buffer_xsize_,
+                             stage_buffer_ysize));
+        }
+      }
     }
   }
+  if (first_image_dim_stage_ != stages_.size() &&
+      out_of_frame_data_[thread_id].xsize() == 0) {
+    JXL_ASSIGN_OR_RETURN(
+        out_of_frame_data_[thread_id],
+        ImageF::Create(memory_manager_, out_of_frame_xsize_, shifts.size()));
+  }
   return true;
 }
 
@@ -737,8 +764,8 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
       prepare_io_rows(y, i);
 
       // Produce output rows.
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows[i], output_rows, xpadding_for_output_[i],
+      JXL_RETURN_IF_ERROR(ProcessStageRow(
+          i, input_rows[i], output_rows, xpadding_for_output_[i],
           group_rect[i].xsize(), group_rect[i].x0(), image_y, thread_id));
     }
 
@@ -779,8 +806,8 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
           i < first_image_dim_stage_ ? full_image_x0 - frame_x0 : full_image_x0;
       size_t y0 =
           i < first_image_dim_stage_ ? full_image_y - frame_y0 : full_image_y;
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows[first_trailing_stage_], output_rows,
+      JXL_RETURN_IF_ERROR(ProcessStageRow(
+          i, input_rows[first_trailing_stage_], output_rows,
           /*xextra=*/0, full_image_x1 - full_image_x0, x0, y0, thread_id));
     }
   }
@@ -801,16 +828,37 @@ Status LowMemoryRenderPipeline::RenderPadding(size_t thread_id, Rect rect) {
     stages_[first_image_dim_stage_ - 1]->ProcessPaddingRow(
         input_rows, rect.xsize(), rect.x0(), rect.y0() + y);
     for (size_t i = first_image_dim_stage_; i < stages_.size(); i++) {
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows, output_rows,
+      JXL_RETURN_IF_ERROR(ProcessStageRow(
+          i, input_rows, output_rows,
           /*xextra=*/0, rect.xsize(), rect.x0(), rect.y0() + y, thread_id));
     }
   }
   return true;
 }
 
+Status LowMemoryRenderPipeline::ProcessStageRow(
+    size_t i, const RenderPipelineStage::RowInfo& input,
+    const RenderPipelineStage::RowInfo& output, size_t xextra, size_t xsize,
+    size_t xpos, size_t ypos, size_t thread_id) {
+  if (!trace_) {
+    return stages_[i]->ProcessRow(input, output, xextra, xsize, xpos, ypos,
+                                  thread_id);
+  }
+  const uint64_t start = DecoderTrace::Now();
+  JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(input, output, xextra, xsize,
+                                             xpos, ypos, thread_id));
+  stage_time_ns_[thread_id][i] += DecoderTrace::Now() - start;
+  return true;
+}
+
 Status LowMemoryRenderPipeline::ProcessBuffers(size_t group_id,
                                                size_t thread_id) {
+  JXL_RETURN_IF_ERROR(EnsureThreadBuffers(thread_id));
+  uint64_t trace_start = 0;
+  if (trace_) {
+    trace_start = DecoderTrace::Now();
+    stage_time_ns_[thread_id].assign(stages_.size(), 0);
+  }
   std::vector<ImageF>& input_data =
       group_data_[use_group_ids_ ? group_id : thread_id];
 
@@ -909,6 +957,9 @@ Status LowMemoryRenderPipeline::ProcessBuffers(size_t group_id,
                                    data_max_color_channel_rect,
                                    image_max_color_channel_rect));
   }
+  if (trace_) {
+    TraceStages(group_id, trace_start, stage_time_ns_[thread_id]);
+  }
   return true;
 }
 }  // namespace jxl
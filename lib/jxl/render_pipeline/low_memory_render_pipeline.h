@@ -8,6 +8,7 @@
 
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
@@ -19,6 +20,7 @@
 #include "lib/jxl/frame_header.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/render_pipeline/render_pipeline.h"
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
 
 namespace jxl {
 
@@ -42,16 +44,46 @@ class LowMemoryRenderPipeline final : public RenderPipeline {
   Status Init() override;
 
   Status EnsureBordersStorage();
+  // Allocates the stage and out-of-frame buffers of `thread_id`. Called from
+  // the thread itself, so that their memory is local to it.
+  Status EnsureThreadBuffers(size_t thread_id);
   size_t GroupInputXSize(size_t c) const;
   size_t GroupInputYSize(size_t c) const;
   Status RenderRect(size_t thread_id, std::vector<ImageF>& input_data,
                     Rect data_max_color_channel_rect,
                     Rect image_max_color_channel_rect);
   Status RenderPadding(size_t thread_id, Rect rect);
+  // Calls ProcessRow of stage `i`, adding its time to stage_time_ns_ when
+  // tracing.
+  Status ProcessStageRow(size_t i, const RenderPipelineStage::RowInfo& input,
+                         const RenderPipelineStage::RowInfo& output,
+                         size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                         size_t thread_id);
 
   Status SaveBorders(size_t group_id, size_t c, const ImageF& in);
   Status LoadBorders(size_t group_id, size_t c, const Rect& r, ImageF* out);
 
+  // Returns the position in borders_horizontal_ of the `slot`-th border.
+  size_t HorizontalBorderSlot(size_t slot) const {
+    return groups_in_row_order_ ? slot % 4 : slot;
+  }
+
+  // Calls copy(dy, storage_y, num) for the runs of the rows [y, y + ysize) of
+  // channel `c` that are consecutive in borders_vertical_[c], which wraps
+  // around when the groups are rendered in row order.
+  template <typename Copy>
+  Status ForEachVerticalBorderRun(size_t c, size_t y, size_t ysize,
+                                  const Copy& copy) const {
+    const size_t storage_ysize = borders_vertical_[c].ysize();
+    for (size_t dy = 0; dy < ysize;) {
+      const size_t storage_y = (y + dy) % storage_ysize;
+      const size_t num = std::min(ysize - dy, storage_ysize - storage_y);
+      JXL_RETURN_IF_ERROR(copy(dy, storage_y, num));
+      dy += num;
+    }
+    return true;
+  }
+
   std::pair<size_t, size_t> ColorDimensionsToChannelDimensions(
       std::pair<size_t, size_t> in, size_t c, size_t stage) const;
 
@@ -84,12 +116,18 @@ class LowMemoryRenderPipeline final : public RenderPipeline {
   size_t group_data_y_border_;
 
   // Buffers for intermediate rows for the various stages, indexed by
-  // [thread][channel][stage].
+  // [thread][channel][stage]; empty until the thread first processes a group.
   std::vector<std::vector<std::vector<ImageF>>> stage_data_;
+  size_t stage_buffer_xsize_ = 0;
 
   // Buffers for out-of-frame data, indexed by [thread]; every row is a
-  // different channel.
+  // different channel. Allocated like stage_data_, if needed.
   std::vector<ImageF> out_of_frame_data_;
+  size_t out_of_frame_xsize_ = 0;
+
+  // Time spent in each stage for the group being rendered, indexed by
+  // [thread][stage]. Only used when tracing.
+  std::vector<std::vector<uint64_t>> stage_time_ns_;
 
   // For each stage, a non-kIgnored channel.
   std::vector<int32_t> anyc_;
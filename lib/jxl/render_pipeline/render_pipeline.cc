@@ -6,6 +6,7 @@
 #include "lib/jxl/render_pipeline/render_pipeline.h"
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -14,6 +15,7 @@
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/sanitizers.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/dec_trace.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/render_pipeline/low_memory_render_pipeline.h"
@@ -68,6 +70,7 @@ StatusOr<std::unique_ptr<RenderPipeline>> RenderPipeline::Builder::Finalize(
   }
 
   res->frame_dimensions_ = frame_dimensions;
+  res->groups_in_row_order_ = groups_in_row_order_;
   res->group_completed_passes_.resize(frame_dimensions.num_groups);
   res->channel_shifts_.resize(stages_.size());
   res->channel_shifts_[0].resize(num_c_);
@@ -122,10 +125,23 @@ Status RenderPipeline::InputReady(
     JXL_CHECK_PLANE_INITIALIZED(*buffers[i].first, buffers[i].second, i);
   }
 
+  TraceScope trace_scope(trace_, "RenderPipeline", group_id);
   JXL_RETURN_IF_ERROR(ProcessBuffers(group_id, thread_id));
   return true;
 }
 
+void RenderPipeline::TraceStages(size_t group_id, uint64_t start_ns,
+                                 const std::vector<uint64_t>& stage_ns) const {
+  uint64_t t = start_ns;
+  for (size_t i = 0; i < stages_.size(); i++) {
+    if (stage_ns[i] == 0) continue;
+    const char* name = stages_[i]->GetName();
+    trace_->Emit(JXL_DEC_TRACE_BEGIN, name, group_id, t);
+    t += stage_ns[i];
+    trace_->Emit(JXL_DEC_TRACE_END, name, group_id, t);
+  }
+}
+
 Status RenderPipeline::PrepareForThreads(size_t num, bool use_group_ids) {
   for (const auto& stage : stages_) {
     JXL_RETURN_IF_ERROR(stage->PrepareForThreads(num));
@@ -17,6 +17,7 @@
 
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/dec_trace.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
@@ -74,6 +75,11 @@ class RenderPipeline {
     // the pipeline.
     void UseSimpleImplementation() { use_simple_implementation_ = true; }
 
+    // Declares that the groups are decoded one group row after the other: all
+    // the groups of a row are done before any group of the next row starts.
+    // The borders between groups are then only kept for two group rows.
+    void RenderGroupsInRowOrder() { groups_in_row_order_ = true; }
+
     // Finalizes setup of the pipeline. Shifts for all channels should be 0 at
     // this point.
     StatusOr<std::unique_ptr<RenderPipeline>> Finalize(
@@ -84,6 +90,7 @@ class RenderPipeline {
     std::vector<std::unique_ptr<RenderPipelineStage>> stages_;
     size_t num_c_;
     bool use_simple_implementation_ = false;
+    bool groups_in_row_order_ = false;
   };
 
   friend class Builder;
@@ -116,6 +123,10 @@ class RenderPipeline {
 
   virtual void ClearDone(size_t i) {}
 
+  // Reports the rendering of each group, and the time spent in each stage, to
+  // `trace` if not null.
+  void SetTrace(const DecoderTrace* trace) { trace_ = trace; }
+
  protected:
   explicit RenderPipeline(JxlMemoryManager* memory_manager)
       : memory_manager_(memory_manager) {}
@@ -133,6 +144,16 @@ class RenderPipeline {
 
   std::vector<uint8_t> group_completed_passes_;
 
+  // See Builder::RenderGroupsInRowOrder.
+  bool groups_in_row_order_ = false;
+
+  const DecoderTrace* trace_ = nullptr;
+
+  // Reports the time spent in each stage to render a group, summed over its
+  // rows, as consecutive events starting at `start_ns`.
+  void TraceStages(size_t group_id, uint64_t start_ns,
+                   const std::vector<uint64_t>& stage_ns) const;
+
   friend class RenderPipelineInput;
 
  private:
@@ -52,11 +52,12 @@ JXL_INLINE Vec<DF> Weight(Vec<DF> sad, Vec<DF> inv_sigma, Vec<DF> thres) {
 // this filter a 7x7 filter.
 class EPF0Stage : public RenderPipelineStage {
  public:
-  EPF0Stage(LoopFilter lf, const ImageF& sigma)
+  EPF0Stage(LoopFilter lf, const ImageF& sigma, const size_t* block_y0)
       : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
             /*shift=*/0, /*border=*/3)),
         lf_(std::move(lf)),
-        sigma_(&sigma) {}
+        sigma_(&sigma),
+        block_y0_(block_y0) {}
 
   template <bool aligned>
   JXL_INLINE void AddPixel(int row, float* JXL_RESTRICT rows[3][7], ptrdiff_t x,
@@ -89,7 +90,7 @@ class EPF0Stage : public RenderPipelineStage {
 
     xextra = RoundUpTo(xextra, Lanes(df));
     const float* JXL_RESTRICT row_sigma =
-        sigma_->Row(ypos / kBlockDim + kSigmaPadding);
+        sigma_->Row(ypos / kBlockDim + kSigmaPadding - *block_y0_);
 
     float sm = lf_.epf_pass0_sigma_scale * 1.65;
     float bsm = sm * lf_.epf_border_sad_mul;
@@ -185,17 +186,19 @@ class EPF0Stage : public RenderPipelineStage {
  private:
   LoopFilter lf_;
   const ImageF* sigma_;
+  const size_t* block_y0_;
 };
 
 // 3x3 plus-shaped kernel with 5 SADs per pixel (also 3x3 plus-shaped). So this
 // makes this filter a 5x5 filter.
 class EPF1Stage : public RenderPipelineStage {
  public:
-  EPF1Stage(LoopFilter lf, const ImageF& sigma)
+  EPF1Stage(LoopFilter lf, const ImageF& sigma, const size_t* block_y0)
       : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
             /*shift=*/0, /*border=*/2)),
         lf_(std::move(lf)),
-        sigma_(&sigma) {}
+        sigma_(&sigma),
+        block_y0_(block_y0) {}
 
   template <bool aligned>
   JXL_INLINE void AddPixel(int row, float* JXL_RESTRICT rows[3][5], ptrdiff_t x,
@@ -223,7 +226,7 @@ class EPF1Stage : public RenderPipelineStage {
     DF df;
     xextra = RoundUpTo(xextra, Lanes(df));
     const float* JXL_RESTRICT row_sigma =
-        sigma_->Row(ypos / kBlockDim + kSigmaPadding);
+        sigma_->Row(ypos / kBlockDim + kSigmaPadding - *block_y0_);
 
     float sm = 1.65f;
     float bsm = sm * lf_.epf_border_sad_mul;
@@ -366,17 +369,19 @@ class EPF1Stage : public RenderPipelineStage {
  private:
   LoopFilter lf_;
   const ImageF* sigma_;
+  const size_t* block_y0_;
 };
 
 // 3x3 plus-shaped kernel with 1 SAD per pixel. So this makes this filter a 3x3
 // filter.
 class EPF2Stage : public RenderPipelineStage {
  public:
-  EPF2Stage(LoopFilter lf, const ImageF& sigma)
+  EPF2Stage(LoopFilter lf, const ImageF& sigma, const size_t* block_y0)
       : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
             /*shift=*/0, /*border=*/1)),
         lf_(std::move(lf)),
-        sigma_(&sigma) {}
+        sigma_(&sigma),
+        block_y0_(block_y0) {}
 
   template <bool aligned>
   JXL_INLINE void AddPixel(int row, float* JXL_RESTRICT rows[3][3], ptrdiff_t x,
@@ -409,7 +414,7 @@ class EPF2Stage : public RenderPipelineStage {
     DF df;
     xextra = RoundUpTo(xextra, Lanes(df));
     const float* JXL_RESTRICT row_sigma =
-        sigma_->Row(ypos / kBlockDim + kSigmaPadding);
+        sigma_->Row(ypos / kBlockDim + kSigmaPadding - *block_y0_);
 
     float sm = lf_.epf_pass2_sigma_scale * 1.65;
     float bsm = sm * lf_.epf_border_sad_mul;
@@ -489,21 +494,25 @@ class EPF2Stage : public RenderPipelineStage {
  private:
   LoopFilter lf_;
   const ImageF* sigma_;
+  const size_t* block_y0_;
 };
 
 std::unique_ptr<RenderPipelineStage> GetEPFStage0(const LoopFilter& lf,
-                                                  const ImageF& sigma) {
-  return jxl::make_unique<EPF0Stage>(lf, sigma);
+                                                  const ImageF& sigma,
+                                                  const size_t* block_y0) {
+  return jxl::make_unique<EPF0Stage>(lf, sigma, block_y0);
 }
 
 std::unique_ptr<RenderPipelineStage> GetEPFStage1(const LoopFilter& lf,
-                                                  const ImageF& sigma) {
-  return jxl::make_unique<EPF1Stage>(lf, sigma);
+                                                  const ImageF& sigma,
+                                                  const size_t* block_y0) {
+  return jxl::make_unique<EPF1Stage>(lf, sigma, block_y0);
 }
 
 std::unique_ptr<RenderPipelineStage> GetEPFStage2(const LoopFilter& lf,
-                                                  const ImageF& sigma) {
-  return jxl::make_unique<EPF2Stage>(lf, sigma);
+                                                  const ImageF& sigma,
+                                                  const size_t* block_y0) {
+  return jxl::make_unique<EPF2Stage>(lf, sigma, block_y0);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -520,15 +529,16 @@ HWY_EXPORT(GetEPFStage2);
 
 std::unique_ptr<RenderPipelineStage> GetEPFStage(const LoopFilter& lf,
                                                  const ImageF& sigma,
+                                                 const size_t* block_y0,
                                                  EpfStage epf_stage) {
   if (lf.epf_iters == 0) return nullptr;
   switch (epf_stage) {
     case EpfStage::Zero:
-      return HWY_DYNAMIC_DISPATCH(GetEPFStage0)(lf, sigma);
+      return HWY_DYNAMIC_DISPATCH(GetEPFStage0)(lf, sigma, block_y0);
     case EpfStage::One:
-      return HWY_DYNAMIC_DISPATCH(GetEPFStage1)(lf, sigma);
+      return HWY_DYNAMIC_DISPATCH(GetEPFStage1)(lf, sigma, block_y0);
     case EpfStage::Two:
-      return HWY_DYNAMIC_DISPATCH(GetEPFStage2)(lf, sigma);
+      return HWY_DYNAMIC_DISPATCH(GetEPFStage2)(lf, sigma, block_y0);
   }
   JXL_DEBUG_ABORT("internal: unexpected EpfStage: %d",
                   static_cast<int>(epf_stage));
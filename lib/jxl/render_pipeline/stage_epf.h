@@ -6,6 +6,7 @@
 #ifndef LIB_JXL_RENDER_PIPELINE_STAGE_EPF_H_
 #define LIB_JXL_RENDER_PIPELINE_STAGE_EPF_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 
@@ -21,8 +22,11 @@ enum class EpfStage : uint8_t { Zero, One, Two };
 // `sigma` will be accessed with an offset of (kSigmaPadding, kSigmaPadding),
 // and should have (kSigmaBorder, kSigmaBorder) mirrored sigma values available
 // around the main image. See also filters.(h|cc)
+// `sigma` holds the block rows from *block_y0 on, which may change between
+// calls to ProcessRow.
 std::unique_ptr<RenderPipelineStage> GetEPFStage(const LoopFilter& lf,
                                                  const ImageF& sigma,
+                                                 const size_t* block_y0,
                                                  EpfStage epf_stage);
 }  // namespace jxl
 
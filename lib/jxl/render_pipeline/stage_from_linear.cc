@@ -5,9 +5,11 @@
 
 #include "lib/jxl/render_pipeline/stage_from_linear.h"
 
+#include <cmath>
 #include <cstddef>
 #include <cstdio>
 #include <memory>
+#include <utility>
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/status.h"
@@ -103,12 +105,59 @@ struct OpGamma {
   }
 };
 
+TfLut MakeTfLut(const OutputEncodingInfo& output_encoding_info,
+                size_t bits_per_sample) {
+  const auto& tf = output_encoding_info.color_encoding.Tf();
+  if (tf.IsSRGB()) {
+    return MakeSRGBTfLut(bits_per_sample);
+  } else if (tf.IsPQ()) {
+    const float intensity_target = output_encoding_info.orig_intensity_target;
+    return TfLut(
+        [intensity_target](double x) {
+          return TF_PQ_Base::EncodedFromDisplay(intensity_target, x);
+        },
+        bits_per_sample);
+  } else if (tf.IsHLG()) {
+    return TfLut([](double x) { return TF_HLG_Base::EncodedFromDisplay(x); },
+                 bits_per_sample);
+  } else if (tf.Is709()) {
+    return TfLut([](double x) { return TF_709::EncodedFromDisplay(x); },
+                 bits_per_sample, 0.018f);
+  }
+  // Unlike OpGamma, this does not flush inputs below 1e-5 to zero.
+  const double inverse_gamma = output_encoding_info.inverse_gamma;
+  return TfLut([inverse_gamma](double x) { return std::pow(x, inverse_gamma); },
+               bits_per_sample);
+}
+
+// Any transfer function, evaluated from a table for output quantized to
+// `bits_per_sample` bits afterwards.
+struct OpLut {
+  OpLut(const OutputEncodingInfo& output_encoding_info, size_t bits_per_sample)
+      : lut_(MakeTfLut(output_encoding_info, bits_per_sample)),
+        is_hlg_(output_encoding_info.color_encoding.Tf().IsHLG()),
+        hlg_ootf_(
+            HlgOOTF::ToSceneLight(output_encoding_info.desired_intensity_target,
+                                  output_encoding_info.luminances)) {}
+
+  template <typename D, typename T>
+  void Transform(D d, T* r, T* g, T* b) const {
+    if (is_hlg_) hlg_ootf_.Apply(r, g, b);
+    for (T* val : {r, g, b}) {
+      *val = lut_.EncodedFromDisplay(d, *val);
+    }
+  }
+  TfLut lut_;
+  bool is_hlg_;
+  HlgOOTF hlg_ootf_;
+};
+
 template <typename Op>
 class FromLinearStage : public RenderPipelineStage {
  public:
-  explicit FromLinearStage(const OutputEncodingInfo& output_encoding_info)
+  explicit FromLinearStage(Op op)
       : RenderPipelineStage(RenderPipelineStage::Settings()),
-        op_(output_encoding_info) {}
+        op_(std::move(op)) {}
 
   Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
                     size_t xextra, size_t xsize, size_t xpos, size_t ypos,
@@ -154,13 +203,16 @@ class FromLinearStage : public RenderPipelineStage {
 template <typename Op>
 std::unique_ptr<FromLinearStage<Op>> MakeFromLinearStage(
     const OutputEncodingInfo& output_encoding_info) {
-  return jxl::make_unique<FromLinearStage<Op>>(output_encoding_info);
+  return jxl::make_unique<FromLinearStage<Op>>(Op(output_encoding_info));
 }
 
 std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
-    const OutputEncodingInfo& output_encoding_info) {
+    const OutputEncodingInfo& output_encoding_info, size_t lut_bits) {
   const auto& tf = output_encoding_info.color_encoding.Tf();
-  if (tf.IsLinear()) {
+  if (!JXL_HIGH_PRECISION && lut_bits != 0 && !tf.IsLinear()) {
+    return jxl::make_unique<FromLinearStage<OpLut>>(
+        OpLut(output_encoding_info, lut_bits));
+  } else if (tf.IsLinear()) {
     return MakeFromLinearStage<OpLinear>(output_encoding_info);
   } else if (tf.IsSRGB()) {
     return MakeFromLinearStage<OpRgb>(output_encoding_info);
@@ -191,8 +243,9 @@ namespace jxl {
 HWY_EXPORT(GetFromLinearStage);
 
 std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
-    const OutputEncodingInfo& output_encoding_info) {
-  return HWY_DYNAMIC_DISPATCH(GetFromLinearStage)(output_encoding_info);
+    const OutputEncodingInfo& output_encoding_info, size_t lut_bits) {
+  return HWY_DYNAMIC_DISPATCH(GetFromLinearStage)(output_encoding_info,
+                                                  lut_bits);
 }
 
 }  // namespace jxl
@@ -6,6 +6,7 @@
 #ifndef LIB_JXL_RENDER_PIPELINE_STAGE_FROM_LINEAR_H_
 #define LIB_JXL_RENDER_PIPELINE_STAGE_FROM_LINEAR_H_
 
+#include <cstddef>
 #include <memory>
 
 #include "lib/jxl/dec_xyb.h"
@@ -14,8 +15,11 @@
 namespace jxl {
 
 // Converts the color channels from linear to the specified output encoding.
+// If `lut_bits` is not 0, the output is quantized to that many bits (at most
+// 16) afterwards, and the transfer function is evaluated from a table, which
+// is faster and accurate enough for that.
 std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
-    const OutputEncodingInfo& output_encoding_info);
+    const OutputEncodingInfo& output_encoding_info, size_t lut_bits = 0);
 
 }  // namespace jxl
 
@@ -9,9 +9,11 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <atomic>
 #include <memory>
 #include <type_traits>
 #include <utility>
@@ -21,6 +23,7 @@
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/sanitizers.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
@@ -47,151 +50,15 @@ using hwy::HWY_NAMESPACE::Clamp;
 using hwy::HWY_NAMESPACE::Div;
 using hwy::HWY_NAMESPACE::Max;
 using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
 using hwy::HWY_NAMESPACE::NearestInt;
 using hwy::HWY_NAMESPACE::Or;
 using hwy::HWY_NAMESPACE::Rebind;
 using hwy::HWY_NAMESPACE::ShiftLeftSame;
 using hwy::HWY_NAMESPACE::ShiftRightSame;
+using hwy::HWY_NAMESPACE::Sub;
 using hwy::HWY_NAMESPACE::VFromD;
 
-// 32x32 blue noise dithering pattern from
-// https://momentsingraphics.de/BlueNoise.html#Downloads scaled to have
-// an average of 0 and be fully contained in (0.49219 to -0.49219).
-// In SIMD codepath we could load up to 128 bits, so need 3 extra (32-bit)
-// elements for zero-cost wrapping.
-const float kDither[1024 + 3] = {
-    -0.26057, 0.32619, 0.21039, -0.03281, -0.10616, 0.16792, 0.43042, -0.48061,
-    -0.00965, -0.31075, 0.24899, -0.35322, -0.02509, -0.25285, 0.02895, 0.10230,
-    -0.28373, -0.00193, 0.23355, 0.43428, -0.23741, 0.18336, -0.31847, -0.11002,
-    -0.36094, 0.26057, -0.19108, -0.29531, 0.40726, -0.09458, 0.11002, -0.48833,
-    0.16020, -0.35708, -0.18336, 0.36094, -0.28373, -0.34550, -0.20267, 0.07914,
-    0.35708, -0.41498, 0.47675, -0.21811, -0.12546, 0.44200, -0.41884, -0.17178,
-    0.39954, 0.33778, -0.33778, 0.04053, -0.46517, 0.27215, -0.16792, 0.39182,
-    0.20653, -0.43814, -0.02895, 0.17950, -0.41498, 0.01737, 0.24899, 0.49219,
-    -0.00965, 0.08300, 0.41112, -0.46903, 0.04053, 0.47289, 0.26057, -0.05983,
-    -0.13704, 0.14862, 0.03281, 0.29531, -0.45744, 0.22583, 0.14862, -0.09072,
-    -0.37638, 0.19881, -0.14476, 0.14476, -0.09072, 0.48447, -0.39954, 0.06369,
-    -0.05983, -0.26829, 0.43428, -0.12546, 0.28759, -0.22969, -0.32619, -0.15248,
-    -0.42270, 0.23741, -0.23355, -0.11774, 0.18722, 0.11388, -0.43814, -0.24899,
-    0.41884, 0.21039, -0.28373, -0.06756, 0.07914, 0.36480, -0.31075, 0.30303,
-    -0.03281, 0.07142, -0.42656, 0.38024, -0.27987, 0.00579, 0.12546, -0.22197,
-    0.29917, 0.36866, 0.13704, -0.47289, 0.09072, 0.35708, -0.04825, 0.38796,
-    -0.28759, -0.07142, 0.44200, 0.27601, -0.38024, -0.16020, -0.01737, 0.30303,
-    -0.33006, -0.40340, -0.16792, 0.40726, -0.36480, -0.00579, -0.19108, 0.41498,
-    -0.26443, 0.46903, -0.21811, 0.28759, -0.04053, 0.22197, 0.34550, -0.44972,
-    -0.14476, -0.34164, 0.04053, -0.19494, 0.45358, -0.37252, 0.21425, 0.05597,
-    0.31075, 0.14090, -0.33778, 0.00579, 0.34550, -0.29917, 0.38796, 0.13704,
-    0.05983, -0.10230, 0.34164, 0.10616, -0.23741, 0.19494, -0.47675, 0.04439,
-    -0.39568, 0.24127, 0.10616, -0.49219, -0.17950, -0.36094, -0.30303, 0.45744,
-    -0.01351, 0.24513, -0.39182, -0.07528, 0.18722, -0.26057, -0.11002, -0.45358,
-    0.46903, -0.17178, -0.41112, 0.07528, -0.09458, 0.21811, -0.20267, -0.48833,
-    0.44972, 0.00965, 0.24127, -0.42656, 0.48447, -0.11774, 0.26443, 0.14090,
-    -0.15634, -0.07142, -0.32233, 0.36094, 0.42270, 0.19108, 0.07142, -0.11002,
-    0.15634, 0.38024, -0.28759, 0.27987, -0.00193, 0.33006, 0.11388, -0.21039,
-    0.02123, 0.17950, 0.38024, -0.24127, -0.44586, 0.48833, -0.03667, 0.26829,
-    -0.36866, -0.22583, 0.17178, -0.30689, 0.29145, -0.04825, -0.35322, 0.43042,
-    0.34936, 0.00193, 0.16792, -0.12932, 0.03667, -0.06756, 0.31847, -0.40726,
-    -0.24513, 0.09458, -0.17564, 0.47675, -0.43042, -0.32233, 0.40340, 0.26057,
-    -0.47675, -0.12160, -0.04825, 0.28759, 0.10230, 0.15634, -0.14862, -0.27601,
-    0.36094, -0.12932, -0.05983, -0.45358, -0.17950, 0.01737, 0.09458, -0.29145,
-    -0.22969, -0.43428, 0.45744, -0.38796, -0.27601, -0.21039, -0.46131, 0.22969,
-    0.41112, -0.05211, -0.48061, 0.16406, 0.05211, -0.14862, -0.03281, -0.36866,
-    -0.27215, 0.34164, -0.31075, 0.42656, -0.38410, -0.32619, 0.02895, 0.19881,
-    0.08300, 0.42270, 0.31461, 0.13318, 0.45744, 0.37638, -0.40726, 0.31847,
-    -0.08686, 0.21425, 0.29917, 0.07914, 0.26829, 0.13704, 0.48447, -0.15248,
-    0.02509, -0.34936, 0.34936, -0.10230, 0.42656, -0.23741, 0.22583, 0.09072,
-    0.44972, 0.20267, 0.04825, -0.21425, 0.24513, -0.07142, 0.39954, -0.46131,
-    -0.39568, -0.01351, -0.33392, 0.05597, -0.26443, 0.22197, -0.20653, 0.15248,
-    0.04439, -0.46517, -0.16406, -0.04439, -0.34936, 0.37252, -0.01351, -0.30689,
-    0.29917, 0.20653, -0.26829, 0.26443, 0.13318, -0.39954, 0.30303, -0.08686,
-    -0.42656, 0.12932, -0.14476, -0.46903, -0.00579, 0.34936, -0.18722, 0.28373,
-    -0.23741, 0.22969, -0.16020, -0.38024, -0.08300, -0.48447, -0.02123, -0.14862,
-    0.48061, -0.31847, 0.39568, -0.24899, 0.18722, -0.41884, 0.10230, -0.08300,
-    -0.38796, 0.06369, -0.19881, -0.44972, 0.00579, -0.33392, 0.37252, -0.19108,
-    -0.02509, -0.35708, 0.32619, 0.46517, 0.17178, -0.28373, 0.10616, 0.47675,
-    -0.09458, 0.15248, 0.43428, 0.35322, 0.17564, 0.27215, 0.41112, -0.36480,
-    0.24899, 0.11774, 0.01351, 0.33006, -0.11388, -0.18336, 0.41884, -0.23355,
-    0.16406, 0.46131, 0.38410, -0.04825, -0.15634, 0.49219, 0.17564, 0.03667,
-    0.40726, 0.23355, -0.25285, -0.08300, -0.41112, -0.12160, -0.35708, 0.05211,
-    -0.41884, -0.29531, 0.02123, -0.21425, 0.09844, -0.30689, -0.11388, 0.34550,
-    -0.26443, -0.07142, -0.39954, 0.44586, 0.05983, -0.48833, 0.24127, 0.34936,
-    -0.44200, -0.12546, 0.12160, -0.30303, 0.27215, 0.07528, -0.48447, -0.29145,
-    0.28373, -0.17564, 0.09458, 0.02123, 0.30689, 0.41884, 0.20653, -0.03667,
-    0.32233, 0.25671, -0.45744, -0.05597, 0.46517, -0.41498, 0.00965, 0.07142,
-    -0.44586, 0.16406, -0.20653, 0.21811, -0.29917, 0.28759, -0.05597, 0.03281,
-    -0.32619, -0.00965, 0.31847, -0.37252, 0.18722, -0.11002, -0.22969, -0.06369,
-    -0.39568, 0.36866, -0.45744, -0.31847, 0.14476, -0.22583, -0.49219, 0.37638,
-    -0.19494, -0.13318, 0.39182, -0.35322, 0.29531, -0.24127, 0.21039, -0.18722,
-    0.45358, 0.31461, -0.13318, -0.01737, -0.36094, 0.12932, -0.25671, 0.43814,
-    -0.16792, 0.23355, -0.22197, 0.44972, -0.42270, 0.33392, 0.42656, 0.11774,
-    -0.13318, 0.19494, -0.03667, 0.44972, 0.24513, -0.15248, 0.08300, -0.33006,
-    0.00579, 0.12546, 0.19494, 0.05983, -0.15634, 0.14476, 0.36480, -0.04053,
-    -0.33006, 0.25671, -0.46903, 0.37252, 0.48833, -0.09458, -0.41112, 0.19108,
-    0.08686, -0.46903, -0.07528, 0.04053, -0.26829, -0.02895, 0.22197, -0.34164,
-    0.47289, -0.21811, 0.06756, -0.38410, -0.27987, -0.06369, 0.27987, 0.43814,
-    -0.25671, -0.39182, 0.49219, -0.27601, -0.07914, -0.48061, 0.42656, -0.38410,
-    0.11002, 0.03667, -0.27215, 0.15634, 0.07528, -0.22197, 0.33006, 0.38410,
-    -0.34936, 0.27987, 0.15248, 0.40340, 0.09844, -0.16406, -0.46131, 0.03281,
-    -0.29531, 0.31461, -0.10616, 0.39954, 0.01351, 0.33778, -0.43814, 0.17178,
-    -0.08686, 0.23741, -0.44586, 0.33778, -0.00193, -0.31461, 0.23741, -0.12932,
-    -0.22583, -0.06756, 0.40340, -0.16792, -0.43428, 0.01351, -0.14476, -0.04053,
-    -0.29145, 0.46517, -0.13704, -0.39182, -0.32233, 0.29531, 0.38410, 0.16020,
-    -0.44200, 0.26443, 0.12546, -0.42270, 0.21425, -0.19881, -0.35708, 0.04825,
-    0.36480, -0.02895, -0.21425, 0.09072, 0.41498, 0.18336, 0.04439, 0.29917,
-    0.47675, -0.40340, 0.27601, -0.31461, 0.31075, 0.17564, 0.24899, -0.45744,
-    0.05597, -0.19494, 0.00193, 0.36094, 0.24127, -0.09844, -0.24513, -0.00965,
-    -0.17564, -0.05597, -0.34550, -0.24899, 0.48061, 0.15248, -0.11388, 0.45358,
-    -0.16406, -0.32233, 0.31461, -0.11774, -0.36866, -0.18722, -0.25671, -0.44200,
-    0.13318, -0.02123, 0.19881, -0.10616, 0.43042, -0.36866, -0.24899, 0.41112,
-    0.11002, 0.21425, -0.25671, -0.47675, -0.04439, 0.13704, -0.37252, 0.43814,
-    0.19108, 0.03667, 0.35708, -0.14090, 0.08300, -0.02123, -0.30303, -0.48061,
-    0.11774, 0.20267, -0.43042, 0.25285, 0.14090, -0.04439, 0.38796, 0.34550,
-    -0.34164, -0.19494, 0.05983, -0.48447, 0.09844, -0.00579, -0.07914, 0.33778,
-    -0.41498, -0.10230, 0.30689, 0.17178, 0.48833, -0.20267, 0.07914, 0.33392,
-    -0.48833, -0.30689, 0.41498, 0.22969, -0.44586, 0.32233, 0.25285, 0.39182,
-    -0.23355, 0.01737, 0.42270, -0.27987, 0.46903, -0.47289, 0.02123, -0.09072,
-    0.21811, 0.44586, -0.25285, 0.36480, -0.29145, 0.47289, -0.18722, 0.14476,
-    -0.31461, 0.43814, -0.36094, 0.04439, -0.29917, -0.41884, 0.25285, -0.11774,
-    0.46131, 0.11388, -0.21039, -0.07528, -0.38024, -0.26057, 0.06369, -0.05983,
-    0.29145, -0.40340, -0.09072, 0.06756, -0.16020, 0.27601, -0.31075, 0.10616,
-    -0.14090, -0.43042, 0.25671, -0.05211, -0.13318, 0.23355, -0.44972, 0.02895,
-    0.26829, -0.02895, -0.17950, 0.37252, -0.13704, 0.40726, 0.01351, -0.26443,
-    -0.03281, -0.40340, 0.27987, 0.17564, 0.02509, 0.44200, -0.15248, -0.34550,
-    0.14862, -0.19881, -0.01351, 0.36866, -0.38796, 0.19494, -0.22197, 0.32619,
-    -0.37638, 0.00193, 0.30689, 0.12160, -0.39182, 0.16792, -0.34550, 0.39954,
-    -0.23355, 0.09072, -0.43428, 0.22969, -0.06369, 0.12546, -0.35322, 0.30689,
-    -0.09844, 0.06756, 0.38410, -0.33392, -0.18336, 0.35322, 0.21039, -0.42270,
-    0.48833, 0.33006, 0.21811, -0.33392, 0.12932, -0.05211, 0.39568, 0.04825,
-    0.48061, 0.17950, -0.31847, -0.21811, 0.38024, 0.05211, 0.32233, -0.06756,
-    -0.12546, 0.46131, 0.16020, -0.25285, 0.29531, -0.44972, 0.17950, -0.16406,
-    0.22583, -0.46131, -0.27601, -0.00579, 0.12932, -0.47289, -0.09844, 0.10230,
-    -0.28759, -0.12160, -0.49219, -0.24127, 0.44586, -0.11388, -0.45358, -0.27215,
-    -0.17178, -0.07528, -0.47675, 0.43042, -0.02509, -0.27215, -0.19108, 0.19881,
-    -0.49219, -0.37252, 0.33392, -0.00193, -0.33006, -0.20267, 0.48061, 0.34164,
-    -0.22969, 0.42270, -0.12160, 0.31075, 0.46903, -0.22583, 0.27215, -0.02509,
-    0.03281, 0.40340, 0.25671, 0.08686, 0.00965, 0.29145, -0.41112, 0.14090,
-    0.24513, 0.34164, 0.08686, -0.14862, 0.27601, -0.42656, 0.48447, 0.09844,
-    0.26443, -0.27987, 0.05597, -0.10230, 0.43428, 0.08686, 0.02895, -0.38024,
-    0.15634, 0.09458, -0.36480, 0.18336, -0.05211, -0.40726, 0.36866, -0.33778,
-    -0.19881, 0.16020, -0.37638, -0.16020, -0.29917, 0.20267, 0.41884, -0.01737,
-    -0.34936, -0.24127, 0.02509, 0.20653, -0.36480, -0.08686, 0.01737, -0.33778,
-    0.41498, -0.03667, 0.37638, -0.17178, -0.47289, 0.26829, -0.28759, -0.05597,
-    0.35708, 0.00193, 0.25285, -0.15634, -0.30303, 0.06369, 0.22197, 0.45358,
-    -0.43814, 0.30303, -0.04053, 0.46517, 0.35322, -0.21039, 0.06756, -0.14090,
-    0.37638, -0.43042, 0.45744, -0.29531, 0.39568, 0.14862, 0.23741, -0.13704,
-    -0.21425, 0.16406, -0.40726, 0.22583, 0.13318, 0.38796, -0.12932, -0.43428,
-    -0.31461, -0.20653, 0.46131, -0.45358, 0.39568, -0.24513, -0.14090, 0.11002,
-    -0.08300, -0.26829, 0.05211, -0.46517, -0.09844, -0.39568, -0.32619, -0.06369,
-    0.16792, 0.28373, 0.11388, -0.04439, -0.18336, -0.44200, 0.35322, -0.26057,
-    -0.46517, 0.31075, -0.07914, -0.34164, -0.24513, -0.02123, 0.19108, 0.44200,
-    0.04825, -0.07914, -0.39954, 0.12160, 0.29145, 0.00965, -0.37638, 0.32233,
-    0.20267, -0.17564, 0.39182, 0.12160, 0.18336, 0.32619, 0.26057, 0.49219,
-    -0.48447, -0.20653, -0.10616, -0.38796, 0.31847, 0.07528, -0.01737, 0.44586,
-    0.11774, 0.02509, 0.47289, 0.07142, 0.33392, -0.38410, -0.17950, 0.28373,
-    // Wrapped values
-    -0.26057, 0.32619, 0.21039
-};
-
 namespace {
 constexpr static size_t kChunkSize = 1024;
 }  // namespace
@@ -222,14 +89,16 @@ VFromD<Rebind<T, DF>> MakeUnsigned(VFromD<DF> v, size_t x0, size_t y0,
 
 class WriteToOutputStage : public RenderPipelineStage {
  public:
-  WriteToOutputStage(const ImageOutput& main_output, size_t width,
-                     size_t height, bool has_alpha, bool unpremul_alpha,
-                     size_t alpha_c, Orientation undo_orientation,
+  WriteToOutputStage(const ImageOutput& main_output, const Rect& output_rect,
+                     bool has_alpha, bool unpremul_alpha, size_t alpha_c,
+                     Orientation undo_orientation, bool ycbcr_input,
                      const std::vector<ImageOutput>& extra_output,
                      JxlMemoryManager* memory_manager)
       : RenderPipelineStage(RenderPipelineStage::Settings()),
-        width_(width),
-        height_(height),
+        x0_(output_rect.x0()),
+        y0_(output_rect.y0()),
+        width_(output_rect.xsize()),
+        height_(output_rect.ysize()),
         main_(main_output),
         num_color_(main_.num_channels_ < 3 ? 1 : 3),
         want_alpha_(main_.num_channels_ == 2 || main_.num_channels_ == 4),
@@ -239,6 +108,9 @@ class WriteToOutputStage : public RenderPipelineStage {
         flip_x_(ShouldFlipX(undo_orientation)),
         flip_y_(ShouldFlipY(undo_orientation)),
         transpose_(ShouldTranspose(undo_orientation)),
+        layout_(main_output.layout),
+        ycbcr_(layout_ == JXL_IMAGE_OUT_I420 || layout_ == JXL_IMAGE_OUT_P010),
+        ycbcr_input_(ycbcr_input),
         opaque_alpha_(kChunkSize, 1.0f),
         memory_manager_(memory_manager) {
     for (size_t ec = 0; ec < extra_output.size(); ++ec) {
@@ -248,6 +120,28 @@ class WriteToOutputStage : public RenderPipelineStage {
         extra_channels_.push_back(extra);
       }
     }
+    if (ycbcr_) {
+      const size_t chroma_ysize = DivCeil(height_, 2);
+      chroma_rows_.reset(new std::atomic<ChromaRows*>[chroma_ysize]);
+      for (size_t cy = 0; cy < chroma_ysize; ++cy) {
+        chroma_rows_[cy].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+    if (layout_ != JXL_IMAGE_OUT_INTERLEAVED) {
+      planes_ = GetImageOutputPlanes(layout_, main_output.format,
+                                     transpose_ ? height_ : width_,
+                                     transpose_ ? width_ : height_);
+    }
+    if (layout_ == JXL_IMAGE_OUT_PLANAR) {
+      for (const ImageOutputPlane& plane : planes_) {
+        Output out(main_output);
+        out.buffer_ = static_cast<uint8_t*>(main_output.buffer) + plane.offset;
+        out.buffer_size_ = main_output.buffer_size - plane.offset;
+        out.stride_ = plane.stride;
+        out.num_channels_ = 1;
+        plane_outputs_.push_back(out);
+      }
+    }
   }
 
   WriteToOutputStage(const WriteToOutputStage&) = delete;
@@ -256,6 +150,12 @@ class WriteToOutputStage : public RenderPipelineStage {
   WriteToOutputStage& operator=(WriteToOutputStage&&) = delete;
 
   ~WriteToOutputStage() override {
+    if (chroma_rows_) {
+      // Pairs of rows of which not all pixels were written.
+      for (size_t cy = 0; cy < DivCeil(height_, 2); ++cy) {
+        delete chroma_rows_[cy].load(std::memory_order_relaxed);
+      }
+    }
     if (main_.run_opaque_) {
       main_.pixel_callback_.destroy(main_.run_opaque_);
     }
@@ -271,22 +171,28 @@ class WriteToOutputStage : public RenderPipelineStage {
                     size_t thread_id) const final {
     JXL_ENSURE(xextra == 0);
     JXL_ENSURE(main_.run_opaque_ || main_.buffer_);
-    if (ypos >= height_) return true;
-    if (xpos >= width_) return true;
+    // Translate to the coordinates of the output region, skipping the pixels
+    // outside of it.
+    if (ypos < y0_ || ypos - y0_ >= height_) return true;
+    if (xpos + xsize <= x0_ || xpos >= x0_ + width_) return true;
+    ypos -= y0_;
+    const size_t xskip = x0_ > xpos ? x0_ - xpos : 0;
+    xpos = xpos + xskip - x0_;
     if (flip_y_) {
       ypos = height_ - 1u - ypos;
     }
-    size_t limit = std::min(xsize, width_ - xpos);
+    size_t limit = std::min(xsize - xskip, width_ - xpos);
     for (size_t x0 = 0; x0 < limit; x0 += kChunkSize) {
       size_t xstart = xpos + x0;
       size_t len = std::min<size_t>(kChunkSize, limit - x0);
+      size_t xin = xskip + x0;
 
       const float* line_buffers[4];
       for (size_t c = 0; c < num_color_; c++) {
-        line_buffers[c] = GetInputRow(input_rows, c, 0) + x0;
+        line_buffers[c] = GetInputRow(input_rows, c, 0) + xin;
       }
       if (has_alpha_) {
-        line_buffers[num_color_] = GetInputRow(input_rows, alpha_c_, 0) + x0;
+        line_buffers[num_color_] = GetInputRow(input_rows, alpha_c_, 0) + xin;
       } else {
         // opaque_alpha_ is a way to set all values to 1.0f.
         line_buffers[num_color_] = opaque_alpha_.data();
@@ -294,9 +200,20 @@ class WriteToOutputStage : public RenderPipelineStage {
       if (has_alpha_ && want_alpha_ && unpremul_alpha_) {
         UnpremulAlpha(thread_id, len, line_buffers);
       }
-      OutputBuffers(main_, thread_id, ypos, xstart, len, line_buffers);
+      if (layout_ == JXL_IMAGE_OUT_INTERLEAVED) {
+        OutputBuffers(main_, thread_id, ypos, xstart, len, line_buffers);
+      } else if (layout_ == JXL_IMAGE_OUT_PLANAR) {
+        for (size_t c = 0; c < main_.num_channels_; ++c) {
+          const float* plane_buffers[4] = {line_buffers[c]};
+          OutputBuffers(plane_outputs_[c], thread_id, ypos, xstart, len,
+                        plane_buffers);
+        }
+      } else {
+        OutputYCbCr(thread_id, ypos, xstart, len, line_buffers);
+      }
       for (const auto& extra : extra_channels_) {
-        line_buffers[0] = GetInputRow(input_rows, extra.channel_index_, 0) + x0;
+        line_buffers[0] =
+            GetInputRow(input_rows, extra.channel_index_, 0) + xin;
         OutputBuffers(extra, thread_id, ypos, xstart, len, line_buffers);
       }
     }
@@ -352,6 +269,18 @@ class WriteToOutputStage : public RenderPipelineStage {
     size_t channel_index_;  // used for extra_channels
   };
 
+  // Chroma of the pixels of rows 2k and 2k+1, until all of them are written.
+  struct ChromaRows {
+    explicit ChromaRows(size_t width)
+        : chroma(4 * width), written(DivCeil(width, 2)) {}
+    // Indexed by row of the pair, then Cb or Cr, then column.
+    std::vector<float> chroma;
+    // Bit 2 * row + column of a block is set once that pixel is written.
+    std::vector<std::atomic<uint8_t>> written;
+    // Number of pixels written so far.
+    std::atomic<size_t> num_written{0};
+  };
+
   Status PrepareForThreads(size_t num_threads) override {
     JXL_RETURN_IF_ERROR(main_.PrepareForThreads(num_threads));
     for (auto& extra : extra_channels_) {
@@ -371,6 +300,18 @@ class WriteToOutputStage : public RenderPipelineStage {
             temp, AlignedMemory::Create(memory_manager_, alloc_size));
       }
     }
+    if (ycbcr_) {
+      // Y, Cb and Cr of a chunk, then Cb and Cr of its chroma samples. The
+      // buffers are initialized as vectors may read past their end.
+      const size_t ycbcr_size = 5 * alloc_size;
+      temp_ycbcr_.resize(num_threads);
+      for (AlignedMemory& temp : temp_ycbcr_) {
+        JXL_ASSIGN_OR_RETURN(
+            temp, AlignedMemory::Create(memory_manager_, ycbcr_size));
+        memset(temp.address<uint8_t>(), 0, ycbcr_size);
+      }
+      unused_chroma_rows_.resize(num_threads);
+    }
     return true;
   }
   static bool ShouldFlipX(Orientation undo_orientation) {
@@ -456,6 +397,233 @@ class WriteToOutputStage : public RenderPipelineStage {
     }
   }
 
+  // Writes a chunk of a row with a YCbCr layout.
+  void OutputYCbCr(size_t thread_id, size_t ypos, size_t xstart, size_t len,
+                   const float* input[4]) const {
+    if (flip_x_) {
+      FlipX(main_, thread_id, len, &xstart, input);
+    }
+    const HWY_FULL(float) d;
+    float* JXL_RESTRICT luma = temp_ycbcr_[thread_id].address<float>();
+    float* JXL_RESTRICT cb = luma + kChunkSize;
+    float* JXL_RESTRICT cr = cb + kChunkSize;
+    const size_t padding = RoundUpTo(len, Lanes(d)) - len;
+    for (size_t c = 0; c < 3; ++c) {
+      msan::UnpoisonMemory(input[c] + len, sizeof(input[c][0]) * padding);
+    }
+    if (ycbcr_input_) {
+      // YCbCr frames hold Cb, Y - 128/255 and Cr in the color channels.
+      const auto offset = Set(d, 128.0f / 255);
+      for (size_t i = 0; i < len; i += Lanes(d)) {
+        Store(Add(LoadU(d, input[1] + i), offset), d, luma + i);
+        Store(LoadU(d, input[0] + i), d, cb + i);
+        Store(LoadU(d, input[2] + i), d, cr + i);
+      }
+    } else {
+      // Full-range BT.601 as defined by JFIF Clause 7, the inverse of the
+      // YCbCr stage.
+      const auto kr = Set(d, 0.299f);
+      const auto kg = Set(d, 0.587f);
+      const auto kb = Set(d, 0.114f);
+      const auto cb_mul = Set(d, 1.0f / 1.772f);
+      const auto cr_mul = Set(d, 1.0f / 1.402f);
+      for (size_t i = 0; i < len; i += Lanes(d)) {
+        const auto r = LoadU(d, input[0] + i);
+        const auto g = LoadU(d, input[1] + i);
+        const auto b = LoadU(d, input[2] + i);
+        const auto y = MulAdd(kr, r, MulAdd(kg, g, Mul(kb, b)));
+        Store(y, d, luma + i);
+        Store(Mul(Sub(b, y), cb_mul), d, cb + i);
+        Store(Mul(Sub(r, y), cr_mul), d, cr + i);
+      }
+    }
+
+    uint8_t* buffer = static_cast<uint8_t*>(main_.buffer_);
+    const ImageOutputPlane& luma_plane = planes_[0];
+    uint8_t* luma_row = buffer + luma_plane.offset + ypos * luma_plane.stride;
+    uint8_t* JXL_RESTRICT temp8 = temp_out_[thread_id].address<uint8_t>();
+    uint16_t* JXL_RESTRICT temp16 = temp_out_[thread_id].address<uint16_t>();
+    if (layout_ == JXL_IMAGE_OUT_I420) {
+      StoreI420Row(luma, len, 0.0f, xstart, ypos, temp8);
+      memcpy(luma_row + xstart, temp8, len);
+    } else {
+      StoreP010Row(luma, nullptr, len, 0.0f, temp16);
+      memcpy(luma_row + 2 * xstart, temp16, 2 * len);
+    }
+
+    WriteChroma(thread_id, ypos, xstart, len, cb, cr);
+  }
+
+  // The chroma sample of a 2x2 block of pixels depends on the ProcessRow
+  // calls of both of its rows and, if the block straddles their columns, of
+  // two column ranges, possibly on different threads and in any order. The
+  // chroma of the pixels is therefore kept by output position, in a buffer per
+  // pair of rows that is shared by all threads. Each call records its pixels
+  // in the bit masks of their blocks, and the call that completes a block
+  // writes its sample; the last call to write a pixel of the pair of rows
+  // releases the buffer. No locks are taken, and each sample is written once,
+  // from all of its pixels.
+  void WriteChroma(size_t thread_id, size_t ypos, size_t xstart, size_t len,
+                   const float* cb, const float* cr) const {
+    const size_t cy = ypos / 2;
+    const size_t row = ypos % 2;
+    const size_t num_rows = std::min<size_t>(2, height_ - 2 * cy);
+    ChromaRows* rows = AcquireChromaRows(thread_id, cy);
+    float* chroma[2] = {rows->chroma.data() + 2 * row * width_,
+                        rows->chroma.data() + (2 * row + 1) * width_};
+    memcpy(chroma[0] + xstart, cb, sizeof(float) * len);
+    memcpy(chroma[1] + xstart, cr, sizeof(float) * len);
+
+    float* JXL_RESTRICT sample_cb =
+        temp_ycbcr_[thread_id].address<float>() + 3 * kChunkSize;
+    float* JXL_RESTRICT sample_cr = sample_cb + kChunkSize;
+    const size_t xend = xstart + len;
+    // Run of consecutive completed samples, from cx0.
+    size_t cx0 = xstart / 2;
+    size_t num_chroma = 0;
+    for (size_t cx = xstart / 2; 2 * cx < xend; ++cx) {
+      const size_t x = 2 * cx;
+      const bool has_right_column = x + 1 < width_;
+      uint32_t mask = 0;
+      if (x >= xstart) mask |= 1u << (2 * row);
+      if (has_right_column && x + 1 < xend) mask |= 2u << (2 * row);
+      uint32_t full_mask = has_right_column ? 3 : 1;
+      if (num_rows == 2) full_mask |= full_mask << 2;
+      // Orders the chroma written by the other calls of the block before the
+      // reads below, and ours before theirs.
+      const uint32_t written =
+          rows->written[cx].fetch_or(static_cast<uint8_t>(mask),
+                                     std::memory_order_acq_rel) |
+          mask;
+      if (written != full_mask) {
+        WriteChromaSamples(thread_id, cy, cx0, num_chroma, sample_cb,
+                           sample_cr);
+        cx0 = cx + 1;
+        num_chroma = 0;
+        continue;
+      }
+      for (size_t c = 0; c < 2; ++c) {
+        float row_values[2] = {};
+        for (size_t r = 0; r < num_rows; ++r) {
+          const float* values = rows->chroma.data() + (2 * r + c) * width_;
+          row_values[r] = has_right_column
+                              ? 0.5f * (values[x] + values[x + 1])
+                              : values[x];
+        }
+        (c == 0 ? sample_cb : sample_cr)[num_chroma] =
+            num_rows == 2 ? 0.5f * (row_values[0] + row_values[1])
+                          : row_values[0];
+      }
+      ++num_chroma;
+    }
+    WriteChromaSamples(thread_id, cy, cx0, num_chroma, sample_cb, sample_cr);
+
+    // The call that writes the last pixels of the pair of rows comes after
+    // all other accesses to its buffer.
+    const size_t num_written =
+        rows->num_written.fetch_add(len, std::memory_order_acq_rel) + len;
+    if (num_written == num_rows * width_) {
+      chroma_rows_[cy].store(nullptr, std::memory_order_relaxed);
+      unused_chroma_rows_[thread_id].emplace_back(rows);
+    }
+  }
+
+  // Returns the buffer of the pair of rows cy, which the first call to write
+  // one of its pixels creates, or takes from the buffers this thread released.
+  ChromaRows* AcquireChromaRows(size_t thread_id, size_t cy) const {
+    ChromaRows* rows = chroma_rows_[cy].load(std::memory_order_acquire);
+    if (rows) return rows;
+    std::vector<std::unique_ptr<ChromaRows>>& unused =
+        unused_chroma_rows_[thread_id];
+    std::unique_ptr<ChromaRows> created;
+    if (unused.empty()) {
+      created = jxl::make_unique<ChromaRows>(width_);
+    } else {
+      created = std::move(unused.back());
+      unused.pop_back();
+      for (std::atomic<uint8_t>& written : created->written) {
+        written.store(0, std::memory_order_relaxed);
+      }
+      created->num_written.store(0, std::memory_order_relaxed);
+    }
+    if (chroma_rows_[cy].compare_exchange_strong(rows, created.get(),
+                                                 std::memory_order_acq_rel)) {
+      return created.release();
+    }
+    // Another thread created the buffer first.
+    unused.push_back(std::move(created));
+    return rows;
+  }
+
+  void WriteChromaSamples(size_t thread_id, size_t cy, size_t cx0,
+                          size_t num_chroma, const float* cb,
+                          const float* cr) const {
+    if (num_chroma == 0) return;
+    uint8_t* buffer = static_cast<uint8_t*>(main_.buffer_);
+    if (layout_ == JXL_IMAGE_OUT_I420) {
+      uint8_t* JXL_RESTRICT temp8 = temp_out_[thread_id].address<uint8_t>();
+      const float* chroma[2] = {cb, cr};
+      for (size_t c = 0; c < 2; ++c) {
+        const ImageOutputPlane& plane = planes_[1 + c];
+        StoreI420Row(chroma[c], num_chroma, 128.0f / 255, cx0, cy, temp8);
+        memcpy(buffer + plane.offset + cy * plane.stride + cx0, temp8,
+               num_chroma);
+      }
+    } else {
+      uint16_t* JXL_RESTRICT temp16 = temp_out_[thread_id].address<uint16_t>();
+      const ImageOutputPlane& plane = planes_[1];
+      StoreP010Row(cb, cr, num_chroma, 512.0f / 1023, temp16);
+      memcpy(buffer + plane.offset + cy * plane.stride + 4 * cx0, temp16,
+             4 * num_chroma);
+    }
+  }
+
+  // Stores 8-bit samples, with offset added to the input.
+  static void StoreI420Row(const float* input, size_t len, float offset,
+                           size_t x0, size_t y0, uint8_t* output) {
+    const HWY_FULL(float) d;
+    const Rebind<uint8_t, decltype(d)> du;
+    const auto mul = Set(d, 255.0f);
+    const auto voffset = Set(d, offset);
+    for (size_t i = 0; i < len; i += Lanes(d)) {
+      StoreU(MakeUnsigned<uint8_t>(Add(LoadU(d, input + i), voffset), x0 + i,
+                                   y0, mul),
+             du, output + i);
+    }
+  }
+
+  // Stores 10-bit samples in the high bits of 16-bit samples, with offset
+  // added to the input; input1, if not null, is interleaved with input0.
+  void StoreP010Row(const float* input0, const float* input1, size_t len,
+                    float offset, uint16_t* output) const {
+    const HWY_FULL(float) d;
+    const Rebind<uint16_t, decltype(d)> du;
+    const auto mul = Set(d, 1023.0f);
+    const auto voffset = Set(d, offset);
+    for (size_t i = 0; i < len; i += Lanes(d)) {
+      const auto v0 = ShiftLeftSame(
+          MakeUnsigned<uint16_t>(Add(LoadU(d, input0 + i), voffset), 0, 0, mul),
+          6);
+      if (input1 == nullptr) {
+        StoreU(v0, du, output + i);
+        continue;
+      }
+      const auto v1 = ShiftLeftSame(
+          MakeUnsigned<uint16_t>(Add(LoadU(d, input1 + i), voffset), 0, 0, mul),
+          6);
+      StoreInterleaved2(v0, v1, du, output + 2 * i);
+    }
+    if (main_.swap_endianness_) {
+      const HWY_FULL(uint16_t) du_full;
+      const size_t output_len = input1 == nullptr ? len : 2 * len;
+      for (size_t j = 0; j < output_len; j += Lanes(du_full)) {
+        auto v = LoadU(du_full, output + j);
+        auto vswap = Or(ShiftRightSame(v, 8), ShiftLeftSame(v, 8));
+        StoreU(vswap, du_full, output + j);
+      }
+    }
+  }
+
   void FlipX(const Output& out, size_t thread_id, size_t len, size_t* xstart,
              const float** line_buffers) const {
     float* temp_in[4];
@@ -628,6 +796,8 @@ class WriteToOutputStage : public RenderPipelineStage {
   }
 
   // Process row in chunks to keep per-thread buffers compact.
+  size_t x0_;
+  size_t y0_;
   size_t width_;
   size_t height_;
   Output main_;  // color + alpha
@@ -639,20 +809,32 @@ class WriteToOutputStage : public RenderPipelineStage {
   bool flip_x_;
   bool flip_y_;
   bool transpose_;
+  JxlImageOutLayout layout_;
+  bool ycbcr_;  // I420 or P010 layout
+  bool ycbcr_input_;
+  std::vector<ImageOutputPlane> planes_;
+  std::vector<Output> plane_outputs_;  // for the planar layout
   std::vector<Output> extra_channels_;
   std::vector<float> opaque_alpha_;
   JxlMemoryManager* memory_manager_;
   std::vector<AlignedMemory> temp_in_;
   std::vector<AlignedMemory> temp_out_;
+  std::vector<AlignedMemory> temp_ycbcr_;
+  // Buffers of the pairs of rows with pixels written, by pair of rows.
+  std::unique_ptr<std::atomic<ChromaRows*>[]> chroma_rows_;
+  // Released buffers, by thread.
+  mutable std::vector<std::vector<std::unique_ptr<ChromaRows>>>
+      unused_chroma_rows_;
 };
 
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
-    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
+    const ImageOutput& main_output, const Rect& output_rect, bool has_alpha,
     bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
-    std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager) {
+    bool ycbcr_input, std::vector<ImageOutput>& extra_output,
+    JxlMemoryManager* memory_manager) {
   return jxl::make_unique<WriteToOutputStage>(
-      main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
-      undo_orientation, extra_output, memory_manager);
+      main_output, output_rect, has_alpha, unpremul_alpha, alpha_c,
+      undo_orientation, ycbcr_input, extra_output, memory_manager);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -664,6 +846,139 @@ HWY_AFTER_NAMESPACE();
 
 namespace jxl {
 
+const float kDither[1024 + 3] = {
+    -0.26057, 0.32619, 0.21039, -0.03281, -0.10616, 0.16792, 0.43042, -0.48061,
+    -0.00965, -0.31075, 0.24899, -0.35322, -0.02509, -0.25285, 0.02895, 0.10230,
+    -0.28373, -0.00193, 0.23355, 0.43428, -0.23741, 0.18336, -0.31847, -0.11002,
+    -0.36094, 0.26057, -0.19108, -0.29531, 0.40726, -0.09458, 0.11002, -0.48833,
+    0.16020, -0.35708, -0.18336, 0.36094, -0.28373, -0.34550, -0.20267, 0.07914,
+    0.35708, -0.41498, 0.47675, -0.21811, -0.12546, 0.44200, -0.41884, -0.17178,
+    0.39954, 0.33778, -0.33778, 0.04053, -0.46517, 0.27215, -0.16792, 0.39182,
+    0.20653, -0.43814, -0.02895, 0.17950, -0.41498, 0.01737, 0.24899, 0.49219,
+    -0.00965, 0.08300, 0.41112, -0.46903, 0.04053, 0.47289, 0.26057, -0.05983,
+    -0.13704, 0.14862, 0.03281, 0.29531, -0.45744, 0.22583, 0.14862, -0.09072,
+    -0.37638, 0.19881, -0.14476, 0.14476, -0.09072, 0.48447, -0.39954, 0.06369,
+    -0.05983, -0.26829, 0.43428, -0.12546, 0.28759, -0.22969, -0.32619, -0.15248,
+    -0.42270, 0.23741, -0.23355, -0.11774, 0.18722, 0.11388, -0.43814, -0.24899,
+    0.41884, 0.21039, -0.28373, -0.06756, 0.07914, 0.36480, -0.31075, 0.30303,
+    -0.03281, 0.07142, -0.42656, 0.38024, -0.27987, 0.00579, 0.12546, -0.22197,
+    0.29917, 0.36866, 0.13704, -0.47289, 0.09072, 0.35708, -0.04825, 0.38796,
+    -0.28759, -0.07142, 0.44200, 0.27601, -0.38024, -0.16020, -0.01737, 0.30303,
+    -0.33006, -0.40340, -0.16792, 0.40726, -0.36480, -0.00579, -0.19108, 0.41498,
+    -0.26443, 0.46903, -0.21811, 0.28759, -0.04053, 0.22197, 0.34550, -0.44972,
+    -0.14476, -0.34164, 0.04053, -0.19494, 0.45358, -0.37252, 0.21425, 0.05597,
+    0.31075, 0.14090, -0.33778, 0.00579, 0.34550, -0.29917, 0.38796, 0.13704,
+    0.05983, -0.10230, 0.34164, 0.10616, -0.23741, 0.19494, -0.47675, 0.04439,
+    -0.39568, 0.24127, 0.10616, -0.49219, -0.17950, -0.36094, -0.30303, 0.45744,
+    -0.01351, 0.24513, -0.39182, -0.07528, 0.18722, -0.26057, -0.11002, -0.45358,
+    0.46903, -0.17178, -0.41112, 0.07528, -0.09458, 0.21811, -0.20267, -0.48833,
+    0.44972, 0.00965, 0.24127, -0.42656, 0.48447, -0.11774, 0.26443, 0.14090,
+    -0.15634, -0.07142, -0.32233, 0.36094, 0.42270, 0.19108, 0.07142, -0.11002,
+    0.15634, 0.38024, -0.28759, 0.27987, -0.00193, 0.33006, 0.11388, -0.21039,
+    0.02123, 0.17950, 0.38024, -0.24127, -0.44586, 0.48833, -0.03667, 0.26829,
+    -0.36866, -0.22583, 0.17178, -0.30689, 0.29145, -0.04825, -0.35322, 0.43042,
+    0.34936, 0.00193, 0.16792, -0.12932, 0.03667, -0.06756, 0.31847, -0.40726,
+    -0.24513, 0.09458, -0.17564, 0.47675, -0.43042, -0.32233, 0.40340, 0.26057,
+    -0.47675, -0.12160, -0.04825, 0.28759, 0.10230, 0.15634, -0.14862, -0.27601,
+    0.36094, -0.12932, -0.05983, -0.45358, -0.17950, 0.01737, 0.09458, -0.29145,
+    -0.22969, -0.43428, 0.45744, -0.38796, -0.27601, -0.21039, -0.46131, 0.22969,
+    0.41112, -0.05211, -0.48061, 0.16406, 0.05211, -0.14862, -0.03281, -0.36866,
+    -0.27215, 0.34164, -0.31075, 0.42656, -0.38410, -0.32619, 0.02895, 0.19881,
+    0.08300, 0.42270, 0.31461, 0.13318, 0.45744, 0.37638, -0.40726, 0.31847,
+    -0.08686, 0.21425, 0.29917, 0.07914, 0.26829, 0.13704, 0.48447, -0.15248,
+    0.02509, -0.34936, 0.34936, -0.10230, 0.42656, -0.23741, 0.22583, 0.09072,
+    0.44972, 0.20267, 0.04825, -0.21425, 0.24513, -0.07142, 0.39954, -0.46131,
+    -0.39568, -0.01351, -0.33392, 0.05597, -0.26443, 0.22197, -0.20653, 0.15248,
+    0.04439, -0.46517, -0.16406, -0.04439, -0.34936, 0.37252, -0.01351, -0.30689,
+    0.29917, 0.20653, -0.26829, 0.26443, 0.13318, -0.39954, 0.30303, -0.08686,
+    -0.42656, 0.12932, -0.14476, -0.46903, -0.00579, 0.34936, -0.18722, 0.28373,
+    -0.23741, 0.22969, -0.16020, -0.38024, -0.08300, -0.48447, -0.02123, -0.14862,
+    0.48061, -0.31847, 0.39568, -0.24899, 0.18722, -0.41884, 0.10230, -0.08300,
+    -0.38796, 0.06369, -0.19881, -0.44972, 0.00579, -0.33392, 0.37252, -0.19108,
+    -0.02509, -0.35708, 0.32619, 0.46517, 0.17178, -0.28373, 0.10616, 0.47675,
+    -0.09458, 0.15248, 0.43428, 0.35322, 0.17564, 0.27215, 0.41112, -0.36480,
+    0.24899, 0.11774, 0.01351, 0.33006, -0.11388, -0.18336, 0.41884, -0.23355,
+    0.16406, 0.46131, 0.38410, -0.04825, -0.15634, 0.49219, 0.17564, 0.03667,
+    0.40726, 0.23355, -0.25285, -0.08300, -0.41112, -0.12160, -0.35708, 0.05211,
+    -0.41884, -0.29531, 0.02123, -0.21425, 0.09844, -0.30689, -0.11388, 0.34550,
+    -0.26443, -0.07142, -0.39954, 0.44586, 0.05983, -0.48833, 0.24127, 0.34936,
+    -0.44200, -0.12546, 0.12160, -0.30303, 0.27215, 0.07528, -0.48447, -0.29145,
+    0.28373, -0.17564, 0.09458, 0.02123, 0.30689, 0.41884, 0.20653, -0.03667,
+    0.32233, 0.25671, -0.45744, -0.05597, 0.46517, -0.41498, 0.00965, 0.07142,
+    -0.44586, 0.16406, -0.20653, 0.21811, -0.29917, 0.28759, -0.05597, 0.03281,
+    -0.32619, -0.00965, 0.31847, -0.37252, 0.18722, -0.11002, -0.22969, -0.06369,
+    -0.39568, 0.36866, -0.45744, -0.31847, 0.14476, -0.22583, -0.49219, 0.37638,
+    -0.19494, -0.13318, 0.39182, -0.35322, 0.29531, -0.24127, 0.21039, -0.18722,
+    0.45358, 0.31461, -0.13318, -0.01737, -0.36094, 0.12932, -0.25671, 0.43814,
+    -0.16792, 0.23355, -0.22197, 0.44972, -0.42270, 0.33392, 0.42656, 0.11774,
+    -0.13318, 0.19494, -0.03667, 0.44972, 0.24513, -0.15248, 0.08300, -0.33006,
+    0.00579, 0.12546, 0.19494, 0.05983, -0.15634, 0.14476, 0.36480, -0.04053,
+    -0.33006, 0.25671, -0.46903, 0.37252, 0.48833, -0.09458, -0.41112, 0.19108,
+    0.08686, -0.46903, -0.07528, 0.04053, -0.26829, -0.02895, 0.22197, -0.34164,
+    0.47289, -0.21811, 0.06756, -0.38410, -0.27987, -0.06369, 0.27987, 0.43814,
+    -0.25671, -0.39182, 0.49219, -0.27601, -0.07914, -0.48061, 0.42656, -0.38410,
+    0.11002, 0.03667, -0.27215, 0.15634, 0.07528, -0.22197, 0.33006, 0.38410,
+    -0.34936, 0.27987, 0.15248, 0.40340, 0.09844, -0.16406, -0.46131, 0.03281,
+    -0.29531, 0.31461, -0.10616, 0.39954, 0.01351, 0.33778, -0.43814, 0.17178,
+    -0.08686, 0.23741, -0.44586, 0.33778, -0.00193, -0.31461, 0.23741, -0.12932,
+    -0.22583, -0.06756, 0.40340, -0.16792, -0.43428, 0.01351, -0.14476, -0.04053,
+    -0.29145, 0.46517, -0.13704, -0.39182, -0.32233, 0.29531, 0.38410, 0.16020,
+    -0.44200, 0.26443, 0.12546, -0.42270, 0.21425, -0.19881, -0.35708, 0.04825,
+    0.36480, -0.02895, -0.21425, 0.09072, 0.41498, 0.18336, 0.04439, 0.29917,
+    0.47675, -0.40340, 0.27601, -0.31461, 0.31075, 0.17564, 0.24899, -0.45744,
+    0.05597, -0.19494, 0.00193, 0.36094, 0.24127, -0.09844, -0.24513, -0.00965,
+    -0.17564, -0.05597, -0.34550, -0.24899, 0.48061, 0.15248, -0.11388, 0.45358,
+    -0.16406, -0.32233, 0.31461, -0.11774, -0.36866, -0.18722, -0.25671, -0.44200,
+    0.13318, -0.02123, 0.19881, -0.10616, 0.43042, -0.36866, -0.24899, 0.41112,
+    0.11002, 0.21425, -0.25671, -0.47675, -0.04439, 0.13704, -0.37252, 0.43814,
+    0.19108, 0.03667, 0.35708, -0.14090, 0.08300, -0.02123, -0.30303, -0.48061,
+    0.11774, 0.20267, -0.43042, 0.25285, 0.14090, -0.04439, 0.38796, 0.34550,
+    -0.34164, -0.19494, 0.05983, -0.48447, 0.09844, -0.00579, -0.07914, 0.33778,
+    -0.41498, -0.10230, 0.30689, 0.17178, 0.48833, -0.20267, 0.07914, 0.33392,
+    -0.48833, -0.30689, 0.41498, 0.22969, -0.44586, 0.32233, 0.25285, 0.39182,
+    -0.23355, 0.01737, 0.42270, -0.27987, 0.46903, -0.47289, 0.02123, -0.09072,
+    0.21811, 0.44586, -0.25285, 0.36480, -0.29145, 0.47289, -0.18722, 0.14476,
+    -0.31461, 0.43814, -0.36094, 0.04439, -0.29917, -0.41884, 0.25285, -0.11774,
+    0.46131, 0.11388, -0.21039, -0.07528, -0.38024, -0.26057, 0.06369, -0.05983,
+    0.29145, -0.40340, -0.09072, 0.06756, -0.16020, 0.27601, -0.31075, 0.10616,
+    -0.14090, -0.43042, 0.25671, -0.05211, -0.13318, 0.23355, -0.44972, 0.02895,
+    0.26829, -0.02895, -0.17950, 0.37252, -0.13704, 0.40726, 0.01351, -0.26443,
+    -0.03281, -0.40340, 0.27987, 0.17564, 0.02509, 0.44200, -0.15248, -0.34550,
+    0.14862, -0.19881, -0.01351, 0.36866, -0.38796, 0.19494, -0.22197, 0.32619,
+    -0.37638, 0.00193, 0.30689, 0.12160, -0.39182, 0.16792, -0.34550, 0.39954,
+    -0.23355, 0.09072, -0.43428, 0.22969, -0.06369, 0.12546, -0.35322, 0.30689,
+    -0.09844, 0.06756, 0.38410, -0.33392, -0.18336, 0.35322, 0.21039, -0.42270,
+    0.48833, 0.33006, 0.21811, -0.33392, 0.12932, -0.05211, 0.39568, 0.04825,
+    0.48061, 0.17950, -0.31847, -0.21811, 0.38024, 0.05211, 0.32233, -0.06756,
+    -0.12546, 0.46131, 0.16020, -0.25285, 0.29531, -0.44972, 0.17950, -0.16406,
+    0.22583, -0.46131, -0.27601, -0.00579, 0.12932, -0.47289, -0.09844, 0.10230,
+    -0.28759, -0.12160, -0.49219, -0.24127, 0.44586, -0.11388, -0.45358, -0.27215,
+    -0.17178, -0.07528, -0.47675, 0.43042, -0.02509, -0.27215, -0.19108, 0.19881,
+    -0.49219, -0.37252, 0.33392, -0.00193, -0.33006, -0.20267, 0.48061, 0.34164,
+    -0.22969, 0.42270, -0.12160, 0.31075, 0.46903, -0.22583, 0.27215, -0.02509,
+    0.03281, 0.40340, 0.25671, 0.08686, 0.00965, 0.29145, -0.41112, 0.14090,
+    0.24513, 0.34164, 0.08686, -0.14862, 0.27601, -0.42656, 0.48447, 0.09844,
+    0.26443, -0.27987, 0.05597, -0.10230, 0.43428, 0.08686, 0.02895, -0.38024,
+    0.15634, 0.09458, -0.36480, 0.18336, -0.05211, -0.40726, 0.36866, -0.33778,
+    -0.19881, 0.16020, -0.37638, -0.16020, -0.29917, 0.20267, 0.41884, -0.01737,
+    -0.34936, -0.24127, 0.02509, 0.20653, -0.36480, -0.08686, 0.01737, -0.33778,
+    0.41498, -0.03667, 0.37638, -0.17178, -0.47289, 0.26829, -0.28759, -0.05597,
+    0.35708, 0.00193, 0.25285, -0.15634, -0.30303, 0.06369, 0.22197, 0.45358,
+    -0.43814, 0.30303, -0.04053, 0.46517, 0.35322, -0.21039, 0.06756, -0.14090,
+    0.37638, -0.43042, 0.45744, -0.29531, 0.39568, 0.14862, 0.23741, -0.13704,
+    -0.21425, 0.16406, -0.40726, 0.22583, 0.13318, 0.38796, -0.12932, -0.43428,
+    -0.31461, -0.20653, 0.46131, -0.45358, 0.39568, -0.24513, -0.14090, 0.11002,
+    -0.08300, -0.26829, 0.05211, -0.46517, -0.09844, -0.39568, -0.32619, -0.06369,
+    0.16792, 0.28373, 0.11388, -0.04439, -0.18336, -0.44200, 0.35322, -0.26057,
+    -0.46517, 0.31075, -0.07914, -0.34164, -0.24513, -0.02123, 0.19108, 0.44200,
+    0.04825, -0.07914, -0.39954, 0.12160, 0.29145, 0.00965, -0.37638, 0.32233,
+    0.20267, -0.17564, 0.39182, 0.12160, 0.18336, 0.32619, 0.26057, 0.49219,
+    -0.48447, -0.20653, -0.10616, -0.38796, 0.31847, 0.07528, -0.01737, 0.44586,
+    0.11774, 0.02509, 0.47289, 0.07142, 0.33392, -0.38410, -0.17950, 0.28373,
+    // Wrapped values
+    -0.26057, 0.32619, 0.21039
+};
+
 HWY_EXPORT(GetWriteToOutputStage);
 
 namespace {
@@ -786,12 +1101,13 @@ std::unique_ptr<RenderPipelineStage> GetWriteToImage3FStage(
 }
 
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
-    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
+    const ImageOutput& main_output, const Rect& output_rect, bool has_alpha,
     bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
-    std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager) {
+    bool ycbcr_input, std::vector<ImageOutput>& extra_output,
+    JxlMemoryManager* memory_manager) {
   return HWY_DYNAMIC_DISPATCH(GetWriteToOutputStage)(
-      main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
-      undo_orientation, extra_output, memory_manager);
+      main_output, output_rect, has_alpha, unpremul_alpha, alpha_c,
+      undo_orientation, ycbcr_input, extra_output, memory_manager);
 }
 
 }  // namespace jxl
@@ -12,6 +12,7 @@
 #include <memory>
 #include <vector>
 
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/dec_cache.h"
 #include "lib/jxl/dec_xyb.h"
 #include "lib/jxl/image.h"
@@ -21,6 +22,13 @@
 
 namespace jxl {
 
+// 32x32 blue noise dithering pattern from
+// https://momentsingraphics.de/BlueNoise.html#Downloads scaled to have
+// an average of 0 and be fully contained in (0.49219 to -0.49219).
+// In SIMD codepath we could load up to 128 bits, so need 3 extra (32-bit)
+// elements for zero-cost wrapping.
+extern const float kDither[1024 + 3];
+
 std::unique_ptr<RenderPipelineStage> GetWriteToImageBundleStage(
     ImageBundle* image_bundle, const OutputEncodingInfo& output_encoding_info);
 
@@ -28,11 +36,14 @@ std::unique_ptr<RenderPipelineStage> GetWriteToImageBundleStage(
 std::unique_ptr<RenderPipelineStage> GetWriteToImage3FStage(
     JxlMemoryManager* memory_manager, Image3F* image);
 
-// Gets a stage to write to a pixel callback or image buffer.
+// Gets a stage to write the region "output_rect" of the image to a pixel
+// callback or image buffer. If "ycbcr_input" is set, the color channels hold
+// the YCbCr values of a YCbCr frame, which requires a YCbCr output layout.
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
-    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
+    const ImageOutput& main_output, const Rect& output_rect, bool has_alpha,
     bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
-    std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager);
+    bool ycbcr_input, std::vector<ImageOutput>& extra_output,
+    JxlMemoryManager* memory_manager);
 
 }  // namespace jxl
 
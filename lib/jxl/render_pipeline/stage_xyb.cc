@@ -5,16 +5,26 @@
 
 #include "lib/jxl/render_pipeline/stage_xyb.h"
 
+#include <jxl/types.h>
+
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <memory>
+#include <vector>
 
+#include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/sanitizers.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/dec_cache.h"
 #include "lib/jxl/dec_xyb.h"
+#include "lib/jxl/memory_manager_internal.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+#include "lib/jxl/render_pipeline/stage_write.h"
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jxl/render_pipeline/stage_xyb.cc"
@@ -22,6 +32,7 @@
 #include <hwy/highway.h>
 
 #include "lib/jxl/cms/opsin_params.h"
+#include "lib/jxl/cms/transfer_functions-inl.h"
 #include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
 #include "lib/jxl/dec_xyb-inl.h"
 
@@ -29,6 +40,15 @@ HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
 
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Clamp;
+using hwy::HWY_NAMESPACE::NearestInt;
+using hwy::HWY_NAMESPACE::Or;
+using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::ShiftLeft;
+using hwy::HWY_NAMESPACE::ShiftRight;
+using hwy::HWY_NAMESPACE::VFromD;
+
 class XYBStage : public RenderPipelineStage {
  public:
   explicit XYBStage(const OutputEncodingInfo& output_encoding_info)
@@ -112,48 +132,123 @@ std::unique_ptr<RenderPipelineStage> GetXYBStage(
   return jxl::make_unique<XYBStage>(output_encoding_info);
 }
 
-// NOLINTNEXTLINE(google-readability-namespace-comments)
-}  // namespace HWY_NAMESPACE
-}  // namespace jxl
-HWY_AFTER_NAMESPACE();
-
-#if HWY_ONCE
-namespace jxl {
+#if !JXL_HIGH_PRECISION
+// Conversions of sRGB values to output samples, as done by the write stage.
+struct ToUint8 {
+  using T = uint8_t;
+  // Applies the ordered dithering of the write stage, at the same positions.
+  template <class D>
+  VFromD<Rebind<T, D>> operator()(D d, VFromD<D> v, size_t x, size_t y) const {
+    const size_t pos = (y % 32) * 32 + (x % 32);
+#if HWY_TARGET != HWY_SCALAR
+    const auto dither = LoadDup128(d, kDither + pos);
+#else
+    const auto dither = LoadU(d, kDither + pos);
+#endif
+    const auto vmul = Set(d, mul);
+    v = Clamp(Zero(d), Add(Mul(v, vmul), dither), vmul);
+    return DemoteTo(Rebind<T, D>(), NearestInt(v));
+  }
+  float mul;
+  bool swap_endianness;
+};
 
-HWY_EXPORT(GetXYBStage);
+struct ToUint16 {
+  using T = uint16_t;
+  template <class D>
+  VFromD<Rebind<T, D>> operator()(D d, VFromD<D> v, size_t /*x*/,
+                                  size_t /*y*/) const {
+    const auto vmul = Set(d, mul);
+    v = Clamp(Zero(d), Mul(v, vmul), vmul);
+    const auto out = DemoteTo(Rebind<T, D>(), NearestInt(v));
+    if (!swap_endianness) return out;
+    return Or(ShiftLeft<8>(out), ShiftRight<8>(out));
+  }
+  float mul;
+  bool swap_endianness;
+};
 
-std::unique_ptr<RenderPipelineStage> GetXYBStage(
-    const OutputEncodingInfo& output_encoding_info) {
-  return HWY_DYNAMIC_DISPATCH(GetXYBStage)(output_encoding_info);
-}
+struct ToFloat16 {
+  using T = uint16_t;
+  template <class D>
+  VFromD<Rebind<T, D>> operator()(D /*d*/, VFromD<D> v, size_t /*x*/,
+                                  size_t /*y*/) const {
+    const Rebind<T, D> du;
+    const auto out = BitCast(du, DemoteTo(Rebind<hwy::float16_t, D>(), v));
+    if (!swap_endianness) return out;
+    return Or(ShiftLeft<8>(out), ShiftRight<8>(out));
+  }
+  float mul;
+  bool swap_endianness;
+};
 
-#if !JXL_HIGH_PRECISION
-namespace {
+// Converts from XYB to sRGB and writes interleaved RGB or RGBA samples of a
+// buffer in a single pass, instead of the XYB, from-linear and write stages.
+// Except for the NEON fixed point path for 8-bit samples, the result is the
+// same as that of those stages: like the from-linear stage, integer samples
+// use the tabulated transfer function.
 class FastXYBStage : public RenderPipelineStage {
  public:
-  FastXYBStage(uint8_t* rgb, size_t stride, size_t width, size_t height,
-               bool rgba, bool has_alpha, size_t alpha_c)
+  FastXYBStage(const ImageOutput& main_output, size_t width, size_t height,
+               bool has_alpha, size_t alpha_c, const OpsinParams& opsin_params,
+               JxlMemoryManager* memory_manager)
       : RenderPipelineStage(RenderPipelineStage::Settings()),
-        rgb_(rgb),
-        stride_(stride),
+        buffer_(static_cast<uint8_t*>(main_output.buffer)),
+        stride_(main_output.stride),
         width_(width),
         height_(height),
-        rgba_(rgba),
+        data_type_(main_output.format.data_type),
+        bits_per_sample_(main_output.bits_per_sample),
+        swap_endianness_(SwapEndianness(main_output.format.endianness)),
+        rgba_(main_output.format.num_channels == 4),
         has_alpha_(has_alpha),
-        alpha_c_(alpha_c) {}
+        alpha_c_(alpha_c),
+        opsin_params_(opsin_params),
+        memory_manager_(memory_manager) {
+    if ((data_type_ == JXL_TYPE_UINT8 || data_type_ == JXL_TYPE_UINT16) &&
+        bits_per_sample_ <= 16) {
+      srgb_lut_ = jxl::make_unique<TfLut>(MakeSRGBTfLut(bits_per_sample_));
+    }
+  }
+
+  Status PrepareForThreads(size_t num_threads) override {
+    const HWY_FULL(float) d;
+    // A vector of 4 channels of at most 2 bytes each.
+    temp_out_.resize(num_threads);
+    for (AlignedMemory& temp : temp_out_) {
+      JXL_ASSIGN_OR_RETURN(temp, AlignedMemory::Create(memory_manager_,
+                                                       8 * Lanes(d)));
+    }
+    return true;
+  }
 
   Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
                     size_t xextra, size_t xsize, size_t xpos, size_t ypos,
                     size_t thread_id) const final {
-    if (ypos >= height_) return true;
+    if (ypos >= height_ || xpos >= width_) return true;
     JXL_ENSURE(xextra == 0);
     const float* xyba[4] = {
         GetInputRow(input_rows, 0, 0), GetInputRow(input_rows, 1, 0),
         GetInputRow(input_rows, 2, 0),
         has_alpha_ ? GetInputRow(input_rows, alpha_c_, 0) : nullptr};
-    uint8_t* out_buf = rgb_ + stride_ * ypos + (rgba_ ? 4 : 3) * xpos;
-    return FastXYBTosRGB8(xyba, out_buf, rgba_,
-                          xsize + xpos <= width_ ? xsize : width_ - xpos);
+    const size_t len = std::min(xsize, width_ - xpos);
+    const float mul = (1u << bits_per_sample_) - 1;
+    uint8_t* row = buffer_ + stride_ * ypos;
+    uint8_t* temp = temp_out_[thread_id].address<uint8_t>();
+    if (data_type_ == JXL_TYPE_UINT8) {
+      if (HasFastXYBTosRGB8() && bits_per_sample_ == 8) {
+        return FastXYBTosRGB8(xyba, row + (rgba_ ? 4 : 3) * xpos, rgba_, len);
+      }
+      WriteRow(ToUint8{mul, false}, xyba, len, xpos, ypos, row, temp);
+    } else if (data_type_ == JXL_TYPE_UINT16) {
+      WriteRow(ToUint16{mul, swap_endianness_}, xyba, len, xpos, ypos, row,
+               temp);
+    } else {
+      JXL_ENSURE(data_type_ == JXL_TYPE_FLOAT16);
+      WriteRow(ToFloat16{mul, swap_endianness_}, xyba, len, xpos, ypos, row,
+               temp);
+    }
+    return true;
   }
 
   RenderPipelineChannelMode GetChannelMode(size_t c) const final {
@@ -165,25 +260,120 @@ class FastXYBStage : public RenderPipelineStage {
   const char* GetName() const override { return "FastXYB"; }
 
  private:
-  uint8_t* rgb_;
+  template <typename Convert>
+  void WriteRow(const Convert& convert, const float* xyba[4], size_t len,
+                size_t xpos, size_t ypos, uint8_t* row, uint8_t* temp) const {
+    using T = typename Convert::T;
+    const HWY_FULL(float) d;
+    const Rebind<T, decltype(d)> du;
+    const size_t num_channels = rgba_ ? 4 : 3;
+    T* out = reinterpret_cast<T*>(row) + num_channels * xpos;
+    const size_t xsize_v = RoundUpTo(len, Lanes(d));
+    for (size_t c = 0; c < 4; ++c) {
+      if (xyba[c] == nullptr) continue;
+      msan::UnpoisonMemory(xyba[c] + len, sizeof(float) * (xsize_v - len));
+    }
+    for (size_t x = 0; x < len; x += Lanes(d)) {
+      auto r = Undefined(d);
+      auto g = Undefined(d);
+      auto b = Undefined(d);
+      XybToRgb(d, LoadU(d, xyba[0] + x), LoadU(d, xyba[1] + x),
+               LoadU(d, xyba[2] + x), opsin_params_, &r, &g, &b);
+      if (srgb_lut_) {
+        r = srgb_lut_->EncodedFromDisplay(d, r);
+        g = srgb_lut_->EncodedFromDisplay(d, g);
+        b = srgb_lut_->EncodedFromDisplay(d, b);
+      } else {
+        r = FastLinearToSRGB(d, r);
+        g = FastLinearToSRGB(d, g);
+        b = FastLinearToSRGB(d, b);
+      }
+      // The last vector of the row goes through temp, to not write past it.
+      const bool partial = x + Lanes(d) > len;
+      T* dst = partial ? reinterpret_cast<T*>(temp) : out + num_channels * x;
+      const size_t xout = xpos + x;
+      if (rgba_) {
+        const auto a = xyba[3] ? LoadU(d, xyba[3] + x) : Set(d, 1.0f);
+        StoreInterleaved4(convert(d, r, xout, ypos), convert(d, g, xout, ypos),
+                          convert(d, b, xout, ypos), convert(d, a, xout, ypos),
+                          du, dst);
+      } else {
+        StoreInterleaved3(convert(d, r, xout, ypos), convert(d, g, xout, ypos),
+                          convert(d, b, xout, ypos), du, dst);
+      }
+      if (partial) {
+        memcpy(out + num_channels * x, dst,
+               sizeof(T) * num_channels * (len - x));
+      }
+    }
+    for (size_t c = 0; c < 4; ++c) {
+      if (xyba[c] == nullptr) continue;
+      msan::PoisonMemory(xyba[c] + len, sizeof(float) * (xsize_v - len));
+    }
+  }
+
+  uint8_t* buffer_;
   size_t stride_;
   size_t width_;
   size_t height_;
+  JxlDataType data_type_;
+  size_t bits_per_sample_;
+  bool swap_endianness_;
   bool rgba_;
   bool has_alpha_;
   size_t alpha_c_;
-  std::vector<float> opaque_alpha_;
+  const OpsinParams opsin_params_;
+  JxlMemoryManager* memory_manager_;
+  std::vector<AlignedMemory> temp_out_;
+  // For integer samples, as in the from-linear stage.
+  std::unique_ptr<TfLut> srgb_lut_;
 };
 
-}  // namespace
+std::unique_ptr<RenderPipelineStage> GetFastXYBTosRGBStage(
+    const ImageOutput& main_output, size_t width, size_t height,
+    bool has_alpha, size_t alpha_c, const OpsinParams& opsin_params,
+    JxlMemoryManager* memory_manager) {
+  return jxl::make_unique<FastXYBStage>(main_output, width, height, has_alpha,
+                                        alpha_c, opsin_params, memory_manager);
+}
+
+bool FastXYBTosRGBStageIsApproximate() { return HasFastXYBTosRGB8(); }
+#endif  // !JXL_HIGH_PRECISION
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+
+HWY_EXPORT(GetXYBStage);
+
+std::unique_ptr<RenderPipelineStage> GetXYBStage(
+    const OutputEncodingInfo& output_encoding_info) {
+  return HWY_DYNAMIC_DISPATCH(GetXYBStage)(output_encoding_info);
+}
+
+#if !JXL_HIGH_PRECISION
+HWY_EXPORT(GetFastXYBTosRGBStage);
+
+std::unique_ptr<RenderPipelineStage> GetFastXYBTosRGBStage(
+    const ImageOutput& main_output, size_t width, size_t height,
+    bool has_alpha, size_t alpha_c, const OpsinParams& opsin_params,
+    JxlMemoryManager* memory_manager) {
+  return HWY_DYNAMIC_DISPATCH(GetFastXYBTosRGBStage)(
+      main_output, width, height, has_alpha, alpha_c, opsin_params,
+      memory_manager);
+}
+
+HWY_EXPORT(FastXYBTosRGBStageIsApproximate);
 
-std::unique_ptr<RenderPipelineStage> GetFastXYBTosRGB8Stage(
-    uint8_t* rgb, size_t stride, size_t width, size_t height, bool rgba,
-    bool has_alpha, size_t alpha_c) {
-  if (!HasFastXYBTosRGB8()) return nullptr;
-  return make_unique<FastXYBStage>(rgb, stride, width, height, rgba, has_alpha,
-                                   alpha_c);
+bool FastXYBTosRGBStageIsApproximate() {
+  return HWY_DYNAMIC_DISPATCH(FastXYBTosRGBStageIsApproximate)();
 }
+#else
+bool FastXYBTosRGBStageIsApproximate() { return false; }
 #endif
 
 }  // namespace jxl
@@ -6,10 +6,12 @@
 #ifndef LIB_JXL_RENDER_PIPELINE_STAGE_XYB_H_
 #define LIB_JXL_RENDER_PIPELINE_STAGE_XYB_H_
 
+#include <jxl/memory_manager.h>
+
 #include <cstddef>
-#include <cstdint>
 #include <memory>
 
+#include "lib/jxl/dec_cache.h"
 #include "lib/jxl/dec_xyb.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
 
@@ -19,11 +21,18 @@ namespace jxl {
 std::unique_ptr<RenderPipelineStage> GetXYBStage(
     const OutputEncodingInfo& output_encoding_info);
 
-// Gets a stage to convert with fixed point arithmetic from XYB to sRGB8 and
-// write to a uint8 buffer.
-std::unique_ptr<RenderPipelineStage> GetFastXYBTosRGB8Stage(
-    uint8_t* rgb, size_t stride, size_t width, size_t height, bool rgba,
-    bool has_alpha, size_t alpha_c);
+// Gets a stage to convert from XYB to sRGB and write the samples of the
+// interleaved RGB or RGBA buffer of main_output, which must be of type uint8,
+// uint16 or float16, in a single pass.
+std::unique_ptr<RenderPipelineStage> GetFastXYBTosRGBStage(
+    const ImageOutput& main_output, size_t width, size_t height,
+    bool has_alpha, size_t alpha_c, const OpsinParams& opsin_params,
+    JxlMemoryManager* memory_manager);
+
+// Whether the stage of GetFastXYBTosRGBStage writes uint8 samples with an
+// approximate fixed point conversion on this CPU, rather than with the same
+// conversion as the separate stages.
+bool FastXYBTosRGBStageIsApproximate();
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_XYB_H_
@@ -225,6 +225,11 @@ class ThreadPoolForTests {
     pool_ =
         jxl::make_unique<ThreadPool>(JxlThreadParallelRunner, runner_.get());
   }
+  explicit ThreadPoolForTests(const JxlThreadParallelRunnerOptions& options) {
+    runner_ = JxlThreadParallelRunnerMake(/* memory_manager */ nullptr, options);
+    pool_ =
+        jxl::make_unique<ThreadPool>(JxlThreadParallelRunner, runner_.get());
+  }
   ThreadPoolForTests(const ThreadPoolForTests&) = delete;
   ThreadPoolForTests& operator&(const ThreadPoolForTests&) = delete;
   ThreadPool* get() { return pool_.get(); }
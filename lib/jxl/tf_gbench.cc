@@ -94,6 +94,32 @@ HWY_NOINLINE void BM_PQEFD(benchmark::State& state) {
   RUN_BENCHMARK(tf_pq.EncodedFromDisplay);
 }
 
+// Tables for 8-bit and 16-bit output, as used by the decoder for integer
+// output.
+HWY_NOINLINE void BM_LutSRGB8(benchmark::State& state) {
+  const TfLut lut([](double x) { return TF_SRGB::EncodedFromDisplay(x); }, 8,
+                  0.0031308f);
+  RUN_BENCHMARK(lut.EncodedFromDisplay);
+}
+
+HWY_NOINLINE void BM_LutSRGB16(benchmark::State& state) {
+  const TfLut lut([](double x) { return TF_SRGB::EncodedFromDisplay(x); }, 16,
+                  0.0031308f);
+  RUN_BENCHMARK(lut.EncodedFromDisplay);
+}
+
+HWY_NOINLINE void BM_LutPQ10(benchmark::State& state) {
+  const TfLut lut(
+      [](double x) { return TF_PQ_Base::EncodedFromDisplay(10000.0, x); }, 10);
+  RUN_BENCHMARK(lut.EncodedFromDisplay);
+}
+
+HWY_NOINLINE void BM_LutPQ16(benchmark::State& state) {
+  const TfLut lut(
+      [](double x) { return TF_PQ_Base::EncodedFromDisplay(10000.0, x); }, 16);
+  RUN_BENCHMARK(lut.EncodedFromDisplay);
+}
+
 HWY_NOINLINE void BM_PQSlowDFE(benchmark::State& state) {
   RUN_BENCHMARK_SCALAR(TF_PQ_Base::DisplayFromEncoded, 10000.0);
 }
@@ -115,6 +141,10 @@ HWY_EXPORT(BM_FastSRGB);
 HWY_EXPORT(BM_TFSRGB);
 HWY_EXPORT(BM_PQDFE);
 HWY_EXPORT(BM_PQEFD);
+HWY_EXPORT(BM_LutSRGB8);
+HWY_EXPORT(BM_LutSRGB16);
+HWY_EXPORT(BM_LutPQ10);
+HWY_EXPORT(BM_LutPQ16);
 HWY_EXPORT(BM_PQSlowDFE);
 HWY_EXPORT(BM_PQSlowEFD);
 
@@ -135,6 +165,18 @@ void BM_PQDFE(benchmark::State& state) {
 void BM_PQEFD(benchmark::State& state) {
   HWY_DYNAMIC_DISPATCH(BM_PQEFD)(state);
 }
+void BM_LutSRGB8(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_LutSRGB8)(state);
+}
+void BM_LutSRGB16(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_LutSRGB16)(state);
+}
+void BM_LutPQ10(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_LutPQ10)(state);
+}
+void BM_LutPQ16(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_LutPQ16)(state);
+}
 void BM_PQSlowDFE(benchmark::State& state) {
   HWY_DYNAMIC_DISPATCH(BM_PQSlowDFE)(state);
 }
@@ -147,8 +189,12 @@ void BM_SRGB_pow(benchmark::State& state) { RUN_BENCHMARK_SCALAR(SRGB_pow, 0); }
 BENCHMARK(BM_FastSRGB);
 BENCHMARK(BM_TFSRGB);
 BENCHMARK(BM_SRGB_pow);
+BENCHMARK(BM_LutSRGB8);
+BENCHMARK(BM_LutSRGB16);
 BENCHMARK(BM_PQDFE);
 BENCHMARK(BM_PQEFD);
+BENCHMARK(BM_LutPQ10);
+BENCHMARK(BM_LutPQ16);
 BENCHMARK(BM_PQSlowDFE);
 BENCHMARK(BM_PQSlowEFD);
 
@@ -177,6 +177,7 @@ libjxl_dec_sources = [
     "jxl/dec_noise.h",
     "jxl/dec_patch_dictionary.cc",
     "jxl/dec_patch_dictionary.h",
+    "jxl/dec_trace.h",
     "jxl/dec_transforms-inl.h",
     "jxl/dec_xyb-inl.h",
     "jxl/dec_xyb.cc",
@@ -243,6 +244,8 @@ libjxl_dec_sources = [
     "jxl/passes_state.cc",
     "jxl/passes_state.h",
     "jxl/patch_dictionary_internal.h",
+    "jxl/pooled_memory_manager.cc",
+    "jxl/pooled_memory_manager.h",
     "jxl/quant_weights.cc",
     "jxl/quant_weights.h",
     "jxl/quantizer-inl.h",
@@ -458,9 +461,12 @@ libjxl_gbench_sources = [
     "extras/tone_mapping_gbench.cc",
     "jxl/dct_gbench.cc",
     "jxl/dec_external_image_gbench.cc",
+    "jxl/decode_gbench.cc",
     "jxl/enc_external_image_gbench.cc",
+    "jxl/encode_gbench.cc",
     "jxl/splines_gbench.cc",
     "jxl/tf_gbench.cc",
+    "threads/thread_parallel_runner_gbench.cc",
 ]
 
 libjxl_jpegli_lib_version = 62
@@ -650,18 +656,24 @@ libjxl_tests = [
     "jxl/splines_test.cc",
     "jxl/toc_test.cc",
     "jxl/xorshift128plus_test.cc",
+    "threads/shared_parallel_runner_test.cc",
     "threads/thread_parallel_runner_test.cc",
 ]
 
 libjxl_threads_public_headers = [
     "include/jxl/resizable_parallel_runner.h",
     "include/jxl/resizable_parallel_runner_cxx.h",
+    "include/jxl/shared_parallel_runner.h",
+    "include/jxl/shared_parallel_runner_cxx.h",
     "include/jxl/thread_parallel_runner.h",
     "include/jxl/thread_parallel_runner_cxx.h",
 ]
 
 libjxl_threads_sources = [
     "threads/resizable_parallel_runner.cc",
+    "threads/shared_parallel_runner.cc",
+    "threads/thread_affinity.cc",
+    "threads/thread_affinity.h",
     "threads/thread_parallel_runner.cc",
     "threads/thread_parallel_runner_internal.cc",
     "threads/thread_parallel_runner_internal.h",
@@ -34,6 +34,8 @@ list(APPEND JPEGXL_INTERNAL_TESTS
   # TODO(deymo): Move this to tools/
   ../tools/djxl_fuzzer_test.cc
   ../tools/gauss_blur_test.cc
+  ../tools/streaming_decode_test.cc
+  ../tools/streaming_encode_test.cc
 )
 
 set(JXL_WASM_TEST_LINK_FLAGS "")
@@ -87,6 +89,10 @@ foreach (TESTFILE IN LISTS JPEGXL_INTERNAL_TESTS)
   if(TESTFILE STREQUAL ../tools/gauss_blur_test.cc)
     target_link_libraries(${TESTNAME} jxl_gauss_blur)
   endif()
+  if(TESTFILE STREQUAL ../tools/streaming_decode_test.cc OR
+     TESTFILE STREQUAL ../tools/streaming_encode_test.cc)
+    target_link_libraries(${TESTNAME} jxl_tool)
+  endif()
 
   # Output test targets in the test directory.
   set_target_properties(${TESTNAME} PROPERTIES PREFIX "tests/")
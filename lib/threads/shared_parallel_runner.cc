@@ -0,0 +1,207 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/jxl_threads_export.h>
+#include <jxl/memory_manager.h>
+#include <jxl/parallel_runner.h>
+#include <jxl/shared_parallel_runner.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jpegxl {
+namespace {
+
+// A runner with weight w advances its pass by kStrideOne / w per task it gets
+// executed; the runner with the smallest pass is served next.
+constexpr uint64_t kStrideOne = 1 << 20;
+
+class SharedPool;
+
+struct SharedRunner {
+  SharedPool* pool;
+  uint64_t stride;
+  uint64_t pass = 0;  // guarded by SharedPool::mutex_
+};
+
+// State of one Run call; lives on the stack of the calling thread. All fields
+// except the constant ones are guarded by SharedPool::mutex_.
+struct Job {
+  SharedRunner* runner;
+  JxlParallelRunFunction func;
+  void* jpegxl_opaque;
+  uint32_t next_task;
+  uint32_t end_task;
+  uint32_t num_pending;
+  std::condition_variable done;
+};
+
+// The pool whose worker is running on the current thread, if any.
+thread_local const SharedPool* current_pool = nullptr;
+
+// A fixed set of worker threads that serves the ranges of any number of
+// concurrent Run calls, in proportion to the weights of their runners.
+class SharedPool {
+ public:
+  explicit SharedPool(size_t num_worker_threads) {
+    workers_.reserve(num_worker_threads);
+    for (size_t i = 0; i < num_worker_threads; i++) {
+      // Thread 0 is left to callers that run their tasks themselves.
+      workers_.emplace_back([this, i]() { WorkerBody(i + 1); });
+    }
+  }
+
+  ~SharedPool() {
+    {
+      std::unique_lock<std::mutex> l(mutex_);
+      exit_ = true;
+    }
+    work_available_.notify_all();
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  JxlParallelRetCode Run(SharedRunner* runner, void* jpegxl_opaque,
+                         JxlParallelRunInit init, JxlParallelRunFunction func,
+                         uint32_t start, uint32_t end) {
+    if (start > end) return JXL_PARALLEL_RET_RUNNER_ERROR;
+    if (start == end) return JXL_PARALLEL_RET_SUCCESS;
+
+    JxlParallelRetCode ret = init(jpegxl_opaque, workers_.size() + 1);
+    if (ret != 0) return ret;
+
+    // Without workers, or when called from a task of this pool (blocking a
+    // worker on other workers could deadlock), run on the calling thread.
+    if (workers_.empty() || current_pool == this) {
+      for (uint32_t task = start; task < end; task++) {
+        func(jpegxl_opaque, task, 0);
+      }
+      return ret;
+    }
+
+    Job job;
+    job.runner = runner;
+    job.func = func;
+    job.jpegxl_opaque = jpegxl_opaque;
+    job.next_task = start;
+    job.end_task = end;
+    job.num_pending = end - start;
+    {
+      std::unique_lock<std::mutex> l(mutex_);
+      // A runner that was idle does not get to catch up on the share it did
+      // not use.
+      runner->pass = std::max(runner->pass, virtual_time_);
+      jobs_.push_back(&job);
+    }
+    work_available_.notify_all();
+
+    std::unique_lock<std::mutex> l(mutex_);
+    while (job.num_pending != 0) {
+      job.done.wait(l);
+    }
+    return ret;
+  }
+
+ private:
+  void WorkerBody(size_t thread_id) {
+    current_pool = this;
+    std::unique_lock<std::mutex> l(mutex_);
+    while (true) {
+      if (exit_) return;
+      if (jobs_.empty()) {
+        work_available_.wait(l);
+        continue;
+      }
+
+      // Serve the job whose runner is furthest behind its share.
+      size_t best = 0;
+      for (size_t i = 1; i < jobs_.size(); i++) {
+        if (jobs_[i]->runner->pass < jobs_[best]->runner->pass) best = i;
+      }
+      Job* job = jobs_[best];
+      const uint32_t remaining = job->end_task - job->next_task;
+      const uint32_t size = std::max<uint32_t>(
+          remaining / static_cast<uint32_t>(workers_.size() * 4), 1);
+      const uint32_t begin = job->next_task;
+      job->next_task += size;
+      if (job->next_task == job->end_task) {
+        jobs_.erase(jobs_.begin() + best);
+      }
+      virtual_time_ = job->runner->pass;
+      job->runner->pass += job->runner->stride * size;
+
+      l.unlock();
+      for (uint32_t task = begin; task < begin + size; task++) {
+        job->func(job->jpegxl_opaque, task, thread_id);
+      }
+      l.lock();
+
+      job->num_pending -= size;
+      if (job->num_pending == 0) {
+        // Notify under the lock: the caller destroys the job once it wakes.
+        job->done.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers_;
+
+  // Protects all the remaining variables and the mutable state of the jobs
+  // and runners.
+  std::mutex mutex_;
+
+  // Signaled when a job is added or the pool is destroyed.
+  std::condition_variable work_available_;
+
+  // Jobs that still have tasks to hand out.
+  std::vector<Job*> jobs_;
+
+  // Pass of the most recently served runner.
+  uint64_t virtual_time_ = 0;
+
+  bool exit_ = false;
+};
+
+}  // namespace
+}  // namespace jpegxl
+
+extern "C" {
+JXL_THREADS_EXPORT JxlParallelRetCode JxlSharedParallelRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+  jpegxl::SharedRunner* runner =
+      static_cast<jpegxl::SharedRunner*>(runner_opaque);
+  return runner->pool->Run(runner, jpegxl_opaque, init, func, start_range,
+                           end_range);
+}
+
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerPoolCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads) {
+  return new jpegxl::SharedPool(num_worker_threads);
+}
+
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerPoolDestroy(void* pool) {
+  delete static_cast<jpegxl::SharedPool*>(pool);
+}
+
+JXL_THREADS_EXPORT void* JxlSharedParallelRunnerCreate(void* pool,
+                                                       uint32_t weight) {
+  if (pool == nullptr || weight == 0) return nullptr;
+  jpegxl::SharedRunner* runner = new jpegxl::SharedRunner();
+  runner->pool = static_cast<jpegxl::SharedPool*>(pool);
+  runner->stride = std::max<uint64_t>(jpegxl::kStrideOne / weight, 1);
+  return runner;
+}
+
+JXL_THREADS_EXPORT void JxlSharedParallelRunnerDestroy(void* runner_opaque) {
+  delete static_cast<jpegxl::SharedRunner*>(runner_opaque);
+}
+}
@@ -0,0 +1,97 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/shared_parallel_runner.h>
+#include <jxl/shared_parallel_runner_cxx.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/testing.h"
+
+namespace jpegxl {
+namespace {
+
+// Many clients run concurrently on one pool; each task must run exactly once
+// with a thread id below the number of threads passed to init.
+TEST(SharedParallelRunnerTest, TestConcurrentClients) {
+  for (size_t num_workers : {0, 1, 3, 8}) {
+    JxlSharedParallelRunnerPoolPtr shared_pool =
+        JxlSharedParallelRunnerPoolMake(/*memory_manager=*/nullptr,
+                                        num_workers);
+    ASSERT_NE(nullptr, shared_pool.get());
+    const size_t kNumClients = 6;
+    std::vector<std::thread> clients;
+    std::atomic<size_t> num_errors{0};
+    for (size_t c = 0; c < kNumClients; ++c) {
+      clients.emplace_back([&, c]() {
+        JxlSharedParallelRunnerPtr runner =
+            JxlSharedParallelRunnerMake(shared_pool.get(), c + 1);
+        jxl::ThreadPool pool(JxlSharedParallelRunner, runner.get());
+        for (uint32_t num_tasks = 1; num_tasks < 300; num_tasks += 37) {
+          std::vector<std::atomic<int>> visits(num_tasks);
+          size_t max_threads = 0;
+          const auto init = [&](size_t num_threads) -> jxl::Status {
+            max_threads = num_threads;
+            return true;
+          };
+          const auto do_task = [&](uint32_t task,
+                                   size_t thread) -> jxl::Status {
+            if (thread >= max_threads) num_errors++;
+            visits[task].fetch_add(1);
+            return true;
+          };
+          if (!RunOnPool(&pool, 0, num_tasks, init, do_task, "Client")) {
+            num_errors++;
+          }
+          for (const auto& v : visits) {
+            if (v.load() != 1) num_errors++;
+          }
+        }
+      });
+    }
+    for (std::thread& client : clients) client.join();
+    EXPECT_EQ(0, num_errors.load());
+  }
+}
+
+// Calls from within a task run on the calling worker instead of blocking it.
+TEST(SharedParallelRunnerTest, TestNested) {
+  JxlSharedParallelRunnerPoolPtr shared_pool =
+      JxlSharedParallelRunnerPoolMake(/*memory_manager=*/nullptr, 2);
+  JxlSharedParallelRunnerPtr outer_runner =
+      JxlSharedParallelRunnerMake(shared_pool.get(), 1);
+  JxlSharedParallelRunnerPtr inner_runner =
+      JxlSharedParallelRunnerMake(shared_pool.get(), 1);
+  jxl::ThreadPool outer_pool(JxlSharedParallelRunner, outer_runner.get());
+  jxl::ThreadPool inner_pool(JxlSharedParallelRunner, inner_runner.get());
+  std::atomic<int> count{0};
+  const auto outer = [&](uint32_t, size_t) -> jxl::Status {
+    const auto inner = [&](uint32_t, size_t) -> jxl::Status {
+      count++;
+      return true;
+    };
+    return RunOnPool(&inner_pool, 0, 10, jxl::ThreadPool::NoInit, inner,
+                     "Inner");
+  };
+  EXPECT_TRUE(
+      RunOnPool(&outer_pool, 0, 8, jxl::ThreadPool::NoInit, outer, "Outer"));
+  EXPECT_EQ(80, count.load());
+}
+
+TEST(SharedParallelRunnerTest, TestInvalidWeight) {
+  JxlSharedParallelRunnerPoolPtr shared_pool =
+      JxlSharedParallelRunnerPoolMake(/*memory_manager=*/nullptr, 1);
+  EXPECT_EQ(nullptr, JxlSharedParallelRunnerMake(shared_pool.get(), 0).get());
+}
+
+}  // namespace
+}  // namespace jpegxl
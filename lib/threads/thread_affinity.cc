@@ -0,0 +1,116 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/threads/thread_affinity.h"
+
+#include <jxl/thread_parallel_runner.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace jpegxl {
+namespace {
+
+#if defined(__linux__)
+
+// Returns the CPUs the calling thread may run on, in increasing order.
+CpuSet AllowedCpus() {
+  CpuSet cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+// Returns the first line of a (small) sysfs file, or an empty string.
+std::string ReadSysfsLine(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file) return std::string();
+  char buffer[4096];
+  std::string line;
+  if (fgets(buffer, sizeof(buffer), file)) line = buffer;
+  fclose(file);
+  while (!line.empty() && (line.back() == '\n' || line.back() == ' ')) {
+    line.pop_back();
+  }
+  return line;
+}
+
+// Returns the allowed CPUs of each NUMA node that has any; empty if the
+// topology is not available.
+std::vector<CpuSet> AllowedCpusPerNode(const CpuSet& allowed) {
+  std::vector<CpuSet> nodes;
+  const CpuSet node_ids =
+      ParseCpuList(ReadSysfsLine("/sys/devices/system/node/online"));
+  for (int node : node_ids) {
+    const CpuSet node_cpus = ParseCpuList(ReadSysfsLine(
+        "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+    CpuSet cpus;
+    std::set_intersection(node_cpus.begin(), node_cpus.end(), allowed.begin(),
+                          allowed.end(), std::back_inserter(cpus));
+    if (!cpus.empty()) nodes.push_back(cpus);
+  }
+  return nodes;
+}
+
+#endif  // defined(__linux__)
+
+}  // namespace
+
+std::vector<CpuSet> AssignWorkerCpus(JxlThreadParallelRunnerAffinity affinity,
+                                     size_t num_workers) {
+  std::vector<CpuSet> assignment;
+  if (affinity == JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NONE ||
+      num_workers == 0) {
+    return assignment;
+  }
+#if defined(__linux__)
+  const CpuSet allowed = AllowedCpus();
+  if (allowed.empty()) return assignment;
+  if (affinity == JXL_THREAD_PARALLEL_RUNNER_AFFINITY_CORES) {
+    for (size_t i = 0; i < num_workers; ++i) {
+      assignment.push_back({allowed[i % allowed.size()]});
+    }
+    return assignment;
+  }
+  const std::vector<CpuSet> nodes = AllowedCpusPerNode(allowed);
+  // Pinning to the only node would not change anything.
+  if (nodes.size() < 2) return assignment;
+  for (size_t i = 0; i < num_workers; ++i) {
+    assignment.push_back(nodes[i * nodes.size() / num_workers]);
+  }
+#endif  // defined(__linux__)
+  return assignment;
+}
+
+bool PinCurrentThread(const CpuSet& cpus) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    CPU_SET(cpu, &set);
+  }
+  // On Linux, pid 0 refers to the calling thread, not the whole process.
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+}  // namespace jpegxl
@@ -0,0 +1,70 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Placement of worker threads on CPUs and NUMA nodes, see
+// JxlThreadParallelRunnerAffinity.
+
+#ifndef LIB_THREADS_THREAD_AFFINITY_H_
+#define LIB_THREADS_THREAD_AFFINITY_H_
+
+#include <jxl/thread_parallel_runner.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace jpegxl {
+
+using CpuSet = std::vector<int>;
+
+// Larger CPU numbers in a list are considered malformed.
+constexpr long kMaxCpus = 1 << 16;
+
+// Parses a Linux CPU or node list such as "0-3,8,10-11". Returns an empty set
+// if the list is malformed. Inline so that tests can use it although the
+// library does not export it.
+inline CpuSet ParseCpuList(const std::string& list) {
+  CpuSet cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t next = list.find(',', pos);
+    if (next == std::string::npos) next = list.size();
+    const std::string item = list.substr(pos, next - pos);
+    pos = next + 1;
+    const size_t dash = item.find('-');
+    char* end;
+    const long first = strtol(item.c_str(), &end, 10);
+    if (end == item.c_str() || first < 0) return CpuSet();
+    long last = first;
+    if (dash != std::string::npos) {
+      const char* second = item.c_str() + dash + 1;
+      last = strtol(second, &end, 10);
+      if (end == second || last < first) return CpuSet();
+    }
+    if (*end != '\0' || last >= kMaxCpus) return CpuSet();
+    for (long cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(static_cast<int>(cpu));
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+// Returns, for each of "num_workers" workers, the CPUs it should be restricted
+// to according to "affinity". Returns an empty vector if the workers should
+// not be pinned, e.g. if the topology cannot be determined on this platform.
+std::vector<CpuSet> AssignWorkerCpus(JxlThreadParallelRunnerAffinity affinity,
+                                     size_t num_workers);
+
+// Restricts the calling thread to "cpus". Returns false if this is not
+// supported or not permitted; the thread then keeps its previous affinity.
+bool PinCurrentThread(const CpuSet& cpus);
+
+}  // namespace jpegxl
+
+#endif  // LIB_THREADS_THREAD_AFFINITY_H_
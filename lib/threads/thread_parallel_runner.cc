@@ -76,6 +76,32 @@ JxlParallelRetCode JxlThreadParallelRunner(
 /// run on the main thread.
 void* JxlThreadParallelRunnerCreate(const JxlMemoryManager* memory_manager,
                                     size_t num_worker_threads) {
+  JxlThreadParallelRunnerOptions options;
+  JxlThreadParallelRunnerDefaultOptions(&options);
+  options.num_worker_threads = num_worker_threads;
+  return JxlThreadParallelRunnerCreateWithOptions(memory_manager, &options);
+}
+
+void JxlThreadParallelRunnerDefaultOptions(
+    JxlThreadParallelRunnerOptions* options) {
+  options->num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+  options->schedule = JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_GUIDED;
+  options->affinity = JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NONE;
+}
+
+void* JxlThreadParallelRunnerCreateWithOptions(
+    const JxlMemoryManager* memory_manager,
+    const JxlThreadParallelRunnerOptions* options) {
+  if (!options) return nullptr;
+  if (options->schedule != JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_GUIDED &&
+      options->schedule != JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_WORK_STEALING) {
+    return nullptr;
+  }
+  if (options->affinity != JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NONE &&
+      options->affinity != JXL_THREAD_PARALLEL_RUNNER_AFFINITY_CORES &&
+      options->affinity != JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NUMA_NODES) {
+    return nullptr;
+  }
   JxlMemoryManager local_memory_manager;
   if (!ThreadMemoryManagerInit(&local_memory_manager, memory_manager))
     return nullptr;
@@ -84,8 +110,9 @@ void* JxlThreadParallelRunnerCreate(const JxlMemoryManager* memory_manager,
                                          sizeof(jpegxl::ThreadParallelRunner));
   if (!alloc) return nullptr;
   // Placement new constructor on allocated memory
-  jpegxl::ThreadParallelRunner* runner =
-      new (alloc) jpegxl::ThreadParallelRunner(num_worker_threads);
+  jpegxl::ThreadParallelRunner* runner = new (alloc)
+      jpegxl::ThreadParallelRunner(options->num_worker_threads,
+                                   options->schedule, options->affinity);
   runner->memory_manager = local_memory_manager;
 
   return runner;
@@ -0,0 +1,122 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/status.h"
+
+namespace jpegxl {
+namespace {
+
+// Task shapes mimic the parallel loops of the codec. Each benchmark performs
+// a sequence of RunOnPool calls with "num_tasks" tasks of roughly "work"
+// iterations each, i.e. a few hundred nanoseconds per 1000 iterations.
+//
+// EncodeFrame: a handful of passes over all 256x256 groups (AC strategy,
+// quantization, tokenization), tasks of tens of microseconds.
+// DecodeFrame: per-group decode followed by many short render pipeline runs,
+// tasks of a few microseconds.
+
+uint32_t Work(uint32_t seed, uint32_t iterations) {
+  uint32_t x = seed | 1;
+  for (uint32_t i = 0; i < iterations; ++i) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+  }
+  return x;
+}
+
+void RunShape(benchmark::State& state,
+              JxlThreadParallelRunnerSchedule schedule,
+              const std::vector<std::pair<uint32_t, uint32_t>>& runs) {
+  JxlThreadParallelRunnerOptions options;
+  JxlThreadParallelRunnerDefaultOptions(&options);
+  options.num_worker_threads = state.range(0);
+  options.schedule = schedule;
+  JxlThreadParallelRunnerPtr runner =
+      JxlThreadParallelRunnerMake(/*memory_manager=*/nullptr, options);
+  if (!runner) {
+    state.SkipWithError("Failed to create runner");
+    return;
+  }
+  jxl::ThreadPool pool(JxlThreadParallelRunner, runner.get());
+  std::atomic<uint32_t> sink{0};
+
+  size_t num_tasks = 0;
+  for (auto _ : state) {
+    (void)_;
+    for (const auto& run : runs) {
+      const uint32_t iterations = run.second;
+      const auto process = [&](const uint32_t task,
+                               size_t /*thread*/) -> jxl::Status {
+        sink.fetch_xor(Work(task, iterations), std::memory_order_relaxed);
+        return true;
+      };
+      if (!RunOnPool(&pool, 0, run.first, jxl::ThreadPool::NoInit, process,
+                     "RunShape")) {
+        state.SkipWithError("RunOnPool failed");
+        return;
+      }
+      num_tasks += run.first;
+    }
+  }
+  benchmark::DoNotOptimize(sink.load());
+  state.counters["tasks/s"] = benchmark::Counter(
+      static_cast<double>(num_tasks), benchmark::Counter::kIsRate);
+}
+
+// 4096x4096 image: 256 groups, 4 DC groups.
+std::vector<std::pair<uint32_t, uint32_t>> EncodeFrameShape() {
+  return {{4, 20000},   {256, 30000}, {256, 10000},
+          {256, 40000}, {4, 5000},    {256, 20000}};
+}
+
+// 4096x4096 image: 4 DC groups, 256 AC groups, then render pipeline runs over
+// 256 groups with a few small stages each.
+std::vector<std::pair<uint32_t, uint32_t>> DecodeFrameShape() {
+  std::vector<std::pair<uint32_t, uint32_t>> runs = {{4, 10000},
+                                                     {256, 15000}};
+  for (size_t i = 0; i < 8; ++i) runs.emplace_back(256, 1000);
+  return runs;
+}
+
+void BM_EncodeFrameShapeGuided(benchmark::State& state) {
+  RunShape(state, JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_GUIDED,
+           EncodeFrameShape());
+}
+void BM_EncodeFrameShapeWorkStealing(benchmark::State& state) {
+  RunShape(state, JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_WORK_STEALING,
+           EncodeFrameShape());
+}
+void BM_DecodeFrameShapeGuided(benchmark::State& state) {
+  RunShape(state, JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_GUIDED,
+           DecodeFrameShape());
+}
+void BM_DecodeFrameShapeWorkStealing(benchmark::State& state) {
+  RunShape(state, JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_WORK_STEALING,
+           DecodeFrameShape());
+}
+
+#define THREAD_COUNTS RangeMultiplier(2)->Range(1, 64)->UseRealTime()
+
+BENCHMARK(BM_EncodeFrameShapeGuided)->THREAD_COUNTS;
+BENCHMARK(BM_EncodeFrameShapeWorkStealing)->THREAD_COUNTS;
+BENCHMARK(BM_DecodeFrameShapeGuided)->THREAD_COUNTS;
+BENCHMARK(BM_DecodeFrameShapeWorkStealing)->THREAD_COUNTS;
+
+#undef THREAD_COUNTS
+
+}  // namespace
+}  // namespace jpegxl
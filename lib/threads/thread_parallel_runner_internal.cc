@@ -15,9 +15,48 @@
 #include <mutex>
 #include <thread>
 
+#include "lib/jxl/base/arch_macros.h"
 #include "lib/jxl/base/compiler_specific.h"
 
+#if JXL_ARCH_X64
+#include <immintrin.h>
+#endif
+
 namespace jpegxl {
+namespace {
+
+// Maximum number of SpinPause calls in each wait of the work-stealing schedule
+// (a worker waiting for the next command or a nested job, the main thread
+// waiting for the workers to finish, a nested caller waiting for its helpers)
+// before the thread blocks on a condition variable. This is a count, not a
+// duration: a pause takes from a few to ~140 cycles depending on the CPU, and a
+// yield on other architectures takes longer still.
+constexpr uint32_t kSpinIterations = 2048;
+
+// A worker takes 1/kChunkDivisor of its remaining part per reservation, which
+// leaves enough for thieves while keeping the number of CAS small.
+constexpr uint32_t kChunkDivisor = 4;
+
+JXL_INLINE void SpinPause() {
+#if JXL_ARCH_X64
+  _mm_pause();
+#elif JXL_ARCH_ARM && (JXL_COMPILER_GCC || JXL_COMPILER_CLANG)
+  __asm__ __volatile__("yield");
+#else
+  std::this_thread::yield();
+#endif
+}
+
+constexpr uint64_t PackRange(uint32_t begin, uint32_t end) {
+  return (static_cast<uint64_t>(begin) << 32) | end;
+}
+
+// Identifies the worker thread (if any) running on the current thread, to
+// detect nested Runner calls.
+thread_local const ThreadParallelRunner* current_runner = nullptr;
+thread_local int current_thread = 0;
+
+}  // namespace
 
 // static
 JxlParallelRetCode ThreadParallelRunner::Runner(
@@ -41,6 +80,11 @@ JxlParallelRetCode ThreadParallelRunner::Runner(
     return JXL_PARALLEL_RET_SUCCESS;
   }
 
+  if (current_runner == self) {
+    return self->RunNested(jpegxl_opaque, func, start_range, end_range,
+                           current_thread);
+  }
+
   if (self->depth_.fetch_add(1, std::memory_order_acq_rel) != 0) {
     return JXL_PARALLEL_RET_RUNNER_ERROR;  // Must not re-enter.
   }
@@ -55,10 +99,18 @@ JxlParallelRetCode ThreadParallelRunner::Runner(
 
   self->data_func_ = func;
   self->jpegxl_opaque_ = jpegxl_opaque;
-  self->num_reserved_.store(0, std::memory_order_relaxed);
 
-  self->StartWorkers(worker_command);
-  self->WorkersReadyBarrier();
+  if (self->IsWorkStealing()) {
+    self->num_tasks_ = end_range - start_range;
+    self->num_tasks_done_.store(0, std::memory_order_relaxed);
+    self->DistributeRange(start_range, end_range);
+    self->StartStealingWorkers(worker_command);
+    self->StealingWorkersDoneBarrier();
+  } else {
+    self->num_reserved_.store(0, std::memory_order_relaxed);
+    self->StartWorkers(worker_command);
+    self->WorkersReadyBarrier();
+  }
 
   if (self->depth_.fetch_add(-1, std::memory_order_acq_rel) != 1) {
     return JXL_PARALLEL_RET_RUNNER_ERROR;
@@ -109,9 +161,153 @@ void ThreadParallelRunner::RunRange(ThreadParallelRunner* self,
   }
 }
 
-// static
+JxlParallelRetCode ThreadParallelRunner::RunNested(
+    void* jpegxl_opaque, const JxlParallelRunFunction func,
+    const uint32_t begin, const uint32_t end, const int thread) {
+  NestedJob job;
+  job.func = func;
+  job.jpegxl_opaque = jpegxl_opaque;
+  job.begin = begin;
+  job.end = end;
+
+  const bool shared = IsWorkStealing();
+  if (shared) {
+    {
+      std::lock_guard<std::mutex> lock(nested_mutex_);
+      nested_jobs_.push_back(&job);
+    }
+    nested_generation_.fetch_add(1, std::memory_order_acq_rel);
+    WakeIdleWorkers();
+  }
+
+  uint32_t my_begin;
+  uint32_t my_end;
+  while (ReserveNested(&job, &my_begin, &my_end)) {
+    for (uint32_t task = my_begin; task < my_end; ++task) {
+      func(jpegxl_opaque, task, thread);
+    }
+    job.num_done.fetch_add(my_end - my_begin, std::memory_order_acq_rel);
+  }
+
+  if (shared) {
+    // All tasks are reserved; helpers no longer need to find the job.
+    {
+      std::lock_guard<std::mutex> lock(nested_mutex_);
+      nested_jobs_.erase(
+          std::find(nested_jobs_.begin(), nested_jobs_.end(), &job));
+    }
+    // We are inside a task and must not help with other jobs (they could
+    // share per-thread state with it), so just wait for the helpers.
+    const auto done = [&job, begin, end]() {
+      return job.num_done.load(std::memory_order_acquire) == end - begin;
+    };
+    for (uint32_t i = 0; i < kSpinIterations; ++i) {
+      if (done()) return JXL_PARALLEL_RET_SUCCESS;
+      SpinPause();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++num_nested_waiting_;
+    while (!done()) {
+      nested_done_cv_.wait(lock);
+    }
+    --num_nested_waiting_;
+  }
+  return JXL_PARALLEL_RET_SUCCESS;
+}
+
+bool ThreadParallelRunner::ReserveNested(NestedJob* job, uint32_t* begin,
+                                         uint32_t* end) const {
+  const uint32_t num_tasks = job->end - job->begin;
+  const uint32_t num_reserved =
+      job->num_reserved.load(std::memory_order_relaxed);
+  const uint32_t num_remaining = num_tasks - std::min(num_reserved, num_tasks);
+  const uint32_t size =
+      std::max(num_remaining / (std::max(num_worker_threads_, 1u) * 4), 1u);
+  const uint32_t my_begin =
+      job->begin +
+      job->num_reserved.fetch_add(size, std::memory_order_relaxed);
+  const uint32_t my_end = std::min(my_begin + size, job->end);
+  if (my_begin >= my_end) return false;
+  *begin = my_begin;
+  *end = my_end;
+  return true;
+}
+
+bool ThreadParallelRunner::HelpNested(const int thread) {
+  NestedJob* job = nullptr;
+  uint32_t begin;
+  uint32_t end;
+  {
+    // Reserving under the lock guarantees the job is still alive: its owner
+    // only returns after removing it and waiting for all reserved tasks.
+    std::lock_guard<std::mutex> lock(nested_mutex_);
+    for (NestedJob* candidate : nested_jobs_) {
+      if (ReserveNested(candidate, &begin, &end)) {
+        job = candidate;
+        break;
+      }
+    }
+  }
+  if (job == nullptr) return false;
+  for (uint32_t task = begin; task < end; ++task) {
+    job->func(job->jpegxl_opaque, task, thread);
+  }
+  // The owner may return as soon as it sees the last chunk done, so "job" must
+  // not be touched after this.
+  job->num_done.fetch_add(end - begin, std::memory_order_acq_rel);
+  WakeNestedCallers();
+  return true;
+}
+
+void ThreadParallelRunner::AwaitNestedOrDone(const uint32_t seen_generation) {
+  const auto ready = [this, seen_generation]() {
+    return nested_generation_.load(std::memory_order_acquire) !=
+               seen_generation ||
+           AllTasksDone();
+  };
+  for (uint32_t i = 0; i < kSpinIterations; ++i) {
+    if (ready()) return;
+    SpinPause();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++num_idle_;
+  while (!ready()) {
+    idle_cv_.wait(lock);
+  }
+  --num_idle_;
+}
+
+void ThreadParallelRunner::WakeIdleWorkers() {
+  {
+    // Waiters check their condition under this lock, so they either see the
+    // update or are already counted in num_idle_.
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (num_idle_ == 0) return;
+  }
+  idle_cv_.notify_all();
+}
+
+void ThreadParallelRunner::WakeNestedCallers() {
+  {
+    // Same protocol as WakeIdleWorkers.
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (num_nested_waiting_ == 0) return;
+  }
+  nested_done_cv_.notify_all();
+}
+
+void ThreadParallelRunner::PinWorker(const int thread) const {
+  if (worker_cpus_.empty()) return;
+  // Failure (e.g. a restrictive seccomp policy) is not fatal: the worker then
+  // just runs wherever the scheduler puts it.
+  (void)PinCurrentThread(worker_cpus_[thread]);
+}
+
 void ThreadParallelRunner::ThreadFunc(ThreadParallelRunner* self,
                                       const int thread) {
+  self->PinWorker(thread);
+  current_runner = self;
+  current_thread = thread;
   // Until kWorkerExit command received:
   for (;;) {
     std::unique_lock<std::mutex> lock(self->mutex_);
@@ -140,18 +336,209 @@ void ThreadParallelRunner::ThreadFunc(ThreadParallelRunner* self,
   }
 }
 
-ThreadParallelRunner::ThreadParallelRunner(const int num_worker_threads)
+void ThreadParallelRunner::DistributeRange(const uint32_t begin,
+                                           const uint32_t end) {
+  const uint64_t num_tasks = end - begin;
+  for (uint32_t i = 0; i < num_worker_threads_; ++i) {
+    const uint32_t part_begin =
+        begin + static_cast<uint32_t>(num_tasks * i / num_worker_threads_);
+    const uint32_t part_end =
+        begin + static_cast<uint32_t>(num_tasks * (i + 1) / num_worker_threads_);
+    parts_[i].range.store(PackRange(part_begin, part_end),
+                          std::memory_order_relaxed);
+  }
+}
+
+void ThreadParallelRunner::StartStealingWorkers(
+    const WorkerCommand worker_command) {
+  num_done_.store(0, std::memory_order_relaxed);
+  bool notify;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    worker_start_command_ = worker_command;
+    // Publishes the command, parts_ and num_done_ to spinning workers.
+    start_epoch_.fetch_add(1, std::memory_order_release);
+    notify = (num_parked_ != 0);
+  }
+  if (notify) worker_start_cv_.notify_all();
+}
+
+void ThreadParallelRunner::StealingWorkersDoneBarrier() {
+  for (uint32_t i = 0; i < kSpinIterations; ++i) {
+    if (num_done_.load(std::memory_order_acquire) == num_worker_threads_) {
+      return;
+    }
+    SpinPause();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (num_done_.load(std::memory_order_acquire) != num_worker_threads_) {
+    workers_ready_cv_.wait(lock);
+  }
+}
+
+uint32_t ThreadParallelRunner::AwaitStartEpoch(const uint32_t seen_epoch) {
+  for (uint32_t i = 0; i < kSpinIterations; ++i) {
+    const uint32_t epoch = start_epoch_.load(std::memory_order_acquire);
+    if (epoch != seen_epoch) return epoch;
+    SpinPause();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++num_parked_;
+  while (start_epoch_.load(std::memory_order_acquire) == seen_epoch) {
+    worker_start_cv_.wait(lock);
+  }
+  --num_parked_;
+  return start_epoch_.load(std::memory_order_acquire);
+}
+
+bool ThreadParallelRunner::PopFront(const int thread, uint32_t* begin,
+                                    uint32_t* end) {
+  std::atomic<uint64_t>& range = parts_[thread].range;
+  uint64_t packed = range.load(std::memory_order_acquire);
+  for (;;) {
+    const uint32_t part_begin = packed >> 32;
+    const uint32_t part_end = packed & 0xFFFFFFFF;
+    if (part_begin >= part_end) return false;
+    const uint32_t size =
+        std::max((part_end - part_begin) / kChunkDivisor, 1u);
+    // On failure (a thief shrank the part), "packed" is reloaded.
+    if (range.compare_exchange_weak(packed,
+                                    PackRange(part_begin + size, part_end),
+                                    std::memory_order_acq_rel)) {
+      *begin = part_begin;
+      *end = part_begin + size;
+      return true;
+    }
+  }
+}
+
+bool ThreadParallelRunner::Steal(const int thread) {
+  for (;;) {
+    // Pick the victim with the most remaining tasks.
+    uint32_t victim = 0;
+    uint64_t victim_packed = 0;
+    uint32_t victim_size = 0;
+    for (uint32_t i = 0; i < num_worker_threads_; ++i) {
+      if (i == static_cast<uint32_t>(thread)) continue;
+      const uint64_t packed = parts_[i].range.load(std::memory_order_acquire);
+      const uint32_t part_begin = packed >> 32;
+      const uint32_t part_end = packed & 0xFFFFFFFF;
+      const uint32_t size =
+          part_begin < part_end ? part_end - part_begin : 0;
+      if (size > victim_size) {
+        victim = i;
+        victim_packed = packed;
+        victim_size = size;
+      }
+    }
+    if (victim_size == 0) return false;
+
+    // The victim keeps the front half (rounded up); we take the back half, or
+    // the single remaining task.
+    const uint32_t part_begin = victim_packed >> 32;
+    const uint32_t part_end = victim_packed & 0xFFFFFFFF;
+    const uint32_t mid =
+        victim_size == 1 ? part_begin : part_begin + (victim_size + 1) / 2;
+    if (parts_[victim].range.compare_exchange_strong(
+            victim_packed, PackRange(part_begin, mid),
+            std::memory_order_acq_rel)) {
+      // Our own part is empty, so thieves do not touch it concurrently.
+      parts_[thread].range.store(PackRange(mid, part_end),
+                                 std::memory_order_release);
+      return true;
+    }
+  }
+}
+
+// static
+void ThreadParallelRunner::RunRangeStealing(ThreadParallelRunner* self,
+                                            const int thread) {
+  for (;;) {
+    uint32_t begin;
+    uint32_t end;
+    while (self->PopFront(thread, &begin, &end)) {
+      for (uint32_t task = begin; task < end; ++task) {
+        self->data_func_(self->jpegxl_opaque_, task, thread);
+      }
+      const uint32_t num_run = end - begin;
+      if (self->num_tasks_done_.fetch_add(num_run, std::memory_order_acq_rel) +
+              num_run ==
+          self->num_tasks_) {
+        self->WakeIdleWorkers();
+      }
+    }
+    if (self->Steal(thread)) continue;
+    // Parts only shrink, so once all are empty, every task is either done or
+    // being run by another worker. Those may still post nested jobs, so help
+    // with them until the whole range is done.
+    const uint32_t generation =
+        self->nested_generation_.load(std::memory_order_acquire);
+    if (self->HelpNested(thread)) continue;
+    if (self->AllTasksDone()) return;
+    self->AwaitNestedOrDone(generation);
+  }
+}
+
+// static
+void ThreadParallelRunner::StealingThreadFunc(ThreadParallelRunner* self,
+                                              const int thread) {
+  self->PinWorker(thread);
+  current_runner = self;
+  current_thread = thread;
+  uint32_t seen_epoch = 0;
+  // Until kWorkerExit command received:
+  for (;;) {
+    seen_epoch = self->AwaitStartEpoch(seen_epoch);
+    const WorkerCommand command = self->worker_start_command_;
+    switch (command) {
+      case kWorkerOnce:
+        self->data_func_(self->jpegxl_opaque_, thread, thread);
+        break;
+      case kWorkerExit:
+        return;  // exits thread
+      default:
+        RunRangeStealing(self, thread);
+        break;
+    }
+    if (self->num_done_.fetch_add(1, std::memory_order_acq_rel) + 1 ==
+        self->num_worker_threads_) {
+      // Taking the lock ensures the main thread either has not checked
+      // num_done_ yet or is already waiting.
+      std::lock_guard<std::mutex> lock(self->mutex_);
+      self->workers_ready_cv_.notify_one();
+    }
+  }
+}
+
+ThreadParallelRunner::ThreadParallelRunner(
+    const int num_worker_threads,
+    const JxlThreadParallelRunnerSchedule schedule,
+    const JxlThreadParallelRunnerAffinity affinity)
     : num_worker_threads_(num_worker_threads),
-      num_threads_(std::max(num_worker_threads, 1)) {
+      num_threads_(std::max(num_worker_threads, 1)),
+      schedule_(schedule),
+      worker_cpus_(AssignWorkerCpus(affinity, num_worker_threads_)) {
   threads_.reserve(num_worker_threads_);
 
   // Suppress "unused-private-field" warning.
   (void)padding1;
   (void)padding2;
+  (void)padding3;
+  (void)padding4;
+  (void)padding5;
 
   // Safely handle spurious worker wakeups.
   worker_start_command_ = kWorkerWait;
 
+  if (IsWorkStealing()) {
+    // Workers wait for start_epoch_ to change and need no ready barrier.
+    parts_.reset(new Part[num_worker_threads_]);
+    for (uint32_t i = 0; i < num_worker_threads_; ++i) {
+      threads_.emplace_back(StealingThreadFunc, this, i);
+    }
+    return;
+  }
+
   for (uint32_t i = 0; i < num_worker_threads_; ++i) {
     threads_.emplace_back(ThreadFunc, this, i);
   }
@@ -163,7 +550,11 @@ ThreadParallelRunner::ThreadParallelRunner(const int num_worker_threads)
 
 ThreadParallelRunner::~ThreadParallelRunner() {
   if (num_worker_threads_ != 0) {
-    StartWorkers(kWorkerExit);
+    if (IsWorkStealing()) {
+      StartStealingWorkers(kWorkerExit);
+    } else {
+      StartWorkers(kWorkerExit);
+    }
   }
 
   for (std::thread& thread : threads_) {
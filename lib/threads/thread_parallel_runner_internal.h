@@ -24,6 +24,23 @@
 // 10-20x higher when using std::async, and ~200x for a queue-based thread
 // pool.
 //
+// With JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_WORK_STEALING, the range is instead
+// split into one contiguous part per worker. Each worker takes chunks from the
+// front of its own part and, once it runs dry, steals the back half of the
+// largest remaining part of another worker. Workers and the main thread spin
+// briefly before blocking, so that back-to-back Run calls with few tasks each
+// (e.g. per-group passes) do not pay a futex round-trip for every call.
+//
+// With an affinity other than JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NONE, each
+// worker pins itself to its CPUs before doing anything else, so that the
+// memory it first touches is allocated on its NUMA node.
+//
+// Runner may be called again from within a task, i.e. from a worker thread of
+// the same instance. The calling worker then runs the nested range itself
+// instead of blocking; with the work-stealing schedule, workers that ran out
+// of tasks of the outer range help with it. Calls from other threads while a
+// Run is in progress are still an error.
+//
 // Usage:
 //   ThreadParallelRunner runner;
 //   JxlDecode(
@@ -34,16 +51,20 @@
 
 #include <jxl/memory_manager.h>
 #include <jxl/parallel_runner.h>
+#include <jxl/thread_parallel_runner.h>
 
 #include <atomic>
 #include <condition_variable>  //NOLINT
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <memory>
 #include <mutex>   //NOLINT
 #include <thread>  //NOLINT
 #include <vector>
 
+#include "lib/threads/thread_affinity.h"
+
 namespace jpegxl {
 
 // Main helper class implementing the ::JxlParallelRunner interface.
@@ -59,7 +80,11 @@ class ThreadParallelRunner {
   // "num_worker_threads" defaults to one per hyperthread. If zero, all tasks
   // run on the main thread.
   explicit ThreadParallelRunner(
-      int num_worker_threads = std::thread::hardware_concurrency());
+      int num_worker_threads = std::thread::hardware_concurrency(),
+      JxlThreadParallelRunnerSchedule schedule =
+          JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_GUIDED,
+      JxlThreadParallelRunnerAffinity affinity =
+          JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NONE);
 
   // Waits for all threads to exit.
   ~ThreadParallelRunner();
@@ -81,6 +106,11 @@ class ThreadParallelRunner {
 
     data_func_ = reinterpret_cast<JxlParallelRunFunction>(&CallClosure<Func>);
     jpegxl_opaque_ = const_cast<void*>(static_cast<const void*>(&func));
+    if (IsWorkStealing()) {
+      StartStealingWorkers(kWorkerOnce);
+      StealingWorkersDoneBarrier();
+      return;
+    }
     StartWorkers(kWorkerOnce);
     WorkersReadyBarrier();
   }
@@ -137,14 +167,88 @@ class ThreadParallelRunner {
 
   static void ThreadFunc(ThreadParallelRunner* self, int thread);
 
+  // Applies the affinity requested at construction to the calling worker.
+  void PinWorker(int thread) const;
+
+  // Work-stealing counterparts of the above. Workers are started by bumping
+  // start_epoch_ instead of waiting in lock-step on worker_start_cv_, and
+  // report completion via num_done_.
+  bool IsWorkStealing() const {
+    return schedule_ == JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_WORK_STEALING;
+  }
+
+  // Splits [begin, end) into one contiguous part per worker.
+  void DistributeRange(uint32_t begin, uint32_t end);
+
+  // Precondition: the previous command (if any) is done.
+  void StartStealingWorkers(WorkerCommand worker_command);
+
+  // Spins, then blocks until all workers finished the current command.
+  void StealingWorkersDoneBarrier();
+
+  // Spins, then blocks until start_epoch_ differs from "seen_epoch".
+  uint32_t AwaitStartEpoch(uint32_t seen_epoch);
+
+  // Takes a chunk from the front of the part owned by "thread".
+  bool PopFront(int thread, uint32_t* begin, uint32_t* end);
+
+  // Moves the back half of the largest part of another worker to the part of
+  // "thread". Returns false if there is nothing left to steal.
+  bool Steal(int thread);
+
+  static void RunRangeStealing(ThreadParallelRunner* self, int thread);
+
+  static void StealingThreadFunc(ThreadParallelRunner* self, int thread);
+
+  // A range passed to Runner from within a task of this instance. Lives on the
+  // stack of the calling worker until all of its tasks are done.
+  struct NestedJob {
+    JxlParallelRunFunction func;
+    void* jpegxl_opaque;
+    uint32_t begin;
+    uint32_t end;
+    std::atomic<uint32_t> num_reserved{0};
+    std::atomic<uint32_t> num_done{0};
+  };
+
+  // Runs [begin, end) on the calling worker "thread", with help from idle
+  // workers if the schedule is work-stealing.
+  JxlParallelRetCode RunNested(void* jpegxl_opaque, JxlParallelRunFunction func,
+                               uint32_t begin, uint32_t end, int thread);
+
+  // Reserves the next chunk of "job" ("guided" schedule, see RunRange).
+  bool ReserveNested(NestedJob* job, uint32_t* begin, uint32_t* end) const;
+
+  // Runs one chunk of any posted nested job on "thread". Returns false if there
+  // was nothing to reserve. Must only be called by workers that are not inside
+  // a task, so that per-thread state of the tasks is not shared.
+  bool HelpNested(int thread);
+
+  // Called by idle workers during a work-stealing Run: spins, then blocks until
+  // nested_generation_ differs from "seen_generation" or all tasks are done.
+  void AwaitNestedOrDone(uint32_t seen_generation);
+
+  bool AllTasksDone() const {
+    return num_tasks_done_.load(std::memory_order_acquire) == num_tasks_;
+  }
+
+  // Wakes workers blocked in AwaitNestedOrDone.
+  void WakeIdleWorkers();
+
+  // Wakes nested callers blocked in RunNested until their helpers finish.
+  void WakeNestedCallers();
+
   // Unmodified after ctor, but cannot be const because we call thread::join().
   std::vector<std::thread> threads_;
 
   const uint32_t num_worker_threads_;  // == threads_.size()
   const uint32_t num_threads_;
+  const JxlThreadParallelRunnerSchedule schedule_;
+  // CPUs of each worker; empty if workers are not pinned.
+  const std::vector<CpuSet> worker_cpus_;
 
   std::atomic<uint32_t> depth_{
-      0};  // detects if Run is re-entered (not supported).
+      0};  // detects concurrent Run from non-worker threads (not supported).
 
   std::mutex mutex_;  // guards both cv and their variables.
   std::condition_variable workers_ready_cv_;
@@ -160,6 +264,40 @@ class ThreadParallelRunner {
   uint8_t padding1[64];
   std::atomic<uint32_t> num_reserved_{0};
   uint8_t padding2[64];
+
+  // Work-stealing state. Each part is a [begin, end) range packed as
+  // (begin << 32) | end, so that the owner and thieves can shrink it with a
+  // single CAS. Parts only ever shrink during a Run, except when an empty part
+  // is refilled by its owner from a steal, hence there is no ABA problem.
+  // The padding keeps the ranges of different parts in different cache lines
+  // without requiring over-aligned allocation.
+  struct Part {
+    std::atomic<uint64_t> range{0};
+    uint8_t padding[64];
+  };
+  std::unique_ptr<Part[]> parts_;
+  uint32_t num_parked_ = 0;  // guarded by mutex_
+  // Written by main thread, polled by workers.
+  std::atomic<uint32_t> start_epoch_{0};
+  uint8_t padding3[64];
+  // Updated by workers, polled by main thread.
+  std::atomic<uint32_t> num_done_{0};
+  uint8_t padding4[64];
+  // Number of tasks of the current work-stealing Run and how many of them
+  // are finished; idle workers keep helping with nested jobs until then.
+  uint32_t num_tasks_ = 0;
+  std::atomic<uint32_t> num_tasks_done_{0};
+  uint8_t padding5[64];
+
+  // Nested jobs that idle workers may help with (work-stealing only).
+  std::mutex nested_mutex_;
+  std::vector<NestedJob*> nested_jobs_;  // guarded by nested_mutex_
+  // Incremented whenever a nested job is posted.
+  std::atomic<uint32_t> nested_generation_{0};
+  std::condition_variable idle_cv_;
+  uint32_t num_idle_ = 0;  // guarded by mutex_
+  std::condition_variable nested_done_cv_;
+  uint32_t num_nested_waiting_ = 0;  // guarded by mutex_
 };
 
 }  // namespace jpegxl
@@ -3,16 +3,25 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#include <jxl/thread_parallel_runner.h>
+
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <thread>
 #include <vector>
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
+#include "lib/threads/thread_affinity.h"
 
 using ::jxl::test::ThreadPoolForTests;
 
@@ -59,6 +68,108 @@ TEST(ThreadParallelRunnerTest, TestPool) {
   }
 }
 
+JxlThreadParallelRunnerOptions WorkStealingOptions(size_t num_threads) {
+  JxlThreadParallelRunnerOptions options;
+  JxlThreadParallelRunnerDefaultOptions(&options);
+  options.num_worker_threads = num_threads;
+  options.schedule = JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_WORK_STEALING;
+  return options;
+}
+
+// Same as TestPool, for the work-stealing schedule; also checks that each task
+// runs exactly once.
+TEST(ThreadParallelRunnerTest, TestWorkStealingPool) {
+  for (int num_threads = 0; num_threads <= 18; ++num_threads) {
+    ThreadPoolForTests pool(WorkStealingOptions(num_threads));
+    for (int num_tasks = 0; num_tasks < 200; num_tasks += 7) {
+      std::vector<std::atomic<int>> visits(num_tasks);
+      for (int begin = 0; begin < 32; begin += 5) {
+        for (auto& v : visits) v.store(0);
+        const auto do_task = [begin, num_tasks, num_threads, &visits](
+                                 const int task,
+                                 const int thread) -> jxl::Status {
+          EXPECT_GE(task, begin);
+          EXPECT_LT(task, begin + num_tasks);
+          EXPECT_LT(thread, std::max(num_threads, 1));
+          visits[task - begin].fetch_add(1, std::memory_order_relaxed);
+          return true;
+        };
+        EXPECT_TRUE(RunOnPool(pool.get(), begin, begin + num_tasks,
+                              jxl::ThreadPool::NoInit, do_task,
+                              "TestWorkStealingPool"));
+        for (int i = 0; i < num_tasks; ++i) {
+          EXPECT_EQ(1, visits[i].load());
+        }
+      }
+    }
+  }
+}
+
+// Tasks may call RunOnPool again on the same pool; fewer outer tasks than
+// threads leaves idle workers to help with the nested ranges.
+TEST(ThreadParallelRunnerTest, TestNested) {
+  for (const bool work_stealing : {false, true}) {
+    for (int num_threads = 0; num_threads <= 8; num_threads += 2) {
+      JxlThreadParallelRunnerOptions options =
+          WorkStealingOptions(num_threads);
+      if (!work_stealing) {
+        options.schedule = JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_GUIDED;
+      }
+      ThreadPoolForTests pool(options);
+      pool.get()->SetAllowNesting(true);
+      const int kNumOuter = 3;
+      const int kNumInner = 50;
+      const int kNumInnermost = 4;
+      std::vector<std::atomic<int>> visits(kNumOuter * kNumInner *
+                                           kNumInnermost);
+      const auto outer = [&](const int i, const int outer_thread) {
+        const auto inner = [&](const int j, const int inner_thread) {
+          EXPECT_LT(inner_thread, std::max(num_threads, 1));
+          const auto innermost = [&](const int k, const int) -> jxl::Status {
+            visits[(i * kNumInner + j) * kNumInnermost + k].fetch_add(1);
+            return true;
+          };
+          return RunOnPool(pool.get(), 0, kNumInnermost,
+                           jxl::ThreadPool::NoInit, innermost, "Innermost");
+        };
+        return RunOnPool(pool.get(), 0, kNumInner, jxl::ThreadPool::NoInit,
+                         inner, "Inner");
+      };
+      for (int repetition = 0; repetition < 3; ++repetition) {
+        for (auto& v : visits) v.store(0);
+        EXPECT_TRUE(RunOnPool(pool.get(), 0, kNumOuter,
+                              jxl::ThreadPool::NoInit, outer, "Outer"));
+        for (const auto& v : visits) EXPECT_EQ(1, v.load());
+      }
+    }
+  }
+}
+
+// Inner tasks that take much longer than the spin before parking, so that the
+// nested caller has to block until its helpers are done.
+TEST(ThreadParallelRunnerTest, TestNestedSlowHelpers) {
+  const int kNumThreads = 4;
+  ThreadPoolForTests pool(WorkStealingOptions(kNumThreads));
+  pool.get()->SetAllowNesting(true);
+  const int kNumInner = 16;
+  std::vector<std::atomic<int>> visits(kNumInner);
+  const auto outer = [&](const int, const int) {
+    const auto inner = [&](const int j, const int) -> jxl::Status {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      visits[j].fetch_add(1);
+      return true;
+    };
+    return RunOnPool(pool.get(), 0, kNumInner, jxl::ThreadPool::NoInit, inner,
+                     "Inner");
+  };
+  for (int repetition = 0; repetition < 5; ++repetition) {
+    for (auto& v : visits) v.store(0);
+    EXPECT_TRUE(RunOnPool(pool.get(), 0, 1, jxl::ThreadPool::NoInit, outer,
+                          "Outer"));
+    for (const auto& v : visits) EXPECT_EQ(1, v.load());
+  }
+}
+
 // Verify "thread" parameter when processing few tasks.
 TEST(ThreadParallelRunnerTest, TestSmallAssignments) {
   const size_t kMaxThreads = 8u;
@@ -126,5 +237,117 @@ TEST(ThreadParallelRunnerTest, TestCounter) {
   EXPECT_EQ(expected, counters[0].counter);
 }
 
+// Unbalanced tasks force workers to steal from each other.
+TEST(ThreadParallelRunnerTest, TestWorkStealingCounter) {
+  const int kNumThreads = 12;
+  ThreadPoolForTests pool(WorkStealingOptions(kNumThreads));
+  alignas(128) Counter counters[kNumThreads];
+
+  const int kNumTasks = kNumThreads * 19;
+  const auto count = [&counters](const int task,
+                                 const int thread) -> jxl::Status {
+    if (task < kNumTasks / kNumThreads) {
+      // The first worker's part is much slower than the others.
+      std::atomic<int> spin{0};
+      while (spin.fetch_add(1, std::memory_order_relaxed) < 100000) {
+      }
+    }
+    counters[thread].counter += task;
+    return true;
+  };
+  for (int repetition = 0; repetition < 10; ++repetition) {
+    EXPECT_TRUE(RunOnPool(pool.get(), 0, kNumTasks, jxl::ThreadPool::NoInit,
+                          count, "TestWorkStealingCounter"));
+  }
+
+  int expected = 0;
+  for (int i = 0; i < kNumTasks; ++i) {
+    expected += i;
+  }
+
+  for (int i = 1; i < kNumThreads; ++i) {
+    counters[0].Assimilate(counters[i]);
+  }
+  EXPECT_EQ(expected * 10, counters[0].counter);
+}
+
+TEST(ThreadParallelRunnerTest, TestParseCpuList) {
+  EXPECT_EQ(CpuSet({0, 1, 2, 3, 8, 10, 11}), ParseCpuList("0-3,8,10-11"));
+  EXPECT_EQ(CpuSet({5}), ParseCpuList("5"));
+  EXPECT_EQ(CpuSet({7}), ParseCpuList("7-7"));
+  // Sorted and deduplicated.
+  EXPECT_EQ(CpuSet({1, 2, 3, 4}), ParseCpuList("3-4,1-3,2"));
+  EXPECT_EQ(CpuSet(), ParseCpuList(""));
+  for (const char* bad : {",", "1,,2", "a", "1-", "-1", "3-1", "1-2-3", "2x",
+                          "0-100000000"}) {
+    EXPECT_EQ(CpuSet(), ParseCpuList(bad)) << bad;
+  }
+}
+
+#if defined(__linux__)
+size_t NumAllowedCpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) return 0;
+  return CPU_COUNT(&set);
+}
+#endif
+
+TEST(ThreadParallelRunnerTest, TestAffinity) {
+  for (JxlThreadParallelRunnerAffinity affinity :
+       {JXL_THREAD_PARALLEL_RUNNER_AFFINITY_CORES,
+        JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NUMA_NODES}) {
+    for (bool work_stealing : {false, true}) {
+      JxlThreadParallelRunnerOptions options = WorkStealingOptions(5);
+      if (!work_stealing) {
+        options.schedule = JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_GUIDED;
+      }
+      options.affinity = affinity;
+      ThreadPoolForTests pool(options);
+      std::atomic<int> sum{0};
+      std::vector<std::atomic<size_t>> num_cpus(5);
+      const auto add = [&](const int task, const int thread) -> jxl::Status {
+        sum.fetch_add(task, std::memory_order_relaxed);
+#if defined(__linux__)
+        num_cpus[thread].store(NumAllowedCpus(), std::memory_order_relaxed);
+#endif
+        return true;
+      };
+      EXPECT_TRUE(RunOnPool(pool.get(), 0, 100, jxl::ThreadPool::NoInit, add,
+                            "TestAffinity"));
+      EXPECT_EQ(99 * 100 / 2, sum.load());
+#if defined(__linux__)
+      // Pinning may be forbidden (e.g. by a seccomp policy); check it with a
+      // thread of our own before requiring it of the workers.
+      bool can_pin = false;
+      std::thread probe([&can_pin] {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        can_pin = sched_getaffinity(0, sizeof(set), &set) == 0 &&
+                  sched_setaffinity(0, sizeof(set), &set) == 0;
+      });
+      probe.join();
+      if (!can_pin) continue;
+      for (size_t i = 0; i < num_cpus.size(); ++i) {
+        const size_t n = num_cpus[i].load();
+        // 0 if the worker did not get any task.
+        if (n == 0) continue;
+        if (affinity == JXL_THREAD_PARALLEL_RUNNER_AFFINITY_CORES) {
+          EXPECT_EQ(1u, n) << "worker " << i;
+        } else {
+          EXPECT_LE(n, NumAllowedCpus()) << "worker " << i;
+        }
+      }
+#endif
+    }
+  }
+
+  JxlThreadParallelRunnerOptions options;
+  JxlThreadParallelRunnerDefaultOptions(&options);
+  options.affinity = static_cast<JxlThreadParallelRunnerAffinity>(3);
+  EXPECT_EQ(nullptr,
+            JxlThreadParallelRunnerCreateWithOptions(nullptr, &options));
+}
+
 }  // namespace
 }  // namespace jpegxl
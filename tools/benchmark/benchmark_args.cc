@@ -177,6 +177,17 @@ Status BenchmarkArgs::AddCommandLineOptions() {
             "The number of extra threads per task. "
             "Defaults to occupy cores (if negative).",
             -1);
+  AddFlag(&shared_pool, "shared_pool",
+          "Run all tasks and their codecs on a single work-stealing pool with "
+          "one thread per CPU core, using nested parallelism instead of a "
+          "static split into --num_threads and --inner_threads.",
+          false);
+  AddString(&thread_affinity, "thread_affinity",
+            "Placement of the worker threads of all pools: none, cores (one "
+            "CPU per worker) or numa (workers spread over the NUMA nodes). "
+            "cores is best combined with --shared_pool, since each pool "
+            "assigns CPUs starting from the first one.",
+            "none");
   AddUnsigned(&encode_reps, "encode_reps",
               "How many times to encode (>1 for more precise measurements). "
               "Defaults to 1.",
@@ -267,6 +278,16 @@ Status BenchmarkArgs::ValidateArgs() {
 
   if (print_details_csv) print_details = true;
 
+  if (thread_affinity == "none") {
+    affinity = JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NONE;
+  } else if (thread_affinity == "cores") {
+    affinity = JXL_THREAD_PARALLEL_RUNNER_AFFINITY_CORES;
+  } else if (thread_affinity == "numa") {
+    affinity = JXL_THREAD_PARALLEL_RUNNER_AFFINITY_NUMA_NODES;
+  } else {
+    return JXL_FAILURE("thread_affinity must be none, cores or numa");
+  }
+
   if (override_bitdepth > 32) {
     return JXL_FAILURE("override_bitdepth must be <= 32");
   }
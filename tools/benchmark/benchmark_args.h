@@ -8,6 +8,8 @@
 
 // Command line parsing and arguments for benchmark_xl
 
+#include <jxl/thread_parallel_runner.h>
+
 #include <cstddef>
 #include <deque>
 #include <string>
@@ -142,6 +144,9 @@ struct BenchmarkArgs {
 
   int num_threads;
   int inner_threads;
+  bool shared_pool;
+  std::string thread_affinity;
+  JxlThreadParallelRunnerAffinity affinity;
   size_t decode_reps;
   size_t encode_reps;
   size_t generations;
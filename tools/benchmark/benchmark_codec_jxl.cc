@@ -270,6 +270,7 @@ class JxlCodec : public ImageCodec {
                   jpegxl::tools::SpeedStats* speed_stats) override {
     cparams_.runner = pool->runner();
     cparams_.runner_opaque = pool->runner_opaque();
+    cparams_.runner_allows_nesting = pool->AllowNesting();
     cparams_.memory_manager = memory_manager_;
     cparams_.distance = butteraugli_target_;
     cparams_.AddOption(JXL_ENC_FRAME_SETTING_NOISE,
@@ -290,7 +291,7 @@ class JxlCodec : public ImageCodec {
     }
     DebugTicket ticket;
     JXL_RETURN_IF_ERROR(SetDebugImageCallback(filename, &ticket, &cparams_));
-    if (args_.print_more_stats) {
+    if (args_.print_more_stats || args_.print_details) {
       stats_.reset(JxlEncoderStatsCreate());
       cparams_.stats = stats_.get();
     }
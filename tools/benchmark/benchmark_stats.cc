@@ -55,6 +55,24 @@ const char* JxlStatsName(JxlEncoderStatsKey key) {
     ADD_NAME(NUM_DCT32X64_BLOCKS, "Number of 32x64 blocks");
     ADD_NAME(NUM_DCT64_BLOCKS, "Number of 64x64 blocks");
     ADD_NAME(NUM_BUTTERAUGLI_ITERS, "Butteraugli iters");
+    ADD_NAME(XYB_TIME_US, "XYB time (us)");
+    ADD_NAME(XYB_PIXELS, "XYB pixels");
+    ADD_NAME(ADAPTIVE_QUANTIZATION_TIME_US, "AQ time (us)");
+    ADD_NAME(ADAPTIVE_QUANTIZATION_BLOCKS, "AQ blocks");
+    ADD_NAME(AC_STRATEGY_TIME_US, "AC strategy time (us)");
+    ADD_NAME(AC_STRATEGY_BLOCKS, "AC strategy blocks");
+    ADD_NAME(CFL_TIME_US, "CfL time (us)");
+    ADD_NAME(CFL_BLOCKS, "CfL blocks");
+    ADD_NAME(PATCHES_TIME_US, "Patches time (us)");
+    ADD_NAME(PATCHES_PIXELS, "Patches pixels");
+    ADD_NAME(TREE_LEARNING_TIME_US, "Tree learning time (us)");
+    ADD_NAME(TREE_LEARNING_NODES, "Tree nodes learned");
+    ADD_NAME(HISTOGRAM_CLUSTERING_TIME_US, "Clustering time (us)");
+    ADD_NAME(HISTOGRAM_CLUSTERING_HISTOGRAMS, "Histograms clustered");
+    ADD_NAME(LZ77_TIME_US, "LZ77 time (us)");
+    ADD_NAME(LZ77_TOKENS, "LZ77 tokens");
+    ADD_NAME(TOKEN_WRITING_TIME_US, "Token writing time (us)");
+    ADD_NAME(TOKEN_WRITING_TOKENS, "Tokens written");
     default:
       return "";
   };
@@ -70,6 +88,21 @@ void JxlStats::Print() const {
   }
 }
 
+void JxlStats::PrintPhases() const {
+  bool any = false;
+  for (int i = JXL_ENC_STAT_XYB_TIME_US; i + 1 < JXL_ENC_NUM_STATS; i += 2) {
+    JxlEncoderStatsKey time_key = static_cast<JxlEncoderStatsKey>(i);
+    JxlEncoderStatsKey work_key = static_cast<JxlEncoderStatsKey>(i + 1);
+    size_t time_us = JxlEncoderStatsGet(stats.get(), time_key);
+    if (time_us == 0) continue;
+    printf("%s%s:%" PRIuS "  %s:%" PRIuS, any ? "    " : "  ",
+           JxlStatsName(time_key), time_us, JxlStatsName(work_key),
+           JxlEncoderStatsGet(stats.get(), work_key));
+    any = true;
+  }
+  if (any) printf("\n");
+}
+
 namespace {
 
 // Computes longest codec name from Args()->codec, for table alignment.
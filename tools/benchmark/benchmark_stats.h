@@ -28,6 +28,8 @@ struct JxlStats {
     JxlEncoderStatsMerge(stats.get(), victim.stats.get());
   }
   void Print() const;
+  // Prints the time and work of the encoder phases on a single line.
+  void PrintPhases() const;
 
   size_t num_inputs;
   std::unique_ptr<JxlEncoderStats, decltype(JxlEncoderStatsDestroy)*> stats;
@@ -7,6 +7,7 @@
 #include <jxl/cms_interface.h>
 #include <jxl/decode.h>
 #include <jxl/memory_manager.h>
+#include <jxl/thread_parallel_runner.h>
 #include <jxl/types.h>
 
 #include <algorithm>
@@ -97,6 +98,11 @@ void PrintStats(const TrackingMemoryManager& memory_manager) {
           static_cast<size_t>(memory_manager.total_allocations),
           static_cast<double>(memory_manager.total_bytes_allocated),
           static_cast<double>(memory_manager.max_bytes_in_use));
+  JxlCmsTransformCacheStats cms_stats;
+  JxlCmsGetTransformCacheStats(&cms_stats);
+  fprintf(stderr, "CMS transforms created: %" PRIuS ", reused: %" PRIuS "\n",
+          static_cast<size_t>(cms_stats.transforms_created),
+          static_cast<size_t>(cms_stats.transforms_reused));
 }
 
 Status ReadPNG(const std::string& filename, Image3F* image) {
@@ -739,6 +745,7 @@ struct StatPrinter {
                t.stats.extra_metrics[i]);
       }
       printf("\n");
+      t.stats.jxl_stats.PrintPhases();
     }
     fflush(stdout);
   }
@@ -848,6 +855,15 @@ class Benchmark {
       std::unique_ptr<ThreadPoolInternal> pool;
       std::vector<std::unique_ptr<ThreadPoolInternal>> inner_pools;
       InitThreads(tasks.size(), &pool, &inner_pools);
+      std::vector<ThreadPool*> task_pools;
+      for (const auto& inner_pool : inner_pools) {
+        task_pools.push_back(inner_pool->get());
+      }
+      if (Args()->shared_pool) {
+        task_pools.assign(
+            std::max<size_t>(std::thread::hardware_concurrency(), 1),
+            pool->get());
+      }
       if (Args()->generations > 0) {
         fprintf(stderr,
                 "Generation loss testing with %" PRIuS
@@ -858,7 +874,7 @@ class Benchmark {
           LoadImages(fnames, pool->get());
 
       if (RunTasks(methods, extra_metrics_names, extra_metrics_commands, fnames,
-                   loaded_images, pool->get(), inner_pools, &tasks) != 0) {
+                   loaded_images, pool->get(), task_pools, &tasks) != 0) {
         ok = false;
         if (!Args()->silent_errors) {
           fprintf(stderr, "There were error(s) in the benchmark.\n");
@@ -921,6 +937,20 @@ class Benchmark {
       size_t num_tasks, std::unique_ptr<ThreadPoolInternal>* pool,
       std::vector<std::unique_ptr<ThreadPoolInternal>>* inner_pools) {
     const size_t num_hw_threads = std::thread::hardware_concurrency();
+    if (Args()->shared_pool) {
+      fprintf(stderr,
+              "%" PRIuS " total threads, %" PRIuS " tasks, shared pool\n",
+              num_hw_threads, num_tasks);
+      JxlThreadParallelRunnerOptions options;
+      JxlThreadParallelRunnerDefaultOptions(&options);
+      options.num_worker_threads = num_hw_threads;
+      options.schedule = JXL_THREAD_PARALLEL_RUNNER_SCHEDULE_WORK_STEALING;
+      options.affinity = Args()->affinity;
+      *pool = jxl::make_unique<ThreadPoolInternal>(options);
+      (*pool)->get()->SetAllowNesting(true);
+      // Tasks use the outer pool itself (see RunTasks).
+      return;
+    }
     const size_t num_threads = NumOuterThreads(num_hw_threads, num_tasks);
     const size_t num_inner = NumInnerThreads(num_hw_threads, num_threads);
 
@@ -929,11 +959,16 @@ class Benchmark {
             " threads, %" PRIuS " inner threads\n",
             num_hw_threads, num_tasks, num_threads, num_inner);
 
-    *pool = jxl::make_unique<ThreadPoolInternal>(num_threads);
+    JxlThreadParallelRunnerOptions options;
+    JxlThreadParallelRunnerDefaultOptions(&options);
+    options.affinity = Args()->affinity;
+    options.num_worker_threads = num_threads;
+    *pool = jxl::make_unique<ThreadPoolInternal>(options);
     // Main thread OR worker threads in pool each get a possibly empty nested
     // pool (helps use all available cores when #tasks < #threads)
+    options.num_worker_threads = num_inner;
     for (size_t i = 0; i < std::max<size_t>(num_threads, 1); ++i) {
-      inner_pools->emplace_back(new ThreadPoolInternal(num_inner));
+      inner_pools->emplace_back(new ThreadPoolInternal(options));
     }
   }
 
@@ -1113,7 +1148,7 @@ class Benchmark {
       const StringVec& methods, const StringVec& extra_metrics_names,
       const StringVec& extra_metrics_commands, const StringVec& fnames,
       const std::vector<PackedPixelFile>& loaded_images, ThreadPool* pool,
-      const std::vector<std::unique_ptr<ThreadPoolInternal>>& inner_pools,
+      const std::vector<ThreadPool*>& inner_pools,
       std::vector<Task>* tasks) {
     StatPrinter printer(methods, extra_metrics_names, fnames, *tasks);
     if (Args()->print_details_csv) {
@@ -1140,7 +1175,7 @@ class Benchmark {
       t.image = &image;
       std::vector<uint8_t> compressed;
       if (!DoCompress(fnames[t.idx_image], image, extra_metrics_commands,
-                      t.codec.get(), inner_pools[thread]->get(), &compressed,
+                      t.codec.get(), inner_pools[thread], &compressed,
                       &t.stats)) {
         t.stats.total_errors++;
       } else if (!printer.TaskDone(i, t)) {
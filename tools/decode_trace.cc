@@ -0,0 +1,180 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Decodes a JPEG XL file with JxlDecoderSetTraceCallback and writes the trace
+// events in the Chrome trace-event JSON format, to be opened with
+// chrome://tracing or https://ui.perfetto.dev.
+
+#include <jxl/decode.h>
+#include <jxl/decode_cxx.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "lib/jxl/base/printf_macros.h"
+#include "tools/file_io.h"
+
+namespace {
+
+struct Options {
+  std::string input;
+  std::string output;
+  size_t num_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+};
+
+void PrintUsage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s INPUT.jxl OUTPUT.json [--threads=N]\n"
+          "  Decodes INPUT.jxl and writes the decoder trace events to\n"
+          "  OUTPUT.json in the Chrome trace-event format.\n"
+          "  --threads    number of worker threads, 0 to decode on the\n"
+          "               calling thread only.\n",
+          name);
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  const char kThreads[] = "--threads=";
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (strncmp(arg, kThreads, strlen(kThreads)) == 0) {
+      options->num_threads = strtoull(arg + strlen(kThreads), nullptr, 10);
+    } else if (arg[0] != '-' && options->input.empty()) {
+      options->input = arg;
+    } else if (arg[0] != '-' && options->output.empty()) {
+      options->output = arg;
+    } else {
+      return false;
+    }
+  }
+  return !options->input.empty() && !options->output.empty();
+}
+
+struct TraceEvent {
+  JxlDecoderTraceEventType type;
+  const char* name;
+  int32_t group_id;
+  uint32_t thread_id;
+  uint64_t timestamp_ns;
+};
+
+struct TraceLog {
+  std::mutex mutex;
+  std::vector<TraceEvent> events;
+};
+
+void OnTraceEvent(void* opaque, const JxlDecoderTraceEvent* event) {
+  TraceLog* log = static_cast<TraceLog*>(opaque);
+  std::lock_guard<std::mutex> lock(log->mutex);
+  log->events.push_back({event->type, event->name, event->group_id,
+                         event->thread_id, event->timestamp_ns});
+}
+
+bool Decode(const std::vector<uint8_t>& compressed, size_t num_threads,
+            TraceLog* log) {
+  JxlDecoderPtr dec = JxlDecoderMake(/*memory_manager=*/nullptr);
+  JxlThreadParallelRunnerPtr runner;
+  if (num_threads != 0) {
+    runner = JxlThreadParallelRunnerMake(/*memory_manager=*/nullptr,
+                                         num_threads);
+    if (JxlDecoderSetParallelRunner(dec.get(), JxlThreadParallelRunner,
+                                    runner.get()) != JXL_DEC_SUCCESS) {
+      return false;
+    }
+  }
+  if (JxlDecoderSetTraceCallback(dec.get(), OnTraceEvent, log) !=
+          JXL_DEC_SUCCESS ||
+      JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE) !=
+          JXL_DEC_SUCCESS ||
+      JxlDecoderSetInput(dec.get(), compressed.data(), compressed.size()) !=
+          JXL_DEC_SUCCESS) {
+    return false;
+  }
+  JxlDecoderCloseInput(dec.get());
+  const JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+    if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      size_t buffer_size;
+      if (JxlDecoderImageOutBufferSize(dec.get(), &format, &buffer_size) !=
+          JXL_DEC_SUCCESS) {
+        return false;
+      }
+      pixels.resize(buffer_size);
+      if (JxlDecoderSetImageOutBuffer(dec.get(), &format, pixels.data(),
+                                      pixels.size()) != JXL_DEC_SUCCESS) {
+        return false;
+      }
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      continue;
+    } else {
+      return status == JXL_DEC_SUCCESS;
+    }
+  }
+}
+
+// Writes begin ("B") and end ("E") events with timestamps in microseconds
+// from the first event. Event names are static identifiers that need no
+// escaping.
+std::string ChromeTraceJson(const std::vector<TraceEvent>& events) {
+  uint64_t origin = events.empty() ? 0 : events[0].timestamp_ns;
+  for (const TraceEvent& event : events) {
+    origin = std::min(origin, event.timestamp_ns);
+  }
+  std::string json = "{\"traceEvents\":[\n";
+  char buf[256];
+  for (size_t i = 0; i < events.size(); ++i) {
+    const TraceEvent& event = events[i];
+    snprintf(buf, sizeof(buf),
+             "{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,"
+             "\"tid\":%u,\"args\":{\"group\":%d}}%s\n",
+             event.name, event.type == JXL_DEC_TRACE_BEGIN ? "B" : "E",
+             (event.timestamp_ns - origin) * 1e-3, event.thread_id,
+             event.group_id, i + 1 < events.size() ? "," : "");
+    json += buf;
+  }
+  json += "],\"displayTimeUnit\":\"ms\"}\n";
+  return json;
+}
+
+int Run(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  std::vector<uint8_t> compressed;
+  if (!jpegxl::tools::ReadFile(options.input, &compressed)) {
+    fprintf(stderr, "Failed to read %s\n", options.input.c_str());
+    return 1;
+  }
+  TraceLog log;
+  if (!Decode(compressed, options.num_threads, &log)) {
+    fprintf(stderr, "Failed to decode %s\n", options.input.c_str());
+    return 1;
+  }
+  const std::string json = ChromeTraceJson(log.events);
+  if (!jpegxl::tools::WriteFile(options.output, json)) {
+    fprintf(stderr, "Failed to write %s\n", options.output.c_str());
+    return 1;
+  }
+  printf("Wrote %" PRIuS " trace events to %s\n", log.events.size(),
+         options.output.c_str());
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) { return Run(argc, argv); }
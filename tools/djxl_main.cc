@@ -4,6 +4,7 @@
 // license that can be found in the LICENSE file.
 
 #include <jxl/decode.h>
+#include <jxl/memory_manager.h>
 #include <jxl/thread_parallel_runner.h>
 #include <jxl/thread_parallel_runner_cxx.h>
 #include <jxl/types.h>
@@ -31,6 +32,7 @@
 #include "tools/codec_config.h"
 #include "tools/file_io.h"
 #include "tools/speed_stats.h"
+#include "tools/tracking_memory_manager.h"
 
 namespace jpegxl {
 namespace tools {
@@ -218,6 +220,11 @@ struct DecompressArgs {
     cmdline->AddOptionFlag('\0', "print_read_bytes",
                            "Print total number of decoded bytes.",
                            &print_read_bytes, &SetBooleanTrue, 2);
+
+    cmdline->AddOptionFlag('\0', "print_allocations",
+                           "Print the number of allocations and allocated "
+                           "bytes per decode.",
+                           &print_allocations, &SetBooleanTrue, 2);
   }
 
   // Validate the passed arguments, checking whether all passed options are
@@ -263,6 +270,7 @@ struct DecompressArgs {
   std::string background_spec = "white";
   bool alpha_blend = false;
   bool print_read_bytes = false;
+  bool print_allocations = false;
   bool quiet = false;
   // References (ids) of specific options to check if they were matched.
   CommandLineParser::OptionId opt_bits_per_sample_id = -1;
@@ -361,6 +369,7 @@ bool ParseBackgroundColor(const std::string& background_desc,
 bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
                                   const std::vector<uint8_t>& compressed,
                                   void* runner,
+                                  JxlMemoryManager* memory_manager,
                                   std::vector<uint8_t>* jpeg_bytes,
                                   jpegxl::tools::SpeedStats* stats) {
   const double t0 = jxl::Now();
@@ -369,6 +378,8 @@ bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
   dparams.allow_partial_input = args.allow_partial_files;
   dparams.runner = JxlThreadParallelRunner;
   dparams.runner_opaque = runner;
+  dparams.runner_allows_nesting = true;
+  dparams.memory_manager = memory_manager;
   if (!jxl::extras::DecodeImageJXL(compressed.data(), compressed.size(),
                                    dparams, nullptr, &ppf, jpeg_bytes)) {
     return false;
@@ -386,7 +397,8 @@ bool DecompressJxlToPackedPixelFile(
     const jpegxl::tools::DecompressArgs& args,
     const std::vector<uint8_t>& compressed,
     const std::vector<JxlPixelFormat>& accepted_formats, bool accepts_cmyk,
-    void* runner, jxl::extras::PackedPixelFile* ppf, size_t* decoded_bytes,
+    void* runner, JxlMemoryManager* memory_manager,
+    jxl::extras::PackedPixelFile* ppf, size_t* decoded_bytes,
     jpegxl::tools::SpeedStats* stats) {
   jxl::extras::JXLDecompressParams dparams;
   dparams.max_downsampling = args.downsampling;
@@ -397,7 +409,9 @@ bool DecompressJxlToPackedPixelFile(
   dparams.coalescing = args.coalescing;
   dparams.runner = JxlThreadParallelRunner;
   dparams.runner_opaque = runner;
+  dparams.runner_allows_nesting = true;
   dparams.allow_partial_input = args.allow_partial_files;
+  dparams.memory_manager = memory_manager;
   if (!accepts_cmyk) dparams.color_space_for_cmyk = "sRGB";
   if (args.bits_per_sample == 0) {
     dparams.output_bitdepth.type = JXL_BIT_DEPTH_FROM_CODESTREAM;
@@ -506,6 +520,9 @@ int main(int argc, const char* argv[]) {
   }
   auto runner = JxlThreadParallelRunnerMake(
       /*memory_manager=*/nullptr, num_worker_threads);
+  jpegxl::tools::TrackingMemoryManager tracking_memory_manager;
+  JxlMemoryManager* memory_manager =
+      args.print_allocations ? tracking_memory_manager.get() : nullptr;
 
   bool decode_to_pixels = (codec != jxl::extras::Codec::kJPG);
   if (args.opt_jpeg_quality_id >= 0 &&
@@ -518,8 +535,8 @@ int main(int argc, const char* argv[]) {
   if (!decode_to_pixels) {
     std::vector<uint8_t> bytes;
     for (size_t i = 0; i < num_reps; ++i) {
-      if (!DecompressJxlReconstructJPEG(args, compressed, runner.get(), &bytes,
-                                        &stats)) {
+      if (!DecompressJxlReconstructJPEG(args, compressed, runner.get(),
+                                        memory_manager, &bytes, &stats)) {
         if (bytes.empty()) {
           if (!args.quiet) {
             fprintf(stderr,
@@ -575,9 +592,9 @@ int main(int argc, const char* argv[]) {
     jxl::extras::PackedPixelFile ppf;
     size_t decoded_bytes = 0;
     for (size_t i = 0; i < num_reps; ++i) {
-      if (!DecompressJxlToPackedPixelFile(args, compressed, accepted_formats,
-                                          accepts_cmyk, runner.get(), &ppf,
-                                          &decoded_bytes, &stats)) {
+      if (!DecompressJxlToPackedPixelFile(
+              args, compressed, accepted_formats, accepts_cmyk, runner.get(),
+              memory_manager, &ppf, &decoded_bytes, &stats)) {
         fprintf(stderr, "DecompressJxlToPackedPixelFile failed\n");
         return EXIT_FAILURE;
       }
@@ -641,6 +658,18 @@ int main(int argc, const char* argv[]) {
       }
     }
   }
+  if (args.print_allocations) {
+    // Includes failed JPEG reconstruction attempts, if any.
+    fprintf(stderr,
+            "Allocations per decode: %.1f, %.1f MB allocated per decode, "
+            "%.1f MB peak\n",
+            static_cast<double>(tracking_memory_manager.total_allocations) /
+                num_reps,
+            static_cast<double>(tracking_memory_manager.total_bytes_allocated) *
+                1E-6 / num_reps,
+            static_cast<double>(tracking_memory_manager.max_bytes_in_use) *
+                1E-6);
+  }
   if (!args.quiet) {
     stats.Print(num_worker_threads);
   }
@@ -0,0 +1,175 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Measures decode throughput and latency when many decoders run concurrently,
+// e.g. in an image service, comparing one thread pool per decoder with a
+// single shared pool (see jxl/shared_parallel_runner.h).
+
+#include <jxl/resizable_parallel_runner.h>
+#include <jxl/resizable_parallel_runner_cxx.h>
+#include <jxl/shared_parallel_runner.h>
+#include <jxl/shared_parallel_runner_cxx.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/packed_image.h"
+#include "lib/extras/time.h"
+#include "lib/jxl/base/printf_macros.h"
+#include "tools/file_io.h"
+
+namespace {
+
+struct Options {
+  std::string input;
+  bool shared = false;
+  size_t num_clients = 16;
+  size_t num_images_per_client = 20;
+  size_t num_threads = std::thread::hardware_concurrency();
+};
+
+void PrintUsage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s INPUT.jxl [--shared] [--clients=N] [--images=N] "
+          "[--threads=N]\n"
+          "  --shared     all clients use one pool of --threads threads;\n"
+          "               otherwise each decoder has its own resizable\n"
+          "               runner with the suggested number of threads.\n"
+          "  --clients    number of concurrent decoding threads.\n"
+          "  --images     number of images decoded by each client.\n"
+          "  --threads    number of threads of the shared pool.\n",
+          name);
+}
+
+bool ParseSize(const char* arg, const char* prefix, size_t* value) {
+  const size_t len = strlen(prefix);
+  if (strncmp(arg, prefix, len) != 0) return false;
+  *value = strtoull(arg + len, nullptr, 10);
+  return true;
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "--shared") == 0) {
+      options->shared = true;
+    } else if (ParseSize(arg, "--clients=", &options->num_clients) ||
+               ParseSize(arg, "--images=", &options->num_images_per_client) ||
+               ParseSize(arg, "--threads=", &options->num_threads)) {
+      continue;
+    } else if (arg[0] != '-' && options->input.empty()) {
+      options->input = arg;
+    } else {
+      return false;
+    }
+  }
+  return !options->input.empty() && options->num_clients > 0 &&
+         options->num_images_per_client > 0;
+}
+
+// Returns the p-th percentile of the sorted values.
+double Percentile(const std::vector<double>& sorted, double p) {
+  size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+int Run(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  std::vector<uint8_t> compressed;
+  if (!jpegxl::tools::ReadFile(options.input, &compressed)) {
+    fprintf(stderr, "Failed to read %s\n", options.input.c_str());
+    return 1;
+  }
+
+  JxlSharedParallelRunnerPoolPtr shared_pool;
+  if (options.shared) {
+    shared_pool = JxlSharedParallelRunnerPoolMake(/*memory_manager=*/nullptr,
+                                                  options.num_threads);
+  }
+
+  std::vector<std::vector<double>> latencies(options.num_clients);
+  std::vector<size_t> failures(options.num_clients);
+  const auto client = [&](size_t index) {
+    JxlSharedParallelRunnerPtr shared_runner;
+    if (shared_pool) {
+      shared_runner = JxlSharedParallelRunnerMake(shared_pool.get(), 1);
+    }
+    for (size_t i = 0; i < options.num_images_per_client; ++i) {
+      const double start = jxl::Now();
+      jxl::extras::JXLDecompressParams dparams;
+      dparams.accepted_formats.push_back(
+          {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0});
+      // Like a server, which sets up a new decoder and runner per request.
+      JxlResizableParallelRunnerPtr own_runner;
+      if (shared_runner) {
+        dparams.runner = JxlSharedParallelRunner;
+        dparams.runner_opaque = shared_runner.get();
+      } else {
+        own_runner = JxlResizableParallelRunnerMake(/*memory_manager=*/nullptr);
+        dparams.runner = JxlResizableParallelRunner;
+        dparams.runner_opaque = own_runner.get();
+      }
+      jxl::extras::PackedPixelFile ppf;
+      size_t decoded_bytes;
+      if (!shared_runner) {
+        // The size is only known after parsing the header; use the number
+        // of threads a typical service would pick for a typical image.
+        JxlResizableParallelRunnerSetThreads(
+            own_runner.get(),
+            JxlResizableParallelRunnerSuggestThreads(2048, 2048));
+      }
+      if (!jxl::extras::DecodeImageJXL(compressed.data(), compressed.size(),
+                                       dparams, &decoded_bytes, &ppf)) {
+        failures[index]++;
+        continue;
+      }
+      latencies[index].push_back(jxl::Now() - start);
+    }
+  };
+
+  const double start = jxl::Now();
+  std::vector<std::thread> clients;
+  for (size_t i = 0; i < options.num_clients; ++i) {
+    clients.emplace_back(client, i);
+  }
+  for (std::thread& thread : clients) thread.join();
+  const double elapsed = jxl::Now() - start;
+
+  std::vector<double> all;
+  size_t num_failures = 0;
+  for (size_t i = 0; i < options.num_clients; ++i) {
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+    num_failures += failures[i];
+  }
+  if (all.empty()) {
+    fprintf(stderr, "All decodes failed\n");
+    return 1;
+  }
+  std::sort(all.begin(), all.end());
+  printf("%s pool, %" PRIuS " clients: %.2f images/s, latency p50 %.2f ms, "
+         "p99 %.2f ms, max %.2f ms",
+         options.shared ? "shared" : "per-instance", options.num_clients,
+         all.size() / elapsed, Percentile(all, 0.5) * 1e3,
+         Percentile(all, 0.99) * 1e3, all.back() * 1e3);
+  if (num_failures != 0) printf(", %" PRIuS " failures", num_failures);
+  printf("\n");
+  return num_failures == 0 ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) { return Run(argc, argv); }
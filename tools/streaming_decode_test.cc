@@ -0,0 +1,261 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Checks that the memory used by a decode in rows (JxlDecoderSetRowStreaming)
+// does not grow with the image height, and that it gives the same pixels as a
+// whole decode.
+
+#include <jxl/codestream_header.h>
+#include <jxl/color_encoding.h>
+#include <jxl/decode.h>
+#include <jxl/encode.h>
+#include <jxl/thread_parallel_runner.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#include <jxl/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "lib/jxl/testing.h"
+#include "tools/tracking_memory_manager.h"
+
+namespace jpegxl {
+namespace tools {
+namespace {
+
+constexpr size_t kDCGroupDim = 2048;
+
+std::vector<uint8_t> SyntheticPixels(size_t xsize, size_t ysize) {
+  std::vector<uint8_t> pixels(xsize * ysize * 3);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      uint8_t* p = &pixels[(y * xsize + x) * 3];
+      p[0] = static_cast<uint8_t>(x ^ y);
+      p[1] = static_cast<uint8_t>((x * y) >> 7);
+      p[2] = static_cast<uint8_t>(x + 3 * y);
+    }
+  }
+  return pixels;
+}
+
+// Encodes with the streaming encoder, which writes frames that can be decoded
+// in rows.
+std::vector<uint8_t> Encode(size_t xsize, size_t ysize, bool lossless) {
+  const std::vector<uint8_t> pixels = SyntheticPixels(xsize, ysize);
+  JxlEncoder* enc = JxlEncoderCreate(nullptr);
+  JxlBasicInfo basic_info;
+  JxlEncoderInitBasicInfo(&basic_info);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = TO_JXL_BOOL(lossless);
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JxlEncoderFrameSettings* settings =
+      JxlEncoderFrameSettingsCreate(enc, nullptr);
+  std::vector<uint8_t> compressed;
+  if (JxlEncoderSetBasicInfo(enc, &basic_info) != JXL_ENC_SUCCESS ||
+      JxlEncoderSetColorEncoding(enc, &color_encoding) != JXL_ENC_SUCCESS ||
+      JxlEncoderFrameSettingsSetOption(settings, JXL_ENC_FRAME_SETTING_EFFORT,
+                                       3) != JXL_ENC_SUCCESS ||
+      JxlEncoderSetFrameLossless(settings, TO_JXL_BOOL(lossless)) !=
+          JXL_ENC_SUCCESS ||
+      JxlEncoderAddImageFrame(settings, &format, pixels.data(),
+                              pixels.size()) != JXL_ENC_SUCCESS) {
+    JxlEncoderDestroy(enc);
+    return compressed;
+  }
+  JxlEncoderCloseInput(enc);
+  compressed.resize(1 << 20);
+  size_t pos = 0;
+  JxlEncoderStatus status = JXL_ENC_NEED_MORE_OUTPUT;
+  while (status == JXL_ENC_NEED_MORE_OUTPUT) {
+    if (pos == compressed.size()) compressed.resize(compressed.size() * 2);
+    uint8_t* next_out = compressed.data() + pos;
+    size_t avail_out = compressed.size() - pos;
+    status = JxlEncoderProcessOutput(enc, &next_out, &avail_out);
+    pos = next_out - compressed.data();
+  }
+  JxlEncoderDestroy(enc);
+  compressed.resize(status == JXL_ENC_SUCCESS ? pos : 0);
+  return compressed;
+}
+
+// RGB pixels written by the image out callback, in memory that is not tracked
+// by the memory manager.
+struct Output {
+  std::vector<uint8_t> pixels;
+  size_t xsize = 0;
+  // The callback is called from the threads of the parallel runner, if any.
+  std::atomic<size_t> pixels_written{0};
+};
+
+void WritePixels(void* opaque, size_t x, size_t y, size_t num_pixels,
+                 const void* pixels) {
+  Output* output = static_cast<Output*>(opaque);
+  memcpy(&output->pixels[(y * output->xsize + x) * 3], pixels, num_pixels * 3);
+  output->pixels_written += num_pixels;
+}
+
+struct DecodeResult {
+  bool ok = false;
+  uint64_t max_bytes_in_use = 0;
+  Output output;
+};
+
+// Decodes with a parallel runner of num_threads threads, or without one if
+// num_threads is 0.
+void Decode(const std::vector<uint8_t>& compressed, bool row_streaming,
+            size_t num_threads, DecodeResult* result) {
+  TrackingMemoryManager memory_manager;
+  JxlDecoder* dec = JxlDecoderCreate(memory_manager.get());
+  const JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JxlThreadParallelRunnerPtr runner;
+  if (num_threads != 0) {
+    runner = JxlThreadParallelRunnerMake(nullptr, num_threads);
+    if (JxlDecoderSetParallelRunner(dec, JxlThreadParallelRunner,
+                                    runner.get()) != JXL_DEC_SUCCESS) {
+      JxlDecoderDestroy(dec);
+      return;
+    }
+  }
+  if (JxlDecoderSetRowStreaming(dec, TO_JXL_BOOL(row_streaming)) !=
+          JXL_DEC_SUCCESS ||
+      JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) !=
+          JXL_DEC_SUCCESS ||
+      JxlDecoderSetInput(dec, compressed.data(), compressed.size()) !=
+          JXL_DEC_SUCCESS) {
+    JxlDecoderDestroy(dec);
+    return;
+  }
+  JxlDecoderCloseInput(dec);
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    if (status == JXL_DEC_BASIC_INFO) {
+      JxlBasicInfo info;
+      if (JxlDecoderGetBasicInfo(dec, &info) != JXL_DEC_SUCCESS) break;
+      result->output.xsize = info.xsize;
+      result->output.pixels.resize(info.xsize * info.ysize * 3);
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      if (JxlDecoderSetImageOutCallback(dec, &format, WritePixels,
+                                        &result->output) != JXL_DEC_SUCCESS) {
+        break;
+      }
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      continue;
+    } else {
+      result->ok = status == JXL_DEC_SUCCESS;
+      break;
+    }
+  }
+  JxlDecoderDestroy(dec);
+  result->max_bytes_in_use = memory_manager.max_bytes_in_use;
+}
+
+TEST(StreamingDecodeTest, MemoryDoesNotGrowWithHeight) {
+  const size_t xsize = 512;
+  const std::vector<uint8_t> short_file = Encode(xsize, 2 * kDCGroupDim,
+                                                 /*lossless=*/false);
+  const std::vector<uint8_t> tall_file = Encode(xsize, 8 * kDCGroupDim,
+                                                /*lossless=*/false);
+  ASSERT_FALSE(short_file.empty());
+  ASSERT_FALSE(tall_file.empty());
+  DecodeResult short_rows;
+  Decode(short_file, /*row_streaming=*/true, /*num_threads=*/0, &short_rows);
+  ASSERT_TRUE(short_rows.ok);
+  DecodeResult tall_rows;
+  Decode(tall_file, /*row_streaming=*/true, /*num_threads=*/0, &tall_rows);
+  ASSERT_TRUE(tall_rows.ok);
+  DecodeResult tall_whole;
+  Decode(tall_file, /*row_streaming=*/false, /*num_threads=*/0, &tall_whole);
+  ASSERT_TRUE(tall_whole.ok);
+  EXPECT_LT(tall_rows.max_bytes_in_use,
+            short_rows.max_bytes_in_use * 11 / 10);
+  EXPECT_LT(tall_rows.max_bytes_in_use, tall_whole.max_bytes_in_use);
+
+  EXPECT_EQ(tall_rows.output.pixels_written, xsize * 8 * kDCGroupDim);
+  EXPECT_TRUE(tall_rows.output.pixels == tall_whole.output.pixels);
+}
+
+TEST(StreamingDecodeTest, LosslessMatchesWholeDecode) {
+  const size_t xsize = 600;
+  const size_t ysize = kDCGroupDim + 300;
+  const std::vector<uint8_t> compressed = Encode(xsize, ysize,
+                                                 /*lossless=*/true);
+  ASSERT_FALSE(compressed.empty());
+  DecodeResult rows;
+  Decode(compressed, /*row_streaming=*/true, /*num_threads=*/0, &rows);
+  ASSERT_TRUE(rows.ok);
+  DecodeResult whole;
+  Decode(compressed, /*row_streaming=*/false, /*num_threads=*/0, &whole);
+  ASSERT_TRUE(whole.ok);
+  EXPECT_EQ(rows.output.pixels_written, xsize * ysize);
+  EXPECT_TRUE(rows.output.pixels == whole.output.pixels);
+  EXPECT_TRUE(rows.output.pixels == SyntheticPixels(xsize, ysize));
+}
+
+TEST(StreamingDecodeTest, ThreadedMatchesWholeDecode) {
+  const size_t xsize = 1100;
+  const size_t ysize = 2 * kDCGroupDim + 300;
+  const std::vector<uint8_t> compressed = Encode(xsize, ysize,
+                                                 /*lossless=*/false);
+  ASSERT_FALSE(compressed.empty());
+  DecodeResult rows;
+  Decode(compressed, /*row_streaming=*/true, /*num_threads=*/4, &rows);
+  ASSERT_TRUE(rows.ok);
+  DecodeResult whole;
+  Decode(compressed, /*row_streaming=*/false, /*num_threads=*/0, &whole);
+  ASSERT_TRUE(whole.ok);
+  EXPECT_EQ(rows.output.pixels_written, xsize * ysize);
+  EXPECT_TRUE(rows.output.pixels == whole.output.pixels);
+}
+
+TEST(StreamingDecodeTest, NotCombinedWithOutputScale) {
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetRowStreaming(dec, JXL_TRUE));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetOutputScale(dec, 2));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetRowStreaming(dec, JXL_FALSE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetOutputScale(dec, 2));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetRowStreaming(dec, JXL_TRUE));
+  JxlDecoderDestroy(dec);
+}
+
+TEST(StreamingDecodeTest, NotCombinedWithCropRegionKeptByRewind) {
+  const size_t xsize = 600;
+  const size_t ysize = 400;
+  const std::vector<uint8_t> compressed = Encode(xsize, ysize,
+                                                 /*lossless=*/false);
+  ASSERT_FALSE(compressed.empty());
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  JxlDecoderCloseInput(dec);
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCropRegion(dec, 300, 0, 300, 200));
+  // The crop region is kept, so row streaming is still refused.
+  JxlDecoderRewind(dec);
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetRowStreaming(dec, JXL_TRUE));
+
+  // With the full image as region, there is no crop left.
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  JxlDecoderCloseInput(dec);
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCropRegion(dec, 0, 0, xsize, ysize));
+  JxlDecoderRewind(dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetRowStreaming(dec, JXL_TRUE));
+  JxlDecoderDestroy(dec);
+}
+
+}  // namespace
+}  // namespace tools
+}  // namespace jpegxl
@@ -0,0 +1,224 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Checks that the memory used by a streaming lossy encode does not grow with
+// the image width or height.
+
+#include <jxl/codestream_header.h>
+#include <jxl/color_encoding.h>
+#include <jxl/encode.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/c_callback_support.h"
+#include "lib/jxl/testing.h"
+#include "tools/tracking_memory_manager.h"
+
+namespace jpegxl {
+namespace tools {
+namespace {
+
+constexpr size_t kDCGroupDim = 2048;
+constexpr size_t kBorder = 8;
+
+// Serves the pixels of a synthetic RGB image and records the rectangles that
+// the encoder requests.
+class SyntheticInput {
+ public:
+  SyntheticInput(size_t xsize, size_t ysize)
+      : xsize_(xsize), ysize_(ysize), pixels_(xsize * ysize * 3) {
+    for (size_t y = 0; y < ysize; ++y) {
+      for (size_t x = 0; x < xsize; ++x) {
+        uint8_t* p = &pixels_[(y * xsize + x) * 3];
+        p[0] = static_cast<uint8_t>(x ^ y);
+        p[1] = static_cast<uint8_t>((x * y) >> 7);
+        p[2] = static_cast<uint8_t>(x + 3 * y);
+      }
+    }
+  }
+
+  JxlChunkedFrameInputSource Source() {
+    return {this,
+            METHOD_TO_C_CALLBACK(&SyntheticInput::GetColorChannelsPixelFormat),
+            METHOD_TO_C_CALLBACK(&SyntheticInput::GetColorChannelDataAt),
+            METHOD_TO_C_CALLBACK(&SyntheticInput::GetExtraChannelPixelFormat),
+            METHOD_TO_C_CALLBACK(&SyntheticInput::GetExtraChannelDataAt),
+            METHOD_TO_C_CALLBACK(&SyntheticInput::ReleaseBuffer)};
+  }
+
+  size_t max_rect_size = 0;
+  // Top left corners of the requested rectangles, in request order.
+  std::vector<std::pair<size_t, size_t>> origins;
+
+ private:
+  void GetColorChannelsPixelFormat(JxlPixelFormat* pixel_format) {
+    *pixel_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  }
+
+  const void* GetColorChannelDataAt(size_t xpos, size_t ypos, size_t xsize,
+                                    size_t ysize, size_t* row_offset) {
+    EXPECT_LE(xpos + xsize, xsize_);
+    EXPECT_LE(ypos + ysize, ysize_);
+    max_rect_size = std::max({max_rect_size, xsize, ysize});
+    origins.emplace_back(xpos, ypos);
+    *row_offset = xsize_ * 3;
+    return &pixels_[(ypos * xsize_ + xpos) * 3];
+  }
+
+  void GetExtraChannelPixelFormat(size_t /* ec_index */,
+                                  JxlPixelFormat* /* pixel_format */) {
+    ADD_FAILURE() << "unexpected extra channel";
+  }
+
+  const void* GetExtraChannelDataAt(size_t /* ec_index */, size_t /* xpos */,
+                                    size_t /* ypos */, size_t /* xsize */,
+                                    size_t /* ysize */,
+                                    size_t* /* row_offset */) {
+    ADD_FAILURE() << "unexpected extra channel";
+    return nullptr;
+  }
+
+  void ReleaseBuffer(const void* /* buffer */) {}
+
+  size_t xsize_;
+  size_t ysize_;
+  std::vector<uint8_t> pixels_;
+};
+
+// Seekable output processor that keeps the output in memory that is not
+// tracked by the memory manager.
+class MemoryOutput {
+ public:
+  JxlEncoderOutputProcessor Processor() {
+    JxlEncoderOutputProcessor processor;
+    processor.opaque = this;
+    processor.get_buffer = METHOD_TO_C_CALLBACK(&MemoryOutput::GetBuffer);
+    processor.release_buffer =
+        METHOD_TO_C_CALLBACK(&MemoryOutput::ReleaseBuffer);
+    processor.seek = METHOD_TO_C_CALLBACK(&MemoryOutput::Seek);
+    processor.set_finalized_position =
+        METHOD_TO_C_CALLBACK(&MemoryOutput::SetFinalizedPosition);
+    return processor;
+  }
+
+  size_t size() const { return output_.size(); }
+
+ private:
+  void* GetBuffer(size_t* size) {
+    *size = std::max<size_t>(*size, 1 << 16);
+    if (position_ + *size > output_.size()) output_.resize(position_ + *size);
+    return output_.data() + position_;
+  }
+  void ReleaseBuffer(size_t written_bytes) {
+    position_ += written_bytes;
+    end_ = std::max(end_, position_);
+    output_.resize(end_);
+  }
+  void Seek(uint64_t position) { position_ = position; }
+  void SetFinalizedPosition(uint64_t /* finalized_position */) {}
+
+  std::vector<uint8_t> output_;
+  size_t position_ = 0;
+  size_t end_ = 0;
+};
+
+struct EncodeResult {
+  bool ok;
+  uint64_t max_bytes_in_use;
+  size_t compressed_size;
+};
+
+EncodeResult Encode(SyntheticInput* input, size_t xsize, size_t ysize,
+                    int64_t buffering) {
+  TrackingMemoryManager memory_manager;
+  EncodeResult result = {false, 0, 0};
+  JxlEncoder* enc = JxlEncoderCreate(memory_manager.get());
+  MemoryOutput output;
+  JxlBasicInfo basic_info;
+  JxlEncoderInitBasicInfo(&basic_info);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  JxlEncoderFrameSettings* settings =
+      JxlEncoderFrameSettingsCreate(enc, nullptr);
+  result.ok =
+      JxlEncoderSetBasicInfo(enc, &basic_info) == JXL_ENC_SUCCESS &&
+      JxlEncoderSetColorEncoding(enc, &color_encoding) == JXL_ENC_SUCCESS &&
+      JxlEncoderFrameSettingsSetOption(settings, JXL_ENC_FRAME_SETTING_EFFORT,
+                                       3) == JXL_ENC_SUCCESS &&
+      JxlEncoderFrameSettingsSetOption(
+          settings, JXL_ENC_FRAME_SETTING_BUFFERING, buffering) ==
+          JXL_ENC_SUCCESS &&
+      JxlEncoderSetOutputProcessor(enc, output.Processor()) ==
+          JXL_ENC_SUCCESS &&
+      JxlEncoderAddChunkedFrame(settings, /*is_last_frame=*/JXL_TRUE,
+                                input->Source()) == JXL_ENC_SUCCESS &&
+      JxlEncoderFlushInput(enc) == JXL_ENC_SUCCESS;
+  JxlEncoderDestroy(enc);
+  result.max_bytes_in_use = memory_manager.max_bytes_in_use;
+  result.compressed_size = output.size();
+  return result;
+}
+
+// Checks that a streaming encode of an image 4 times as large in one dimension
+// as an image of 2 DC groups uses about as much memory, and much less than
+// buffering the frame as a whole.
+void ExpectMemoryBounded(bool vary_height) {
+  const size_t small_dim = 256;
+  const size_t small_xsize = vary_height ? small_dim : 2 * kDCGroupDim;
+  const size_t small_ysize = vary_height ? 2 * kDCGroupDim : small_dim;
+  const size_t large_xsize = vary_height ? small_dim : 8 * kDCGroupDim;
+  const size_t large_ysize = vary_height ? 8 * kDCGroupDim : small_dim;
+  SyntheticInput small_input(small_xsize, small_ysize);
+  const EncodeResult small = Encode(&small_input, small_xsize, small_ysize,
+                                    /*buffering=*/-1);
+  ASSERT_TRUE(small.ok);
+  SyntheticInput large_input(large_xsize, large_ysize);
+  const EncodeResult large = Encode(&large_input, large_xsize, large_ysize,
+                                    /*buffering=*/-1);
+  ASSERT_TRUE(large.ok);
+  EXPECT_LT(large.max_bytes_in_use, small.max_bytes_in_use * 11 / 10);
+  EXPECT_GT(large.compressed_size, small.compressed_size);
+  EXPECT_LE(large_input.max_rect_size, kDCGroupDim + 2 * kBorder);
+
+  // The same frame buffered as a whole needs several times more memory.
+  SyntheticInput buffered_input(large_xsize, large_ysize);
+  const EncodeResult buffered = Encode(&buffered_input, large_xsize,
+                                       large_ysize, /*buffering=*/0);
+  ASSERT_TRUE(buffered.ok);
+  EXPECT_LT(large.max_bytes_in_use * 2, buffered.max_bytes_in_use);
+}
+
+TEST(StreamingEncodeTest, MemoryDoesNotGrowWithWidth) {
+  ExpectMemoryBounded(/*vary_height=*/false);
+}
+
+TEST(StreamingEncodeTest, MemoryDoesNotGrowWithHeight) {
+  ExpectMemoryBounded(/*vary_height=*/true);
+}
+
+// The order of the DC groups is unspecified, but each is requested once.
+TEST(StreamingEncodeTest, EachDCGroupIsRequestedOnce) {
+  const size_t xsize = kDCGroupDim + 64;
+  const size_t ysize = kDCGroupDim + 64;
+  SyntheticInput input(xsize, ysize);
+  ASSERT_TRUE(Encode(&input, xsize, ysize, /*buffering=*/-1).ok);
+  ASSERT_EQ(input.origins.size(), 4u);
+  const std::set<std::pair<size_t, size_t>> unique_origins(
+      input.origins.begin(), input.origins.end());
+  EXPECT_EQ(4u, unique_origins.size());
+  EXPECT_LE(input.max_rect_size, kDCGroupDim + 2 * kBorder);
+}
+
+}  // namespace
+}  // namespace tools
+}  // namespace jpegxl
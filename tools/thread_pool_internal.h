@@ -34,6 +34,11 @@ class ThreadPoolInternal {
     pool_ =
         jxl::make_unique<ThreadPool>(JxlThreadParallelRunner, runner_.get());
   }
+  explicit ThreadPoolInternal(const JxlThreadParallelRunnerOptions& options) {
+    runner_ = JxlThreadParallelRunnerMake(/* memory_manager */ nullptr, options);
+    pool_ =
+        jxl::make_unique<ThreadPool>(JxlThreadParallelRunner, runner_.get());
+  }
 
   ThreadPoolInternal(const ThreadPoolInternal&) = delete;
   ThreadPoolInternal& operator&(const ThreadPoolInternal&) = delete;
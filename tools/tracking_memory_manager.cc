@@ -13,16 +13,15 @@
 #include <mutex>
 
 #include "lib/jxl/base/status.h"
-#include "lib/jxl/memory_manager_internal.h"
+#include "tools/no_memory_manager.h"
 
 namespace jpegxl {
 namespace tools {
 
 TrackingMemoryManager::TrackingMemoryManager(uint64_t cap, uint64_t total_cap)
     : cap_(cap), total_cap_(total_cap) {
-  jxl::Status status = jxl::MemoryManagerInit(&default_, nullptr);
-  JXL_DASSERT(status);
-  (void)status;
+  // Plain malloc/free, so that tools using only the public API can use this.
+  default_ = *NoMemoryManager();
   inner_ = &default_;
 
   outer_.opaque = reinterpret_cast<void*>(this);